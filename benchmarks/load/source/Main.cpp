@@ -0,0 +1,372 @@
+// ///////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2013 Jimmie Bergmann - jimmiebergmann@gmail.com
+//
+// This software is provided 'as-is', without any express or
+// implied warranty. In no event will the authors be held
+// liable for any damages arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute
+// it freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented;
+//    you must not claim that you wrote the original software.
+//    If you use this software in a product, an acknowledgment
+//    in the product documentation would be appreciated but
+//    is not required.
+//
+// 2. Altered source versions must be plainly marked as such,
+//    and must not be misrepresented as being the original software.
+//
+// 3. This notice may not be removed or altered from any
+//    source distribution.
+// ///////////////////////////////////////////////////////////////////////////
+
+// Multi-core load benchmark, every thread owns a script and runs a mix of operations.
+// Usage: benchmark-load [--threads N] [--duration ms] [--mix call,userdata,string]
+//                       [--packed-counters] [--script-directory path]
+// The thread count is doubled from 1 up to N, the results are written to stdout as JSON.
+
+#include <LuaW.hpp>
+#include <LuaW/GarbageCollector.hpp>
+#include <LuaW/Instrumentation.hpp>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef LUAW_SCRIPT_DIRECTORY
+#define LUAW_SCRIPT_DIRECTORY "../script/"
+#endif
+
+// Settings structure
+struct Settings
+{
+	unsigned int MaxThreads;
+	unsigned int Duration; // Milliseconds
+	unsigned int CallWeight;
+	unsigned int UserdataWeight;
+	unsigned int StringWeight;
+	bool PackedCounters; // Counters of all threads share cache lines
+	std::string ScriptPath;
+};
+
+// Worker structure, owned by the main thread until the worker is started.
+struct Worker
+{
+	unsigned int Index;
+	const Settings * pSettings;
+	std::atomic<unsigned long long> * pCounter; // Operations done, written by the worker only
+	LuaW::Histogram Latency; // Nanoseconds
+	LuaW::GarbageCollectorStats GarbageCollector;
+	unsigned long long CallFailures; // Calls that raised an error
+	bool Failed;
+};
+
+static std::atomic<bool> g_Start( false );
+static std::atomic<bool> g_Stop( false );
+static std::atomic<unsigned int> g_Ready( 0 );
+
+static long long GetTime( )
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now( ).time_since_epoch( ) ).count( );
+}
+
+// Userdata of the benchmark, constructed in place so that the Lua heap sees all of its memory.
+struct Object
+{
+	lua_Integer Data;
+};
+
+static const char * g_pObjectTable = "Benchmark_Object";
+
+static int ObjectGetData( lua_State * p_pState )
+{
+	const Object * pObject = static_cast<const Object *>( luaL_checkudata( p_pState, 1, g_pObjectTable ) );
+	lua_pushinteger( p_pState, pObject->Data );
+	return 1;
+}
+
+static int NewObject( lua_State * p_pState )
+{
+	lua_Integer Data = luaL_checkinteger( p_pState, 1 );
+	Object * pObject = static_cast<Object *>( lua_newuserdata( p_pState, sizeof( Object ) ) );
+	pObject->Data = Data;
+
+	if( luaL_newmetatable( p_pState, g_pObjectTable ) )
+	{
+		lua_createtable( p_pState, 0, 1 );
+		lua_pushcfunction( p_pState, ObjectGetData );
+		lua_setfield( p_pState, -2, "GetData" );
+		lua_setfield( p_pState, -2, "__index" );
+	}
+	lua_setmetatable( p_pState, -2 );
+	return 1;
+}
+
+static void RunWorker( Worker * p_pWorker )
+{
+	const Settings & Config = *p_pWorker->pSettings;
+
+	LuaW::Script Lua;
+	Lua.RegisterFunction( "NewObject", NewObject );
+	Lua.EnableGarbageCollectorTelemetry( true );
+
+	if( Lua.RunFile( Config.ScriptPath.c_str( ) ) != LuaW::ERROR_NONE )
+	{
+		std::cerr << "[Error]: " << Lua.GetLastError( ) << std::endl;
+		p_pWorker->Failed = true;
+		g_Ready++;
+		Lua.Unload( );
+		return;
+	}
+
+	const std::string Message( 64, 'x' );
+	const unsigned int TotalWeight = Config.CallWeight + Config.UserdataWeight + Config.StringWeight;
+	unsigned int Random = 2463534242U + p_pWorker->Index * 7919U;
+	std::atomic<unsigned long long> & Counter = *p_pWorker->pCounter;
+	unsigned long long Operations = 0;
+
+	g_Ready++;
+	while( g_Start.load( ) == false )
+	{
+		std::this_thread::yield( );
+	}
+
+	while( g_Stop.load( std::memory_order_relaxed ) == false )
+	{
+		// Xorshift, pick the next operation
+		Random ^= Random << 13;
+		Random ^= Random >> 17;
+		Random ^= Random << 5;
+		unsigned int Choice = Random % TotalWeight;
+
+		long long Start = GetTime( );
+
+		// A failed call pops its error message, there is no result to pop.
+		if( Choice < Config.CallWeight )
+		{
+			Lua.PushGlobal( "Compute" );
+			Lua.PushInteger( Choice );
+			Lua.PushInteger( 3 );
+			if( Lua.Call( 2, 1 ) == LuaW::ERROR_NONE )
+			{
+				Lua.Pop( );
+			}
+			else
+			{
+				p_pWorker->CallFailures++;
+			}
+		}
+		else if( Choice < Config.CallWeight + Config.UserdataWeight )
+		{
+			Lua.PushGlobal( "CreateObject" );
+			Lua.PushInteger( Choice );
+			if( Lua.Call( 1, 1 ) == LuaW::ERROR_NONE )
+			{
+				Lua.Pop( );
+			}
+			else
+			{
+				p_pWorker->CallFailures++;
+			}
+		}
+		else
+		{
+			Lua.PushGlobal( "Concat" );
+			Lua.PushString( Message );
+			if( Lua.Call( 1, 1 ) == LuaW::ERROR_NONE )
+			{
+				Lua.PopString( );
+			}
+			else
+			{
+				p_pWorker->CallFailures++;
+			}
+		}
+
+		p_pWorker->Latency.Record( static_cast<unsigned long long>( GetTime( ) - Start ) );
+		Counter.store( ++Operations, std::memory_order_relaxed );
+	}
+
+	p_pWorker->GarbageCollector = Lua.GetGarbageCollectorTelemetry( )->GetStats( );
+	Lua.Unload( );
+}
+
+static bool RunThreads( const Settings & p_Settings, const unsigned int p_Threads, const bool p_Last )
+{
+	// One cache line per counter, unless we want to see the false sharing.
+	const unsigned int Stride = p_Settings.PackedCounters ? 1 : 64 / sizeof( unsigned long long );
+	std::vector<std::atomic<unsigned long long> > Counters( p_Threads * Stride );
+	for( size_t i = 0; i < Counters.size( ); i++ )
+	{
+		Counters[ i ] = 0;
+	}
+
+	std::vector<Worker *> Workers;
+	std::vector<std::thread> Threads;
+	g_Start = false;
+	g_Stop = false;
+	g_Ready = 0;
+
+	for( unsigned int i = 0; i < p_Threads; i++ )
+	{
+		Worker * pWorker = new Worker;
+		pWorker->Index = i;
+		pWorker->pSettings = &p_Settings;
+		pWorker->pCounter = &Counters[ i * Stride ];
+		pWorker->CallFailures = 0;
+		pWorker->Failed = false;
+		std::memset( &pWorker->GarbageCollector, 0, sizeof( pWorker->GarbageCollector ) );
+		Workers.push_back( pWorker );
+		Threads.push_back( std::thread( RunWorker, pWorker ) );
+	}
+
+	// Wait for every script to load, then run for the duration.
+	while( g_Ready.load( ) < p_Threads )
+	{
+		std::this_thread::yield( );
+	}
+
+	long long Start = GetTime( );
+	g_Start = true;
+	std::this_thread::sleep_for( std::chrono::milliseconds( p_Settings.Duration ) );
+	g_Stop = true;
+
+	for( size_t i = 0; i < Threads.size( ); i++ )
+	{
+		Threads[ i ].join( );
+	}
+	double Seconds = static_cast<double>( GetTime( ) - Start ) / 1000000000.0;
+
+	// Merge the results of all threads
+	LuaW::Histogram Latency;
+	unsigned long long Operations = 0;
+	unsigned long long Cycles = 0;
+	unsigned long long MaxPause = 0;
+	unsigned long long TotalPause = 0;
+	size_t PeakHeapBytes = 0;
+	unsigned long long CallFailures = 0;
+	bool Failed = false;
+
+	for( size_t i = 0; i < Workers.size( ); i++ )
+	{
+		const Worker & Current = *Workers[ i ];
+		Failed = Failed || Current.Failed;
+		Operations += Current.pCounter->load( );
+		Latency.Merge( Current.Latency );
+		Cycles += Current.GarbageCollector.Cycles;
+		TotalPause += Current.GarbageCollector.TotalPause;
+		MaxPause = Current.GarbageCollector.MaxPause > MaxPause ? Current.GarbageCollector.MaxPause : MaxPause;
+		PeakHeapBytes += Current.GarbageCollector.PeakHeapBytes;
+		CallFailures += Current.CallFailures;
+		delete Workers[ i ];
+	}
+
+	std::cout << "    { \"threads\": " << p_Threads <<
+		", \"operations\": " << Operations <<
+		", \"failed_calls\": " << CallFailures <<
+		", \"throughput\": " << static_cast<double>( Operations ) / Seconds <<
+		", \"p50_ns\": " << Latency.GetPercentile( 50.0 ) <<
+		", \"p99_ns\": " << Latency.GetPercentile( 99.0 ) <<
+		", \"p999_ns\": " << Latency.GetPercentile( 99.9 ) <<
+		", \"max_ns\": " << Latency.GetMax( ) <<
+		", \"gc_cycles\": " << Cycles <<
+		", \"gc_max_pause_ns\": " << MaxPause <<
+		", \"gc_total_pause_ns\": " << TotalPause <<
+		", \"peak_heap_bytes\": " << PeakHeapBytes << " }" <<
+		( p_Last ? "" : "," ) << std::endl;
+
+	return Failed == false;
+}
+
+int main( int p_ArgumentCount, char ** p_ppArguments )
+{
+	Settings Config;
+	Config.MaxThreads = std::thread::hardware_concurrency( );
+	Config.Duration = 2000;
+	Config.CallWeight = 70;
+	Config.UserdataWeight = 20;
+	Config.StringWeight = 10;
+	Config.PackedCounters = false;
+	std::string ScriptDirectory = LUAW_SCRIPT_DIRECTORY;
+
+	for( int i = 1; i < p_ArgumentCount; i++ )
+	{
+		std::string Argument = p_ppArguments[ i ];
+		bool HasValue = i + 1 < p_ArgumentCount;
+
+		if( Argument == "--threads" && HasValue )
+		{
+			Config.MaxThreads = static_cast<unsigned int>( std::atoi( p_ppArguments[ ++i ] ) );
+		}
+		else if( Argument == "--duration" && HasValue )
+		{
+			Config.Duration = static_cast<unsigned int>( std::atoi( p_ppArguments[ ++i ] ) );
+		}
+		else if( Argument == "--mix" && HasValue )
+		{
+			unsigned int Weights[ 3 ] = { 0, 0, 0 };
+			char * pValue = p_ppArguments[ ++i ];
+			for( int Weight = 0; Weight < 3 && *pValue; Weight++ )
+			{
+				Weights[ Weight ] = static_cast<unsigned int>( std::strtoul( pValue, &pValue, 10 ) );
+				if( *pValue == ',' )
+				{
+					pValue++;
+				}
+			}
+			Config.CallWeight = Weights[ 0 ];
+			Config.UserdataWeight = Weights[ 1 ];
+			Config.StringWeight = Weights[ 2 ];
+		}
+		else if( Argument == "--packed-counters" )
+		{
+			Config.PackedCounters = true;
+		}
+		else if( Argument == "--script-directory" && HasValue )
+		{
+			ScriptDirectory = p_ppArguments[ ++i ];
+		}
+		else
+		{
+			std::cerr << "Unknown argument: " << Argument << std::endl;
+			return 1;
+		}
+	}
+
+	if( Config.MaxThreads == 0 )
+	{
+		Config.MaxThreads = 1;
+	}
+	if( Config.CallWeight + Config.UserdataWeight + Config.StringWeight == 0 )
+	{
+		std::cerr << "The operation mix is empty." << std::endl;
+		return 1;
+	}
+	Config.ScriptPath = ScriptDirectory + "Load.lua";
+
+	std::cout << "{\n";
+	std::cout << "  \"duration_ms\": " << Config.Duration << ",\n";
+	std::cout << "  \"mix\": { \"call\": " << Config.CallWeight << ", \"userdata\": " << Config.UserdataWeight <<
+		", \"string\": " << Config.StringWeight << " },\n";
+	std::cout << "  \"counters\": \"" << ( Config.PackedCounters ? "packed" : "padded" ) << "\",\n";
+	std::cout << "  \"runs\": [\n";
+
+	bool Succeeded = true;
+	for( unsigned int Threads = 1; Threads <= Config.MaxThreads && Succeeded; Threads *= 2 )
+	{
+		bool Last = Threads * 2 > Config.MaxThreads;
+		Succeeded = RunThreads( Config, Threads, Last );
+	}
+
+	std::cout << "  ]\n";
+	std::cout << "}" << std::endl;
+
+	return Succeeded ? 0 : 1;
+}
@@ -0,0 +1,351 @@
+// ///////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2013 Jimmie Bergmann - jimmiebergmann@gmail.com
+//
+// This software is provided 'as-is', without any express or
+// implied warranty. In no event will the authors be held
+// liable for any damages arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute
+// it freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented;
+//    you must not claim that you wrote the original software.
+//    If you use this software in a product, an acknowledgment
+//    in the product documentation would be appreciated but
+//    is not required.
+//
+// 2. Altered source versions must be plainly marked as such,
+//    and must not be misrepresented as being the original software.
+//
+// 3. This notice may not be removed or altered from any
+//    source distribution.
+// ///////////////////////////////////////////////////////////////////////////
+
+// Micro benchmarks of every wrapper operation against the raw C API.
+// Usage: benchmark-micro [iterations] [script directory]
+// The results are written to stdout as JSON, times are nanoseconds per operation.
+
+#include <LuaW.hpp>
+#include <LuaW/ArrayView.hpp>
+#include <LuaW/EventBus.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#ifndef LUAW_SCRIPT_DIRECTORY
+#define LUAW_SCRIPT_DIRECTORY "../script/"
+#endif
+
+// Benchmark result structure
+struct Result
+{
+	std::string Name;
+	unsigned int Iterations;
+	double WrapperTime;
+	double RawTime;
+};
+
+static std::vector<Result> g_Results;
+static volatile long long g_Sink = 0;
+
+// Runs the function five times, returns the median time per operation.
+template<typename Function>
+static double Measure( Function p_Function, const unsigned int p_Iterations, const unsigned int p_Batch )
+{
+	std::vector<double> Times;
+	for( int Run = 0; Run < 5; Run++ )
+	{
+		std::chrono::steady_clock::time_point Start = std::chrono::steady_clock::now( );
+		for( unsigned int i = 0; i < p_Iterations; i++ )
+		{
+			p_Function( );
+		}
+		std::chrono::steady_clock::time_point End = std::chrono::steady_clock::now( );
+
+		double Time = static_cast<double>( std::chrono::duration_cast<std::chrono::nanoseconds>( End - Start ).count( ) );
+		Times.push_back( Time / ( static_cast<double>( p_Iterations ) * p_Batch ) );
+	}
+
+	std::sort( Times.begin( ), Times.end( ) );
+	return Times[ Times.size( ) / 2 ];
+}
+
+template<typename Wrapper, typename Raw>
+static void Benchmark( const char * p_pName, Wrapper p_Wrapper, Raw p_Raw, const unsigned int p_Iterations,
+	const unsigned int p_Batch = 1 )
+{
+	Result NewResult;
+	NewResult.Name = p_pName;
+	NewResult.Iterations = p_Iterations * p_Batch;
+	NewResult.WrapperTime = Measure( p_Wrapper, p_Iterations, p_Batch );
+	NewResult.RawTime = Measure( p_Raw, p_Iterations, p_Batch );
+	g_Results.push_back( NewResult );
+}
+
+// Raw C API version of the userdata created by FooTest
+static int RawFooNew( lua_State * p_pState )
+{
+	int Parameter = static_cast<int>( lua_tointeger( p_pState, -1 ) );
+
+	int ** ppData = static_cast<int **>( lua_newuserdata( p_pState, sizeof( int * ) ) );
+	*ppData = new int( Parameter );
+
+	luaL_getmetatable( p_pState, "RawFoo_Table" );
+	lua_setmetatable( p_pState, -2 );
+	return 1;
+}
+
+static int RawFooGetData( lua_State * p_pState )
+{
+	int * pFoo = *static_cast<int **>( luaL_checkudata( p_pState, 1, "RawFoo_Table" ) );
+	lua_pushinteger( p_pState, pFoo ? *pFoo : 0 );
+	return 1;
+}
+
+static const luaL_Reg g_RawFooFunctions[ ] =
+{
+	{ "New", RawFooNew },
+	{ "GetData", RawFooGetData },
+	{ NULL, NULL }
+};
+
+static void RawFooTest( lua_State * p_pState )
+{
+	luaL_newmetatable( p_pState, "RawFoo_Table" );
+	luaL_setfuncs( p_pState, g_RawFooFunctions, 0 );
+	lua_pushvalue( p_pState, -1 );
+	lua_setfield( p_pState, -1, "__index" );
+	lua_setglobal( p_pState, "RawFoo" );
+}
+
+// Pushes a Lua function running the code in a loop of the batch size
+static int CreateLoop( lua_State * p_pState, const char * p_pPrologue, const char * p_pBody, const unsigned int p_Batch )
+{
+	std::string Code = std::string( p_pPrologue ) + "\nreturn function( ) for i = 1, " +
+		std::to_string( static_cast<unsigned long long>( p_Batch ) ) + " do " + p_pBody + " end end";
+
+	if( luaL_dostring( p_pState, Code.c_str( ) ) != LUA_OK )
+	{
+		std::cerr << "[Error]: " << lua_tostring( p_pState, -1 ) << std::endl;
+		std::exit( 1 );
+	}
+
+	return luaL_ref( p_pState, LUA_REGISTRYINDEX );
+}
+
+static void CallLoop( lua_State * p_pState, const int p_Reference )
+{
+	lua_rawgeti( p_pState, LUA_REGISTRYINDEX, p_Reference );
+	lua_pcall( p_pState, 0, 0, 0 );
+}
+
+static void WriteJson( const unsigned int p_Iterations )
+{
+	std::cout << "{\n";
+	std::cout << "  \"lua\": \"" << LUA_RELEASE << "\",\n";
+	std::cout << "  \"iterations\": " << p_Iterations << ",\n";
+	std::cout << "  \"benchmarks\": [\n";
+	for( size_t i = 0; i < g_Results.size( ); i++ )
+	{
+		const Result & Current = g_Results[ i ];
+		std::cout << "    { \"name\": \"" << Current.Name << "\", \"iterations\": " << Current.Iterations <<
+			", \"wrapper_ns\": " << Current.WrapperTime << ", \"raw_ns\": " << Current.RawTime <<
+			", \"overhead_ns\": " << ( Current.WrapperTime - Current.RawTime ) << " }" <<
+			( i + 1 < g_Results.size( ) ? "," : "" ) << "\n";
+	}
+	std::cout << "  ]\n";
+	std::cout << "}" << std::endl;
+}
+
+int main( int p_ArgumentCount, char ** p_ppArguments )
+{
+	unsigned int Iterations = p_ArgumentCount > 1 ? static_cast<unsigned int>( std::atoi( p_ppArguments[ 1 ] ) ) : 1000000;
+	std::string ScriptDirectory = p_ArgumentCount > 2 ? p_ppArguments[ 2 ] : LUAW_SCRIPT_DIRECTORY;
+	std::string ScriptPath = ScriptDirectory + "Benchmark.lua";
+
+	if( Iterations < 1000 )
+	{
+		Iterations = 1000;
+	}
+
+	LuaW::Script Lua;
+	lua_State * L = Lua.GetState( );
+
+	if( Lua.RunFile( ScriptPath.c_str( ) ) != LuaW::ERROR_NONE )
+	{
+		std::cerr << "[Error]: " << Lua.GetLastError( ) << std::endl;
+		return 1;
+	}
+
+	Lua.FooTest( );
+	RawFooTest( L );
+
+	// Stack push/pop functions
+	Benchmark( "PushPopBoolean",
+		[ & ]( ) { Lua.PushBoolean( true ); g_Sink += Lua.PopBoolean( ); },
+		[ & ]( ) { lua_pushboolean( L, 1 ); g_Sink += lua_toboolean( L, -1 ); lua_pop( L, 1 ); },
+		Iterations );
+	Benchmark( "PushPopInteger",
+		[ & ]( ) { Lua.PushInteger( 42 ); g_Sink += Lua.PopInteger( ); },
+		[ & ]( ) { lua_pushinteger( L, 42 ); g_Sink += lua_tointeger( L, -1 ); lua_pop( L, 1 ); },
+		Iterations );
+	Benchmark( "PushPopIntegerUnchecked",
+		[ & ]( ) { Lua.PushInteger( 42 ); g_Sink += Lua.PopIntegerUnchecked( ); },
+		[ & ]( ) { lua_pushinteger( L, 42 ); g_Sink += lua_tointeger( L, -1 ); lua_pop( L, 1 ); },
+		Iterations );
+	Benchmark( "PushPopNumber",
+		[ & ]( ) { Lua.PushNumber( 4.2 ); g_Sink += static_cast<long long>( Lua.PopNumber( ) ); },
+		[ & ]( ) { lua_pushnumber( L, 4.2 ); g_Sink += static_cast<long long>( lua_tonumber( L, -1 ) ); lua_pop( L, 1 ); },
+		Iterations );
+	Benchmark( "PushPopString",
+		[ & ]( ) { Lua.PushString( "Hello World" ); g_Sink += Lua.PopString( ).size( ); },
+		[ & ]( ) { lua_pushstring( L, "Hello World" ); size_t Length = 0; lua_tolstring( L, -1, &Length ); g_Sink += Length; lua_pop( L, 1 ); },
+		Iterations );
+
+	// Get stack functions
+	Lua.PushBoolean( true );
+	Lua.PushNumber( 4.2 );
+	Lua.PushInteger( 42 );
+	Lua.PushString( "Hello World" );
+	Benchmark( "GetString",
+		[ & ]( ) { g_Sink += Lua.GetString( ).size( ); },
+		[ & ]( ) { size_t Length = 0; lua_tolstring( L, -1, &Length ); g_Sink += Length; },
+		Iterations );
+	Benchmark( "GetStringIndex",
+		[ & ]( ) { g_Sink += Lua.GetString( -1 ).size( ); },
+		[ & ]( ) { size_t Length = 0; lua_tolstring( L, -1, &Length ); g_Sink += Length; },
+		Iterations );
+	Lua.Pop( );
+	Benchmark( "GetInteger",
+		[ & ]( ) { g_Sink += Lua.GetInteger( ); },
+		[ & ]( ) { g_Sink += lua_tointeger( L, -1 ); },
+		Iterations );
+	Benchmark( "GetIntegerUnchecked",
+		[ & ]( ) { g_Sink += Lua.GetIntegerUnchecked( ); },
+		[ & ]( ) { g_Sink += lua_tointeger( L, -1 ); },
+		Iterations );
+	Benchmark( "GetIntegerIndex",
+		[ & ]( ) { g_Sink += Lua.GetInteger( -1 ); },
+		[ & ]( ) { g_Sink += lua_tointeger( L, -1 ); },
+		Iterations );
+	Lua.Pop( );
+	Benchmark( "GetNumber",
+		[ & ]( ) { g_Sink += static_cast<long long>( Lua.GetNumber( ) ); },
+		[ & ]( ) { g_Sink += static_cast<long long>( lua_tonumber( L, -1 ) ); },
+		Iterations );
+	Benchmark( "GetNumberIndex",
+		[ & ]( ) { g_Sink += static_cast<long long>( Lua.GetNumber( -1 ) ); },
+		[ & ]( ) { g_Sink += static_cast<long long>( lua_tonumber( L, -1 ) ); },
+		Iterations );
+	Lua.Pop( );
+	Benchmark( "GetBoolean",
+		[ & ]( ) { g_Sink += Lua.GetBoolean( ); },
+		[ & ]( ) { g_Sink += lua_toboolean( L, -1 ); },
+		Iterations );
+	Benchmark( "GetBooleanIndex",
+		[ & ]( ) { g_Sink += Lua.GetBoolean( -1 ); },
+		[ & ]( ) { g_Sink += lua_toboolean( L, -1 ); },
+		Iterations );
+	Lua.Pop( );
+
+	// Global functions
+	Benchmark( "SetGlobalBoolean",
+		[ & ]( ) { Lua.SetGlobalBoolean( "flag", true ); },
+		[ & ]( ) { lua_pushboolean( L, 1 ); lua_setglobal( L, "flag" ); },
+		Iterations );
+	Benchmark( "GetGlobalBoolean",
+		[ & ]( ) { g_Sink += Lua.GetGlobalBoolean( "flag" ); },
+		[ & ]( ) { lua_getglobal( L, "flag" ); g_Sink += lua_toboolean( L, -1 ); lua_pop( L, 1 ); },
+		Iterations );
+	Benchmark( "SetGlobalInteger",
+		[ & ]( ) { Lua.SetGlobalInteger( "size", 1024 ); },
+		[ & ]( ) { lua_pushinteger( L, 1024 ); lua_setglobal( L, "size" ); },
+		Iterations );
+	Benchmark( "GetGlobalInteger",
+		[ & ]( ) { g_Sink += Lua.GetGlobalInteger( "size" ); },
+		[ & ]( ) { lua_getglobal( L, "size" ); g_Sink += lua_tointeger( L, -1 ); lua_pop( L, 1 ); },
+		Iterations );
+	Benchmark( "SetGlobalNumber",
+		[ & ]( ) { Lua.SetGlobalNumber( "progress", 0.314159 ); },
+		[ & ]( ) { lua_pushnumber( L, 0.314159 ); lua_setglobal( L, "progress" ); },
+		Iterations );
+	Benchmark( "GetGlobalNumber",
+		[ & ]( ) { g_Sink += static_cast<long long>( Lua.GetGlobalNumber( "progress" ) ); },
+		[ & ]( ) { lua_getglobal( L, "progress" ); g_Sink += static_cast<long long>( lua_tonumber( L, -1 ) ); lua_pop( L, 1 ); },
+		Iterations );
+	Benchmark( "SetGlobalString",
+		[ & ]( ) { Lua.SetGlobalString( "title", "Hello World" ); },
+		[ & ]( ) { lua_pushstring( L, "Hello World" ); lua_setglobal( L, "title" ); },
+		Iterations );
+	Benchmark( "GetGlobalString",
+		[ & ]( ) { g_Sink += Lua.GetGlobalString( "title" ).size( ); },
+		[ & ]( ) { lua_getglobal( L, "title" ); size_t Length = 0; lua_tolstring( L, -1, &Length ); g_Sink += Length; lua_pop( L, 1 ); },
+		Iterations );
+
+	// Calls
+	Benchmark( "Call",
+		[ & ]( ) { Lua.PushGlobal( "Add" ); Lua.PushInteger( 1 ); Lua.PushInteger( 2 ); Lua.Call( 2, 1 ); g_Sink += Lua.PopInteger( ); },
+		[ & ]( ) { lua_getglobal( L, "Add" ); lua_pushinteger( L, 1 ); lua_pushinteger( L, 2 ); lua_pcall( L, 2, 1, 0 );
+			g_Sink += lua_tointeger( L, -1 ); lua_pop( L, 1 ); },
+		Iterations );
+	Benchmark( "RunString",
+		[ & ]( ) { Lua.RunString( "counter = counter + 1" ); },
+		[ & ]( ) { luaL_dostring( L, "counter = counter + 1" ); },
+		Iterations / 10 );
+	Benchmark( "RunFile",
+		[ & ]( ) { Lua.RunFile( ScriptPath.c_str( ) ); },
+		[ & ]( ) { luaL_dofile( L, ScriptPath.c_str( ) ); },
+		Iterations / 100 );
+
+	// Userdata, the loops run in Lua, the C functions are what we measure.
+	const unsigned int Batch = 100;
+	int WrapperNew = CreateLoop( L, "local New = Foo.New", "New( i )", Batch );
+	int RawNew = CreateLoop( L, "local New = RawFoo.New", "New( i )", Batch );
+	Benchmark( "FooNew",
+		[ & ]( ) { CallLoop( L, WrapperNew ); },
+		[ & ]( ) { CallLoop( L, RawNew ); },
+		Iterations / Batch / 10, Batch );
+
+	int WrapperMethod = CreateLoop( L, "local Object = Foo.New( 1 )", "Object:GetData( )", Batch );
+	int RawMethod = CreateLoop( L, "local Object = RawFoo.New( 1 )", "Object:GetData( )", Batch );
+	Benchmark( "FooGetData",
+		[ & ]( ) { CallLoop( L, WrapperMethod ); },
+		[ & ]( ) { CallLoop( L, RawMethod ); },
+		Iterations / Batch, Batch );
+
+	// Column update of 10k entities, the builtin against a plain Lua loop over tables.
+	const size_t EntityCount = 10000;
+	std::vector<double> PositionColumn( EntityCount, 0.0 ), VelocityColumn( EntityCount, 1.0 );
+	LuaW::ArrayView::OpenLibrary( L );
+	LuaW::ArrayView::Push( L, &PositionColumn[ 0 ], EntityCount );
+	lua_setglobal( L, "px" );
+	LuaW::ArrayView::Push( L, &VelocityColumn[ 0 ], EntityCount );
+	lua_setglobal( L, "vx" );
+	int WrapperIntegrate = CreateLoop( L, "local px, vx = px, vx", "soa.integrate( px, vx, 0.016 )", 1 );
+	int RawIntegrate = CreateLoop( L, "local px, vx = { }, { } for i = 1, 10000 do px[ i ] = 0 vx[ i ] = 1 end",
+		"for j = 1, #px do px[ j ] = px[ j ] + vx[ j ] * 0.016 end", 1 );
+	Benchmark( "SoaIntegrate10k",
+		[ & ]( ) { CallLoop( L, WrapperIntegrate ); },
+		[ & ]( ) { CallLoop( L, RawIntegrate ); },
+		Iterations / 1000 );
+
+	// Event dispatch of 100 events, the bus against a global lookup and call per event.
+	LuaW::EventBus Events( Lua );
+	unsigned int HitEvent = Events.GetEventType( "hit" );
+	luaL_dostring( L, "function OnHit( Id, Damage ) counter = counter + Damage end events.on( 'hit', OnHit )" );
+	Benchmark( "EventDispatch100",
+		[ & ]( ) { for( unsigned int i = 0; i < Batch; i++ ) { Events.Emit( HitEvent ); Events.PushInteger( i ); Events.PushNumber( 1.0 ); }
+			Events.Dispatch( ); },
+		[ & ]( ) { for( unsigned int i = 0; i < Batch; i++ ) { lua_getglobal( L, "OnHit" ); lua_pushinteger( L, i ); lua_pushnumber( L, 1.0 );
+			lua_pcall( L, 2, 0, 0 ); } },
+		Iterations / Batch, Batch );
+
+	WriteJson( Iterations );
+
+	Lua.Unload( );
+	return 0;
+}
@@ -0,0 +1,30 @@
+# Embeds Lua scripts into a target, Script::RunEmbedded runs them by name.
+# The scripts are compiled by luaw-embed at build time and rebuilt when they change.
+#
+#   luaw_embed_scripts( <target> [DEBUG] [ROOT <directory>] SCRIPTS <file>... )
+#
+# The names are the file paths relative to ROOT. DEBUG keeps the debug information,
+# the line numbers of errors are lost otherwise.
+
+function( luaw_embed_scripts TARGET )
+	cmake_parse_arguments( EMBED "DEBUG" "ROOT" "SCRIPTS" ${ARGN} )
+
+	set( OUTPUT ${CMAKE_CURRENT_BINARY_DIR}/${TARGET}-embedded.cpp )
+	set( OPTIONS )
+	if( EMBED_DEBUG )
+		list( APPEND OPTIONS --debug )
+	endif( )
+	if( EMBED_ROOT )
+		list( APPEND OPTIONS --root ${EMBED_ROOT} )
+	endif( )
+
+	add_custom_command(
+		OUTPUT ${OUTPUT}
+		COMMAND luaw-embed ${OPTIONS} ${OUTPUT} ${EMBED_SCRIPTS}
+		DEPENDS luaw-embed ${EMBED_SCRIPTS}
+		COMMENT "Embedding Lua scripts into ${TARGET}"
+		VERBATIM )
+
+	target_sources( ${TARGET} PRIVATE ${OUTPUT} )
+	target_compile_definitions( ${TARGET} PRIVATE LUAW_EMBEDDED_SCRIPTS )
+endfunction( )
@@ -32,7 +32,12 @@ int main( )
 	LuaW::Script Lua;
 
 	// Run the Lua file
+	// The CMake build embeds the script into the executable.
+#if defined( LUAW_EMBEDDED_SCRIPTS )
+	if( Lua.RunEmbedded( "Settings.lua" ) != LuaW::ERROR_NONE )
+#else
 	if( Lua.RunFile( g_ScriptPath.c_str( ) ) != LuaW::ERROR_NONE )
+#endif
 	{
 		std::cout << "[Error]: " << Lua.GetLastError( ) << std::endl;
 		std::cin.get( );
@@ -42,6 +42,18 @@ public:
 		return m_Size;
 	}
 
+	// Layout for Lua proxies, declared in the class to reach the private members.
+	static const LuaW::Layout & GetLayout( )
+	{
+		static const LuaW::FieldDescriptor Fields[ ] =
+		{
+			LUAW_STRUCT_FIELD( "Position", Object, m_Position, &Vector2::GetLayout( ) ),
+			LUAW_FIELD( "Size", Object, m_Size, LuaW::FIELD_DOUBLE )
+		};
+		static const LuaW::Layout Layout( "Object", sizeof( Object ), Fields, 2 );
+		return Layout;
+	}
+
 private:
 
 	// Private variables
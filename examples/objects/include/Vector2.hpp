@@ -1,6 +1,8 @@
 #ifndef EXAMPLE_VECTOR2_HPP
 #define EXAMPLE_VECTOR2_HPP
 
+#include <LuaW/Layout.hpp>
+
 class Vector2
 {
 
@@ -21,6 +23,18 @@ public:
 		x( p_X ), y( p_Y )
 	{ }
 
+	// Layout for Lua proxies
+	static const LuaW::Layout & GetLayout( )
+	{
+		static const LuaW::FieldDescriptor Fields[ ] =
+		{
+			LUAW_FIELD( "x", Vector2, x, LuaW::FIELD_DOUBLE ),
+			LUAW_FIELD( "y", Vector2, y, LuaW::FIELD_DOUBLE )
+		};
+		static const LuaW::Layout Layout( "Vector2", sizeof( Vector2 ), Fields, 2 );
+		return Layout;
+	}
+
 	// Public variables
 	double x;
 	double y;
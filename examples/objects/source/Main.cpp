@@ -23,24 +23,75 @@
 // ///////////////////////////////////////////////////////////////////////////
 
 #include <LuaW.hpp>
+#include <LuaW/ArrayView.hpp>
 #include <Object.hpp>
 #include <iostream>
 #include <vector>
 
 static const std::string g_ScriptPath = "../script/Objects.lua";
-static std::vector<Object*> g_Objects;
+static std::vector<Object> g_Objects;
+
+// Entities stored as structure of arrays, updated by the script a column at a time.
+static const size_t g_EntityCount = 100000;
+static std::vector<double> g_X( g_EntityCount ), g_Y( g_EntityCount );
+static std::vector<double> g_VelocityX( g_EntityCount, 1.0 ), g_VelocityY( g_EntityCount, -2.0 );
+static std::vector<float> g_Size( g_EntityCount, 1.0f );
 
 int main( )
 {
 	LuaW::Script Lua;
 
+	// Expose the objects to Lua, the script reads and writes them in place.
+	for( int i = 0; i < 4; i++ )
+	{
+		g_Objects.push_back( Object( Vector2( i, i * 2 ), 1.0 ) );
+	}
+	Object::GetLayout( ).PushArray( Lua.GetState( ), &g_Objects[ 0 ], g_Objects.size( ) );
+	lua_setglobal( Lua.GetState( ), "Objects" );
+
+	// Expose the entity columns
+	LuaW::ArrayView::OpenLibrary( Lua.GetState( ) );
+	LuaW::ColumnSet Entities( g_EntityCount );
+	Entities.Add( "x", &g_X[ 0 ] );
+	Entities.Add( "y", &g_Y[ 0 ] );
+	Entities.Add( "vx", &g_VelocityX[ 0 ], true );
+	Entities.Add( "vy", &g_VelocityY[ 0 ], true );
+	Entities.Add( "size", &g_Size[ 0 ] );
+	Entities.Push( Lua.GetState( ) );
+	lua_setglobal( Lua.GetState( ), "Entities" );
+
 	// Run the Lua file
+	// The CMake build embeds the script into the executable.
+#if defined( LUAW_EMBEDDED_SCRIPTS )
+	if( Lua.RunEmbedded( "Objects.lua" ) != LuaW::ERROR_NONE )
+#else
 	if( Lua.RunFile( g_ScriptPath.c_str( ) ) != LuaW::ERROR_NONE )
+#endif
 	{
 		std::cout << "[Error]: " << Lua.GetLastError( ) << std::endl;
 		std::cin.get( );
 		return 0;
 	}
+
+	// Run a few ticks of the entity update
+	for( int Tick = 0; Tick < 10; Tick++ )
+	{
+		Lua.PushGlobal( "UpdateEntities" );
+		Lua.PushNumber( 1.0 / 60.0 );
+		if( Lua.Call( 1, 0 ) != LuaW::ERROR_NONE )
+		{
+			std::cout << "[Error]: " << Lua.GetLastError( ) << std::endl;
+			break;
+		}
+	}
+	std::cout << "(C++) Entity 0: (" << g_X[ 0 ] << ", " << g_Y[ 0 ] << ") size " << g_Size[ 0 ] << std::endl;
+
+	// Print the objects moved by the script
+	for( size_t i = 0; i < g_Objects.size( ); i++ )
+	{
+		std::cout << "(C++) Object " << i << ": (" << g_Objects[ i ].GetPosition( ).x << ", "
+			<< g_Objects[ i ].GetPosition( ).y << ") size " << g_Objects[ i ].GetSize( ) << std::endl;
+	}
 	
 	// Unload Lua
 	Lua.Unload( );
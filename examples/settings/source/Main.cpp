@@ -29,8 +29,8 @@ static const std::string g_ScriptPath = "../script/Functions.lua";
 
 int SumFunction( lua_State * p_pState )
 {
-	// Pass the state to a new lua class
-	LuaW::Script Lua( p_pState );
+	// View the state, the view does not own it
+	LuaW::StateView Lua( p_pState );
 
 	// Get the paramters
 	int StackSize = Lua.GetStackSize( );
@@ -38,7 +38,7 @@ int SumFunction( lua_State * p_pState )
 
 	for( int i = 0; i < StackSize; i++ )
 	{
-		Sum += Lua.PopInteger( );
+		Sum += Lua.PopIntegerUnchecked( ); // The loop never pops more than the stack size
 	}
 
 	// Push the result to the lua stack(makes it into a return value for the lua function)
@@ -57,7 +57,12 @@ int main( )
 	Lua.RegisterFunction( "Sum", SumFunction );
 
 	// Run the Lua file
+	// The CMake build embeds the script into the executable.
+#if defined( LUAW_EMBEDDED_SCRIPTS )
+	if( Lua.RunEmbedded( "Functions.lua" ) != LuaW::ERROR_NONE )
+#else
 	if( Lua.RunFile( g_ScriptPath.c_str( ) ) != LuaW::ERROR_NONE )
+#endif
 	{
 		std::cout << "[Error]: " << Lua.GetLastError( ) << std::endl;
 		std::cin.get( );
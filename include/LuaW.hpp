@@ -28,12 +28,21 @@
 #define LUA_W_HPP
 
 #include <lua.hpp>
+#include <LuaW/Compat.hpp>
+#include <atomic>
+#include <cassert>
 #include <string>
 
 namespace LuaW
 {
 	// Forward declaractions
+	class StateView;
 	class Script;
+	class Scheduler;
+	class Profiler;
+	class Instrumentation;
+	class GarbageCollectorTelemetry;
+	class TraceRecorder;
 
 
 	// Error codes for the Lua wrapper
@@ -46,7 +55,17 @@ namespace LuaW
 		ERROR_STACK = 4,
 		ERROR_MEMORY = 5,
 		ERROR_MESSAGE_HANDLER = 6,
-		ERROR_GARBAGE_COLLECTOR = 7
+		ERROR_GARBAGE_COLLECTOR = 7,
+		ERROR_TIMEOUT = 8,
+		ERROR_INSTRUCTION_LIMIT = 9
+	};
+
+
+	// Garbage collector modes
+	enum eGarbageCollectorMode
+	{
+		GC_INCREMENTAL = 0,
+		GC_GENERATIONAL = 1
 	};
 
 
@@ -54,26 +73,15 @@ namespace LuaW
 	typedef int ( * CFunction )( Script * );
 
 
-	// Lua script class
-	class Script
+	// Non-owning view of a Lua state, cheap to copy and free of allocations.
+	// Use it inside C functions, the state is never closed by the view.
+	class StateView
 	{
 
 	public:
 
-		// Constructor/destructor
-		Script( );
-		Script( lua_State * p_pState );
-		~Script( );
-
-		// Public functions
-		eError Call( int p_Arguments, int p_ReturnValues );
-		void RegisterFunction( const char * p_pName, lua_CFunction p_Function );
-		eError RunFile( const char * p_pFilePath );
-		eError RunString( const char * p_pString );
-		void Unload( );
-
-		// Foo test
-		void FooTest( );
+		// Constructor
+		StateView( lua_State * p_pState );
 
 		// Get globals functions
 		bool GetGlobalBoolean( const char * p_pName );
@@ -81,7 +89,7 @@ namespace LuaW
 		lua_Number GetGlobalNumber( const char * p_pName );
 		std::string GetGlobalString( const char * p_pName );
 
-		// Set globals functions
+		// Set globals functions, recorded while the script owning the state traces.
 		void SetGlobalBoolean( const char * p_pName, const bool p_Boolean );
 		void SetGlobalInteger( const char * p_pName, const lua_Integer p_Integer );
 		void SetGlobalNumber( const char * p_pName, const lua_Number p_Number );
@@ -96,7 +104,7 @@ namespace LuaW
 		void Push( );
 		void PushBoolean( const bool p_Boolean );
 		void PushGlobal( const char * p_pName );
-		void PushInteger( const lua_Number p_Integer );
+		void PushInteger( const lua_Integer p_Integer ); // Native integer subtype on Lua 5.4
 		void PushNumber( const lua_Number p_Number );
 		void PushString( const std::string & p_String );
 		void PushValue( const int p_Index ); // Push copy from the stack
@@ -119,21 +127,192 @@ namespace LuaW
 		std::string GetString( );
 		std::string GetString( const int p_Index );
 
+		// Userdata functions, user values are native on Lua 5.4 and kept in a table on the other backends.
+		void * NewUserdata( const size_t p_Size, const int p_UserValues );
+		bool SetUserValue( const int p_Index, const int p_Slot ); // Pops the value, false if there is no such slot.
+		bool PushUserValue( const int p_Index, const int p_Slot ); // Pushes nil and returns false if there is no such slot.
+
+		// Unchecked get/pop functions for arguments that are already validated.
+		// The stack is only checked in debug builds, release builds compile down to the bare lua_to* calls.
+		bool GetBooleanUnchecked( );
+		lua_Integer GetIntegerUnchecked( );
+		lua_Number GetNumberUnchecked( );
+		std::string GetStringUnchecked( );
+		bool PopBooleanUnchecked( );
+		lua_Integer PopIntegerUnchecked( );
+		lua_Number PopNumberUnchecked( );
+		std::string PopStringUnchecked( );
+
 		// General get functions
 		lua_State * GetState( ) const;
-		const std::string & GetLastError( ) const;
+
+	protected:
+
+		// Protected variables
+		lua_State * m_pState;
+
+	};
+
+
+	// Lua script class, owns and closes its state. Move only.
+	class Script : public StateView
+	{
+
+	public:
+
+		// Constructor/destructor
+		Script( );
+		Script( lua_State * p_pState ); // Takes ownership of the state
+		Script( Script && p_Script );
+		~Script( );
+
+		// Move operator, the objects referring to the script(scheduler, profiler) are not moved.
+		Script & operator = ( Script && p_Script );
+
+		// Public functions
+		eError Call( int p_Arguments, int p_ReturnValues ); // Leaves p_ReturnValues results, LUA_MULTRET keeps all of them.
+		void RegisterFunction( const char * p_pName, lua_CFunction p_Function );
+		eError RunFile( const char * p_pFilePath );
+		eError RunString( const char * p_pString );
+		eError RunEmbedded( const char * p_pName ); // Script compiled into the binary, see LuaW/Embedded.hpp.
+		eError RunBuffer( const char * p_pData, const size_t p_Size, const char * p_pChunkName ); // Source or bytecode
+		void Unload( );
+
+		// Execution limit functions, coroutines inherit the hook of the call creating them.
+		// Threads created from C++ outside of a call are not limited.
+		void SetInstructionLimit( const unsigned int p_Instructions ); // 0 = no limit
+		void SetTimeLimit( const unsigned int p_Microseconds ); // 0 = no limit
+		void ArmTimer( const unsigned int p_Microseconds ); // Thread safe, limits the running or the next call.
+		void Interrupt( ); // Thread safe, aborts the running call. Ignored between calls.
+
+		// Instrumentation functions
+		void EnableInstrumentation( const bool p_Enabled ); // Affects functions registered from now on.
+		Instrumentation * GetInstrumentation( ) const; // NULL if never enabled
+
+		// Garbage collector functions
+		void SetGarbageCollectorMode( const eGarbageCollectorMode p_Mode );
+		int SetGarbageCollectorPause( const int p_Percent ); // Returns the previous value
+		int SetGarbageCollectorStepMultiplier( const int p_Percent ); // Returns the previous value
+		void StopGarbageCollector( ); // Only explicit collections and steps are run
+		void RestartGarbageCollector( );
+		bool IsGarbageCollectorRunning( );
+		void CollectGarbage( ); // Full cycle
+		bool StepGarbageCollector( const unsigned int p_Microseconds ); // Steps within the time budget, true if a cycle finished.
+		size_t GetMemoryUsage( ); // Bytes
+		void EnableGarbageCollectorTelemetry( const bool p_Enabled );
+		GarbageCollectorTelemetry * GetGarbageCollectorTelemetry( ) const; // NULL if not enabled
+
+		// JIT functions, only supported by the LuaJIT backend.
+		// Compiled code does not run the hooks, the execution limits and preemption only apply to interpreted code.
+		bool SetJitEnabled( const bool p_Enabled ); // False if there is no JIT
+		bool FlushJit( ); // Discards all compiled code
+		bool EnableFfi( ); // Sets the global "ffi" to the FFI module
+
+		// Error functions
+		void EnableTraceback( const bool p_Enabled ); // Errors capture the call stack, formatted by GetLastError.
+
+		// Trace functions, see LuaW/Trace.hpp
+		bool StartRecording( const char * p_pFilePath ); // Records calls, runs and global sets made from C++.
+		void StopRecording( );
+
+		// Foo test
+		void FooTest( );
+
+		// General get functions
+		const std::string & GetLastError( ) const; // Includes the traceback, if captured.
 
 	private:
 
+		// Friend classes
+		friend class Scheduler;
+		friend class Profiler;
+
+		// Forward declarations
+		struct HookContext;
+		struct ErrorTrace;
+
+		// Copy is not allowed, the state is owned by the script.
+		Script( const Script & p_Script );
+		Script & operator = ( const Script & p_Script );
+
 		// Private functions
 		eError ConvertErrorCode( int p_Code ); // Converts from int to eError
+		HookContext * GetHookContext( );
+		void ReleaseHookContext( );
+		void BeginExecution( );
+		eError EndExecution( ); // Returns the expired limit, if any.
+		static void HookCallback( lua_State * p_pState, lua_Debug * p_pDebug );
+		static int MessageHandler( lua_State * p_pState );
+		int ProtectedCall( const int p_Arguments, const int p_ReturnValues ); // lua_pcall with the message handler, if enabled.
+		eError RunChunk( const int p_LoadError, TraceRecorder * p_pRecorder ); // Runs the loaded chunk, ends the execution and the trace record.
+		void DiscardErrorTrace( ); // The next error message must not get the traceback of an earlier one.
 
 		// Private variables
-		lua_State * m_pState;
-		std::string m_ErrorMessage;
+		mutable std::string m_ErrorMessage; // The traceback is appended when read.
+		ErrorTrace * m_pErrorTrace;
+		HookContext * m_pHookContext;
+		std::atomic<HookContext *> m_pWatchedContext; // The hook context as seen by watchdog threads
+		std::atomic<unsigned int> m_WatchdogCalls; // ArmTimer and Interrupt calls in progress
+		Instrumentation * m_pInstrumentation;
+		GarbageCollectorTelemetry * m_pGarbageCollectorTelemetry;
+		TraceRecorder * m_pTraceRecorder;
 
 	};
 
+
+	// Unchecked get/pop functions of the state view
+	inline bool StateView::GetBooleanUnchecked( )
+	{
+		assert( lua_gettop( m_pState ) > 0 );
+		return lua_toboolean( m_pState, -1 ) != 0;
+	}
+
+	inline lua_Integer StateView::GetIntegerUnchecked( )
+	{
+		assert( lua_gettop( m_pState ) > 0 );
+		return lua_tointeger( m_pState, -1 );
+	}
+
+	inline lua_Number StateView::GetNumberUnchecked( )
+	{
+		assert( lua_gettop( m_pState ) > 0 );
+		return lua_tonumber( m_pState, -1 );
+	}
+
+	inline std::string StateView::GetStringUnchecked( )
+	{
+		assert( lua_gettop( m_pState ) > 0 && lua_tostring( m_pState, -1 ) != NULL );
+		return lua_tostring( m_pState, -1 );
+	}
+
+	inline bool StateView::PopBooleanUnchecked( )
+	{
+		bool Ret = GetBooleanUnchecked( );
+		lua_pop( m_pState, 1 );
+		return Ret;
+	}
+
+	inline lua_Integer StateView::PopIntegerUnchecked( )
+	{
+		lua_Integer Ret = GetIntegerUnchecked( );
+		lua_pop( m_pState, 1 );
+		return Ret;
+	}
+
+	inline lua_Number StateView::PopNumberUnchecked( )
+	{
+		lua_Number Ret = GetNumberUnchecked( );
+		lua_pop( m_pState, 1 );
+		return Ret;
+	}
+
+	inline std::string StateView::PopStringUnchecked( )
+	{
+		std::string Ret = GetStringUnchecked( );
+		lua_pop( m_pState, 1 );
+		return Ret;
+	}
+
 };
 
 
@@ -0,0 +1,118 @@
+// ///////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2013 Jimmie Bergmann - jimmiebergmann@gmail.com
+//
+// This software is provided 'as-is', without any express or
+// implied warranty. In no event will the authors be held
+// liable for any damages arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute
+// it freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented;
+//    you must not claim that you wrote the original software.
+//    If you use this software in a product, an acknowledgment
+//    in the product documentation would be appreciated but
+//    is not required.
+//
+// 2. Altered source versions must be plainly marked as such,
+//    and must not be misrepresented as being the original software.
+//
+// 3. This notice may not be removed or altered from any
+//    source distribution.
+// ///////////////////////////////////////////////////////////////////////////
+
+// Typed array views for structure-of-arrays bindings
+
+#ifndef LUA_W_ARRAY_VIEW_HPP
+#define LUA_W_ARRAY_VIEW_HPP
+
+#include <LuaW/Layout.hpp>
+#include <string>
+#include <vector>
+
+namespace LuaW
+{
+
+	// View of a C++ array, indexed from 1 in Lua. Only the numeric field types are supported.
+	// The view holds a raw pointer, the array must outlive it and must not be reallocated.
+	struct ArrayViewData
+	{
+		void * pData;
+		size_t Count;
+		eFieldType Type;
+		bool ReadOnly;
+	};
+
+
+	// Pushes array views and opens the "soa" library of column operations.
+	// The library functions run over whole columns in C++:
+	//   soa.integrate( x, vx, dt )  x[ i ] = x[ i ] + vx[ i ] * dt
+	//   soa.clamp( x, min, max )
+	//   soa.scale( x, factor )
+	//   soa.fill( x, value )
+	//   soa.sum( x )                returns the sum
+	// Columns of different lengths are processed up to the shortest one.
+	class ArrayView
+	{
+
+	public:
+
+		// Public functions
+		static void Push( lua_State * p_pState, int * p_pData, const size_t p_Count, const bool p_ReadOnly = false );
+		static void Push( lua_State * p_pState, float * p_pData, const size_t p_Count, const bool p_ReadOnly = false );
+		static void Push( lua_State * p_pState, double * p_pData, const size_t p_Count, const bool p_ReadOnly = false );
+		static ArrayViewData * ToArrayView( lua_State * p_pState, const int p_Index ); // NULL if not an array view
+		static void OpenLibrary( lua_State * p_pState );
+
+	private:
+
+		// Private functions
+		static void Push( lua_State * p_pState, void * p_pData, const size_t p_Count, const eFieldType p_Type, const bool p_ReadOnly );
+		static int Index( lua_State * p_pState );
+		static int NewIndex( lua_State * p_pState );
+		static int Length( lua_State * p_pState );
+		static int Integrate( lua_State * p_pState );
+		static int Clamp( lua_State * p_pState );
+		static int Scale( lua_State * p_pState );
+		static int Fill( lua_State * p_pState );
+		static int Sum( lua_State * p_pState );
+
+	};
+
+
+	// Named columns of equal length, pushed as a table of array views with a "count" field.
+	class ColumnSet
+	{
+
+	public:
+
+		// Constructor
+		ColumnSet( const size_t p_Count );
+
+		// Public functions
+		void Add( const char * p_pName, int * p_pData, const bool p_ReadOnly = false );
+		void Add( const char * p_pName, float * p_pData, const bool p_ReadOnly = false );
+		void Add( const char * p_pName, double * p_pData, const bool p_ReadOnly = false );
+		void Push( lua_State * p_pState ) const;
+
+		// General get functions
+		size_t GetCount( ) const;
+
+	private:
+
+		struct Column
+		{
+			std::string Name;
+			ArrayViewData View;
+		};
+
+		// Private variables
+		size_t m_Count;
+		std::vector<Column> m_Columns;
+
+	};
+
+}
+
+#endif
@@ -0,0 +1,191 @@
+// ///////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2013 Jimmie Bergmann - jimmiebergmann@gmail.com
+//
+// This software is provided 'as-is', without any express or
+// implied warranty. In no event will the authors be held
+// liable for any damages arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute
+// it freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented;
+//    you must not claim that you wrote the original software.
+//    If you use this software in a product, an acknowledgment
+//    in the product documentation would be appreciated but
+//    is not required.
+//
+// 2. Altered source versions must be plainly marked as such,
+//    and must not be misrepresented as being the original software.
+//
+// 3. This notice may not be removed or altered from any
+//    source distribution.
+// ///////////////////////////////////////////////////////////////////////////
+// Non-blocking file and pipe I/O for scheduler tasks
+
+#ifndef LUA_W_ASYNC_IO_HPP
+#define LUA_W_ASYNC_IO_HPP
+
+#include <LuaW.hpp>
+#include <LuaW/Scheduler.hpp>
+#include <deque>
+#include <string>
+#include <vector>
+
+#if defined( __linux__ )
+
+namespace LuaW
+{
+
+	// I/O backends
+	enum eIoBackend
+	{
+		IO_BACKEND_AUTO = 0, // io_uring if the kernel allows it, else epoll
+		IO_BACKEND_URING = 1,
+		IO_BACKEND_EPOLL = 2
+	};
+
+
+	// Asynchronous reads and writes of files and pipes, one worker thread drives the I/O of all its tasks.
+	// A task starting an operation yields to the scheduler and is resumed when the operation completed.
+	// Outside of a scheduler task, including coroutines resumed by a task, the calls block like the io library.
+	// Read and write buffers are reused from a pool.
+	// The epoll backend cannot wait for regular files, it reads and writes them directly.
+	// Creating the object adds the global "aio" table to the script:
+	//   aio.open( path [, mode] )   opens a file or a named pipe, mode is "r", "w" or "a"
+	//   aio.pipe( )                 returns the read and the write end of a new pipe
+	//   aio.backend( )              "io_uring" or "epoll"
+	// The files have read( format ), write( ... ), lines( format ) and close( ), the formats are
+	// "l", "L", "a" and a byte count. The object must be destroyed before the script is unloaded.
+	// Pass IdleCallback and the object to Scheduler::SetIdleCallback to block in Wait while every task waits.
+	class AsyncIo
+	{
+
+	public:
+
+		// Constructor/destructor
+		AsyncIo( Script & p_Script, const eIoBackend p_Backend = IO_BACKEND_AUTO,
+				 const unsigned int p_Entries = 256, const size_t p_BufferSize = 16384 );
+		~AsyncIo( );
+
+		// Public functions
+		void Poll( ); // Submits queued operations and collects the completed ones without blocking.
+		void Wait( const int p_Milliseconds ); // Blocks until an operation completes or the time passes (-1 = forever), returns at once if nothing is pending.
+		static void IdleCallback( const unsigned int p_Microseconds, void * p_pAsyncIo ); // Scheduler idle callback, waits for I/O or sleeps.
+
+		// General get functions
+		eIoBackend GetBackend( ) const;
+		size_t GetPendingCount( ) const;
+		const std::string & GetLastError( ) const;
+
+	private:
+
+		// Copy is not allowed
+		AsyncIo( const AsyncIo & p_AsyncIo );
+		AsyncIo & operator = ( const AsyncIo & p_AsyncIo );
+
+		// Operation states
+		enum eState
+		{
+			STATE_IDLE = 0,
+			STATE_PENDING = 1,
+			STATE_DONE = 2 // The result is not collected yet
+		};
+
+		// Open file, a task waits for it while its operation is pending.
+		// Only one operation is pending at a time, tasks sharing a file wait for each other.
+		struct File : public Waitable
+		{
+			bool IsReady( ) const;
+
+			AsyncIo * pIo; // NULL after the object was destroyed
+			File * pNext;
+			File * pPrevious;
+			int Descriptor;
+			bool Regular; // Regular files are not polled by epoll
+			bool Writing; // Kind of the pending operation
+			bool Registered; // Added to the epoll set
+			bool Released; // Collected by Lua while pending, deleted on completion
+			bool EndOfFile;
+			int State;
+			int Result; // Bytes or -errno
+			std::vector<char> Input;
+			size_t InputBegin;
+			size_t InputEnd;
+			std::vector<char> Output;
+			size_t OutputBegin;
+			size_t OutputEnd;
+		};
+
+		// Private functions
+		bool CreateUring( const unsigned int p_Entries );
+		void DestroyUring( );
+		bool CreateEpoll( );
+		File * AddFile( const int p_Descriptor );
+		void ReleaseFile( File * p_pFile );
+		void RemoveFile( File * p_pFile );
+		void AcquireBuffer( std::vector<char> & p_Buffer );
+		void ReleaseBuffer( std::vector<char> & p_Buffer );
+		void Submit( File * p_pFile, const bool p_Writing );
+		bool PushEntry( File * p_pFile, const unsigned char p_Operation );
+		void Perform( File * p_pFile );
+		void Complete( File * p_pFile, const int p_Result );
+		int Collect( File * p_pFile ); // Applies the result of a completed operation, returns 0 or -errno.
+		size_t Reap( );
+		void Enter( );
+		static File * CheckFile( lua_State * p_pState );
+		static void PushFile( lua_State * p_pState, File * p_pFile );
+		static int LuaOpen( lua_State * p_pState );
+		static int LuaPipe( lua_State * p_pState );
+		static int LuaBackend( lua_State * p_pState );
+		static int LuaRead( lua_State * p_pState );
+		static int LuaWrite( lua_State * p_pState );
+		static int LuaFlush( lua_State * p_pState );
+		static int LuaBlock( lua_State * p_pState );
+		static int LuaIsTask( lua_State * p_pState );
+		static int LuaClose( lua_State * p_pState );
+		static int LuaGarbageCollect( lua_State * p_pState );
+
+		// io_uring rings, mapped from the kernel
+		struct Uring
+		{
+			int Descriptor;
+			void * pSubmitRing;
+			size_t SubmitRingSize;
+			void * pCompleteRing;
+			size_t CompleteRingSize;
+			void * pEntries;
+			size_t EntriesSize;
+			unsigned int * pSubmitHead;
+			unsigned int * pSubmitTail;
+			unsigned int * pSubmitArray;
+			unsigned int SubmitMask;
+			unsigned int SubmitEntries;
+			unsigned int * pCompleteHead;
+			unsigned int * pCompleteTail;
+			void * pCompletions;
+			unsigned int CompleteMask;
+			unsigned int Unsubmitted;
+			unsigned int InFlight; // Entries whose completion is not reaped
+		};
+
+		// Private variables
+		Script & m_Script;
+		eIoBackend m_Backend;
+		Uring m_Uring;
+		int m_Epoll;
+		size_t m_BufferSize;
+		File * m_pFirstFile;
+		std::deque<File *> m_Backlog; // Waiting for a free submission entry
+		std::deque<File *> m_CancelBacklog; // Released files whose cancel is waiting for a free entry
+		std::vector<std::vector<char> > m_Buffers;
+		size_t m_PendingCount;
+		std::string m_ErrorMessage;
+
+	};
+
+}
+
+#endif
+
+#endif
@@ -0,0 +1,124 @@
+// ///////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2013 Jimmie Bergmann - jimmiebergmann@gmail.com
+//
+// This software is provided 'as-is', without any express or
+// implied warranty. In no event will the authors be held
+// liable for any damages arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute
+// it freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented;
+//    you must not claim that you wrote the original software.
+//    If you use this software in a product, an acknowledgment
+//    in the product documentation would be appreciated but
+//    is not required.
+//
+// 2. Altered source versions must be plainly marked as such,
+//    and must not be misrepresented as being the original software.
+//
+// 3. This notice may not be removed or altered from any
+//    source distribution.
+// ///////////////////////////////////////////////////////////////////////////
+
+// Packed bundles of Lua modules
+
+#ifndef LUA_W_BUNDLE_HPP
+#define LUA_W_BUNDLE_HPP
+
+#include <LuaW.hpp>
+#include <string>
+#include <vector>
+
+namespace LuaW
+{
+
+	class MappedFile;
+
+	// Indexed archive of modules, mapped from a file or used in place from memory.
+	// Installing the bundle adds a searcher to package.searchers, right after the preload searcher,
+	// so require resolves the modules with a hash lookup instead of probing package.path.
+	// The modules are precompiled chunks or source, the bytecode is not verified: only load trusted bundles.
+	// The bundle must outlive and stay loaded in every state it was installed in.
+	class Bundle
+	{
+
+	public:
+
+		// Constructor/destructor
+		Bundle( );
+		~Bundle( );
+
+		// Public functions
+		bool Load( const std::string & p_FileName ); // Maps the file
+		bool Load( const char * p_pData, const size_t p_Size ); // The memory is used in place, 8 byte aligned.
+		void Unload( );
+		bool Install( lua_State * p_pState ) const; // False if the package library is not open
+		bool FindModule( const char * p_pName, const size_t p_Length, const char *& p_pChunk, size_t & p_Size ) const;
+
+		// General get functions
+		bool IsLoaded( ) const;
+		size_t GetModuleCount( ) const;
+		const char * GetModuleName( const size_t p_Module, size_t & p_Length ) const;
+
+	private:
+
+		friend class BundleBuilder;
+
+		// Copy is not allowed
+		Bundle( const Bundle & p_Bundle );
+		Bundle & operator = ( const Bundle & p_Bundle );
+
+		// Block structures, defined in the source file.
+		struct Header;
+		struct Module;
+
+		// Private functions
+		static int Search( lua_State * p_pState );
+
+		// Private variables
+		MappedFile * m_pFile; // Mapping when loaded from a file
+		const Header * m_pHeader;
+		const Module * m_pModules;
+		const unsigned int * m_pBuckets;
+		const char * m_pChunks;
+
+	};
+
+
+	// Collects modules and writes them as a bundle.
+	class BundleBuilder
+	{
+
+	public:
+
+		// Constructor
+		BundleBuilder( );
+
+		// Public functions
+		void AddModule( const std::string & p_Name, const std::string & p_Chunk ); // Replaces a module with the same name
+		bool AddFile( const std::string & p_Name, const std::string & p_FileName, const bool p_Precompile );
+		bool Save( const std::string & p_FileName ) const;
+		void Clear( );
+
+		// General get functions
+		const std::string & GetLastError( ) const;
+		size_t GetModuleCount( ) const;
+
+	private:
+
+		// Copy is not allowed
+		BundleBuilder( const BundleBuilder & p_Builder );
+		BundleBuilder & operator = ( const BundleBuilder & p_Builder );
+
+		// Private variables
+		std::vector<std::string> m_Names;
+		std::vector<std::string> m_Chunks;
+		std::string m_LastError;
+
+	};
+
+}
+
+#endif
@@ -0,0 +1,120 @@
+// ///////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2013 Jimmie Bergmann - jimmiebergmann@gmail.com
+//
+// This software is provided 'as-is', without any express or
+// implied warranty. In no event will the authors be held
+// liable for any damages arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute
+// it freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented;
+//    you must not claim that you wrote the original software.
+//    If you use this software in a product, an acknowledgment
+//    in the product documentation would be appreciated but
+//    is not required.
+//
+// 2. Altered source versions must be plainly marked as such,
+//    and must not be misrepresented as being the original software.
+//
+// 3. This notice may not be removed or altered from any
+//    source distribution.
+// ///////////////////////////////////////////////////////////////////////////
+
+// Lock-free channels between Lua states
+
+#ifndef LUA_W_CHANNEL_HPP
+#define LUA_W_CHANNEL_HPP
+
+#include <LuaW/Scheduler.hpp>
+#include <atomic>
+#include <string>
+
+namespace LuaW
+{
+
+	// Bounded lock-free queue of serialized Lua values, any number of threads may send and receive.
+	// Values are encoded by the Serializer of the sending state, shared and cyclic tables are kept.
+	// The channel is shared by pointer, it must outlive every state it was pushed to.
+	//
+	// Lua methods of a pushed channel:
+	//   channel:try_send( value )  false if the channel is full
+	//   channel:try_recv( )        true and the value, or false if the channel is empty
+	//   channel:send( value )      waits for space when running as a scheduler task, else returns false if full
+	//   channel:recv( )            waits for a value when running as a scheduler task, else raises an error if empty
+	class Channel
+	{
+
+	public:
+
+		// Constructor/destructor
+		Channel( const size_t p_Capacity ); // Rounded up to a power of two
+		~Channel( );
+
+		// Public functions
+		bool TrySend( std::string & p_Message ); // Swaps the message in, false if full.
+		bool TryReceive( std::string & p_Message ); // Swaps the message out, false if empty.
+		bool TrySend( lua_State * p_pState, const int p_Index ); // Raises a Lua error if the value cannot be serialized.
+		bool TryReceive( lua_State * p_pState ); // Pushes the value if there is one.
+		void Push( lua_State * p_pState );
+
+		// General get functions
+		size_t GetCapacity( ) const;
+		bool IsEmpty( ) const; // Approximate if other threads are active
+		bool IsFull( ) const; // Approximate if other threads are active
+
+	private:
+
+		// Copy is not allowed
+		Channel( const Channel & p_Channel );
+		Channel & operator = ( const Channel & p_Channel );
+
+		// Waitables of the scheduler
+		struct ReadableWaitable : public Waitable
+		{
+			ReadableWaitable( const Channel & p_Channel ) : m_Channel( p_Channel ) { }
+			bool IsReady( ) const { return m_Channel.IsEmpty( ) == false; }
+			const Channel & m_Channel;
+		private:
+			ReadableWaitable & operator = ( const ReadableWaitable & p_Waitable );
+		};
+
+		struct WritableWaitable : public Waitable
+		{
+			WritableWaitable( const Channel & p_Channel ) : m_Channel( p_Channel ) { }
+			bool IsReady( ) const { return m_Channel.IsFull( ) == false; }
+			const Channel & m_Channel;
+		private:
+			WritableWaitable & operator = ( const WritableWaitable & p_Waitable );
+		};
+
+		// Ring buffer cell, the sequence tells if the cell is free or holds a message.
+		struct Cell
+		{
+			std::atomic<size_t> Sequence;
+			std::string Message;
+		};
+
+		// Private functions
+		static int LuaTrySend( lua_State * p_pState );
+		static int LuaTryReceive( lua_State * p_pState );
+		static int LuaWait( lua_State * p_pState );
+		static int LuaIsTask( lua_State * p_pState );
+
+		// Private variables
+		Cell * m_pCells;
+		size_t m_Mask;
+		char m_Padding0[ 64 ]; // Keep the positions on separate cache lines
+		std::atomic<size_t> m_SendPosition;
+		char m_Padding1[ 64 ];
+		std::atomic<size_t> m_ReceivePosition;
+		char m_Padding2[ 64 ];
+		ReadableWaitable m_Readable;
+		WritableWaitable m_Writable;
+
+	};
+
+}
+
+#endif
@@ -0,0 +1,146 @@
+// ///////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2013 Jimmie Bergmann - jimmiebergmann@gmail.com
+//
+// This software is provided 'as-is', without any express or
+// implied warranty. In no event will the authors be held
+// liable for any damages arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute
+// it freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented;
+//    you must not claim that you wrote the original software.
+//    If you use this software in a product, an acknowledgment
+//    in the product documentation would be appreciated but
+//    is not required.
+//
+// 2. Altered source versions must be plainly marked as such,
+//    and must not be misrepresented as being the original software.
+//
+// 3. This notice may not be removed or altered from any
+//    source distribution.
+// ///////////////////////////////////////////////////////////////////////////
+
+// Bridges the API differences between the Lua backends.
+// Lua 5.2 is the reference API, the shims are only defined for the other backends.
+
+#ifndef LUA_W_COMPAT_HPP
+#define LUA_W_COMPAT_HPP
+
+#include <lua.hpp>
+
+// LuaJIT, its lua.hpp includes luajit.h
+#if defined( LUAJIT_VERSION )
+
+#define LUAW_BACKEND_LUAJIT
+
+#ifndef LUA_OK
+#define LUA_OK 0
+#endif
+
+namespace LuaW
+{
+
+	// The shims live in the LuaW namespace, they never clash with the user's own compatibility code.
+	inline int lua_absindex( lua_State * p_pState, const int p_Index )
+	{
+		return ( p_Index > 0 || p_Index <= LUA_REGISTRYINDEX ) ? p_Index : lua_gettop( p_pState ) + p_Index + 1;
+	}
+
+#ifndef lua_rawlen
+	inline size_t lua_rawlen( lua_State * p_pState, const int p_Index )
+	{
+		return lua_objlen( p_pState, p_Index );
+	}
+#endif
+
+	inline void lua_rawgetp( lua_State * p_pState, const int p_Index, const void * p_pKey )
+	{
+		int Index = lua_absindex( p_pState, p_Index );
+		lua_pushlightuserdata( p_pState, const_cast<void *>( p_pKey ) );
+		lua_rawget( p_pState, Index );
+	}
+
+	inline void lua_rawsetp( lua_State * p_pState, const int p_Index, const void * p_pKey )
+	{
+		int Index = lua_absindex( p_pState, p_Index );
+		lua_pushlightuserdata( p_pState, const_cast<void *>( p_pKey ) );
+		lua_insert( p_pState, -2 );
+		lua_rawset( p_pState, Index );
+	}
+
+#ifndef lua_pushglobaltable
+	inline void lua_pushglobaltable( lua_State * p_pState )
+	{
+		lua_pushvalue( p_pState, LUA_GLOBALSINDEX );
+	}
+#endif
+
+	// Counts the yielded values as in Lua 5.4, the stack holds nothing else.
+	inline int lua_resume( lua_State * p_pState, lua_State * p_pFrom, const int p_Arguments, int * p_pResults )
+	{
+		int Error = ::lua_resume( p_pState, p_Arguments );
+		*p_pResults = lua_gettop( p_pState );
+		return Error;
+	}
+
+	inline void luaL_setfuncs( lua_State * p_pState, const luaL_Reg * p_pFunctions, const int p_Upvalues )
+	{
+		// Same as Lua 5.2, every function shares the upvalues below the table.
+		luaL_checkstack( p_pState, p_Upvalues, "too many upvalues" );
+		for( ; p_pFunctions->name != NULL; p_pFunctions++ )
+		{
+			for( int i = 0; i < p_Upvalues; i++ )
+			{
+				lua_pushvalue( p_pState, -p_Upvalues );
+			}
+			lua_pushcclosure( p_pState, p_pFunctions->func, p_Upvalues );
+			lua_setfield( p_pState, -( p_Upvalues + 2 ), p_pFunctions->name );
+		}
+		lua_pop( p_pState, p_Upvalues );
+	}
+
+	inline void luaL_setmetatable( lua_State * p_pState, const char * p_pName )
+	{
+		luaL_getmetatable( p_pState, p_pName );
+		lua_setmetatable( p_pState, -2 );
+	}
+
+}
+
+// Lua 5.4
+#elif LUA_VERSION_NUM >= 504
+
+#define LUAW_BACKEND_LUA54
+
+namespace LuaW
+{
+
+	// The debug information is kept, as in Lua 5.2.
+	inline int lua_dump( lua_State * p_pState, lua_Writer p_Writer, void * p_pData )
+	{
+		return ::lua_dump( p_pState, p_Writer, p_pData, 0 );
+	}
+
+}
+
+// Lua 5.2
+#else
+
+namespace LuaW
+{
+
+	// Counts the yielded values as in Lua 5.4, the stack holds nothing else.
+	inline int lua_resume( lua_State * p_pState, lua_State * p_pFrom, const int p_Arguments, int * p_pResults )
+	{
+		int Error = ::lua_resume( p_pState, p_pFrom, p_Arguments );
+		*p_pResults = lua_gettop( p_pState );
+		return Error;
+	}
+
+}
+
+#endif
+
+#endif
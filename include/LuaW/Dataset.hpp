@@ -0,0 +1,185 @@
+// ///////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2013 Jimmie Bergmann - jimmiebergmann@gmail.com
+//
+// This software is provided 'as-is', without any express or
+// implied warranty. In no event will the authors be held
+// liable for any damages arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute
+// it freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented;
+//    you must not claim that you wrote the original software.
+//    If you use this software in a product, an acknowledgment
+//    in the product documentation would be appreciated but
+//    is not required.
+//
+// 2. Altered source versions must be plainly marked as such,
+//    and must not be misrepresented as being the original software.
+//
+// 3. This notice may not be removed or altered from any
+//    source distribution.
+// ///////////////////////////////////////////////////////////////////////////
+
+// Shared read-only datasets
+
+#ifndef LUA_W_DATASET_HPP
+#define LUA_W_DATASET_HPP
+
+#include <LuaW.hpp>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace LuaW
+{
+
+	class MappedFile;
+
+	// Column types
+	enum eColumnType
+	{
+		COLUMN_BOOLEAN = 0,
+		COLUMN_INTEGER = 1, // 64 bit
+		COLUMN_NUMBER = 2, // double
+		COLUMN_STRING = 3
+	};
+
+
+	// Immutable table of rows with a string key and typed columns, stored in a single block of memory.
+	// The block is either built in memory or mapped from a file, so the pages are shared with every
+	// process mapping the same file. Any number of states on any threads may read the same dataset,
+	// each state gets proxies reading straight from the block instead of a copy in Lua tables.
+	// The dataset must outlive and stay loaded in every state it was pushed to.
+	// Rows read before the dataset was loaded or built again raise an error when accessed.
+	// Files are written in the byte order of the host.
+	//
+	// Lua access of a pushed dataset:
+	//   dataset[ key ]       row proxy, or nil if there is no such key
+	//   dataset[ n ]         row proxy of the n:th row
+	//   #dataset             number of rows
+	//   pairs( dataset )     key and row proxy of every row
+	//   row.column           value of the column, or nil if there is no such column
+	//   pairs( row )         name and value of every column
+	class Dataset
+	{
+
+	public:
+
+		// Constructor/destructor
+		Dataset( );
+		~Dataset( );
+
+		// Public functions
+		bool Load( const std::string & p_FileName ); // Maps the file
+		void Unload( );
+		void Push( lua_State * p_pState ) const;
+		bool FindRow( const char * p_pKey, const size_t p_Length, size_t & p_Row ) const;
+
+		// General get functions
+		bool IsLoaded( ) const;
+		size_t GetRowCount( ) const;
+		size_t GetColumnCount( ) const;
+		const char * GetKey( const size_t p_Row, size_t & p_Length ) const;
+		const char * GetColumnName( const size_t p_Column, size_t & p_Length ) const;
+		bool FindColumn( const char * p_pName, size_t & p_Column ) const;
+		eColumnType GetColumnType( const size_t p_Column ) const;
+		bool GetBoolean( const size_t p_Row, const size_t p_Column ) const;
+		long long GetInteger( const size_t p_Row, const size_t p_Column ) const;
+		double GetNumber( const size_t p_Row, const size_t p_Column ) const;
+		const char * GetString( const size_t p_Row, const size_t p_Column, size_t & p_Length ) const;
+
+	private:
+
+		friend class DatasetBuilder;
+
+		// Copy is not allowed
+		Dataset( const Dataset & p_Dataset );
+		Dataset & operator = ( const Dataset & p_Dataset );
+
+		// Block structures, defined in the source file.
+		struct Header;
+		struct Column;
+		struct String;
+
+		// Private functions
+		bool Attach( const char * p_pData, const size_t p_Size );
+		const char * GetPoolString( const String & p_String, size_t & p_Length ) const;
+		void PushRow( lua_State * p_pState, const size_t p_Row ) const;
+		void PushRowTable( lua_State * p_pState ) const;
+		void PushValue( lua_State * p_pState, const size_t p_Row, const size_t p_Column ) const;
+		static int Index( lua_State * p_pState );
+		static int Length( lua_State * p_pState );
+		static int Pairs( lua_State * p_pState );
+		static int Next( lua_State * p_pState );
+		static const void * CheckRow( lua_State * p_pState );
+		static int RowIndex( lua_State * p_pState );
+		static int RowPairs( lua_State * p_pState );
+		static int RowNext( lua_State * p_pState );
+
+		// Private variables
+		const char * m_pData;
+		size_t m_Size;
+		unsigned long long * m_pBuffer; // Owned block when built in memory
+		MappedFile * m_pFile; // Mapping when loaded from a file
+		const Header * m_pHeader;
+		const String * m_pKeys;
+		const unsigned int * m_pBuckets;
+		const Column * m_pColumns;
+		const char * m_pStrings;
+		unsigned long long m_Generation; // Changes on every load, 0 when unloaded
+
+	};
+
+
+	// Collects rows and writes them as a dataset block.
+	class DatasetBuilder
+	{
+
+	public:
+
+		// Constructor
+		DatasetBuilder( );
+
+		// Public functions
+		size_t AddColumn( const std::string & p_Name, const eColumnType p_Type ); // Returns the column number
+		size_t AddRow( const std::string & p_Key ); // Returns the row number, an existing key returns its row.
+		void SetBoolean( const size_t p_Row, const size_t p_Column, const bool p_Value );
+		void SetInteger( const size_t p_Row, const size_t p_Column, const long long p_Value );
+		void SetNumber( const size_t p_Row, const size_t p_Column, const double p_Value );
+		void SetString( const size_t p_Row, const size_t p_Column, const std::string & p_Value );
+		bool Build( Dataset & p_Dataset ) const; // Replaces the content of the dataset
+		bool Save( const std::string & p_FileName ) const;
+		void Clear( );
+
+	private:
+
+		// Copy is not allowed
+		DatasetBuilder( const DatasetBuilder & p_Builder );
+		DatasetBuilder & operator = ( const DatasetBuilder & p_Builder );
+
+		// Column values, only the vector of the column type is used.
+		struct ColumnData
+		{
+			std::string Name;
+			eColumnType Type;
+			std::vector<long long> Integers; // Booleans and integers
+			std::vector<double> Numbers;
+			std::vector<std::string> Strings;
+		};
+
+		// Private functions
+		unsigned long long * CreateBlock( size_t & p_Size ) const; // NULL if the strings exceed 4 GB
+		static bool AddString( std::string & p_Pool, const std::string & p_String, unsigned int & p_Offset, unsigned int & p_Length );
+
+		// Private variables
+		std::vector<std::string> m_Keys;
+		std::unordered_map<std::string, size_t> m_Rows;
+		std::vector<ColumnData> m_Columns;
+
+	};
+
+}
+
+#endif
@@ -0,0 +1,73 @@
+// ///////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2013 Jimmie Bergmann - jimmiebergmann@gmail.com
+//
+// This software is provided 'as-is', without any express or
+// implied warranty. In no event will the authors be held
+// liable for any damages arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute
+// it freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented;
+//    you must not claim that you wrote the original software.
+//    If you use this software in a product, an acknowledgment
+//    in the product documentation would be appreciated but
+//    is not required.
+//
+// 2. Altered source versions must be plainly marked as such,
+//    and must not be misrepresented as being the original software.
+//
+// 3. This notice may not be removed or altered from any
+//    source distribution.
+// ///////////////////////////////////////////////////////////////////////////
+
+// Scripts compiled into the binary
+
+#ifndef LUA_W_EMBEDDED_HPP
+#define LUA_W_EMBEDDED_HPP
+
+#include <cstddef>
+
+namespace LuaW
+{
+
+	// Chunk of an embedded script, usually stripped bytecode.
+	struct EmbeddedScript
+	{
+		const char * pName;
+		const unsigned char * pChunk;
+		size_t Size;
+	};
+
+
+	// Group of embedded scripts. The sources generated by luaw-embed define one each,
+	// it registers itself during static initialization and is never removed.
+	// Script::RunEmbedded runs the scripts by name.
+	class EmbeddedScripts
+	{
+
+	public:
+
+		// Constructor, the scripts are not copied.
+		EmbeddedScripts( const EmbeddedScript * p_pScripts, const size_t p_Count );
+
+		// Static functions
+		static const EmbeddedScript * Find( const char * p_pName ); // NULL if not embedded
+
+	private:
+
+		// Copy is not allowed
+		EmbeddedScripts( const EmbeddedScripts & p_Scripts );
+		EmbeddedScripts & operator = ( const EmbeddedScripts & p_Scripts );
+
+		// Private variables
+		const EmbeddedScript * m_pScripts;
+		size_t m_Count;
+		const EmbeddedScripts * m_pNext;
+
+	};
+
+}
+
+#endif
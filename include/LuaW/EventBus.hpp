@@ -0,0 +1,132 @@
+// ///////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2013 Jimmie Bergmann - jimmiebergmann@gmail.com
+//
+// This software is provided 'as-is', without any express or
+// implied warranty. In no event will the authors be held
+// liable for any damages arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute
+// it freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented;
+//    you must not claim that you wrote the original software.
+//    If you use this software in a product, an acknowledgment
+//    in the product documentation would be appreciated but
+//    is not required.
+//
+// 2. Altered source versions must be plainly marked as such,
+//    and must not be misrepresented as being the original software.
+//
+// 3. This notice may not be removed or altered from any
+//    source distribution.
+// ///////////////////////////////////////////////////////////////////////////
+
+// Event dispatch from C++ into Lua handlers
+
+#ifndef LUA_W_EVENT_BUS_HPP
+#define LUA_W_EVENT_BUS_HPP
+
+#include <LuaW.hpp>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace LuaW
+{
+
+	// Queues events emitted by C++ and calls the Lua handlers of each event type in batches.
+	// The handlers of a type are kept as registry references in a contiguous array,
+	// dispatching an event costs no name lookups, only the handler calls.
+	// Creating the bus adds the global "events" table to the script:
+	//   events.on( name, handler )   adds a handler, returns it
+	//   events.off( name, handler )  removes a handler, true if it was found
+	// The bus must be destroyed before the script is unloaded.
+	class EventBus
+	{
+
+	public:
+
+		// Constructor/destructor
+		EventBus( Script & p_Script );
+		~EventBus( );
+
+		// Public functions
+		unsigned int GetEventType( const char * p_pName ); // Creates the type, also created by events.on.
+		void Emit( const unsigned int p_Type ); // Queues an event, the push functions add arguments to it.
+		void PushBoolean( const bool p_Boolean );
+		void PushInteger( const long long p_Integer );
+		void PushNumber( const lua_Number p_Number );
+		void PushString( const char * p_pString, const size_t p_Length );
+		void PushString( const std::string & p_String );
+		eError Dispatch( ); // Handler errors do not stop the batch, the first error is returned.
+
+		// General get functions
+		size_t GetQueuedEvents( ) const;
+		size_t GetHandlerCount( const unsigned int p_Type ) const;
+
+	private:
+
+		// Copy is not allowed
+		EventBus( const EventBus & p_Bus );
+		EventBus & operator = ( const EventBus & p_Bus );
+
+		// Argument types
+		enum eArgument
+		{
+			ARGUMENT_BOOLEAN = 0,
+			ARGUMENT_INTEGER = 1,
+			ARGUMENT_NUMBER = 2,
+			ARGUMENT_STRING = 3
+		};
+
+		// Queued argument, strings are stored in the string buffer of the queue.
+		struct Argument
+		{
+			unsigned int Type;
+			unsigned int Length;
+			union
+			{
+				bool Boolean;
+				long long Integer;
+				lua_Number Number;
+				size_t Offset;
+			};
+		};
+
+		// Queued event
+		struct Event
+		{
+			unsigned int Type;
+			unsigned int FirstArgument;
+			unsigned int ArgumentCount;
+		};
+
+		// Event queue, two of them are swapped by each dispatch.
+		struct Queue
+		{
+			std::vector<Event> Events;
+			std::vector<Argument> Arguments;
+			std::string Strings;
+		};
+
+		// Private functions
+		void PushArgument( const Argument & p_Argument );
+		void PushArgument( lua_State * p_pState, const Argument & p_Argument, const std::string & p_Strings ) const;
+		static int LuaOn( lua_State * p_pState );
+		static int LuaOff( lua_State * p_pState );
+
+		// Private variables
+		Script & m_Script;
+		std::unordered_map<std::string, unsigned int> m_Types;
+		std::vector<std::vector<int> > m_Handlers; // Registry references, indexed by the event type.
+		Queue m_Queue;
+		Queue m_Dispatched;
+		bool m_Dispatching;
+		bool m_Removed; // Handlers were removed while dispatching
+
+	};
+
+}
+
+#endif
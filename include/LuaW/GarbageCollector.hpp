@@ -0,0 +1,132 @@
+// ///////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2013 Jimmie Bergmann - jimmiebergmann@gmail.com
+//
+// This software is provided 'as-is', without any express or
+// implied warranty. In no event will the authors be held
+// liable for any damages arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute
+// it freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented;
+//    you must not claim that you wrote the original software.
+//    If you use this software in a product, an acknowledgment
+//    in the product documentation would be appreciated but
+//    is not required.
+//
+// 2. Altered source versions must be plainly marked as such,
+//    and must not be misrepresented as being the original software.
+//
+// 3. This notice may not be removed or altered from any
+//    source distribution.
+// ///////////////////////////////////////////////////////////////////////////
+
+// Garbage collector telemetry
+
+#ifndef LUA_W_GARBAGE_COLLECTOR_HPP
+#define LUA_W_GARBAGE_COLLECTOR_HPP
+
+#include <lua.hpp>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+namespace LuaW
+{
+
+	// Snapshot of the collector statistics, times are in nanoseconds.
+	// Pauses are estimated from the bursts of frees made by the sweep of each step, a gap of a few
+	// microseconds between two frees ends a burst. The allocator never sees the mark phase, so the
+	// pauses only cover sweeping and are a lower bound of the real collector latency.
+	struct GarbageCollectorStats
+	{
+		size_t HeapBytes;
+		size_t PeakHeapBytes;
+		unsigned long long Cycles;
+		unsigned long long BytesFreedLastCycle;
+		unsigned long long TotalBytesFreed;
+		unsigned long long LastCyclePause; // Longest sweep step of the last cycle
+		unsigned long long MaxPause;
+		unsigned long long TotalPause;
+	};
+
+
+	// Heap size at the end of a cycle
+	struct GarbageCollectorSample
+	{
+		long long Time; // Nanoseconds, steady clock
+		size_t HeapBytes;
+	};
+
+
+	// Typedefs
+	typedef void ( * GarbageCollectorCallback )( const GarbageCollectorStats & p_Stats, void * p_pUserData );
+
+
+	// Wraps the allocator of a state and tracks every collector cycle with a finalized sentinel.
+	// Only the Lua thread writes, any thread may read the statistics.
+	class GarbageCollectorTelemetry
+	{
+
+	public:
+
+		// Constructor/destructor
+		GarbageCollectorTelemetry( lua_State * p_pState );
+		~GarbageCollectorTelemetry( ); // Restores the allocator, the state must still be open.
+
+		// Public functions
+		void SetCallback( GarbageCollectorCallback p_Callback, void * p_pUserData ); // Called at the end of every cycle, Lua thread.
+		GarbageCollectorStats GetStats( ) const;
+		void GetHistory( std::vector<GarbageCollectorSample> & p_Samples ) const; // Oldest sample first
+
+	private:
+
+		// Copy is not allowed
+		GarbageCollectorTelemetry( const GarbageCollectorTelemetry & p_Telemetry );
+		GarbageCollectorTelemetry & operator = ( const GarbageCollectorTelemetry & p_Telemetry );
+
+		enum { HistorySize = 256 };
+
+		// Private functions
+		void CreateSentinel( lua_State * p_pState );
+		void EndBurst( );
+		void EndCycle( lua_State * p_pState );
+		static void * Allocate( void * p_pUserData, void * p_pPointer, size_t p_OldSize, size_t p_NewSize );
+		static int SentinelFinalizer( lua_State * p_pState );
+
+		// Private variables
+		lua_State * m_pState;
+		lua_Alloc m_Allocator;
+		void * m_pAllocatorData;
+		GarbageCollectorTelemetry ** m_ppSentinel; // Pointer stored in the pending sentinel
+		GarbageCollectorCallback m_Callback;
+		void * m_pCallbackData;
+
+		// Statistics
+		std::atomic<size_t> m_HeapBytes;
+		std::atomic<size_t> m_PeakHeapBytes;
+		std::atomic<unsigned long long> m_Cycles;
+		std::atomic<unsigned long long> m_BytesFreedLastCycle;
+		std::atomic<unsigned long long> m_TotalBytesFreed;
+		std::atomic<unsigned long long> m_LastCyclePause;
+		std::atomic<unsigned long long> m_MaxPause;
+		std::atomic<unsigned long long> m_TotalPause;
+
+		// Current cycle and burst of frees, Lua thread only.
+		unsigned long long m_CycleFreedStart;
+		unsigned long long m_CyclePause;
+		bool m_InBurst;
+		long long m_BurstStart;
+		long long m_BurstEnd; // Last free of the burst
+
+		// History ring
+		std::vector<GarbageCollectorSample> m_History;
+		size_t m_HistoryCount;
+		mutable std::mutex m_HistoryMutex;
+
+	};
+
+}
+
+#endif
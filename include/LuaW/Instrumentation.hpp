@@ -0,0 +1,156 @@
+// ///////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2013 Jimmie Bergmann - jimmiebergmann@gmail.com
+//
+// This software is provided 'as-is', without any express or
+// implied warranty. In no event will the authors be held
+// liable for any damages arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute
+// it freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented;
+//    you must not claim that you wrote the original software.
+//    If you use this software in a product, an acknowledgment
+//    in the product documentation would be appreciated but
+//    is not required.
+//
+// 2. Altered source versions must be plainly marked as such,
+//    and must not be misrepresented as being the original software.
+//
+// 3. This notice may not be removed or altered from any
+//    source distribution.
+// ///////////////////////////////////////////////////////////////////////////
+
+// Call counters and latency histograms of bindings
+
+#ifndef LUA_W_INSTRUMENTATION_HPP
+#define LUA_W_INSTRUMENTATION_HPP
+
+#include <lua.hpp>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace LuaW
+{
+
+	// Fixed memory log-linear histogram, HDR style.
+	// Each power of two is split into 8 buckets, the relative error is at most 12.5%.
+	// Only one thread may record, any thread may read.
+	class Histogram
+	{
+
+	public:
+
+		// Constructor
+		Histogram( );
+
+		// Public functions
+		void Record( const unsigned long long p_Value );
+		void Merge( const Histogram & p_Histogram ); // Adds the values of another histogram
+		void Reset( );
+
+		// General get functions
+		unsigned long long GetCount( ) const;
+		unsigned long long GetMax( ) const;
+		unsigned long long GetPercentile( const double p_Percentile ) const; // 0 - 100
+
+	private:
+
+		// Copy is not allowed
+		Histogram( const Histogram & p_Histogram );
+		Histogram & operator = ( const Histogram & p_Histogram );
+
+		enum { BucketCount = 496 };
+
+		// Private functions
+		static unsigned int GetBucketIndex( const unsigned long long p_Value );
+		static unsigned long long GetBucketValue( const unsigned int p_Index ); // Highest value of the bucket
+
+		// Private variables
+		std::atomic<unsigned long long> m_Buckets[ BucketCount ];
+		std::atomic<unsigned long long> m_Count;
+		std::atomic<unsigned long long> m_Max;
+
+	};
+
+
+	// Statistics of a single binding, latencies are in nanoseconds.
+	// The latency only covers calls that returned, the difference to the call count are the errors.
+	struct BindingStats
+	{
+		BindingStats( const std::string & p_Name ) :
+			Name( p_Name ),
+			Calls( 0 )
+		{ }
+
+		unsigned long long GetErrorCount( ) const
+		{
+			unsigned long long Count = Calls.load( std::memory_order_relaxed );
+			unsigned long long Returned = Latency.GetCount( );
+			return Count > Returned ? Count - Returned : 0;
+		}
+
+		const std::string Name;
+		std::atomic<unsigned long long> Calls;
+		Histogram Latency;
+
+	private:
+
+		// Copy is not allowed
+		BindingStats( const BindingStats & p_Stats );
+		BindingStats & operator = ( const BindingStats & p_Stats );
+	};
+
+
+	// Statistics of all instrumented C functions and Call targets of a script.
+	class Instrumentation
+	{
+
+	public:
+
+		// Constructor/destructor
+		Instrumentation( );
+		~Instrumentation( );
+
+		// Public functions
+		void SetEnabled( const bool p_Enabled );
+		bool IsEnabled( ) const;
+		void GetBindings( std::vector<const BindingStats *> & p_Bindings ) const; // Thread safe
+
+		// Pushes a closure recording the statistics of the C function, Lua thread only.
+		void PushFunction( lua_State * p_pState, const char * p_pName, lua_CFunction p_Function );
+
+		// Gets the statistics of the function at the stack, Lua thread only.
+		// Lua functions are told apart by where they are defined, closures of one function share the statistics.
+		BindingStats * GetCallTarget( lua_State * p_pState, const int p_Index );
+
+	private:
+
+		// Copy is not allowed
+		Instrumentation( const Instrumentation & p_Instrumentation );
+		Instrumentation & operator = ( const Instrumentation & p_Instrumentation );
+
+		// Private functions
+		BindingStats * AddBinding( const std::string & p_Name );
+		static int InstrumentedFunction( lua_State * p_pState );
+
+		// Call target key, the short source and line of Lua functions or the address of C functions.
+		typedef std::pair<std::string, std::pair<const void *, int> > CallTargetKey;
+
+		// Private variables
+		bool m_Enabled;
+		std::vector<BindingStats *> m_Bindings;
+		std::map<CallTargetKey, BindingStats *> m_CallTargets; // Lua thread only
+		CallTargetKey m_CallTargetKey; // Reused by the lookups
+		BindingStats * m_pOtherCallTargets; // Targets beyond the limit
+		mutable std::mutex m_Mutex;
+
+	};
+
+}
+
+#endif
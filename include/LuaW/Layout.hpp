@@ -0,0 +1,119 @@
+// ///////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2013 Jimmie Bergmann - jimmiebergmann@gmail.com
+//
+// This software is provided 'as-is', without any express or
+// implied warranty. In no event will the authors be held
+// liable for any damages arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute
+// it freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented;
+//    you must not claim that you wrote the original software.
+//    If you use this software in a product, an acknowledgment
+//    in the product documentation would be appreciated but
+//    is not required.
+//
+// 2. Altered source versions must be plainly marked as such,
+//    and must not be misrepresented as being the original software.
+//
+// 3. This notice may not be removed or altered from any
+//    source distribution.
+// ///////////////////////////////////////////////////////////////////////////
+
+// Direct field access to C++ structs through layout descriptors
+
+#ifndef LUA_W_LAYOUT_HPP
+#define LUA_W_LAYOUT_HPP
+
+#include <LuaW.hpp>
+#include <cstddef>
+
+// Field descriptor of a member, the Lua name is given separately to allow prefixed member names.
+#define LUAW_FIELD( p_pName, p_Class, p_Member, p_Type ) \
+	{ p_pName, offsetof( p_Class, p_Member ), p_Type, NULL, false }
+#define LUAW_READ_ONLY_FIELD( p_pName, p_Class, p_Member, p_Type ) \
+	{ p_pName, offsetof( p_Class, p_Member ), p_Type, NULL, true }
+#define LUAW_STRUCT_FIELD( p_pName, p_Class, p_Member, p_pLayout ) \
+	{ p_pName, offsetof( p_Class, p_Member ), LuaW::FIELD_STRUCT, p_pLayout, true }
+
+namespace LuaW
+{
+
+	// Field types
+	enum eFieldType
+	{
+		FIELD_BOOLEAN = 0, // bool
+		FIELD_INT = 1, // int
+		FIELD_UNSIGNED_INT = 2, // unsigned int
+		FIELD_LONG_LONG = 3, // long long
+		FIELD_FLOAT = 4, // float
+		FIELD_DOUBLE = 5, // double
+		FIELD_STRING = 6, // std::string
+		FIELD_STRUCT = 7 // Nested struct, described by its own layout. Read only, the proxy refers to the member.
+	};
+
+	class Layout;
+
+	// Describes a single field of a struct.
+	struct FieldDescriptor
+	{
+		const char * pName;
+		size_t Offset;
+		eFieldType Type;
+		const Layout * pLayout; // FIELD_STRUCT only
+		bool ReadOnly;
+	};
+
+
+	// Compile time layout of a struct. Proxies of the struct read and write the memory directly,
+	// a field access costs a single C function call without any allocations. Reading a nested struct
+	// or an array element creates a new proxy userdata, keep it in a local when it is used repeatedly.
+	// The proxies hold raw pointers, the objects must outlive them.
+	class Layout
+	{
+
+	public:
+
+		// Constructor, the fields are not copied.
+		Layout( const char * p_pName, const size_t p_Size, const FieldDescriptor * p_pFields, const unsigned int p_FieldCount );
+
+		// Public functions
+		void Push( lua_State * p_pState, void * p_pObject ) const; // Proxy of a single object
+		void PushArray( lua_State * p_pState, void * p_pObjects, const size_t p_Count ) const; // Proxy of a contiguous array, indexed from 1.
+		void * ToObject( lua_State * p_pState, const int p_Index ) const; // NULL if not a proxy of this layout
+
+		// General get functions
+		const char * GetName( ) const;
+		size_t GetSize( ) const;
+		const FieldDescriptor * GetFields( ) const;
+		unsigned int GetFieldCount( ) const;
+
+	private:
+
+		// Copy is not allowed
+		Layout( const Layout & p_Layout );
+		Layout & operator = ( const Layout & p_Layout );
+
+		// Private functions
+		void PushMetatable( lua_State * p_pState ) const;
+		void PushArrayMetatable( lua_State * p_pState ) const;
+		static int Index( lua_State * p_pState );
+		static int NewIndex( lua_State * p_pState );
+		static int ArrayIndex( lua_State * p_pState );
+		static int ArrayLength( lua_State * p_pState );
+		static void * CheckProxy( lua_State * p_pState, const void * p_pKey, const char * p_pName ); // Argument 1
+
+		// Private variables
+		const char * m_pName;
+		size_t m_Size;
+		const FieldDescriptor * m_pFields;
+		unsigned int m_FieldCount;
+		char m_ArrayKey; // The address is the registry key of the array metatable.
+
+	};
+
+}
+
+#endif
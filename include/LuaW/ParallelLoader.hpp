@@ -0,0 +1,95 @@
+// ///////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2013 Jimmie Bergmann - jimmiebergmann@gmail.com
+//
+// This software is provided 'as-is', without any express or
+// implied warranty. In no event will the authors be held
+// liable for any damages arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute
+// it freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented;
+//    you must not claim that you wrote the original software.
+//    If you use this software in a product, an acknowledgment
+//    in the product documentation would be appreciated but
+//    is not required.
+//
+// 2. Altered source versions must be plainly marked as such,
+//    and must not be misrepresented as being the original software.
+//
+// 3. This notice may not be removed or altered from any
+//    source distribution.
+// ///////////////////////////////////////////////////////////////////////////
+
+// Parallel compilation of scripts
+
+#ifndef LUA_W_PARALLEL_LOADER_HPP
+#define LUA_W_PARALLEL_LOADER_HPP
+
+#include <LuaW.hpp>
+#include <atomic>
+#include <string>
+#include <vector>
+
+namespace LuaW
+{
+
+	// Compiles a set of files concurrently and runs them in a script in dependency order.
+	// Every worker thread parses with its own scratch state and keeps the bytecode,
+	// running a file then only loads the prototypes in the target state.
+	// Usage:
+	//   size_t Base = Loader.AddFile( "Base.lua" );
+	//   size_t Game = Loader.AddFile( "Game.lua" );
+	//   Loader.AddDependency( Game, Base );
+	//   if( Loader.Compile( ) ) Loader.Run( Script );
+	class ParallelLoader
+	{
+
+	public:
+
+		// Constructor
+		ParallelLoader( const unsigned int p_Threads ); // 0 = one per hardware thread
+
+		// Public functions
+		size_t AddFile( const std::string & p_FileName ); // Returns the file number, files run in the order added.
+		bool AddDependency( const size_t p_File, const size_t p_Dependency ); // The file runs after the dependency, false if either is not a file number.
+		bool Compile( ); // False if any file failed, the errors of every file are collected.
+		eError Run( Script & p_Script ); // Stops at the first error, see Script::GetLastError.
+		void Clear( );
+
+		// General get functions
+		const std::string & GetLastError( ) const; // Compilation or dependency errors
+		size_t GetFileCount( ) const;
+
+	private:
+
+		// Copy is not allowed
+		ParallelLoader( const ParallelLoader & p_Loader );
+		ParallelLoader & operator = ( const ParallelLoader & p_Loader );
+
+		// Compiled file
+		struct File
+		{
+			std::string FileName;
+			std::string Chunk; // Bytecode
+			std::string Error;
+			std::vector<size_t> Dependencies;
+		};
+
+		// Private functions
+		void CompileFiles( );
+		bool SortFile( const size_t p_File, std::vector<unsigned char> & p_States, std::vector<size_t> & p_Order );
+
+		// Private variables
+		unsigned int m_Threads;
+		std::vector<File> m_Files;
+		std::atomic<size_t> m_NextFile; // Next file to compile, shared by the workers.
+		bool m_Compiled;
+		std::string m_LastError;
+
+	};
+
+}
+
+#endif
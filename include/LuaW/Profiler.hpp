@@ -0,0 +1,114 @@
+// ///////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2013 Jimmie Bergmann - jimmiebergmann@gmail.com
+//
+// This software is provided 'as-is', without any express or
+// implied warranty. In no event will the authors be held
+// liable for any damages arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute
+// it freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented;
+//    you must not claim that you wrote the original software.
+//    If you use this software in a product, an acknowledgment
+//    in the product documentation would be appreciated but
+//    is not required.
+//
+// 2. Altered source versions must be plainly marked as such,
+//    and must not be misrepresented as being the original software.
+//
+// 3. This notice may not be removed or altered from any
+//    source distribution.
+// ///////////////////////////////////////////////////////////////////////////
+
+// Sampling profiler for Lua code
+
+#ifndef LUA_W_PROFILER_HPP
+#define LUA_W_PROFILER_HPP
+
+#include <LuaW.hpp>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace LuaW
+{
+
+	// Samples the Lua call stack from the count hook of the script.
+	// Samples are written to a lock-free ring buffer by the Lua thread,
+	// any thread may start/stop the profiler and export the folded stacks.
+	// Stop waits for a sample in progress, the profiler may be destroyed once it returns.
+	class Profiler
+	{
+
+	public:
+
+		// Constructor/destructor
+		Profiler( Script & p_Script );
+		~Profiler( );
+
+		// Public functions
+		bool Start( const unsigned int p_Microseconds = 1000 ); // Sample period, thread safe
+		void Stop( ); // Thread safe
+		void Reset( );
+		void WriteFolded( std::ostream & p_Stream ); // Flamegraph compatible "a;b;c count" lines
+
+		// General get functions
+		bool IsRunning( ) const;
+		unsigned int GetSampleCount( );
+		unsigned int GetDroppedSampleCount( ) const;
+
+	private:
+
+		// Friend classes
+		friend class Script;
+
+		// Copy is not allowed
+		Profiler( const Profiler & p_Profiler );
+		Profiler & operator = ( const Profiler & p_Profiler );
+
+		// Stack sample structure
+		enum { MaxDepth = 32, BufferSize = 4096 };
+		struct StackSample
+		{
+			unsigned int Depth;
+			unsigned int Frames[ MaxDepth ]; // Innermost frame first
+		};
+
+		// Private functions
+		void TakeSample( lua_State * p_pState ); // Called by the hook, Lua thread only
+		unsigned int GetFrameId( lua_State * p_pState, lua_Debug & p_Debug );
+		void Drain( );
+
+		// Private variables
+		Script & m_Script;
+		std::atomic<long long> m_Period; // Nanoseconds
+		long long m_NextSample; // Lua thread only
+
+		// Ring buffer
+		std::vector<StackSample> m_Buffer;
+		std::atomic<unsigned int> m_Head; // Written by the Lua thread
+		std::atomic<unsigned int> m_Tail; // Written by the reader
+		std::atomic<unsigned int> m_Dropped;
+
+		// Frames, the ids are only touched by the Lua thread.
+		// Lua functions are keyed by the short source and line, the address of a collected chunk is reused.
+		typedef std::pair<std::string, std::pair<const void *, int> > FrameKey;
+		std::map<FrameKey, unsigned int> m_FrameIds;
+		FrameKey m_FrameKey; // Reused by the lookups
+		std::vector<std::string> m_FrameNames;
+		std::mutex m_FrameMutex;
+
+		// Aggregated stacks, root frame first.
+		std::map<std::vector<unsigned int>, unsigned int> m_Stacks;
+		std::mutex m_StackMutex;
+
+	};
+
+}
+
+#endif
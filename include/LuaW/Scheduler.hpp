@@ -0,0 +1,117 @@
+// ///////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2013 Jimmie Bergmann - jimmiebergmann@gmail.com
+//
+// This software is provided 'as-is', without any express or
+// implied warranty. In no event will the authors be held
+// liable for any damages arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute
+// it freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented;
+//    you must not claim that you wrote the original software.
+//    If you use this software in a product, an acknowledgment
+//    in the product documentation would be appreciated but
+//    is not required.
+//
+// 2. Altered source versions must be plainly marked as such,
+//    and must not be misrepresented as being the original software.
+//
+// 3. This notice may not be removed or altered from any
+//    source distribution.
+// ///////////////////////////////////////////////////////////////////////////
+
+// Time-sliced scheduler of Lua coroutines
+
+#ifndef LUA_W_SCHEDULER_HPP
+#define LUA_W_SCHEDULER_HPP
+
+#include <LuaW.hpp>
+#include <deque>
+#include <string>
+
+namespace LuaW
+{
+
+	// Something a task can wait for, see Scheduler::GetWaitKey.
+	class Waitable
+	{
+
+	public:
+
+		// Destructor
+		virtual ~Waitable( ) { }
+
+		// Public functions
+		virtual bool IsReady( ) const = 0; // May be called often, keep it cheap.
+
+	};
+
+
+	// Called by Scheduler::Run while every task waits, instead of sleeping for the given time.
+	typedef void ( * SchedulerIdleCallback )( const unsigned int p_Microseconds, void * p_pUserData );
+
+
+	// Runs many Lua tasks on one OS thread.
+	// Every task is a coroutine, it runs until it yields, finishes or its time slice is used.
+	// A task with weight N gets a time slice N times longer than a task with weight 1.
+	// A task waits by yielding the wait key and a Waitable as light userdata, it is not resumed until the waitable is ready.
+	class Scheduler
+	{
+
+	public:
+
+		// Constructor/destructor
+		Scheduler( Script & p_Script );
+		~Scheduler( );
+
+		// Public functions
+		void SetTimeSlice( const unsigned int p_Microseconds ); // 0 = cooperative only
+		void SetIdleCallback( SchedulerIdleCallback p_Callback, void * p_pUserData ); // NULL = sleep, see AsyncIo::IdleCallback.
+		eError Spawn( const int p_Arguments, const unsigned int p_Weight = 1 ); // Function and arguments at the stack
+		eError Step( ); // Resumes the next ready task, ERROR_YEILD if the task is still alive or every task is waiting.
+		eError Run( ); // Runs until all tasks are done or one of them fails, idles up to 1 ms at a time while every task waits.
+
+		// General get functions
+		unsigned int GetTaskCount( ) const;
+		unsigned int GetTimeSlice( ) const;
+		bool IsWaiting( ) const; // Every task was waiting at the last step, the driver of Step may sleep.
+		const std::string & GetLastError( ) const;
+		static const void * GetWaitKey( );
+		static bool IsTask( lua_State * p_pState ); // True for the threads of scheduler tasks, only they may yield the wait key.
+
+	private:
+
+		// Copy is not allowed
+		Scheduler( const Scheduler & p_Scheduler );
+		Scheduler & operator = ( const Scheduler & p_Scheduler );
+
+		// Task structure
+		struct Task
+		{
+			lua_State * pThread;
+			int Reference; // Registry reference keeping the thread alive
+			int Arguments; // Arguments of the first resume
+			int YieldedValues; // Values of the last yield, none if the task was preempted
+			unsigned int Weight;
+			const Waitable * pWaitable; // NULL if not waiting
+		};
+
+		// Private functions
+		void ReleaseTask( const Task & p_Task );
+
+		// Private variables
+		Script & m_Script;
+		std::deque<Task> m_Tasks;
+		unsigned int m_TimeSlice;
+		bool m_Waiting; // Every task was waiting at the last step
+		SchedulerIdleCallback m_IdleCallback;
+		void * m_pIdleData;
+		std::string m_ErrorMessage;
+
+	};
+
+}
+
+#endif
@@ -0,0 +1,138 @@
+// ///////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2013 Jimmie Bergmann - jimmiebergmann@gmail.com
+//
+// This software is provided 'as-is', without any express or
+// implied warranty. In no event will the authors be held
+// liable for any damages arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute
+// it freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented;
+//    you must not claim that you wrote the original software.
+//    If you use this software in a product, an acknowledgment
+//    in the product documentation would be appreciated but
+//    is not required.
+//
+// 2. Altered source versions must be plainly marked as such,
+//    and must not be misrepresented as being the original software.
+//
+// 3. This notice may not be removed or altered from any
+//    source distribution.
+// ///////////////////////////////////////////////////////////////////////////
+
+// Binary serialization of Lua values
+
+#ifndef LUA_W_SERIALIZER_HPP
+#define LUA_W_SERIALIZER_HPP
+
+#include <LuaW.hpp>
+#include <string>
+#include <vector>
+
+namespace LuaW
+{
+
+	// Serializes nil, booleans, numbers, strings and tables into a compact binary format.
+	// Shared tables and cycles are kept, repeated strings are written once and tables are presized on decode.
+	// The internal maps are reused between calls, a warmed up serializer encodes without allocations.
+	// A serializer may only be used by one thread at a time.
+	class Serializer
+	{
+
+	public:
+
+		// Constructor
+		Serializer( );
+
+		// Public functions
+		bool Encode( lua_State * p_pState, const int p_Index, std::string & p_Buffer ); // Replaces the content, the capacity is kept.
+		size_t Encode( lua_State * p_pState, const int p_Index, char * p_pBuffer, const size_t p_Capacity ); // 0 on error or if the buffer is too small
+		bool Decode( lua_State * p_pState, const char * p_pData, const size_t p_Size ); // Pushes the value
+		bool Decode( lua_State * p_pState, const std::string & p_Buffer );
+
+		// General get functions
+		const char * GetLastError( ) const;
+		size_t GetRequiredSize( ) const; // Size of the last encoded value, even if it did not fit.
+		std::string & GetScratchBuffer( ); // Free for the caller to use, keeps its capacity.
+
+		// Static functions
+		static Serializer & Get( lua_State * p_pState ); // Serializer shared by everything using the state
+		static void OpenLibrary( lua_State * p_pState ); // Global "serializer" with encode( value ) and decode( string )
+
+	private:
+
+		// Copy is not allowed
+		Serializer( const Serializer & p_Serializer );
+		Serializer & operator = ( const Serializer & p_Serializer );
+
+		// Open addressing map of pointers to numbers, clearing it keeps the memory.
+		class PointerMap
+		{
+
+		public:
+
+			PointerMap( );
+			void Clear( );
+			unsigned int Find( const void * p_pKey ) const; // 0 if missing
+			void Insert( const void * p_pKey, const unsigned int p_Value ); // The value must not be 0
+			unsigned int GetSize( ) const;
+
+		private:
+
+			// Entries of older generations are empty.
+			struct Entry
+			{
+				const void * pKey;
+				unsigned int Value;
+				unsigned int Generation;
+			};
+
+			size_t GetSlot( const void * p_pKey ) const;
+			void Grow( );
+
+			std::vector<Entry> m_Entries;
+			unsigned int m_Size;
+			unsigned int m_Generation;
+
+		};
+
+		// Private functions
+		bool Encode( lua_State * p_pState, const int p_Index );
+		bool EncodeValue( lua_State * p_pState, const int p_Index, const int p_Depth );
+		bool DecodeValue( lua_State * p_pState, const int p_Depth );
+		void Write( const void * p_pData, const size_t p_Size );
+		void WriteByte( const unsigned char p_Byte );
+		void WriteInteger( unsigned long long p_Integer );
+		void Patch( const size_t p_Position, const void * p_pData, const size_t p_Size );
+		bool ReadInteger( unsigned long long & p_Integer );
+		static int LuaEncode( lua_State * p_pState );
+		static int LuaDecode( lua_State * p_pState );
+		static int LuaCollect( lua_State * p_pState );
+
+		// Encoding
+		PointerMap m_Tables;
+		PointerMap m_Strings;
+		std::string * m_pString; // Output string, or
+		char * m_pBuffer; // output buffer
+		size_t m_Size;
+		size_t m_Capacity;
+		unsigned char m_Flags;
+
+		// Decoding
+		const char * m_pData;
+		const char * m_pEnd;
+		int m_References; // Stack index of the reference table, 0 if none.
+		unsigned int m_TableCount;
+		unsigned int m_StringCount;
+
+		// Private variables
+		const char * m_pError;
+		std::string m_Scratch;
+
+	};
+
+}
+
+#endif
@@ -0,0 +1,117 @@
+// ///////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2013 Jimmie Bergmann - jimmiebergmann@gmail.com
+//
+// This software is provided 'as-is', without any express or
+// implied warranty. In no event will the authors be held
+// liable for any damages arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute
+// it freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented;
+//    you must not claim that you wrote the original software.
+//    If you use this software in a product, an acknowledgment
+//    in the product documentation would be appreciated but
+//    is not required.
+//
+// 2. Altered source versions must be plainly marked as such,
+//    and must not be misrepresented as being the original software.
+//
+// 3. This notice may not be removed or altered from any
+//    source distribution.
+// ///////////////////////////////////////////////////////////////////////////
+
+// Timers of Lua callbacks
+
+#ifndef LUA_W_TIMER_WHEEL_HPP
+#define LUA_W_TIMER_WHEEL_HPP
+
+#include <LuaW.hpp>
+#include <vector>
+
+namespace LuaW
+{
+
+	// Hierarchical timing wheel with a resolution of a millisecond, adding and cancelling a timer is O(1).
+	// Five levels of 256, 64, 64, 64 and 64 slots cover 2^32 ms, later timers are cascaded again when reached.
+	// Tick advances the wheel and calls the due callbacks in order of their slots.
+	// Creating the wheel adds the global "timer" table to the script:
+	//   timer.after( ms, callback )   calls the callback once, returns a handle
+	//   timer.every( ms, callback )   calls the callback every interval, returns a handle
+	//   timer.cancel( handle )        true if the timer was pending
+	//   timer.now( )                  time of the wheel in milliseconds
+	// The callbacks get their handle as the argument. The wheel must be destroyed before the script is unloaded.
+	class TimerWheel
+	{
+
+	public:
+
+		// Constructor/destructor
+		TimerWheel( Script & p_Script );
+		~TimerWheel( );
+
+		// Public functions
+		eError Tick( const unsigned long long p_Now ); // Milliseconds of a monotonic clock, the first tick sets the start.
+		bool Cancel( const unsigned long long p_Handle );
+
+		// General get functions
+		size_t GetTimerCount( ) const;
+		unsigned long long GetTime( ) const; // Milliseconds since the first tick
+
+	private:
+
+		// Copy is not allowed
+		TimerWheel( const TimerWheel & p_Wheel );
+		TimerWheel & operator = ( const TimerWheel & p_Wheel );
+
+		// Slot lists of the levels, followed by the list of the timers being fired.
+		enum eList
+		{
+			LIST_DUE = 256 + 4 * 64,
+			LIST_COUNT = LIST_DUE + 1
+		};
+
+		// Timer, linked into a slot list by indices. Free timers are linked through Next.
+		struct Timer
+		{
+			unsigned long long Expires; // Ticks
+			unsigned long long Interval; // 0 = once
+			int Reference; // Callback, LUA_NOREF if free
+			unsigned int Generation; // Makes the handles of reused timers unique
+			unsigned int List;
+			unsigned int Next;
+			unsigned int Previous;
+		};
+
+		// Private functions
+		unsigned long long Add( const unsigned long long p_Delay, const unsigned long long p_Interval, const int p_Reference );
+		unsigned int Find( const unsigned long long p_Handle ) const;
+		unsigned long long GetHandle( const unsigned int p_Timer ) const;
+		void Insert( const unsigned int p_Timer );
+		void Link( const unsigned int p_List, const unsigned int p_Timer );
+		void Unlink( const unsigned int p_Timer );
+		void Release( const unsigned int p_Timer );
+		void Move( const unsigned int p_List, const bool p_Insert ); // Moves a list to the due list or reinserts it
+		static int LuaAfter( lua_State * p_pState );
+		static int LuaEvery( lua_State * p_pState );
+		static int LuaCancel( lua_State * p_pState );
+		static int LuaNow( lua_State * p_pState );
+
+		// Private variables
+		Script & m_Script;
+		std::vector<Timer> m_Timers;
+		unsigned int m_Lists[ LIST_COUNT ]; // First timer of each list
+		unsigned int m_FreeTimer;
+		size_t m_Count;
+		size_t m_FirstLevelCount; // Timers in the slots of the first level
+		unsigned long long m_Base; // Next tick to process
+		unsigned long long m_Start; // Time of the first tick
+		bool m_Started;
+		bool m_Ticking;
+
+	};
+
+}
+
+#endif
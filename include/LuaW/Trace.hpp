@@ -0,0 +1,152 @@
+// ///////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2013 Jimmie Bergmann - jimmiebergmann@gmail.com
+//
+// This software is provided 'as-is', without any express or
+// implied warranty. In no event will the authors be held
+// liable for any damages arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute
+// it freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented;
+//    you must not claim that you wrote the original software.
+//    If you use this software in a product, an acknowledgment
+//    in the product documentation would be appreciated but
+//    is not required.
+//
+// 2. Altered source versions must be plainly marked as such,
+//    and must not be misrepresented as being the original software.
+//
+// 3. This notice may not be removed or altered from any
+//    source distribution.
+// ///////////////////////////////////////////////////////////////////////////
+
+// Recording and replaying of script traces
+
+#ifndef LUA_W_TRACE_HPP
+#define LUA_W_TRACE_HPP
+
+#include <LuaW.hpp>
+#include <fstream>
+#include <map>
+#include <string>
+
+namespace LuaW
+{
+
+	// Trace record types
+	enum eTraceRecord
+	{
+		TRACE_CALL = 1,
+		TRACE_RUN_STRING = 2,
+		TRACE_RUN_FILE = 3,
+		TRACE_SET_GLOBAL = 4,
+		TRACE_RUN_EMBEDDED = 5
+	};
+
+
+	// Writes a compact binary trace of the calls made to a script.
+	// File layout: "LUAWTRC1", then records of
+	//   type (byte), start time delta (varint ns), duration (varint ns), payload.
+	// Strings are a varint length followed by the bytes, numbers are doubles in host byte order.
+	// Values are a tag byte: nil, false, true, number, string, integer. Other types are recorded as nil.
+	class TraceRecorder
+	{
+
+	public:
+
+		// Constructor/destructor
+		TraceRecorder( );
+		~TraceRecorder( );
+
+		// Public functions
+		bool Open( const char * p_pFilePath );
+		void Close( );
+
+		// Record functions, nested records are skipped, Begin returns false for them.
+		bool Begin( const eTraceRecord p_Type );
+		void WriteString( const char * p_pString );
+		void WriteInteger( const unsigned long long p_Integer );
+		void WriteValue( lua_State * p_pState, const int p_Index );
+		void WriteFunction( lua_State * p_pState, const int p_Index ); // Name of the global function
+		void End( );
+
+		// Name of the last global pushed, used to name the called function.
+		void SetGlobalHint( lua_State * p_pState, const char * p_pName );
+
+	private:
+
+		// Copy is not allowed
+		TraceRecorder( const TraceRecorder & p_Recorder );
+		TraceRecorder & operator = ( const TraceRecorder & p_Recorder );
+
+		// Private functions
+		static bool IsGlobal( lua_State * p_pState, const int p_Index, const std::string & p_Name ); // Index must be absolute
+		static void AppendInteger( std::string & p_Buffer, unsigned long long p_Integer );
+
+		// Private variables
+		std::ofstream m_File;
+		std::string m_Record; // Payload of the current record
+		eTraceRecord m_Type;
+		int m_Depth;
+		long long m_Start; // Start of the current record
+		long long m_LastStart; // Start of the previous record
+		const void * m_pHintFunction;
+		std::string m_HintName;
+		std::map<const void *, std::string> m_FunctionNames; // Checked before use, addresses are reused.
+
+	};
+
+
+	// Replay statistics, times are in nanoseconds.
+	struct TraceStats
+	{
+		unsigned int Records;
+		unsigned int Errors;
+		unsigned int UnresolvedCalls; // Calls of functions without a global name
+		unsigned long long RecordedTime; // Sum of the recorded durations
+		unsigned long long ReplayedTime; // Sum of the replayed durations
+		unsigned long long WallTime;
+	};
+
+
+	// Drives a script from a recorded trace.
+	class TraceReplayer
+	{
+
+	public:
+
+		// Constructor
+		TraceReplayer( Script & p_Script );
+
+		// Public functions
+		eError Replay( const char * p_pFilePath, const bool p_Paced ); // Paced keeps the recorded start times.
+
+		// General get functions
+		const TraceStats & GetStats( ) const;
+		const std::string & GetLastError( ) const;
+
+	private:
+
+		// Copy is not allowed
+		TraceReplayer( const TraceReplayer & p_Replayer );
+		TraceReplayer & operator = ( const TraceReplayer & p_Replayer );
+
+		// Private functions
+		bool ReadInteger( unsigned long long & p_Integer );
+		bool ReadString( std::string & p_String );
+		bool PushValue( );
+
+		// Private variables
+		Script & m_Script;
+		std::ifstream m_File;
+		unsigned long long m_FileSize;
+		TraceStats m_Stats;
+		std::string m_ErrorMessage;
+
+	};
+
+}
+
+#endif
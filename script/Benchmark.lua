@@ -0,0 +1,6 @@
+-- Used by the micro benchmarks
+counter = 0
+
+function Add( a, b )
+	return a + b
+end
\ No newline at end of file
@@ -0,0 +1,16 @@
+-- Used by the load benchmark
+function Compute( a, b )
+	local Sum = 0
+	for i = 1, 16 do
+		Sum = Sum + a * i + b
+	end
+	return Sum
+end
+
+function CreateObject( x )
+	return NewObject( x ):GetData( )
+end
+
+function Concat( s )
+	return s .. "!"
+end
\ No newline at end of file
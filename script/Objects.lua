@@ -0,0 +1,16 @@
+-- Move every object, the fields are read and written in place
+for i = 1, #Objects do
+	local Object = Objects[ i ]
+	local Position = Object.Position
+	Position.x = Position.x + 10
+	Position.y = Position.y * 0.5
+	Object.Size = Object.Size * i
+end
+
+-- Update all entities a column at a time, called once per tick
+function UpdateEntities( dt )
+	soa.integrate( Entities.x, Entities.vx, dt )
+	soa.integrate( Entities.y, Entities.vy, dt )
+	soa.clamp( Entities.y, -0.1, 100 )
+	soa.scale( Entities.size, 1.01 )
+end
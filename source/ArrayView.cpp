@@ -0,0 +1,374 @@
+// ///////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2013 Jimmie Bergmann - jimmiebergmann@gmail.com
+//
+// This software is provided 'as-is', without any express or
+// implied warranty. In no event will the authors be held
+// liable for any damages arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute
+// it freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented;
+//    you must not claim that you wrote the original software.
+//    If you use this software in a product, an acknowledgment
+//    in the product documentation would be appreciated but
+//    is not required.
+//
+// 2. Altered source versions must be plainly marked as such,
+//    and must not be misrepresented as being the original software.
+//
+// 3. This notice may not be removed or altered from any
+//    source distribution.
+// ///////////////////////////////////////////////////////////////////////////
+
+#include <LuaW/ArrayView.hpp>
+#include <climits>
+
+namespace LuaW
+{
+
+	// Metatable name of the array views
+	static const char * g_ArrayViewTable = "LuaW_ArrayView";
+
+	// Element access of any numeric type, the slow path of mixed columns.
+	static double LoadElement( const ArrayViewData & p_View, const size_t p_Index )
+	{
+		switch( p_View.Type )
+		{
+			case FIELD_INT: return static_cast<double>( static_cast<const int *>( p_View.pData )[ p_Index ] );
+			case FIELD_FLOAT: return static_cast<double>( static_cast<const float *>( p_View.pData )[ p_Index ] );
+			default: return static_cast<const double *>( p_View.pData )[ p_Index ];
+		}
+	}
+
+	// Converts to int, saturating. NaN and values out of range are undefined for a plain cast.
+	static int ToInt( const double p_Value )
+	{
+		if( p_Value != p_Value )
+		{
+			return 0;
+		}
+		if( p_Value >= static_cast<double>( INT_MAX ) )
+		{
+			return INT_MAX;
+		}
+		if( p_Value <= static_cast<double>( INT_MIN ) )
+		{
+			return INT_MIN;
+		}
+		return static_cast<int>( p_Value );
+	}
+
+	static void StoreElement( const ArrayViewData & p_View, const size_t p_Index, const double p_Value )
+	{
+		switch( p_View.Type )
+		{
+			case FIELD_INT: static_cast<int *>( p_View.pData )[ p_Index ] = ToInt( p_Value ); break;
+			case FIELD_FLOAT: static_cast<float *>( p_View.pData )[ p_Index ] = static_cast<float>( p_Value ); break;
+			default: static_cast<double *>( p_View.pData )[ p_Index ] = p_Value; break;
+		}
+	}
+
+	// Column kernels, plain loops the compiler can vectorize.
+	template<typename T>
+	static void IntegrateKernel( T * p_pDestination, const T * p_pSource, const size_t p_Count, const T p_Step )
+	{
+		for( size_t i = 0; i < p_Count; i++ )
+		{
+			p_pDestination[ i ] += p_pSource[ i ] * p_Step;
+		}
+	}
+
+	template<typename T>
+	static void ClampKernel( T * p_pData, const size_t p_Count, const T p_Min, const T p_Max )
+	{
+		for( size_t i = 0; i < p_Count; i++ )
+		{
+			T Value = p_pData[ i ] < p_Min ? p_Min : p_pData[ i ];
+			p_pData[ i ] = Value > p_Max ? p_Max : Value;
+		}
+	}
+
+	template<typename T>
+	static void ScaleKernel( T * p_pData, const size_t p_Count, const T p_Factor )
+	{
+		for( size_t i = 0; i < p_Count; i++ )
+		{
+			p_pData[ i ] *= p_Factor;
+		}
+	}
+
+	// Checks the argument and raises a Lua error if it is not a writable view.
+	static ArrayViewData * CheckView( lua_State * p_pState, const int p_Index, const bool p_Write )
+	{
+		ArrayViewData * pView = static_cast<ArrayViewData *>( luaL_checkudata( p_pState, p_Index, g_ArrayViewTable ) );
+		if( p_Write && pView->ReadOnly )
+		{
+			luaL_argerror( p_pState, p_Index, "array view is read only" );
+		}
+		return pView;
+	}
+
+	// Public functions
+	void ArrayView::Push( lua_State * p_pState, int * p_pData, const size_t p_Count, const bool p_ReadOnly )
+	{
+		Push( p_pState, p_pData, p_Count, FIELD_INT, p_ReadOnly );
+	}
+
+	void ArrayView::Push( lua_State * p_pState, float * p_pData, const size_t p_Count, const bool p_ReadOnly )
+	{
+		Push( p_pState, p_pData, p_Count, FIELD_FLOAT, p_ReadOnly );
+	}
+
+	void ArrayView::Push( lua_State * p_pState, double * p_pData, const size_t p_Count, const bool p_ReadOnly )
+	{
+		Push( p_pState, p_pData, p_Count, FIELD_DOUBLE, p_ReadOnly );
+	}
+
+	ArrayViewData * ArrayView::ToArrayView( lua_State * p_pState, const int p_Index )
+	{
+		return static_cast<ArrayViewData *>( luaL_testudata( p_pState, p_Index, g_ArrayViewTable ) );
+	}
+
+	void ArrayView::OpenLibrary( lua_State * p_pState )
+	{
+		static const luaL_Reg Functions[ ] =
+		{
+			{ "integrate", Integrate },
+			{ "clamp", Clamp },
+			{ "scale", Scale },
+			{ "fill", Fill },
+			{ "sum", Sum },
+			{ NULL, NULL }
+		};
+
+		lua_createtable( p_pState, 0, 5 );
+		luaL_setfuncs( p_pState, Functions, 0 );
+		lua_setglobal( p_pState, "soa" );
+	}
+
+	// Private functions
+	void ArrayView::Push( lua_State * p_pState, void * p_pData, const size_t p_Count, const eFieldType p_Type, const bool p_ReadOnly )
+	{
+		ArrayViewData * pView = static_cast<ArrayViewData *>( lua_newuserdata( p_pState, sizeof( ArrayViewData ) ) );
+		pView->pData = p_pData;
+		pView->Count = p_Count;
+		pView->Type = p_Type;
+		pView->ReadOnly = p_ReadOnly;
+
+		if( luaL_newmetatable( p_pState, g_ArrayViewTable ) )
+		{
+			lua_pushcfunction( p_pState, Index );
+			lua_setfield( p_pState, -2, "__index" );
+			lua_pushcfunction( p_pState, NewIndex );
+			lua_setfield( p_pState, -2, "__newindex" );
+			lua_pushcfunction( p_pState, Length );
+			lua_setfield( p_pState, -2, "__len" );
+			lua_pushboolean( p_pState, 0 );
+			lua_setfield( p_pState, -2, "__metatable" );
+		}
+		lua_setmetatable( p_pState, -2 );
+	}
+
+	int ArrayView::Index( lua_State * p_pState )
+	{
+		ArrayViewData * pView = CheckView( p_pState, 1, false );
+		lua_Integer Index = lua_tointeger( p_pState, 2 );
+
+		if( Index < 1 || static_cast<size_t>( Index ) > pView->Count )
+		{
+			lua_pushnil( p_pState );
+			return 1;
+		}
+
+		if( pView->Type == FIELD_INT )
+		{
+			lua_pushinteger( p_pState, static_cast<int *>( pView->pData )[ Index - 1 ] );
+		}
+		else
+		{
+			lua_pushnumber( p_pState, LoadElement( *pView, static_cast<size_t>( Index - 1 ) ) );
+		}
+		return 1;
+	}
+
+	int ArrayView::NewIndex( lua_State * p_pState )
+	{
+		ArrayViewData * pView = CheckView( p_pState, 1, true );
+		lua_Integer Index = luaL_checkinteger( p_pState, 2 );
+
+		if( Index < 1 || static_cast<size_t>( Index ) > pView->Count )
+		{
+			return luaL_error( p_pState, "array index %d out of range", static_cast<int>( Index ) );
+		}
+
+		StoreElement( *pView, static_cast<size_t>( Index - 1 ), luaL_checknumber( p_pState, 3 ) );
+		return 0;
+	}
+
+	int ArrayView::Length( lua_State * p_pState )
+	{
+		ArrayViewData * pView = CheckView( p_pState, 1, false );
+		lua_pushinteger( p_pState, static_cast<lua_Integer>( pView->Count ) );
+		return 1;
+	}
+
+	int ArrayView::Integrate( lua_State * p_pState )
+	{
+		ArrayViewData * pDestination = CheckView( p_pState, 1, true );
+		ArrayViewData * pSource = CheckView( p_pState, 2, false );
+		double Step = luaL_checknumber( p_pState, 3 );
+		size_t Count = pDestination->Count < pSource->Count ? pDestination->Count : pSource->Count;
+
+		if( pDestination->Type == FIELD_DOUBLE && pSource->Type == FIELD_DOUBLE )
+		{
+			IntegrateKernel( static_cast<double *>( pDestination->pData ), static_cast<const double *>( pSource->pData ), Count, Step );
+		}
+		else if( pDestination->Type == FIELD_FLOAT && pSource->Type == FIELD_FLOAT )
+		{
+			IntegrateKernel( static_cast<float *>( pDestination->pData ), static_cast<const float *>( pSource->pData ), Count, static_cast<float>( Step ) );
+		}
+		else
+		{
+			for( size_t i = 0; i < Count; i++ )
+			{
+				StoreElement( *pDestination, i, LoadElement( *pDestination, i ) + LoadElement( *pSource, i ) * Step );
+			}
+		}
+		return 0;
+	}
+
+	int ArrayView::Clamp( lua_State * p_pState )
+	{
+		ArrayViewData * pView = CheckView( p_pState, 1, true );
+		double Min = luaL_checknumber( p_pState, 2 );
+		double Max = luaL_checknumber( p_pState, 3 );
+
+		switch( pView->Type )
+		{
+			case FIELD_INT:
+			{
+				ClampKernel( static_cast<int *>( pView->pData ), pView->Count, ToInt( Min ), ToInt( Max ) );
+			}
+			break;
+			case FIELD_FLOAT:
+			{
+				ClampKernel( static_cast<float *>( pView->pData ), pView->Count, static_cast<float>( Min ), static_cast<float>( Max ) );
+			}
+			break;
+			default:
+			{
+				ClampKernel( static_cast<double *>( pView->pData ), pView->Count, Min, Max );
+			}
+			break;
+		}
+		return 0;
+	}
+
+	int ArrayView::Scale( lua_State * p_pState )
+	{
+		ArrayViewData * pView = CheckView( p_pState, 1, true );
+		double Factor = luaL_checknumber( p_pState, 2 );
+
+		switch( pView->Type )
+		{
+			case FIELD_FLOAT:
+			{
+				ScaleKernel( static_cast<float *>( pView->pData ), pView->Count, static_cast<float>( Factor ) );
+			}
+			break;
+			case FIELD_DOUBLE:
+			{
+				ScaleKernel( static_cast<double *>( pView->pData ), pView->Count, Factor );
+			}
+			break;
+			default:
+			{
+				for( size_t i = 0; i < pView->Count; i++ )
+				{
+					StoreElement( *pView, i, LoadElement( *pView, i ) * Factor );
+				}
+			}
+			break;
+		}
+		return 0;
+	}
+
+	int ArrayView::Fill( lua_State * p_pState )
+	{
+		ArrayViewData * pView = CheckView( p_pState, 1, true );
+		double Value = luaL_checknumber( p_pState, 2 );
+
+		for( size_t i = 0; i < pView->Count; i++ )
+		{
+			StoreElement( *pView, i, Value );
+		}
+		return 0;
+	}
+
+	int ArrayView::Sum( lua_State * p_pState )
+	{
+		ArrayViewData * pView = CheckView( p_pState, 1, false );
+
+		double Sum = 0.0;
+		for( size_t i = 0; i < pView->Count; i++ )
+		{
+			Sum += LoadElement( *pView, i );
+		}
+
+		lua_pushnumber( p_pState, Sum );
+		return 1;
+	}
+
+
+	// Column set
+	ColumnSet::ColumnSet( const size_t p_Count ) :
+		m_Count( p_Count )
+	{
+	}
+
+	void ColumnSet::Add( const char * p_pName, int * p_pData, const bool p_ReadOnly )
+	{
+		Column Current = { p_pName, { p_pData, m_Count, FIELD_INT, p_ReadOnly } };
+		m_Columns.push_back( Current );
+	}
+
+	void ColumnSet::Add( const char * p_pName, float * p_pData, const bool p_ReadOnly )
+	{
+		Column Current = { p_pName, { p_pData, m_Count, FIELD_FLOAT, p_ReadOnly } };
+		m_Columns.push_back( Current );
+	}
+
+	void ColumnSet::Add( const char * p_pName, double * p_pData, const bool p_ReadOnly )
+	{
+		Column Current = { p_pName, { p_pData, m_Count, FIELD_DOUBLE, p_ReadOnly } };
+		m_Columns.push_back( Current );
+	}
+
+	void ColumnSet::Push( lua_State * p_pState ) const
+	{
+		lua_createtable( p_pState, 0, static_cast<int>( m_Columns.size( ) ) + 1 );
+
+		for( size_t i = 0; i < m_Columns.size( ); i++ )
+		{
+			const ArrayViewData & View = m_Columns[ i ].View;
+			switch( View.Type )
+			{
+				case FIELD_INT: ArrayView::Push( p_pState, static_cast<int *>( View.pData ), View.Count, View.ReadOnly ); break;
+				case FIELD_FLOAT: ArrayView::Push( p_pState, static_cast<float *>( View.pData ), View.Count, View.ReadOnly ); break;
+				default: ArrayView::Push( p_pState, static_cast<double *>( View.pData ), View.Count, View.ReadOnly ); break;
+			}
+			lua_setfield( p_pState, -2, m_Columns[ i ].Name.c_str( ) );
+		}
+
+		lua_pushinteger( p_pState, static_cast<lua_Integer>( m_Count ) );
+		lua_setfield( p_pState, -2, "count" );
+	}
+
+	size_t ColumnSet::GetCount( ) const
+	{
+		return m_Count;
+	}
+
+}
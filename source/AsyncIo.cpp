@@ -0,0 +1,1105 @@
+// ///////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2013 Jimmie Bergmann - jimmiebergmann@gmail.com
+//
+// This software is provided 'as-is', without any express or
+// implied warranty. In no event will the authors be held
+// liable for any damages arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute
+// it freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented;
+//    you must not claim that you wrote the original software.
+//    If you use this software in a product, an acknowledgment
+//    in the product documentation would be appreciated but
+//    is not required.
+//
+// 2. Altered source versions must be plainly marked as such,
+//    and must not be misrepresented as being the original software.
+//
+// 3. This notice may not be removed or altered from any
+//    source distribution.
+// ///////////////////////////////////////////////////////////////////////////
+#include <LuaW/AsyncIo.hpp>
+
+#if defined( __linux__ )
+
+#include <linux/io_uring.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+// Older C libraries lack the numbers, they are the same on every architecture.
+#if !defined( __NR_io_uring_setup )
+#define __NR_io_uring_setup 425
+#endif
+#if !defined( __NR_io_uring_enter )
+#define __NR_io_uring_enter 426
+#endif
+
+namespace LuaW
+{
+
+	// Metatable name of the files
+	static const char * g_FileTable = "LuaW_AsyncFile";
+
+	// Waiting versions of the file functions, they yield to the scheduler or block until the operation completed.
+	static const char * g_FileFunctions =
+		"local Read, Write, Flush, Close, Block, IsTask, Key = ...\n"
+		"local yield = coroutine.yield\n"
+		"local function Retry( Function, self, ... )\n"
+		"	while true do\n"
+		"		local Result, Extra = Function( self, ... )\n"
+		"		if Result ~= false then return Result, Extra end\n"
+		"		if IsTask( ) then yield( Key, Extra ) else Block( self ) end\n"
+		"	end\n"
+		"end\n"
+		"local function read( self, Format )\n"
+		"	return Retry( Read, self, Format or 'l' )\n"
+		"end\n"
+		"local function write( self, ... )\n"
+		"	local Result, Message = Retry( Write, self, ... )\n"
+		"	if not Result then return nil, Message end\n"
+		"	return Retry( Flush, self )\n"
+		"end\n"
+		"local function lines( self, Format )\n"
+		"	return function( ) return Retry( Read, self, Format or 'l' ) end\n"
+		"end\n"
+		"local function close( self )\n"
+		"	return Retry( Close, self )\n"
+		"end\n"
+		"return read, write, lines, close\n";
+
+	// Largest transfer of one operation
+	static const size_t g_MaximumTransfer = 0x7FFFF000;
+
+	// Waitable of the files
+	bool AsyncIo::File::IsReady( ) const
+	{
+		if( State == STATE_PENDING && pIo != NULL )
+		{
+			pIo->Poll( );
+		}
+		return State != STATE_PENDING;
+	}
+
+	// Constructor/destructor
+	AsyncIo::AsyncIo( Script & p_Script, const eIoBackend p_Backend, const unsigned int p_Entries, const size_t p_BufferSize ) :
+		m_Script( p_Script ),
+		m_Backend( IO_BACKEND_EPOLL ),
+		m_Epoll( -1 ),
+		m_BufferSize( p_BufferSize > 0 ? p_BufferSize : 1 ),
+		m_pFirstFile( NULL ),
+		m_PendingCount( 0 )
+	{
+		memset( &m_Uring, 0, sizeof( m_Uring ) );
+		m_Uring.Descriptor = -1;
+
+		// io_uring may be missing or blocked by a seccomp filter, epoll is always there.
+		if( p_Backend != IO_BACKEND_EPOLL && CreateUring( p_Entries ) )
+		{
+			m_Backend = IO_BACKEND_URING;
+		}
+		else
+		{
+			CreateEpoll( );
+		}
+
+		lua_State * pState = m_Script.GetState( );
+
+		lua_createtable( pState, 0, 3 );
+		lua_pushlightuserdata( pState, this );
+		lua_pushcclosure( pState, LuaOpen, 1 );
+		lua_setfield( pState, -2, "open" );
+		lua_pushlightuserdata( pState, this );
+		lua_pushcclosure( pState, LuaPipe, 1 );
+		lua_setfield( pState, -2, "pipe" );
+		lua_pushlightuserdata( pState, this );
+		lua_pushcclosure( pState, LuaBackend, 1 );
+		lua_setfield( pState, -2, "backend" );
+		lua_setglobal( pState, "aio" );
+	}
+
+	AsyncIo::~AsyncIo( )
+	{
+		// The kernel writes into the buffers of pending io_uring operations, cancel them and wait for their completions.
+		if( m_Backend == IO_BACKEND_URING )
+		{
+			for( size_t i = 0; i < m_Backlog.size( ); i++ )
+			{
+				m_Backlog[ i ]->State = STATE_IDLE;
+				m_PendingCount--;
+			}
+			m_Backlog.clear( );
+
+			// Every pending file is cancelled below.
+			m_CancelBacklog.clear( );
+
+			std::vector<File *> Pending;
+			for( File * pFile = m_pFirstFile; pFile != NULL; pFile = pFile->pNext )
+			{
+				if( pFile->State == STATE_PENDING )
+				{
+					Pending.push_back( pFile );
+				}
+			}
+
+			// The cancel entries only use the address as a key, released files may be deleted meanwhile.
+			for( size_t i = 0; i < Pending.size( ); i++ )
+			{
+				while( PushEntry( Pending[ i ], IORING_OP_ASYNC_CANCEL ) == false )
+				{
+					Wait( -1 );
+				}
+			}
+
+			while( m_Uring.InFlight > 0 )
+			{
+				Enter( );
+				if( Reap( ) == 0 )
+				{
+					pollfd Poll = { m_Uring.Descriptor, POLLIN, 0 };
+					poll( &Poll, 1, -1 );
+				}
+			}
+		}
+
+		// Files still referenced by Lua stay allocated until they are collected.
+		File * pFile = m_pFirstFile;
+		while( pFile != NULL )
+		{
+			File * pNext = pFile->pNext;
+			if( pFile->Descriptor >= 0 )
+			{
+				close( pFile->Descriptor );
+				pFile->Descriptor = -1;
+			}
+			std::vector<char>( ).swap( pFile->Input );
+			std::vector<char>( ).swap( pFile->Output );
+			pFile->State = STATE_IDLE;
+			pFile->pIo = NULL;
+
+			if( pFile->Released )
+			{
+				delete pFile;
+			}
+			pFile = pNext;
+		}
+		m_pFirstFile = NULL;
+
+		DestroyUring( );
+		if( m_Epoll >= 0 )
+		{
+			close( m_Epoll );
+		}
+
+		// The functions of the aio table refer to the object.
+		lua_State * pState = m_Script.GetState( );
+		if( pState != NULL )
+		{
+			lua_pushnil( pState );
+			lua_setglobal( pState, "aio" );
+		}
+	}
+
+	// Public functions
+	void AsyncIo::Poll( )
+	{
+		Wait( 0 );
+	}
+
+	void AsyncIo::Wait( const int p_Milliseconds )
+	{
+		if( m_Backend == IO_BACKEND_URING )
+		{
+			size_t Reaped = Reap( );
+			Enter( );
+
+			if( Reaped == 0 && p_Milliseconds != 0 && m_PendingCount > 0 )
+			{
+				// The ring descriptor is readable when completions are queued.
+				pollfd Poll = { m_Uring.Descriptor, POLLIN, 0 };
+				poll( &Poll, 1, p_Milliseconds );
+				Reap( );
+				Enter( );
+			}
+			return;
+		}
+
+		if( m_PendingCount == 0 )
+		{
+			return;
+		}
+
+		epoll_event Events[ 64 ];
+		int Count = epoll_wait( m_Epoll, Events, 64, p_Milliseconds );
+		for( int i = 0; i < Count; i++ )
+		{
+			Perform( static_cast<File *>( Events[ i ].data.ptr ) );
+		}
+	}
+
+	void AsyncIo::IdleCallback( const unsigned int p_Microseconds, void * p_pAsyncIo )
+	{
+		// Wake up as soon as an operation completes, or sleep if none is pending.
+		AsyncIo * pIo = static_cast<AsyncIo *>( p_pAsyncIo );
+		if( pIo->m_PendingCount > 0 )
+		{
+			pIo->Wait( static_cast<int>( ( p_Microseconds + 999 ) / 1000 ) );
+		}
+		else if( p_Microseconds == 0 )
+		{
+			std::this_thread::yield( );
+		}
+		else
+		{
+			std::this_thread::sleep_for( std::chrono::microseconds( p_Microseconds ) );
+		}
+	}
+
+	// General get functions
+	eIoBackend AsyncIo::GetBackend( ) const
+	{
+		return m_Backend;
+	}
+
+	size_t AsyncIo::GetPendingCount( ) const
+	{
+		return m_PendingCount;
+	}
+
+	const std::string & AsyncIo::GetLastError( ) const
+	{
+		return m_ErrorMessage;
+	}
+
+	// Private functions
+	bool AsyncIo::CreateUring( const unsigned int p_Entries )
+	{
+		io_uring_params Params;
+		memset( &Params, 0, sizeof( Params ) );
+
+		int Descriptor = static_cast<int>( syscall( __NR_io_uring_setup, p_Entries > 0 ? p_Entries : 1, &Params ) );
+		if( Descriptor < 0 )
+		{
+			m_ErrorMessage = std::string( "io_uring_setup failed: " ) + strerror( errno );
+			return false;
+		}
+		m_Uring.Descriptor = Descriptor;
+
+		// Reads and writes at the file position came with Linux 5.6, pipes need them.
+		if( ( Params.features & IORING_FEAT_RW_CUR_POS ) == 0 )
+		{
+			m_ErrorMessage = "io_uring of the kernel is too old.";
+			DestroyUring( );
+			return false;
+		}
+
+		// Map the rings, since Linux 5.4 both rings share one mapping.
+		m_Uring.SubmitRingSize = Params.sq_off.array + Params.sq_entries * sizeof( unsigned int );
+		m_Uring.CompleteRingSize = Params.cq_off.cqes + Params.cq_entries * sizeof( io_uring_cqe );
+		bool Single = ( Params.features & IORING_FEAT_SINGLE_MMAP ) != 0;
+		if( Single && m_Uring.CompleteRingSize > m_Uring.SubmitRingSize )
+		{
+			m_Uring.SubmitRingSize = m_Uring.CompleteRingSize;
+		}
+
+		void * pRing = mmap( NULL, m_Uring.SubmitRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+							 Descriptor, IORING_OFF_SQ_RING );
+		if( pRing == MAP_FAILED )
+		{
+			m_ErrorMessage = std::string( "Failed to map the submission ring: " ) + strerror( errno );
+			DestroyUring( );
+			return false;
+		}
+		m_Uring.pSubmitRing = pRing;
+
+		if( Single )
+		{
+			m_Uring.pCompleteRing = pRing;
+		}
+		else
+		{
+			pRing = mmap( NULL, m_Uring.CompleteRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+						  Descriptor, IORING_OFF_CQ_RING );
+			if( pRing == MAP_FAILED )
+			{
+				m_ErrorMessage = std::string( "Failed to map the completion ring: " ) + strerror( errno );
+				DestroyUring( );
+				return false;
+			}
+			m_Uring.pCompleteRing = pRing;
+		}
+
+		m_Uring.EntriesSize = Params.sq_entries * sizeof( io_uring_sqe );
+		pRing = mmap( NULL, m_Uring.EntriesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+					  Descriptor, IORING_OFF_SQES );
+		if( pRing == MAP_FAILED )
+		{
+			m_ErrorMessage = std::string( "Failed to map the submission entries: " ) + strerror( errno );
+			DestroyUring( );
+			return false;
+		}
+		m_Uring.pEntries = pRing;
+
+		char * pSubmit = static_cast<char *>( m_Uring.pSubmitRing );
+		m_Uring.pSubmitHead = reinterpret_cast<unsigned int *>( pSubmit + Params.sq_off.head );
+		m_Uring.pSubmitTail = reinterpret_cast<unsigned int *>( pSubmit + Params.sq_off.tail );
+		m_Uring.pSubmitArray = reinterpret_cast<unsigned int *>( pSubmit + Params.sq_off.array );
+		m_Uring.SubmitMask = *reinterpret_cast<unsigned int *>( pSubmit + Params.sq_off.ring_mask );
+		m_Uring.SubmitEntries = *reinterpret_cast<unsigned int *>( pSubmit + Params.sq_off.ring_entries );
+
+		char * pComplete = static_cast<char *>( m_Uring.pCompleteRing );
+		m_Uring.pCompleteHead = reinterpret_cast<unsigned int *>( pComplete + Params.cq_off.head );
+		m_Uring.pCompleteTail = reinterpret_cast<unsigned int *>( pComplete + Params.cq_off.tail );
+		m_Uring.pCompletions = pComplete + Params.cq_off.cqes;
+		m_Uring.CompleteMask = *reinterpret_cast<unsigned int *>( pComplete + Params.cq_off.ring_mask );
+
+		// The completion ring is twice the size, keeping the submissions in flight below
+		// the submission ring size means that completions never overflow.
+		return true;
+	}
+
+	void AsyncIo::DestroyUring( )
+	{
+		if( m_Uring.pEntries != NULL )
+		{
+			munmap( m_Uring.pEntries, m_Uring.EntriesSize );
+		}
+		if( m_Uring.pCompleteRing != NULL && m_Uring.pCompleteRing != m_Uring.pSubmitRing )
+		{
+			munmap( m_Uring.pCompleteRing, m_Uring.CompleteRingSize );
+		}
+		if( m_Uring.pSubmitRing != NULL )
+		{
+			munmap( m_Uring.pSubmitRing, m_Uring.SubmitRingSize );
+		}
+		if( m_Uring.Descriptor >= 0 )
+		{
+			close( m_Uring.Descriptor );
+		}
+
+		memset( &m_Uring, 0, sizeof( m_Uring ) );
+		m_Uring.Descriptor = -1;
+	}
+
+	bool AsyncIo::CreateEpoll( )
+	{
+		m_Epoll = epoll_create1( EPOLL_CLOEXEC );
+		if( m_Epoll < 0 )
+		{
+			m_ErrorMessage = std::string( "epoll_create1 failed: " ) + strerror( errno );
+			return false;
+		}
+		return true;
+	}
+
+	AsyncIo::File * AsyncIo::AddFile( const int p_Descriptor )
+	{
+		File * pFile = new File;
+		pFile->pIo = this;
+		pFile->pNext = m_pFirstFile;
+		pFile->pPrevious = NULL;
+		pFile->Descriptor = p_Descriptor;
+		pFile->Regular = false;
+		pFile->Writing = false;
+		pFile->Registered = false;
+		pFile->Released = false;
+		pFile->EndOfFile = false;
+		pFile->State = STATE_IDLE;
+		pFile->Result = 0;
+		pFile->InputBegin = 0;
+		pFile->InputEnd = 0;
+		pFile->OutputBegin = 0;
+		pFile->OutputEnd = 0;
+
+		if( m_pFirstFile != NULL )
+		{
+			m_pFirstFile->pPrevious = pFile;
+		}
+		m_pFirstFile = pFile;
+
+		struct stat Status;
+		if( fstat( p_Descriptor, &Status ) == 0 )
+		{
+			pFile->Regular = S_ISREG( Status.st_mode );
+		}
+
+		// epoll needs non-blocking pipes, io_uring waits for blocking ones itself and
+		// hands EAGAIN back for non-blocking ones.
+		int Flags = fcntl( p_Descriptor, F_GETFL );
+		if( Flags >= 0 )
+		{
+			Flags = m_Backend == IO_BACKEND_EPOLL ? ( Flags | O_NONBLOCK ) : ( Flags & ~O_NONBLOCK );
+			fcntl( p_Descriptor, F_SETFL, Flags );
+		}
+
+		return pFile;
+	}
+
+	void AsyncIo::ReleaseFile( File * p_pFile )
+	{
+		if( p_pFile->State != STATE_PENDING )
+		{
+			RemoveFile( p_pFile );
+			return;
+		}
+
+		// A pending epoll operation is dropped with the descriptor.
+		if( m_Backend == IO_BACKEND_EPOLL )
+		{
+			m_PendingCount--;
+			RemoveFile( p_pFile );
+			return;
+		}
+
+		for( std::deque<File *>::iterator it = m_Backlog.begin( ); it != m_Backlog.end( ); ++it )
+		{
+			if( *it == p_pFile )
+			{
+				m_Backlog.erase( it );
+				m_PendingCount--;
+				RemoveFile( p_pFile );
+				return;
+			}
+		}
+
+		// The kernel still owns the buffers, the file is deleted when the cancelled operation completes.
+		p_pFile->Released = true;
+		if( PushEntry( p_pFile, IORING_OP_ASYNC_CANCEL ) == false )
+		{
+			m_CancelBacklog.push_back( p_pFile );
+		}
+	}
+
+	void AsyncIo::RemoveFile( File * p_pFile )
+	{
+		if( p_pFile->pPrevious != NULL )
+		{
+			p_pFile->pPrevious->pNext = p_pFile->pNext;
+		}
+		else
+		{
+			m_pFirstFile = p_pFile->pNext;
+		}
+		if( p_pFile->pNext != NULL )
+		{
+			p_pFile->pNext->pPrevious = p_pFile->pPrevious;
+		}
+
+		if( p_pFile->Descriptor >= 0 )
+		{
+			close( p_pFile->Descriptor );
+		}
+		ReleaseBuffer( p_pFile->Input );
+		ReleaseBuffer( p_pFile->Output );
+		delete p_pFile;
+	}
+
+	void AsyncIo::AcquireBuffer( std::vector<char> & p_Buffer )
+	{
+		if( m_Buffers.empty( ) )
+		{
+			p_Buffer.resize( m_BufferSize );
+			return;
+		}
+
+		p_Buffer.swap( m_Buffers.back( ) );
+		m_Buffers.pop_back( );
+	}
+
+	void AsyncIo::ReleaseBuffer( std::vector<char> & p_Buffer )
+	{
+		if( p_Buffer.empty( ) )
+		{
+			return;
+		}
+
+		// Buffers grown by long lines or large writes are freed instead of pooled.
+		if( p_Buffer.size( ) > m_BufferSize * 4 )
+		{
+			std::vector<char>( ).swap( p_Buffer );
+			return;
+		}
+
+		m_Buffers.push_back( std::vector<char>( ) );
+		m_Buffers.back( ).swap( p_Buffer );
+	}
+
+	void AsyncIo::Submit( File * p_pFile, const bool p_Writing )
+	{
+		p_pFile->Writing = p_Writing;
+		p_pFile->State = STATE_PENDING;
+		m_PendingCount++;
+
+		if( m_Backend == IO_BACKEND_EPOLL )
+		{
+			Perform( p_pFile );
+		}
+		else if( PushEntry( p_pFile, p_Writing ? IORING_OP_WRITE : IORING_OP_READ ) == false )
+		{
+			m_Backlog.push_back( p_pFile );
+		}
+	}
+
+	bool AsyncIo::PushEntry( File * p_pFile, const unsigned char p_Operation )
+	{
+		if( m_Uring.InFlight >= m_Uring.SubmitEntries )
+		{
+			return false;
+		}
+
+		// The tail is only written by us, the kernel reads it.
+		unsigned int Tail = *m_Uring.pSubmitTail;
+		unsigned int Index = Tail & m_Uring.SubmitMask;
+		io_uring_sqe * pEntry = static_cast<io_uring_sqe *>( m_Uring.pEntries ) + Index;
+		memset( pEntry, 0, sizeof( io_uring_sqe ) );
+		pEntry->opcode = p_Operation;
+
+		if( p_Operation == IORING_OP_ASYNC_CANCEL )
+		{
+			pEntry->fd = -1;
+			pEntry->addr = reinterpret_cast<unsigned long long>( p_pFile );
+			pEntry->user_data = 0;
+		}
+		else
+		{
+			// An offset of -1 uses and advances the file position, like read and write.
+			size_t Length = 0;
+			if( p_Operation == IORING_OP_READ )
+			{
+				pEntry->addr = reinterpret_cast<unsigned long long>( p_pFile->Input.data( ) + p_pFile->InputEnd );
+				Length = p_pFile->Input.size( ) - p_pFile->InputEnd;
+			}
+			else
+			{
+				pEntry->addr = reinterpret_cast<unsigned long long>( p_pFile->Output.data( ) + p_pFile->OutputBegin );
+				Length = p_pFile->OutputEnd - p_pFile->OutputBegin;
+			}
+			pEntry->fd = p_pFile->Descriptor;
+			pEntry->off = static_cast<unsigned long long>( -1 );
+			pEntry->len = static_cast<unsigned int>( Length < g_MaximumTransfer ? Length : g_MaximumTransfer );
+			pEntry->user_data = reinterpret_cast<unsigned long long>( p_pFile );
+		}
+
+		m_Uring.pSubmitArray[ Index ] = Index;
+		__atomic_store_n( m_Uring.pSubmitTail, Tail + 1, __ATOMIC_RELEASE );
+		m_Uring.Unsubmitted++;
+		m_Uring.InFlight++;
+		return true;
+	}
+
+	void AsyncIo::Perform( File * p_pFile )
+	{
+		ssize_t Result = 0;
+		do
+		{
+			if( p_pFile->Writing )
+			{
+				size_t Length = p_pFile->OutputEnd - p_pFile->OutputBegin;
+				Result = write( p_pFile->Descriptor, p_pFile->Output.data( ) + p_pFile->OutputBegin,
+								Length < g_MaximumTransfer ? Length : g_MaximumTransfer );
+			}
+			else
+			{
+				size_t Length = p_pFile->Input.size( ) - p_pFile->InputEnd;
+				Result = read( p_pFile->Descriptor, p_pFile->Input.data( ) + p_pFile->InputEnd,
+							   Length < g_MaximumTransfer ? Length : g_MaximumTransfer );
+			}
+		}
+		while( Result < 0 && errno == EINTR );
+
+		if( Result >= 0 || ( errno != EAGAIN && errno != EWOULDBLOCK ) || p_pFile->Regular )
+		{
+			Complete( p_pFile, Result >= 0 ? static_cast<int>( Result ) : -errno );
+			return;
+		}
+
+		// Not ready, wait for one readiness event.
+		epoll_event Event;
+		Event.events = ( p_pFile->Writing ? EPOLLOUT : EPOLLIN ) | EPOLLONESHOT;
+		Event.data.ptr = p_pFile;
+		if( epoll_ctl( m_Epoll, p_pFile->Registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, p_pFile->Descriptor, &Event ) != 0 )
+		{
+			Complete( p_pFile, -errno );
+			return;
+		}
+		p_pFile->Registered = true;
+	}
+
+	void AsyncIo::Complete( File * p_pFile, const int p_Result )
+	{
+		if( p_pFile->Released )
+		{
+			// The cancel entries use the address as a key, drop a queued one before the address is reused.
+			std::deque<File *>::iterator Cancel = std::find( m_CancelBacklog.begin( ), m_CancelBacklog.end( ), p_pFile );
+			if( Cancel != m_CancelBacklog.end( ) )
+			{
+				m_CancelBacklog.erase( Cancel );
+			}
+
+			m_PendingCount--;
+			RemoveFile( p_pFile );
+			return;
+		}
+
+		p_pFile->Result = p_Result;
+		p_pFile->State = STATE_DONE;
+		m_PendingCount--;
+	}
+
+	int AsyncIo::Collect( File * p_pFile )
+	{
+		if( p_pFile->State != STATE_DONE )
+		{
+			return 0;
+		}
+
+		int Result = p_pFile->Result;
+		p_pFile->State = STATE_IDLE;
+
+		// Output is dropped on errors like the io library does, the buffers return to the pool when empty.
+		if( p_pFile->Writing )
+		{
+			if( Result > 0 )
+			{
+				p_pFile->OutputBegin += Result;
+			}
+			if( Result < 0 || p_pFile->OutputBegin == p_pFile->OutputEnd )
+			{
+				ReleaseBuffer( p_pFile->Output );
+				p_pFile->OutputBegin = 0;
+				p_pFile->OutputEnd = 0;
+			}
+		}
+		else if( Result > 0 )
+		{
+			p_pFile->InputEnd += Result;
+		}
+		else if( Result == 0 )
+		{
+			p_pFile->EndOfFile = true;
+		}
+
+		return Result < 0 ? Result : 0;
+	}
+
+	size_t AsyncIo::Reap( )
+	{
+		if( m_Uring.pCompleteHead == NULL )
+		{
+			return 0;
+		}
+
+		// The head is only written by us, the tail is written by the kernel.
+		unsigned int Head = *m_Uring.pCompleteHead;
+		unsigned int Tail = __atomic_load_n( m_Uring.pCompleteTail, __ATOMIC_ACQUIRE );
+		size_t Count = 0;
+
+		while( Head != Tail )
+		{
+			const io_uring_cqe & Entry = static_cast<const io_uring_cqe *>( m_Uring.pCompletions )[ Head & m_Uring.CompleteMask ];
+			File * pFile = reinterpret_cast<File *>( Entry.user_data );
+			int Result = Entry.res;
+			Head++;
+			Count++;
+			m_Uring.InFlight--;
+
+			// Cancel entries have no file.
+			if( pFile != NULL )
+			{
+				Complete( pFile, Result );
+			}
+		}
+		__atomic_store_n( m_Uring.pCompleteHead, Head, __ATOMIC_RELEASE );
+
+		// Cancels and operations waiting for a free entry, cancels first to release their files.
+		while( m_CancelBacklog.empty( ) == false && PushEntry( m_CancelBacklog.front( ), IORING_OP_ASYNC_CANCEL ) )
+		{
+			m_CancelBacklog.pop_front( );
+		}
+		while( m_Backlog.empty( ) == false &&
+			   PushEntry( m_Backlog.front( ), m_Backlog.front( )->Writing ? IORING_OP_WRITE : IORING_OP_READ ) )
+		{
+			m_Backlog.pop_front( );
+		}
+
+		return Count;
+	}
+
+	void AsyncIo::Enter( )
+	{
+		if( m_Uring.Unsubmitted == 0 )
+		{
+			return;
+		}
+
+		int Submitted = static_cast<int>( syscall( __NR_io_uring_enter, m_Uring.Descriptor, m_Uring.Unsubmitted, 0, 0, NULL, 0 ) );
+		if( Submitted > 0 )
+		{
+			m_Uring.Unsubmitted -= static_cast<unsigned int>( Submitted );
+		}
+	}
+
+	AsyncIo::File * AsyncIo::CheckFile( lua_State * p_pState )
+	{
+		File * pFile = *static_cast<File **>( luaL_checkudata( p_pState, 1, g_FileTable ) );
+		if( pFile == NULL )
+		{
+			luaL_error( p_pState, "attempt to use a closed file" );
+		}
+		if( pFile->pIo == NULL )
+		{
+			luaL_error( p_pState, "attempt to use a file of a destroyed AsyncIo" );
+		}
+		return pFile;
+	}
+
+	void AsyncIo::PushFile( lua_State * p_pState, File * p_pFile )
+	{
+		File ** ppFile = static_cast<File **>( lua_newuserdata( p_pState, sizeof( File * ) ) );
+		*ppFile = p_pFile;
+
+		if( luaL_newmetatable( p_pState, g_FileTable ) )
+		{
+			lua_pushcfunction( p_pState, LuaGarbageCollect );
+			lua_setfield( p_pState, -2, "__gc" );
+
+			// Create the waiting functions
+			lua_createtable( p_pState, 0, 4 );
+			luaL_loadstring( p_pState, g_FileFunctions );
+			lua_pushcfunction( p_pState, LuaRead );
+			lua_pushcfunction( p_pState, LuaWrite );
+			lua_pushcfunction( p_pState, LuaFlush );
+			lua_pushcfunction( p_pState, LuaClose );
+			lua_pushcfunction( p_pState, LuaBlock );
+			lua_pushcfunction( p_pState, LuaIsTask );
+			lua_pushlightuserdata( p_pState, const_cast<void *>( Scheduler::GetWaitKey( ) ) );
+			lua_call( p_pState, 7, 4 );
+			lua_setfield( p_pState, -5, "close" );
+			lua_setfield( p_pState, -4, "lines" );
+			lua_setfield( p_pState, -3, "write" );
+			lua_setfield( p_pState, -2, "read" );
+
+			lua_setfield( p_pState, -2, "__index" );
+		}
+		lua_setmetatable( p_pState, -2 );
+	}
+
+	int AsyncIo::LuaOpen( lua_State * p_pState )
+	{
+		AsyncIo * pIo = static_cast<AsyncIo *>( lua_touserdata( p_pState, lua_upvalueindex( 1 ) ) );
+		const char * pPath = luaL_checkstring( p_pState, 1 );
+		const char * pMode = luaL_optstring( p_pState, 2, "r" );
+
+		int Flags = O_CLOEXEC;
+		switch( pMode[ 0 ] )
+		{
+			case 'r': Flags |= O_RDONLY; break;
+			case 'w': Flags |= O_WRONLY | O_CREAT | O_TRUNC; break;
+			case 'a': Flags |= O_WRONLY | O_CREAT | O_APPEND; break;
+			default: return luaL_argerror( p_pState, 2, "invalid mode" );
+		}
+		luaL_argcheck( p_pState, pMode[ 1 ] == '\0' || ( pMode[ 1 ] == 'b' && pMode[ 2 ] == '\0' ), 2, "invalid mode" );
+
+		// Opening the read end of a named pipe would block until it has a writer.
+		int Descriptor = open( pPath, Flags | O_NONBLOCK, 0666 );
+		if( Descriptor < 0 )
+		{
+			lua_pushnil( p_pState );
+			lua_pushfstring( p_pState, "%s: %s", pPath, strerror( errno ) );
+			return 2;
+		}
+
+		PushFile( p_pState, pIo->AddFile( Descriptor ) );
+		return 1;
+	}
+
+	int AsyncIo::LuaPipe( lua_State * p_pState )
+	{
+		AsyncIo * pIo = static_cast<AsyncIo *>( lua_touserdata( p_pState, lua_upvalueindex( 1 ) ) );
+
+		int Descriptors[ 2 ];
+		if( pipe2( Descriptors, O_CLOEXEC ) != 0 )
+		{
+			lua_pushnil( p_pState );
+			lua_pushstring( p_pState, strerror( errno ) );
+			return 2;
+		}
+
+		PushFile( p_pState, pIo->AddFile( Descriptors[ 0 ] ) );
+		PushFile( p_pState, pIo->AddFile( Descriptors[ 1 ] ) );
+		return 2;
+	}
+
+	int AsyncIo::LuaBackend( lua_State * p_pState )
+	{
+		AsyncIo * pIo = static_cast<AsyncIo *>( lua_touserdata( p_pState, lua_upvalueindex( 1 ) ) );
+		lua_pushstring( p_pState, pIo->m_Backend == IO_BACKEND_URING ? "io_uring" : "epoll" );
+		return 1;
+	}
+
+	// The C functions below return false and the waitable while an operation is pending,
+	// the Lua functions yield or block and call them again.
+	int AsyncIo::LuaRead( lua_State * p_pState )
+	{
+		File * pFile = CheckFile( p_pState );
+		AsyncIo * pIo = pFile->pIo;
+
+		// Formats of the io library, 'n' reads a count
+		size_t Count = 0;
+		char Format = 'n';
+		if( lua_type( p_pState, 2 ) == LUA_TNUMBER )
+		{
+			lua_Integer Value = lua_tointeger( p_pState, 2 );
+			luaL_argcheck( p_pState, Value >= 0, 2, "negative count" );
+			Count = static_cast<size_t>( Value );
+		}
+		else
+		{
+			const char * pFormat = luaL_checkstring( p_pState, 2 );
+			if( pFormat[ 0 ] == '*' )
+			{
+				pFormat++;
+			}
+			Format = pFormat[ 0 ];
+			luaL_argcheck( p_pState, Format == 'l' || Format == 'L' || Format == 'a', 2, "invalid format" );
+		}
+
+		for( ;; )
+		{
+			int Error = pIo->Collect( pFile );
+			if( pFile->State == STATE_PENDING )
+			{
+				lua_pushboolean( p_pState, 0 );
+				lua_pushlightuserdata( p_pState, static_cast<Waitable *>( pFile ) );
+				return 2;
+			}
+			if( Error != 0 )
+			{
+				lua_pushnil( p_pState );
+				lua_pushstring( p_pState, strerror( -Error ) );
+				return 2;
+			}
+
+			const char * pData = pFile->Input.data( ) + pFile->InputBegin;
+			size_t Available = pFile->InputEnd - pFile->InputBegin;
+			size_t Consumed = 0;
+			size_t Length = 0;
+			bool Found = false;
+
+			if( Format == 'n' )
+			{
+				if( Available >= Count || pFile->EndOfFile )
+				{
+					Found = true;
+					Consumed = Length = Available < Count ? Available : Count;
+				}
+			}
+			else if( Format == 'a' )
+			{
+				if( pFile->EndOfFile )
+				{
+					Found = true;
+					Consumed = Length = Available;
+				}
+			}
+			else
+			{
+				const char * pLine = Available > 0 ? static_cast<const char *>( memchr( pData, '\n', Available ) ) : NULL;
+				if( pLine != NULL )
+				{
+					Found = true;
+					Consumed = static_cast<size_t>( pLine - pData ) + 1;
+					Length = Format == 'L' ? Consumed : Consumed - 1;
+				}
+				else if( pFile->EndOfFile )
+				{
+					Found = true;
+					Consumed = Length = Available;
+				}
+			}
+
+			if( Found )
+			{
+				if( Available == 0 && pFile->EndOfFile && Format != 'a' )
+				{
+					lua_pushnil( p_pState );
+					return 1;
+				}
+
+				lua_pushlstring( p_pState, Length > 0 ? pData : "", Length );
+				pFile->InputBegin += Consumed;
+				if( pFile->InputBegin == pFile->InputEnd )
+				{
+					pIo->ReleaseBuffer( pFile->Input );
+					pFile->InputBegin = 0;
+					pFile->InputEnd = 0;
+				}
+				return 1;
+			}
+
+			// Make room behind the buffered data and read more.
+			if( pFile->Input.empty( ) )
+			{
+				pIo->AcquireBuffer( pFile->Input );
+			}
+			if( pFile->InputBegin > 0 )
+			{
+				memmove( pFile->Input.data( ), pData, Available );
+				pFile->InputBegin = 0;
+				pFile->InputEnd = Available;
+			}
+			if( pFile->InputEnd == pFile->Input.size( ) )
+			{
+				pFile->Input.resize( pFile->Input.size( ) * 2 );
+			}
+			pIo->Submit( pFile, false );
+		}
+	}
+
+	int AsyncIo::LuaWrite( lua_State * p_pState )
+	{
+		File * pFile = CheckFile( p_pState );
+		AsyncIo * pIo = pFile->pIo;
+
+		int Error = pIo->Collect( pFile );
+		if( pFile->State == STATE_PENDING )
+		{
+			lua_pushboolean( p_pState, 0 );
+			lua_pushlightuserdata( p_pState, static_cast<Waitable *>( pFile ) );
+			return 2;
+		}
+		if( Error != 0 )
+		{
+			lua_pushnil( p_pState );
+			lua_pushstring( p_pState, strerror( -Error ) );
+			return 2;
+		}
+
+		// Copy the arguments to the output buffer, it stays valid while the kernel writes it.
+		int Top = lua_gettop( p_pState );
+		for( int i = 2; i <= Top; i++ )
+		{
+			size_t Length = 0;
+			const char * pData = luaL_checklstring( p_pState, i, &Length );
+
+			if( pFile->Output.empty( ) )
+			{
+				pIo->AcquireBuffer( pFile->Output );
+			}
+			while( pFile->OutputEnd + Length > pFile->Output.size( ) )
+			{
+				pFile->Output.resize( pFile->Output.size( ) * 2 );
+			}
+			memcpy( pFile->Output.data( ) + pFile->OutputEnd, pData, Length );
+			pFile->OutputEnd += Length;
+		}
+
+		if( pFile->OutputEnd > pFile->OutputBegin )
+		{
+			pIo->Submit( pFile, true );
+		}
+		lua_pushboolean( p_pState, 1 );
+		return 1;
+	}
+
+	int AsyncIo::LuaFlush( lua_State * p_pState )
+	{
+		File * pFile = CheckFile( p_pState );
+		AsyncIo * pIo = pFile->pIo;
+
+		for( ;; )
+		{
+			int Error = pIo->Collect( pFile );
+			if( pFile->State == STATE_PENDING )
+			{
+				lua_pushboolean( p_pState, 0 );
+				lua_pushlightuserdata( p_pState, static_cast<Waitable *>( pFile ) );
+				return 2;
+			}
+			if( Error != 0 )
+			{
+				lua_pushnil( p_pState );
+				lua_pushstring( p_pState, strerror( -Error ) );
+				return 2;
+			}
+
+			// Short writes are continued until the buffer is empty.
+			if( pFile->OutputBegin == pFile->OutputEnd )
+			{
+				lua_pushvalue( p_pState, 1 );
+				return 1;
+			}
+			pIo->Submit( pFile, true );
+		}
+	}
+
+	int AsyncIo::LuaBlock( lua_State * p_pState )
+	{
+		File * pFile = CheckFile( p_pState );
+		while( pFile->State == STATE_PENDING )
+		{
+			pFile->pIo->Wait( -1 );
+		}
+		return 0;
+	}
+
+	int AsyncIo::LuaIsTask( lua_State * p_pState )
+	{
+		// Plain coroutines, like generators of coroutine.wrap, block instead of yielding the wait key to their resumer.
+		lua_pushboolean( p_pState, Scheduler::IsTask( p_pState ) ? 1 : 0 );
+		return 1;
+	}
+
+	int AsyncIo::LuaClose( lua_State * p_pState )
+	{
+		File * pFile = CheckFile( p_pState );
+
+		// Tasks may wait for the pending operation, wait for it as well.
+		if( pFile->State == STATE_PENDING )
+		{
+			lua_pushboolean( p_pState, 0 );
+			lua_pushlightuserdata( p_pState, static_cast<Waitable *>( pFile ) );
+			return 2;
+		}
+
+		pFile->pIo->ReleaseFile( pFile );
+		*static_cast<File **>( lua_touserdata( p_pState, 1 ) ) = NULL;
+		lua_pushboolean( p_pState, 1 );
+		return 1;
+	}
+
+	int AsyncIo::LuaGarbageCollect( lua_State * p_pState )
+	{
+		File ** ppFile = static_cast<File **>( lua_touserdata( p_pState, 1 ) );
+		if( *ppFile == NULL )
+		{
+			return 0;
+		}
+
+		if( ( *ppFile )->pIo != NULL )
+		{
+			( *ppFile )->pIo->ReleaseFile( *ppFile );
+		}
+		else
+		{
+			delete *ppFile;
+		}
+		*ppFile = NULL;
+		return 0;
+	}
+
+}
+
+#endif
@@ -0,0 +1,413 @@
+// ///////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2013 Jimmie Bergmann - jimmiebergmann@gmail.com
+//
+// This software is provided 'as-is', without any express or
+// implied warranty. In no event will the authors be held
+// liable for any damages arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute
+// it freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented;
+//    you must not claim that you wrote the original software.
+//    If you use this software in a product, an acknowledgment
+//    in the product documentation would be appreciated but
+//    is not required.
+//
+// 2. Altered source versions must be plainly marked as such,
+//    and must not be misrepresented as being the original software.
+//
+// 3. This notice may not be removed or altered from any
+//    source distribution.
+// ///////////////////////////////////////////////////////////////////////////
+
+#include <LuaW/Bundle.hpp>
+#include "ChunkWriter.hpp"
+#include "MappedFile.hpp"
+#include <cstdio>
+#include <cstring>
+
+namespace LuaW
+{
+
+	// Magic number of the bundles, the last character is the version.
+	static const char g_BundleMagic[ 8 ] = { 'L', 'U', 'A', 'W', 'B', 'D', 'L', '1' };
+
+	// Module of the bundle, the offsets are relative to the chunk area.
+	struct Bundle::Module
+	{
+		unsigned long long NameOffset;
+		unsigned long long ChunkOffset;
+		unsigned long long ChunkSize;
+		unsigned int NameLength;
+		unsigned int Reserved;
+	};
+
+	// First bytes of the bundle, the offsets are relative to the bundle and aligned to 8 bytes.
+	// The buckets are an open addressed hash table of module numbers plus one, 0 is an empty bucket.
+	struct Bundle::Header
+	{
+		char Magic[ 8 ];
+		unsigned int ModuleCount;
+		unsigned int BucketCount; // Power of two
+		unsigned long long ModulesOffset;
+		unsigned long long BucketsOffset;
+		unsigned long long ChunksOffset;
+		unsigned long long ChunksSize;
+	};
+
+	// Constructor/destructor
+	Bundle::Bundle( ) :
+		m_pFile( NULL ),
+		m_pHeader( NULL ),
+		m_pModules( NULL ),
+		m_pBuckets( NULL ),
+		m_pChunks( NULL )
+	{
+	}
+
+	Bundle::~Bundle( )
+	{
+		Unload( );
+	}
+
+	// Public functions
+	bool Bundle::Load( const std::string & p_FileName )
+	{
+		Unload( );
+
+		MappedFile * pFile = new MappedFile;
+		if( pFile->Open( p_FileName ) == false || Load( pFile->GetData( ), pFile->GetSize( ) ) == false )
+		{
+			delete pFile;
+			return false;
+		}
+
+		m_pFile = pFile;
+		return true;
+	}
+
+	bool Bundle::Load( const char * p_pData, const size_t p_Size )
+	{
+		Unload( );
+
+		if( p_pData == NULL || ( reinterpret_cast<size_t>( p_pData ) & 7 ) != 0 || p_Size < sizeof( Header ) )
+		{
+			return false;
+		}
+
+		// The module table is small, validate every module once instead of on each lookup.
+		const Header * pHeader = reinterpret_cast<const Header *>( p_pData );
+		unsigned long long Size = static_cast<unsigned long long>( p_Size );
+		unsigned long long Modules = pHeader->ModuleCount;
+		unsigned long long Buckets = pHeader->BucketCount;
+
+		if( std::memcmp( pHeader->Magic, g_BundleMagic, sizeof( g_BundleMagic ) ) != 0 ||
+			Buckets == 0 || ( Buckets & ( Buckets - 1 ) ) != 0 || Buckets < Modules ||
+			( ( pHeader->ModulesOffset | pHeader->BucketsOffset ) & 7 ) != 0 ||
+			pHeader->ModulesOffset > Size || Modules * sizeof( Module ) > Size - pHeader->ModulesOffset ||
+			pHeader->BucketsOffset > Size || Buckets * sizeof( unsigned int ) > Size - pHeader->BucketsOffset ||
+			pHeader->ChunksOffset > Size || pHeader->ChunksSize > Size - pHeader->ChunksOffset )
+		{
+			return false;
+		}
+
+		const Module * pModules = reinterpret_cast<const Module *>( p_pData + pHeader->ModulesOffset );
+		for( unsigned long long i = 0; i < Modules; i++ )
+		{
+			const Module & Current = pModules[ i ];
+			if( Current.NameOffset > pHeader->ChunksSize || Current.NameLength > pHeader->ChunksSize - Current.NameOffset ||
+				Current.ChunkOffset > pHeader->ChunksSize || Current.ChunkSize > pHeader->ChunksSize - Current.ChunkOffset )
+			{
+				return false;
+			}
+		}
+
+		m_pHeader = pHeader;
+		m_pModules = pModules;
+		m_pBuckets = reinterpret_cast<const unsigned int *>( p_pData + pHeader->BucketsOffset );
+		m_pChunks = p_pData + pHeader->ChunksOffset;
+		return true;
+	}
+
+	void Bundle::Unload( )
+	{
+		delete m_pFile;
+
+		m_pFile = NULL;
+		m_pHeader = NULL;
+		m_pModules = NULL;
+		m_pBuckets = NULL;
+		m_pChunks = NULL;
+	}
+
+	bool Bundle::Install( lua_State * p_pState ) const
+	{
+		lua_getglobal( p_pState, "package" );
+		if( lua_istable( p_pState, -1 ) == 0 )
+		{
+			lua_pop( p_pState, 1 );
+			return false;
+		}
+
+		// LuaJIT still calls the searchers loaders.
+		lua_getfield( p_pState, -1, "searchers" );
+		if( lua_istable( p_pState, -1 ) == 0 )
+		{
+			lua_pop( p_pState, 1 );
+			lua_getfield( p_pState, -1, "loaders" );
+		}
+		if( lua_istable( p_pState, -1 ) == 0 )
+		{
+			lua_pop( p_pState, 2 );
+			return false;
+		}
+
+		// Make room after the preload searcher
+		int Count = static_cast<int>( lua_rawlen( p_pState, -1 ) );
+		for( int i = Count; i >= 2; i-- )
+		{
+			lua_rawgeti( p_pState, -1, i );
+			lua_rawseti( p_pState, -2, i + 1 );
+		}
+
+		lua_pushlightuserdata( p_pState, const_cast<Bundle *>( this ) );
+		lua_pushcclosure( p_pState, Search, 1 );
+		lua_rawseti( p_pState, -2, Count >= 1 ? 2 : 1 );
+
+		lua_pop( p_pState, 2 );
+		return true;
+	}
+
+	bool Bundle::FindModule( const char * p_pName, const size_t p_Length, const char *& p_pChunk, size_t & p_Size ) const
+	{
+		if( m_pHeader == NULL )
+		{
+			return false;
+		}
+
+		unsigned int Mask = m_pHeader->BucketCount - 1;
+		unsigned int Bucket = HashString( p_pName, p_Length ) & Mask;
+
+		// Linear probing, never more than every bucket once.
+		for( unsigned int i = 0; i < m_pHeader->BucketCount; i++ )
+		{
+			unsigned int Number = m_pBuckets[ Bucket ];
+			if( Number == 0 || Number > m_pHeader->ModuleCount )
+			{
+				return false;
+			}
+
+			const Module & Current = m_pModules[ Number - 1 ];
+			if( Current.NameLength == p_Length && std::memcmp( m_pChunks + Current.NameOffset, p_pName, p_Length ) == 0 )
+			{
+				p_pChunk = m_pChunks + Current.ChunkOffset;
+				p_Size = static_cast<size_t>( Current.ChunkSize );
+				return true;
+			}
+
+			Bucket = ( Bucket + 1 ) & Mask;
+		}
+
+		return false;
+	}
+
+	// General get functions
+	bool Bundle::IsLoaded( ) const
+	{
+		return m_pHeader != NULL;
+	}
+
+	size_t Bundle::GetModuleCount( ) const
+	{
+		return m_pHeader ? m_pHeader->ModuleCount : 0;
+	}
+
+	const char * Bundle::GetModuleName( const size_t p_Module, size_t & p_Length ) const
+	{
+		p_Length = m_pModules[ p_Module ].NameLength;
+		return m_pChunks + m_pModules[ p_Module ].NameOffset;
+	}
+
+	// Private functions
+	int Bundle::Search( lua_State * p_pState )
+	{
+		const Bundle * pBundle = static_cast<const Bundle *>( lua_touserdata( p_pState, lua_upvalueindex( 1 ) ) );
+		size_t Length = 0;
+		const char * pName = luaL_checklstring( p_pState, 1, &Length );
+
+		const char * pChunk = NULL;
+		size_t Size = 0;
+		if( pBundle->FindModule( pName, Length, pChunk, Size ) == false )
+		{
+			lua_pushfstring( p_pState, "\n\tno module '%s' in bundle", pName );
+			return 1;
+		}
+
+		// The chunk is loaded straight from the bundle memory.
+		const char * pChunkName = lua_pushfstring( p_pState, "@%s", pName );
+		if( luaL_loadbuffer( p_pState, pChunk, Size, pChunkName ) != LUA_OK )
+		{
+			return luaL_error( p_pState, "error loading module '%s' from bundle:\n\t%s", pName, lua_tostring( p_pState, -1 ) );
+		}
+
+		// The loader gets the name as its second argument, as for files.
+		lua_pushvalue( p_pState, 1 );
+		return 2;
+	}
+
+
+	// Constructor
+	BundleBuilder::BundleBuilder( )
+	{
+	}
+
+	// Public functions
+	void BundleBuilder::AddModule( const std::string & p_Name, const std::string & p_Chunk )
+	{
+		for( size_t i = 0; i < m_Names.size( ); i++ )
+		{
+			if( m_Names[ i ] == p_Name )
+			{
+				m_Chunks[ i ] = p_Chunk;
+				return;
+			}
+		}
+
+		m_Names.push_back( p_Name );
+		m_Chunks.push_back( p_Chunk );
+	}
+
+	bool BundleBuilder::AddFile( const std::string & p_Name, const std::string & p_FileName, const bool p_Precompile )
+	{
+		// Read the source
+		std::string Source;
+		FILE * pFile = fopen( p_FileName.c_str( ), "rb" );
+		if( pFile == NULL )
+		{
+			m_LastError = "cannot open " + p_FileName;
+			return false;
+		}
+
+		char Buffer[ 4096 ];
+		size_t Read = 0;
+		while( ( Read = fread( Buffer, 1, sizeof( Buffer ), pFile ) ) > 0 )
+		{
+			Source.append( Buffer, Read );
+		}
+		fclose( pFile );
+
+		// Compile even if the source is kept, syntax errors are found when building.
+		lua_State * pState = luaL_newstate( );
+		if( pState == NULL )
+		{
+			m_LastError = "cannot create a Lua state";
+			return false;
+		}
+
+		std::string ChunkName = "@" + p_Name;
+		if( luaL_loadbuffer( pState, Source.data( ), Source.size( ), ChunkName.c_str( ) ) != LUA_OK )
+		{
+			m_LastError = lua_tostring( pState, -1 );
+			lua_close( pState );
+			return false;
+		}
+
+		std::string Chunk;
+		if( p_Precompile )
+		{
+			lua_dump( pState, WriteChunk, &Chunk );
+		}
+		lua_close( pState );
+
+		AddModule( p_Name, p_Precompile ? Chunk : Source );
+		return true;
+	}
+
+	bool BundleBuilder::Save( const std::string & p_FileName ) const
+	{
+		typedef Bundle::Header Header;
+		typedef Bundle::Module Module;
+
+		size_t ModuleCount = m_Names.size( );
+		size_t BucketCount = 1;
+		while( BucketCount < ModuleCount * 2 )
+		{
+			BucketCount <<= 1;
+		}
+
+		// The names and chunks follow the tables
+		std::vector<Module> Modules( ModuleCount );
+		std::vector<unsigned int> Buckets( BucketCount, 0 );
+		std::string Chunks;
+
+		for( size_t i = 0; i < ModuleCount; i++ )
+		{
+			Module & Current = Modules[ i ];
+			std::memset( &Current, 0, sizeof( Current ) );
+			Current.NameOffset = Chunks.size( );
+			Current.NameLength = static_cast<unsigned int>( m_Names[ i ].size( ) );
+			Chunks.append( m_Names[ i ] );
+			Current.ChunkOffset = Chunks.size( );
+			Current.ChunkSize = m_Chunks[ i ].size( );
+			Chunks.append( m_Chunks[ i ] );
+
+			unsigned int Bucket = HashString( m_Names[ i ].data( ), m_Names[ i ].size( ) ) & ( BucketCount - 1 );
+			while( Buckets[ Bucket ] )
+			{
+				Bucket = ( Bucket + 1 ) & ( BucketCount - 1 );
+			}
+			Buckets[ Bucket ] = static_cast<unsigned int>( i + 1 );
+		}
+
+		Header BundleHeader;
+		std::memset( &BundleHeader, 0, sizeof( BundleHeader ) );
+		std::memcpy( BundleHeader.Magic, g_BundleMagic, sizeof( g_BundleMagic ) );
+		BundleHeader.ModuleCount = static_cast<unsigned int>( ModuleCount );
+		BundleHeader.BucketCount = static_cast<unsigned int>( BucketCount );
+		BundleHeader.ModulesOffset = sizeof( Header );
+		BundleHeader.BucketsOffset = BundleHeader.ModulesOffset + ModuleCount * sizeof( Module );
+		BundleHeader.ChunksOffset = BundleHeader.BucketsOffset + BucketCount * sizeof( unsigned int );
+		BundleHeader.ChunksSize = Chunks.size( );
+
+		FILE * pFile = fopen( p_FileName.c_str( ), "wb" );
+		if( pFile == NULL )
+		{
+			return false;
+		}
+
+		bool Written = fwrite( &BundleHeader, sizeof( BundleHeader ), 1, pFile ) == 1;
+		if( ModuleCount )
+		{
+			Written = Written && fwrite( &Modules[ 0 ], sizeof( Module ), ModuleCount, pFile ) == ModuleCount;
+		}
+		Written = Written && fwrite( &Buckets[ 0 ], sizeof( unsigned int ), BucketCount, pFile ) == BucketCount;
+		Written = Written && fwrite( Chunks.data( ), 1, Chunks.size( ), pFile ) == Chunks.size( );
+
+		if( fclose( pFile ) != 0 )
+		{
+			Written = false;
+		}
+		return Written;
+	}
+
+	void BundleBuilder::Clear( )
+	{
+		m_Names.clear( );
+		m_Chunks.clear( );
+		m_LastError.clear( );
+	}
+
+	// General get functions
+	const std::string & BundleBuilder::GetLastError( ) const
+	{
+		return m_LastError;
+	}
+
+	size_t BundleBuilder::GetModuleCount( ) const
+	{
+		return m_Names.size( );
+	}
+
+}
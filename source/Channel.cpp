@@ -0,0 +1,266 @@
+// ///////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2013 Jimmie Bergmann - jimmiebergmann@gmail.com
+//
+// This software is provided 'as-is', without any express or
+// implied warranty. In no event will the authors be held
+// liable for any damages arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute
+// it freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented;
+//    you must not claim that you wrote the original software.
+//    If you use this software in a product, an acknowledgment
+//    in the product documentation would be appreciated but
+//    is not required.
+//
+// 2. Altered source versions must be plainly marked as such,
+//    and must not be misrepresented as being the original software.
+//
+// 3. This notice may not be removed or altered from any
+//    source distribution.
+// ///////////////////////////////////////////////////////////////////////////
+
+#include <LuaW/Channel.hpp>
+#include <LuaW/Serializer.hpp>
+
+namespace LuaW
+{
+
+	// Metatable name of the channels
+	static const char * g_ChannelTable = "LuaW_Channel";
+
+	// Waiting versions of send and recv, they yield to the scheduler and try again.
+	static const char * g_ChannelFunctions =
+		"local TrySend, TryReceive, Wait, IsTask, Key = ...\n"
+		"local yield = coroutine.yield\n"
+		"local function recv( self )\n"
+		"	while true do\n"
+		"		local Ok, Value = TryReceive( self )\n"
+		"		if Ok then return Value end\n"
+		"		if not IsTask( ) then error( 'channel is empty', 2 ) end\n"
+		"		yield( Key, Wait( self, false ) )\n"
+		"	end\n"
+		"end\n"
+		"local function send( self, Value )\n"
+		"	while not TrySend( self, Value ) do\n"
+		"		if not IsTask( ) then return false end\n"
+		"		yield( Key, Wait( self, true ) )\n"
+		"	end\n"
+		"	return true\n"
+		"end\n"
+		"return recv, send\n";
+
+	// Constructor/destructor
+	Channel::Channel( const size_t p_Capacity ) :
+		m_pCells( NULL ),
+		m_Mask( 0 ),
+		m_SendPosition( 0 ),
+		m_ReceivePosition( 0 ),
+		m_Readable( *this ),
+		m_Writable( *this )
+	{
+		size_t Capacity = 2;
+		while( Capacity < p_Capacity )
+		{
+			Capacity <<= 1;
+		}
+
+		m_pCells = new Cell[ Capacity ];
+		m_Mask = Capacity - 1;
+		for( size_t i = 0; i < Capacity; i++ )
+		{
+			m_pCells[ i ].Sequence.store( i, std::memory_order_relaxed );
+		}
+	}
+
+	Channel::~Channel( )
+	{
+		delete [ ] m_pCells;
+	}
+
+	// Public functions
+	bool Channel::TrySend( std::string & p_Message )
+	{
+		// Bounded MPMC queue, the cell sequence equals the position when the cell is free.
+		size_t Position = m_SendPosition.load( std::memory_order_relaxed );
+		Cell * pCell = NULL;
+
+		for( ;; )
+		{
+			pCell = &m_pCells[ Position & m_Mask ];
+			size_t Sequence = pCell->Sequence.load( std::memory_order_acquire );
+			ptrdiff_t Difference = static_cast<ptrdiff_t>( Sequence ) - static_cast<ptrdiff_t>( Position );
+
+			if( Difference == 0 )
+			{
+				if( m_SendPosition.compare_exchange_weak( Position, Position + 1, std::memory_order_relaxed ) )
+				{
+					break;
+				}
+			}
+			else if( Difference < 0 )
+			{
+				return false;
+			}
+			else
+			{
+				Position = m_SendPosition.load( std::memory_order_relaxed );
+			}
+		}
+
+		// The old buffer of the cell is handed back to the caller for reuse.
+		pCell->Message.swap( p_Message );
+		pCell->Sequence.store( Position + 1, std::memory_order_release );
+		return true;
+	}
+
+	bool Channel::TryReceive( std::string & p_Message )
+	{
+		size_t Position = m_ReceivePosition.load( std::memory_order_relaxed );
+		Cell * pCell = NULL;
+
+		for( ;; )
+		{
+			pCell = &m_pCells[ Position & m_Mask ];
+			size_t Sequence = pCell->Sequence.load( std::memory_order_acquire );
+			ptrdiff_t Difference = static_cast<ptrdiff_t>( Sequence ) - static_cast<ptrdiff_t>( Position + 1 );
+
+			if( Difference == 0 )
+			{
+				if( m_ReceivePosition.compare_exchange_weak( Position, Position + 1, std::memory_order_relaxed ) )
+				{
+					break;
+				}
+			}
+			else if( Difference < 0 )
+			{
+				return false;
+			}
+			else
+			{
+				Position = m_ReceivePosition.load( std::memory_order_relaxed );
+			}
+		}
+
+		pCell->Message.swap( p_Message );
+		pCell->Sequence.store( Position + m_Mask + 1, std::memory_order_release );
+		return true;
+	}
+
+	bool Channel::TrySend( lua_State * p_pState, const int p_Index )
+	{
+		// Encode into the scratch buffer of the state, sending swaps in the old buffer of the cell.
+		Serializer & Current = Serializer::Get( p_pState );
+		std::string & Message = Current.GetScratchBuffer( );
+		if( Current.Encode( p_pState, p_Index, Message ) == false )
+		{
+			luaL_error( p_pState, "value cannot be sent through a channel: %s", Current.GetLastError( ) );
+		}
+		return TrySend( Message );
+	}
+
+	bool Channel::TryReceive( lua_State * p_pState )
+	{
+		Serializer & Current = Serializer::Get( p_pState );
+		std::string & Message = Current.GetScratchBuffer( );
+		if( TryReceive( Message ) == false )
+		{
+			return false;
+		}
+
+		if( Current.Decode( p_pState, Message ) == false )
+		{
+			luaL_error( p_pState, "corrupt channel message: %s", Current.GetLastError( ) );
+		}
+		return true;
+	}
+
+	void Channel::Push( lua_State * p_pState )
+	{
+		Channel ** ppChannel = static_cast<Channel **>( lua_newuserdata( p_pState, sizeof( Channel * ) ) );
+		*ppChannel = this;
+
+		if( luaL_newmetatable( p_pState, g_ChannelTable ) )
+		{
+			lua_createtable( p_pState, 0, 4 );
+
+			lua_pushcfunction( p_pState, LuaTrySend );
+			lua_setfield( p_pState, -2, "try_send" );
+			lua_pushcfunction( p_pState, LuaTryReceive );
+			lua_setfield( p_pState, -2, "try_recv" );
+
+			// Create the waiting functions
+			luaL_loadstring( p_pState, g_ChannelFunctions );
+			lua_pushcfunction( p_pState, LuaTrySend );
+			lua_pushcfunction( p_pState, LuaTryReceive );
+			lua_pushcfunction( p_pState, LuaWait );
+			lua_pushcfunction( p_pState, LuaIsTask );
+			lua_pushlightuserdata( p_pState, const_cast<void *>( Scheduler::GetWaitKey( ) ) );
+			lua_call( p_pState, 5, 2 );
+			lua_setfield( p_pState, -3, "send" );
+			lua_setfield( p_pState, -2, "recv" );
+
+			lua_setfield( p_pState, -2, "__index" );
+		}
+		lua_setmetatable( p_pState, -2 );
+	}
+
+	// General get functions
+	size_t Channel::GetCapacity( ) const
+	{
+		return m_Mask + 1;
+	}
+
+	bool Channel::IsEmpty( ) const
+	{
+		size_t Position = m_ReceivePosition.load( std::memory_order_relaxed );
+		return m_pCells[ Position & m_Mask ].Sequence.load( std::memory_order_acquire ) != Position + 1;
+	}
+
+	bool Channel::IsFull( ) const
+	{
+		size_t Position = m_SendPosition.load( std::memory_order_relaxed );
+		return m_pCells[ Position & m_Mask ].Sequence.load( std::memory_order_acquire ) != Position;
+	}
+
+	// Private functions
+	int Channel::LuaTrySend( lua_State * p_pState )
+	{
+		Channel * pChannel = *static_cast<Channel **>( luaL_checkudata( p_pState, 1, g_ChannelTable ) );
+		lua_pushboolean( p_pState, pChannel->TrySend( p_pState, 2 ) ? 1 : 0 );
+		return 1;
+	}
+
+	int Channel::LuaTryReceive( lua_State * p_pState )
+	{
+		Channel * pChannel = *static_cast<Channel **>( luaL_checkudata( p_pState, 1, g_ChannelTable ) );
+		if( pChannel->TryReceive( p_pState ) == false )
+		{
+			lua_pushboolean( p_pState, 0 );
+			return 1;
+		}
+
+		lua_pushboolean( p_pState, 1 );
+		lua_insert( p_pState, -2 );
+		return 2;
+	}
+
+	int Channel::LuaWait( lua_State * p_pState )
+	{
+		Channel * pChannel = *static_cast<Channel **>( luaL_checkudata( p_pState, 1, g_ChannelTable ) );
+		const Waitable * pWaitable = lua_toboolean( p_pState, 2 ) ?
+			static_cast<const Waitable *>( &pChannel->m_Writable ) : static_cast<const Waitable *>( &pChannel->m_Readable );
+		lua_pushlightuserdata( p_pState, const_cast<Waitable *>( pWaitable ) );
+		return 1;
+	}
+
+	int Channel::LuaIsTask( lua_State * p_pState )
+	{
+		// Plain coroutines fail or return false like the main thread, the wait key would reach their resumer.
+		lua_pushboolean( p_pState, Scheduler::IsTask( p_pState ) ? 1 : 0 );
+		return 1;
+	}
+
+}
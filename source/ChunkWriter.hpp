@@ -0,0 +1,46 @@
+// ///////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2013 Jimmie Bergmann - jimmiebergmann@gmail.com
+//
+// This software is provided 'as-is', without any express or
+// implied warranty. In no event will the authors be held
+// liable for any damages arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute
+// it freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented;
+//    you must not claim that you wrote the original software.
+//    If you use this software in a product, an acknowledgment
+//    in the product documentation would be appreciated but
+//    is not required.
+//
+// 2. Altered source versions must be plainly marked as such,
+//    and must not be misrepresented as being the original software.
+//
+// 3. This notice may not be removed or altered from any
+//    source distribution.
+// ///////////////////////////////////////////////////////////////////////////
+
+// Internal lua_dump writer, shared by the bundle builder and the parallel loader.
+
+#ifndef LUA_W_CHUNK_WRITER_HPP
+#define LUA_W_CHUNK_WRITER_HPP
+
+#include <LuaW.hpp>
+#include <string>
+
+namespace LuaW
+{
+
+	// Appends the dumped chunk to the std::string passed as the data of lua_dump.
+	inline int WriteChunk( lua_State * p_pState, const void * p_pData, size_t p_Size, void * p_pChunk )
+	{
+		( void )p_pState;
+		static_cast<std::string *>( p_pChunk )->append( static_cast<const char *>( p_pData ), p_Size );
+		return 0;
+	}
+
+}
+
+#endif
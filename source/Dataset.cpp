@@ -0,0 +1,843 @@
+// ///////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2013 Jimmie Bergmann - jimmiebergmann@gmail.com
+//
+// This software is provided 'as-is', without any express or
+// implied warranty. In no event will the authors be held
+// liable for any damages arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute
+// it freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented;
+//    you must not claim that you wrote the original software.
+//    If you use this software in a product, an acknowledgment
+//    in the product documentation would be appreciated but
+//    is not required.
+//
+// 2. Altered source versions must be plainly marked as such,
+//    and must not be misrepresented as being the original software.
+//
+// 3. This notice may not be removed or altered from any
+//    source distribution.
+// ///////////////////////////////////////////////////////////////////////////
+
+#include <LuaW/Dataset.hpp>
+#include "MappedFile.hpp"
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+
+namespace LuaW
+{
+
+	// Metatable name of the datasets
+	static const char * g_DatasetTable = "LuaW_Dataset";
+
+	// Key of the generation in the row metatables, its address marks them as row metatables.
+	static const char g_RowKey = 0;
+
+	// Last generation given to a loaded block
+	static std::atomic<unsigned long long> g_Generation( 0 );
+
+	// Magic number of the blocks, the last character is the version.
+	static const char g_DatasetMagic[ 8 ] = { 'L', 'U', 'A', 'W', 'D', 'S', 'E', '1' };
+
+	// String in the pool of the block
+	struct Dataset::String
+	{
+		unsigned int Offset;
+		unsigned int Length;
+	};
+
+	// Column of the block, the values are stored contiguously at the data offset.
+	struct Dataset::Column
+	{
+		String Name;
+		unsigned int Type;
+		unsigned int Reserved;
+		unsigned long long DataOffset;
+	};
+
+	// First bytes of the block, every offset is relative to the block and aligned to 8 bytes.
+	// The buckets are an open addressed hash table of row numbers plus one, 0 is an empty bucket.
+	struct Dataset::Header
+	{
+		char Magic[ 8 ];
+		unsigned int RowCount;
+		unsigned int ColumnCount;
+		unsigned int BucketCount; // Power of two
+		unsigned int Reserved;
+		unsigned long long KeysOffset;
+		unsigned long long BucketsOffset;
+		unsigned long long ColumnsOffset;
+		unsigned long long StringsOffset;
+		unsigned long long StringsSize;
+	};
+
+	// Row proxy data
+	struct RowProxy
+	{
+		const Dataset * pDataset;
+		unsigned long long Generation;
+		size_t Row;
+	};
+
+	static size_t GetValueSize( const unsigned int p_Type )
+	{
+		return p_Type == COLUMN_BOOLEAN ? 1 : 8;
+	}
+
+	static size_t Align( const size_t p_Size )
+	{
+		return ( p_Size + 7 ) & ~static_cast<size_t>( 7 );
+	}
+
+	// Constructor/destructor
+	Dataset::Dataset( ) :
+		m_pData( NULL ),
+		m_Size( 0 ),
+		m_pBuffer( NULL ),
+		m_pFile( NULL ),
+		m_pHeader( NULL ),
+		m_pKeys( NULL ),
+		m_pBuckets( NULL ),
+		m_pColumns( NULL ),
+		m_pStrings( NULL ),
+		m_Generation( 0 )
+	{
+	}
+
+	Dataset::~Dataset( )
+	{
+		Unload( );
+	}
+
+	// Public functions
+	bool Dataset::Load( const std::string & p_FileName )
+	{
+		Unload( );
+
+		m_pFile = new MappedFile;
+		if( m_pFile->Open( p_FileName ) == false || Attach( m_pFile->GetData( ), m_pFile->GetSize( ) ) == false )
+		{
+			Unload( );
+			return false;
+		}
+		return true;
+	}
+
+	void Dataset::Unload( )
+	{
+		delete m_pFile;
+		delete [ ] m_pBuffer;
+
+		m_pData = NULL;
+		m_Size = 0;
+		m_pBuffer = NULL;
+		m_pFile = NULL;
+		m_pHeader = NULL;
+		m_pKeys = NULL;
+		m_pBuckets = NULL;
+		m_pColumns = NULL;
+		m_pStrings = NULL;
+		m_Generation = 0;
+	}
+
+	void Dataset::Push( lua_State * p_pState ) const
+	{
+		const Dataset ** ppDataset = static_cast<const Dataset **>( lua_newuserdata( p_pState, sizeof( Dataset * ) ) );
+		*ppDataset = this;
+
+		if( luaL_newmetatable( p_pState, g_DatasetTable ) )
+		{
+			lua_pushcfunction( p_pState, Index );
+			lua_setfield( p_pState, -2, "__index" );
+			lua_pushcfunction( p_pState, Length );
+			lua_setfield( p_pState, -2, "__len" );
+			lua_pushcfunction( p_pState, Pairs );
+			lua_setfield( p_pState, -2, "__pairs" );
+			lua_pushboolean( p_pState, 0 );
+			lua_setfield( p_pState, -2, "__metatable" );
+		}
+		lua_setmetatable( p_pState, -2 );
+	}
+
+	bool Dataset::FindRow( const char * p_pKey, const size_t p_Length, size_t & p_Row ) const
+	{
+		if( m_pHeader == NULL )
+		{
+			return false;
+		}
+
+		unsigned int Mask = m_pHeader->BucketCount - 1;
+		unsigned int Bucket = HashString( p_pKey, p_Length ) & Mask;
+
+		// Linear probing, never more than every bucket once.
+		for( unsigned int i = 0; i < m_pHeader->BucketCount; i++ )
+		{
+			unsigned int Row = m_pBuckets[ Bucket ];
+			if( Row == 0 || Row > m_pHeader->RowCount )
+			{
+				return false;
+			}
+
+			size_t Length = 0;
+			const char * pKey = GetPoolString( m_pKeys[ Row - 1 ], Length );
+			if( Length == p_Length && std::memcmp( pKey, p_pKey, p_Length ) == 0 )
+			{
+				p_Row = Row - 1;
+				return true;
+			}
+
+			Bucket = ( Bucket + 1 ) & Mask;
+		}
+
+		return false;
+	}
+
+	// General get functions
+	bool Dataset::IsLoaded( ) const
+	{
+		return m_pHeader != NULL;
+	}
+
+	size_t Dataset::GetRowCount( ) const
+	{
+		return m_pHeader ? m_pHeader->RowCount : 0;
+	}
+
+	size_t Dataset::GetColumnCount( ) const
+	{
+		return m_pHeader ? m_pHeader->ColumnCount : 0;
+	}
+
+	const char * Dataset::GetKey( const size_t p_Row, size_t & p_Length ) const
+	{
+		return GetPoolString( m_pKeys[ p_Row ], p_Length );
+	}
+
+	const char * Dataset::GetColumnName( const size_t p_Column, size_t & p_Length ) const
+	{
+		return GetPoolString( m_pColumns[ p_Column ].Name, p_Length );
+	}
+
+	bool Dataset::FindColumn( const char * p_pName, size_t & p_Column ) const
+	{
+		size_t NameLength = std::strlen( p_pName );
+		for( size_t i = 0; i < GetColumnCount( ); i++ )
+		{
+			size_t Length = 0;
+			const char * pName = GetColumnName( i, Length );
+			if( Length == NameLength && std::memcmp( pName, p_pName, Length ) == 0 )
+			{
+				p_Column = i;
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	eColumnType Dataset::GetColumnType( const size_t p_Column ) const
+	{
+		return static_cast<eColumnType>( m_pColumns[ p_Column ].Type );
+	}
+
+	bool Dataset::GetBoolean( const size_t p_Row, const size_t p_Column ) const
+	{
+		return m_pData[ m_pColumns[ p_Column ].DataOffset + p_Row ] != 0;
+	}
+
+	long long Dataset::GetInteger( const size_t p_Row, const size_t p_Column ) const
+	{
+		return reinterpret_cast<const long long *>( m_pData + m_pColumns[ p_Column ].DataOffset )[ p_Row ];
+	}
+
+	double Dataset::GetNumber( const size_t p_Row, const size_t p_Column ) const
+	{
+		return reinterpret_cast<const double *>( m_pData + m_pColumns[ p_Column ].DataOffset )[ p_Row ];
+	}
+
+	const char * Dataset::GetString( const size_t p_Row, const size_t p_Column, size_t & p_Length ) const
+	{
+		const String * pStrings = reinterpret_cast<const String *>( m_pData + m_pColumns[ p_Column ].DataOffset );
+		return GetPoolString( pStrings[ p_Row ], p_Length );
+	}
+
+	// Private functions
+	bool Dataset::Attach( const char * p_pData, const size_t p_Size )
+	{
+		// Validate everything but the strings, they are checked when read to not touch every page here.
+		if( p_Size < sizeof( Header ) )
+		{
+			return false;
+		}
+
+		const Header * pHeader = reinterpret_cast<const Header *>( p_pData );
+		unsigned long long Size = static_cast<unsigned long long>( p_Size );
+		unsigned long long Rows = pHeader->RowCount;
+		unsigned long long Buckets = pHeader->BucketCount;
+		unsigned long long Columns = pHeader->ColumnCount;
+
+		if( std::memcmp( pHeader->Magic, g_DatasetMagic, sizeof( g_DatasetMagic ) ) != 0 ||
+			Buckets == 0 || ( Buckets & ( Buckets - 1 ) ) != 0 || Buckets < Rows ||
+			( ( pHeader->KeysOffset | pHeader->BucketsOffset | pHeader->ColumnsOffset ) & 7 ) != 0 ||
+			pHeader->KeysOffset > Size || Rows * sizeof( String ) > Size - pHeader->KeysOffset ||
+			pHeader->BucketsOffset > Size || Buckets * sizeof( unsigned int ) > Size - pHeader->BucketsOffset ||
+			pHeader->ColumnsOffset > Size || Columns * sizeof( Column ) > Size - pHeader->ColumnsOffset ||
+			pHeader->StringsOffset > Size || pHeader->StringsSize > Size - pHeader->StringsOffset )
+		{
+			return false;
+		}
+
+		const Column * pColumns = reinterpret_cast<const Column *>( p_pData + pHeader->ColumnsOffset );
+		for( unsigned long long i = 0; i < Columns; i++ )
+		{
+			const Column & Current = pColumns[ i ];
+			if( Current.Type > COLUMN_STRING || ( Current.DataOffset & 7 ) != 0 ||
+				Current.DataOffset > Size || Rows * GetValueSize( Current.Type ) > Size - Current.DataOffset )
+			{
+				return false;
+			}
+		}
+
+		m_pData = p_pData;
+		m_Size = p_Size;
+		m_pHeader = pHeader;
+		m_pKeys = reinterpret_cast<const String *>( p_pData + pHeader->KeysOffset );
+		m_pBuckets = reinterpret_cast<const unsigned int *>( p_pData + pHeader->BucketsOffset );
+		m_pColumns = pColumns;
+		m_pStrings = p_pData + pHeader->StringsOffset;
+		m_Generation = ++g_Generation;
+		return true;
+	}
+
+	const char * Dataset::GetPoolString( const String & p_String, size_t & p_Length ) const
+	{
+		if( static_cast<unsigned long long>( p_String.Offset ) + p_String.Length > m_pHeader->StringsSize )
+		{
+			p_Length = 0;
+			return "";
+		}
+
+		p_Length = p_String.Length;
+		return m_pStrings + p_String.Offset;
+	}
+
+	void Dataset::PushRow( lua_State * p_pState, const size_t p_Row ) const
+	{
+		RowProxy * pRow = static_cast<RowProxy *>( lua_newuserdata( p_pState, sizeof( RowProxy ) ) );
+		pRow->pDataset = this;
+		pRow->Generation = m_Generation;
+		pRow->Row = p_Row;
+
+		PushRowTable( p_pState );
+		lua_setmetatable( p_pState, -2 );
+	}
+
+	void Dataset::PushRowTable( lua_State * p_pState ) const
+	{
+		// The row metatable is cached per state under the dataset,
+		// it is rebuilt when another block was loaded since it was created.
+		lua_rawgetp( p_pState, LUA_REGISTRYINDEX, this );
+		if( lua_istable( p_pState, -1 ) )
+		{
+			lua_rawgetp( p_pState, -1, &g_RowKey );
+			bool Current = lua_tonumber( p_pState, -1 ) == static_cast<lua_Number>( m_Generation );
+			lua_pop( p_pState, 1 );
+			if( Current )
+			{
+				return;
+			}
+		}
+		lua_pop( p_pState, 1 );
+
+		lua_createtable( p_pState, 0, 4 );
+
+		// Map of the column names to the column numbers
+		size_t ColumnCount = GetColumnCount( );
+		lua_createtable( p_pState, 0, static_cast<int>( ColumnCount ) );
+		for( size_t i = 0; i < ColumnCount; i++ )
+		{
+			size_t Length = 0;
+			const char * pName = GetColumnName( i, Length );
+			lua_pushlstring( p_pState, pName, Length );
+			lua_pushinteger( p_pState, static_cast<lua_Integer>( i + 1 ) );
+			lua_rawset( p_pState, -3 );
+		}
+		lua_pushcclosure( p_pState, RowIndex, 1 );
+		lua_setfield( p_pState, -2, "__index" );
+
+		lua_pushcfunction( p_pState, RowPairs );
+		lua_setfield( p_pState, -2, "__pairs" );
+		lua_pushboolean( p_pState, 0 );
+		lua_setfield( p_pState, -2, "__metatable" );
+
+		lua_pushnumber( p_pState, static_cast<lua_Number>( m_Generation ) );
+		lua_rawsetp( p_pState, -2, &g_RowKey );
+
+		lua_pushvalue( p_pState, -1 );
+		lua_rawsetp( p_pState, LUA_REGISTRYINDEX, this );
+	}
+
+	const void * Dataset::CheckRow( lua_State * p_pState )
+	{
+		// Only row metatables hold the generation key.
+		bool IsRow = false;
+		if( lua_type( p_pState, 1 ) == LUA_TUSERDATA && lua_getmetatable( p_pState, 1 ) )
+		{
+			lua_rawgetp( p_pState, -1, &g_RowKey );
+			IsRow = lua_type( p_pState, -1 ) == LUA_TNUMBER;
+			lua_pop( p_pState, 2 );
+		}
+		if( IsRow == false )
+		{
+			luaL_error( p_pState, "dataset row expected" );
+			return NULL;
+		}
+
+		// The columns and rows may have changed since the row was pushed.
+		const RowProxy * pRow = static_cast<const RowProxy *>( lua_touserdata( p_pState, 1 ) );
+		if( pRow->Generation != pRow->pDataset->m_Generation )
+		{
+			luaL_error( p_pState, "dataset row is stale" );
+			return NULL;
+		}
+		return pRow;
+	}
+
+	void Dataset::PushValue( lua_State * p_pState, const size_t p_Row, const size_t p_Column ) const
+	{
+		switch( m_pColumns[ p_Column ].Type )
+		{
+			case COLUMN_BOOLEAN:
+			{
+				lua_pushboolean( p_pState, GetBoolean( p_Row, p_Column ) ? 1 : 0 );
+			}
+			break;
+			case COLUMN_INTEGER:
+			{
+				lua_pushinteger( p_pState, static_cast<lua_Integer>( GetInteger( p_Row, p_Column ) ) );
+			}
+			break;
+			case COLUMN_NUMBER:
+			{
+				lua_pushnumber( p_pState, static_cast<lua_Number>( GetNumber( p_Row, p_Column ) ) );
+			}
+			break;
+			default:
+			{
+				size_t Length = 0;
+				const char * pString = GetString( p_Row, p_Column, Length );
+				lua_pushlstring( p_pState, pString, Length );
+			}
+			break;
+		}
+	}
+
+	int Dataset::Index( lua_State * p_pState )
+	{
+		const Dataset * pDataset = *static_cast<const Dataset **>( luaL_checkudata( p_pState, 1, g_DatasetTable ) );
+		size_t Row = 0;
+		bool Found = false;
+
+		if( lua_type( p_pState, 2 ) == LUA_TSTRING )
+		{
+			size_t Length = 0;
+			const char * pKey = lua_tolstring( p_pState, 2, &Length );
+			Found = pDataset->FindRow( pKey, Length, Row );
+		}
+		else if( lua_type( p_pState, 2 ) == LUA_TNUMBER )
+		{
+			lua_Integer Number = lua_tointeger( p_pState, 2 );
+			Found = Number >= 1 && static_cast<size_t>( Number ) <= pDataset->GetRowCount( );
+			Row = static_cast<size_t>( Number - 1 );
+		}
+
+		if( Found == false )
+		{
+			lua_pushnil( p_pState );
+			return 1;
+		}
+
+		pDataset->PushRow( p_pState, Row );
+		return 1;
+	}
+
+	int Dataset::Length( lua_State * p_pState )
+	{
+		const Dataset * pDataset = *static_cast<const Dataset **>( luaL_checkudata( p_pState, 1, g_DatasetTable ) );
+		lua_pushinteger( p_pState, static_cast<lua_Integer>( pDataset->GetRowCount( ) ) );
+		return 1;
+	}
+
+	int Dataset::Pairs( lua_State * p_pState )
+	{
+		luaL_checkudata( p_pState, 1, g_DatasetTable );
+
+		// The position is kept as an upvalue instead of looking up the previous key.
+		lua_pushinteger( p_pState, 0 );
+		lua_pushcclosure( p_pState, Next, 1 );
+		lua_pushvalue( p_pState, 1 );
+		lua_pushnil( p_pState );
+		return 3;
+	}
+
+	int Dataset::Next( lua_State * p_pState )
+	{
+		const Dataset * pDataset = *static_cast<const Dataset **>( luaL_checkudata( p_pState, 1, g_DatasetTable ) );
+		size_t Row = static_cast<size_t>( lua_tointeger( p_pState, lua_upvalueindex( 1 ) ) );
+		if( Row >= pDataset->GetRowCount( ) )
+		{
+			return 0;
+		}
+
+		lua_pushinteger( p_pState, static_cast<lua_Integer>( Row + 1 ) );
+		lua_replace( p_pState, lua_upvalueindex( 1 ) );
+
+		size_t Length = 0;
+		const char * pKey = pDataset->GetKey( Row, Length );
+		lua_pushlstring( p_pState, pKey, Length );
+		pDataset->PushRow( p_pState, Row );
+		return 2;
+	}
+
+	int Dataset::RowIndex( lua_State * p_pState )
+	{
+		const RowProxy * pRow = static_cast<const RowProxy *>( CheckRow( p_pState ) );
+
+		// Find the column number
+		lua_pushvalue( p_pState, 2 );
+		lua_rawget( p_pState, lua_upvalueindex( 1 ) );
+		lua_Integer Number = lua_tointeger( p_pState, -1 );
+		lua_pop( p_pState, 1 );
+
+		if( Number == 0 )
+		{
+			lua_pushnil( p_pState );
+			return 1;
+		}
+
+		pRow->pDataset->PushValue( p_pState, pRow->Row, static_cast<size_t>( Number - 1 ) );
+		return 1;
+	}
+
+	int Dataset::RowPairs( lua_State * p_pState )
+	{
+		CheckRow( p_pState );
+
+		lua_pushinteger( p_pState, 0 );
+		lua_pushcclosure( p_pState, RowNext, 1 );
+		lua_pushvalue( p_pState, 1 );
+		lua_pushnil( p_pState );
+		return 3;
+	}
+
+	int Dataset::RowNext( lua_State * p_pState )
+	{
+		const RowProxy * pRow = static_cast<const RowProxy *>( CheckRow( p_pState ) );
+		size_t Column = static_cast<size_t>( lua_tointeger( p_pState, lua_upvalueindex( 1 ) ) );
+		if( Column >= pRow->pDataset->GetColumnCount( ) )
+		{
+			return 0;
+		}
+
+		lua_pushinteger( p_pState, static_cast<lua_Integer>( Column + 1 ) );
+		lua_replace( p_pState, lua_upvalueindex( 1 ) );
+
+		size_t Length = 0;
+		const char * pName = pRow->pDataset->GetColumnName( Column, Length );
+		lua_pushlstring( p_pState, pName, Length );
+		pRow->pDataset->PushValue( p_pState, pRow->Row, Column );
+		return 2;
+	}
+
+
+	// Constructor
+	DatasetBuilder::DatasetBuilder( )
+	{
+	}
+
+	// Public functions
+	size_t DatasetBuilder::AddColumn( const std::string & p_Name, const eColumnType p_Type )
+	{
+		ColumnData Column;
+		Column.Name = p_Name;
+		Column.Type = p_Type;
+		m_Columns.push_back( Column );
+
+		// Fill the column for the existing rows
+		ColumnData & Added = m_Columns.back( );
+		if( p_Type == COLUMN_NUMBER )
+		{
+			Added.Numbers.resize( m_Keys.size( ), 0.0 );
+		}
+		else if( p_Type == COLUMN_STRING )
+		{
+			Added.Strings.resize( m_Keys.size( ) );
+		}
+		else
+		{
+			Added.Integers.resize( m_Keys.size( ), 0 );
+		}
+
+		return m_Columns.size( ) - 1;
+	}
+
+	size_t DatasetBuilder::AddRow( const std::string & p_Key )
+	{
+		std::unordered_map<std::string, size_t>::iterator it = m_Rows.find( p_Key );
+		if( it != m_Rows.end( ) )
+		{
+			return it->second;
+		}
+
+		size_t Row = m_Keys.size( );
+		m_Keys.push_back( p_Key );
+		m_Rows.insert( std::make_pair( p_Key, Row ) );
+
+		for( std::vector<ColumnData>::iterator Column = m_Columns.begin( ); Column != m_Columns.end( ); ++Column )
+		{
+			if( Column->Type == COLUMN_NUMBER )
+			{
+				Column->Numbers.push_back( 0.0 );
+			}
+			else if( Column->Type == COLUMN_STRING )
+			{
+				Column->Strings.push_back( std::string( ) );
+			}
+			else
+			{
+				Column->Integers.push_back( 0 );
+			}
+		}
+
+		return Row;
+	}
+
+	void DatasetBuilder::SetBoolean( const size_t p_Row, const size_t p_Column, const bool p_Value )
+	{
+		m_Columns[ p_Column ].Integers[ p_Row ] = p_Value ? 1 : 0;
+	}
+
+	void DatasetBuilder::SetInteger( const size_t p_Row, const size_t p_Column, const long long p_Value )
+	{
+		m_Columns[ p_Column ].Integers[ p_Row ] = p_Value;
+	}
+
+	void DatasetBuilder::SetNumber( const size_t p_Row, const size_t p_Column, const double p_Value )
+	{
+		m_Columns[ p_Column ].Numbers[ p_Row ] = p_Value;
+	}
+
+	void DatasetBuilder::SetString( const size_t p_Row, const size_t p_Column, const std::string & p_Value )
+	{
+		m_Columns[ p_Column ].Strings[ p_Row ] = p_Value;
+	}
+
+	bool DatasetBuilder::Build( Dataset & p_Dataset ) const
+	{
+		p_Dataset.Unload( );
+
+		size_t Size = 0;
+		unsigned long long * pBlock = CreateBlock( Size );
+		if( pBlock == NULL )
+		{
+			return false;
+		}
+
+		p_Dataset.m_pBuffer = pBlock;
+		return p_Dataset.Attach( reinterpret_cast<const char *>( pBlock ), Size );
+	}
+
+	bool DatasetBuilder::Save( const std::string & p_FileName ) const
+	{
+		size_t Size = 0;
+		unsigned long long * pBlock = CreateBlock( Size );
+		if( pBlock == NULL )
+		{
+			return false;
+		}
+
+		FILE * pFile = fopen( p_FileName.c_str( ), "wb" );
+		bool Written = pFile && fwrite( pBlock, 1, Size, pFile ) == Size;
+		if( pFile && fclose( pFile ) != 0 )
+		{
+			Written = false;
+		}
+
+		delete [ ] pBlock;
+		return Written;
+	}
+
+	void DatasetBuilder::Clear( )
+	{
+		m_Keys.clear( );
+		m_Rows.clear( );
+		m_Columns.clear( );
+	}
+
+	// Private functions
+	unsigned long long * DatasetBuilder::CreateBlock( size_t & p_Size ) const
+	{
+		typedef Dataset::Header Header;
+		typedef Dataset::Column Column;
+		typedef Dataset::String String;
+
+		size_t RowCount = m_Keys.size( );
+		size_t ColumnCount = m_Columns.size( );
+		if( RowCount > 0x7FFFFFFF )
+		{
+			return NULL;
+		}
+
+		// Twice as many buckets as rows keeps the probe sequences short.
+		size_t BucketCount = 1;
+		while( BucketCount < RowCount * 2 )
+		{
+			BucketCount <<= 1;
+		}
+
+		// Collect the strings, every reference is an offset and a length.
+		std::string Pool;
+		std::vector<String> Keys( RowCount );
+		std::vector<Column> Columns( ColumnCount );
+		std::vector<std::vector<String> > Strings( ColumnCount );
+
+		for( size_t i = 0; i < RowCount; i++ )
+		{
+			if( AddString( Pool, m_Keys[ i ], Keys[ i ].Offset, Keys[ i ].Length ) == false )
+			{
+				return NULL;
+			}
+		}
+
+		for( size_t i = 0; i < ColumnCount; i++ )
+		{
+			const ColumnData & Current = m_Columns[ i ];
+			if( AddString( Pool, Current.Name, Columns[ i ].Name.Offset, Columns[ i ].Name.Length ) == false )
+			{
+				return NULL;
+			}
+
+			if( Current.Type == COLUMN_STRING )
+			{
+				Strings[ i ].resize( RowCount );
+				for( size_t j = 0; j < RowCount; j++ )
+				{
+					if( AddString( Pool, Current.Strings[ j ], Strings[ i ][ j ].Offset, Strings[ i ][ j ].Length ) == false )
+					{
+						return NULL;
+					}
+				}
+			}
+		}
+
+		// Layout of the block
+		Header BlockHeader;
+		std::memset( &BlockHeader, 0, sizeof( BlockHeader ) );
+		std::memcpy( BlockHeader.Magic, g_DatasetMagic, sizeof( g_DatasetMagic ) );
+		BlockHeader.RowCount = static_cast<unsigned int>( RowCount );
+		BlockHeader.ColumnCount = static_cast<unsigned int>( ColumnCount );
+		BlockHeader.BucketCount = static_cast<unsigned int>( BucketCount );
+
+		size_t Position = Align( sizeof( Header ) );
+		BlockHeader.KeysOffset = Position;
+		Position = Align( Position + RowCount * sizeof( String ) );
+		BlockHeader.BucketsOffset = Position;
+		Position = Align( Position + BucketCount * sizeof( unsigned int ) );
+		BlockHeader.ColumnsOffset = Position;
+		Position = Align( Position + ColumnCount * sizeof( Column ) );
+
+		for( size_t i = 0; i < ColumnCount; i++ )
+		{
+			Columns[ i ].Type = m_Columns[ i ].Type;
+			Columns[ i ].DataOffset = Position;
+			Position = Align( Position + RowCount * GetValueSize( m_Columns[ i ].Type ) );
+		}
+
+		BlockHeader.StringsOffset = Position;
+		BlockHeader.StringsSize = Pool.size( );
+		p_Size = Align( Position + Pool.size( ) );
+
+		// Write the block
+		unsigned long long * pBlock = new unsigned long long[ p_Size / 8 ];
+		char * pData = reinterpret_cast<char *>( pBlock );
+		std::memset( pData, 0, p_Size );
+
+		std::memcpy( pData, &BlockHeader, sizeof( BlockHeader ) );
+		if( RowCount )
+		{
+			std::memcpy( pData + BlockHeader.KeysOffset, &Keys[ 0 ], RowCount * sizeof( String ) );
+		}
+		if( ColumnCount )
+		{
+			std::memcpy( pData + BlockHeader.ColumnsOffset, &Columns[ 0 ], ColumnCount * sizeof( Column ) );
+		}
+		if( Pool.size( ) )
+		{
+			std::memcpy( pData + BlockHeader.StringsOffset, Pool.data( ), Pool.size( ) );
+		}
+
+		unsigned int * pBuckets = reinterpret_cast<unsigned int *>( pData + BlockHeader.BucketsOffset );
+		for( size_t i = 0; i < RowCount; i++ )
+		{
+			unsigned int Bucket = HashString( m_Keys[ i ].data( ), m_Keys[ i ].size( ) ) & ( BucketCount - 1 );
+			while( pBuckets[ Bucket ] )
+			{
+				Bucket = ( Bucket + 1 ) & ( BucketCount - 1 );
+			}
+			pBuckets[ Bucket ] = static_cast<unsigned int>( i + 1 );
+		}
+
+		for( size_t i = 0; i < ColumnCount && RowCount; i++ )
+		{
+			const ColumnData & Current = m_Columns[ i ];
+			char * pValues = pData + Columns[ i ].DataOffset;
+
+			switch( Current.Type )
+			{
+				case COLUMN_BOOLEAN:
+				{
+					for( size_t j = 0; j < RowCount; j++ )
+					{
+						pValues[ j ] = Current.Integers[ j ] ? 1 : 0;
+					}
+				}
+				break;
+				case COLUMN_INTEGER:
+				{
+					std::memcpy( pValues, &Current.Integers[ 0 ], RowCount * sizeof( long long ) );
+				}
+				break;
+				case COLUMN_NUMBER:
+				{
+					std::memcpy( pValues, &Current.Numbers[ 0 ], RowCount * sizeof( double ) );
+				}
+				break;
+				default:
+				{
+					std::memcpy( pValues, &Strings[ i ][ 0 ], RowCount * sizeof( String ) );
+				}
+				break;
+			}
+		}
+
+		return pBlock;
+	}
+
+	bool DatasetBuilder::AddString( std::string & p_Pool, const std::string & p_String, unsigned int & p_Offset, unsigned int & p_Length )
+	{
+		if( p_Pool.size( ) + p_String.size( ) > 0xFFFFFFFF )
+		{
+			return false;
+		}
+
+		p_Offset = static_cast<unsigned int>( p_Pool.size( ) );
+		p_Length = static_cast<unsigned int>( p_String.size( ) );
+		p_Pool.append( p_String );
+		return true;
+	}
+
+}
@@ -0,0 +1,60 @@
+// ///////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2013 Jimmie Bergmann - jimmiebergmann@gmail.com
+//
+// This software is provided 'as-is', without any express or
+// implied warranty. In no event will the authors be held
+// liable for any damages arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute
+// it freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented;
+//    you must not claim that you wrote the original software.
+//    If you use this software in a product, an acknowledgment
+//    in the product documentation would be appreciated but
+//    is not required.
+//
+// 2. Altered source versions must be plainly marked as such,
+//    and must not be misrepresented as being the original software.
+//
+// 3. This notice may not be removed or altered from any
+//    source distribution.
+// ///////////////////////////////////////////////////////////////////////////
+
+#include <LuaW/Embedded.hpp>
+#include <cstring>
+
+namespace LuaW
+{
+
+	// Registered groups, a plain pointer is zero initialized before any constructor runs.
+	static const EmbeddedScripts * g_pFirstScripts = NULL;
+
+	// Constructor
+	EmbeddedScripts::EmbeddedScripts( const EmbeddedScript * p_pScripts, const size_t p_Count ) :
+		m_pScripts( p_pScripts ),
+		m_Count( p_Count ),
+		m_pNext( g_pFirstScripts )
+	{
+		g_pFirstScripts = this;
+	}
+
+	// Static functions
+	const EmbeddedScript * EmbeddedScripts::Find( const char * p_pName )
+	{
+		for( const EmbeddedScripts * pScripts = g_pFirstScripts; pScripts != NULL; pScripts = pScripts->m_pNext )
+		{
+			for( size_t i = 0; i < pScripts->m_Count; i++ )
+			{
+				if( std::strcmp( pScripts->m_pScripts[ i ].pName, p_pName ) == 0 )
+				{
+					return &pScripts->m_pScripts[ i ];
+				}
+			}
+		}
+
+		return NULL;
+	}
+
+}
@@ -0,0 +1,338 @@
+// ///////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2013 Jimmie Bergmann - jimmiebergmann@gmail.com
+//
+// This software is provided 'as-is', without any express or
+// implied warranty. In no event will the authors be held
+// liable for any damages arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute
+// it freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented;
+//    you must not claim that you wrote the original software.
+//    If you use this software in a product, an acknowledgment
+//    in the product documentation would be appreciated but
+//    is not required.
+//
+// 2. Altered source versions must be plainly marked as such,
+//    and must not be misrepresented as being the original software.
+//
+// 3. This notice may not be removed or altered from any
+//    source distribution.
+// ///////////////////////////////////////////////////////////////////////////
+
+#include <LuaW/EventBus.hpp>
+#include <algorithm>
+
+namespace LuaW
+{
+
+	// Constructor/destructor
+	EventBus::EventBus( Script & p_Script ) :
+		m_Script( p_Script ),
+		m_Dispatching( false ),
+		m_Removed( false )
+	{
+		lua_State * pState = m_Script.GetState( );
+
+		lua_createtable( pState, 0, 2 );
+		lua_pushlightuserdata( pState, this );
+		lua_pushcclosure( pState, LuaOn, 1 );
+		lua_setfield( pState, -2, "on" );
+		lua_pushlightuserdata( pState, this );
+		lua_pushcclosure( pState, LuaOff, 1 );
+		lua_setfield( pState, -2, "off" );
+		lua_setglobal( pState, "events" );
+	}
+
+	EventBus::~EventBus( )
+	{
+		lua_State * pState = m_Script.GetState( );
+		if( pState == NULL )
+		{
+			return;
+		}
+
+		for( size_t i = 0; i < m_Handlers.size( ); i++ )
+		{
+			for( size_t j = 0; j < m_Handlers[ i ].size( ); j++ )
+			{
+				luaL_unref( pState, LUA_REGISTRYINDEX, m_Handlers[ i ][ j ] );
+			}
+		}
+
+		// The functions of the events table refer to the bus.
+		lua_pushnil( pState );
+		lua_setglobal( pState, "events" );
+	}
+
+	// Public functions
+	unsigned int EventBus::GetEventType( const char * p_pName )
+	{
+		std::unordered_map<std::string, unsigned int>::iterator it = m_Types.find( p_pName );
+		if( it != m_Types.end( ) )
+		{
+			return it->second;
+		}
+
+		unsigned int Type = static_cast<unsigned int>( m_Handlers.size( ) );
+		m_Types.insert( std::make_pair( std::string( p_pName ), Type ) );
+		m_Handlers.push_back( std::vector<int>( ) );
+		return Type;
+	}
+
+	void EventBus::Emit( const unsigned int p_Type )
+	{
+		Event NewEvent;
+		NewEvent.Type = p_Type;
+		NewEvent.FirstArgument = static_cast<unsigned int>( m_Queue.Arguments.size( ) );
+		NewEvent.ArgumentCount = 0;
+		m_Queue.Events.push_back( NewEvent );
+	}
+
+	void EventBus::PushBoolean( const bool p_Boolean )
+	{
+		Argument Value;
+		Value.Type = ARGUMENT_BOOLEAN;
+		Value.Length = 0;
+		Value.Boolean = p_Boolean;
+		PushArgument( Value );
+	}
+
+	void EventBus::PushInteger( const long long p_Integer )
+	{
+		Argument Value;
+		Value.Type = ARGUMENT_INTEGER;
+		Value.Length = 0;
+		Value.Integer = p_Integer;
+		PushArgument( Value );
+	}
+
+	void EventBus::PushNumber( const lua_Number p_Number )
+	{
+		Argument Value;
+		Value.Type = ARGUMENT_NUMBER;
+		Value.Length = 0;
+		Value.Number = p_Number;
+		PushArgument( Value );
+	}
+
+	void EventBus::PushString( const char * p_pString, const size_t p_Length )
+	{
+		Argument Value;
+		Value.Type = ARGUMENT_STRING;
+		Value.Length = static_cast<unsigned int>( p_Length );
+		Value.Offset = m_Queue.Strings.size( );
+		m_Queue.Strings.append( p_pString, p_Length );
+		PushArgument( Value );
+	}
+
+	void EventBus::PushString( const std::string & p_String )
+	{
+		PushString( p_String.data( ), p_String.size( ) );
+	}
+
+	eError EventBus::Dispatch( )
+	{
+		// Handlers may emit events, they are queued for the next dispatch.
+		if( m_Dispatching )
+		{
+			return ERROR_NONE;
+		}
+
+		std::swap( m_Queue, m_Dispatched );
+		m_Queue.Events.clear( );
+		m_Queue.Arguments.clear( );
+		m_Queue.Strings.clear( );
+		m_Dispatching = true;
+
+		lua_State * pState = m_Script.GetState( );
+		int Top = lua_gettop( pState );
+		eError Result = ERROR_NONE;
+
+		for( size_t i = 0; i < m_Dispatched.Events.size( ); i++ )
+		{
+			const Event & Current = m_Dispatched.Events[ i ];
+			if( Current.Type >= m_Handlers.size( ) )
+			{
+				continue;
+			}
+
+			// The handlers are indexed, handlers added by a handler are called as well.
+			for( size_t j = 0; j < m_Handlers[ Current.Type ].size( ); j++ )
+			{
+				int Reference = m_Handlers[ Current.Type ][ j ];
+				if( Reference == LUA_NOREF )
+				{
+					continue;
+				}
+				if( lua_checkstack( pState, static_cast<int>( Current.ArgumentCount ) + 1 ) == 0 )
+				{
+					if( Result == ERROR_NONE )
+					{
+						Result = ERROR_STACK;
+					}
+					continue;
+				}
+
+				lua_rawgeti( pState, LUA_REGISTRYINDEX, Reference );
+				for( unsigned int k = 0; k < Current.ArgumentCount; k++ )
+				{
+					PushArgument( pState, m_Dispatched.Arguments[ Current.FirstArgument + k ], m_Dispatched.Strings );
+				}
+
+				// Drop whatever the handler returned or left on the stack.
+				eError Error = m_Script.Call( static_cast<int>( Current.ArgumentCount ), 0 );
+				lua_settop( pState, Top );
+				if( Error != ERROR_NONE && Result == ERROR_NONE )
+				{
+					Result = Error;
+				}
+			}
+		}
+
+		m_Dispatching = false;
+
+		// Compact the handlers removed while dispatching
+		if( m_Removed )
+		{
+			for( size_t i = 0; i < m_Handlers.size( ); i++ )
+			{
+				std::vector<int> & Handlers = m_Handlers[ i ];
+				Handlers.erase( std::remove( Handlers.begin( ), Handlers.end( ), static_cast<int>( LUA_NOREF ) ), Handlers.end( ) );
+			}
+			m_Removed = false;
+		}
+
+		return Result;
+	}
+
+	// General get functions
+	size_t EventBus::GetQueuedEvents( ) const
+	{
+		return m_Queue.Events.size( );
+	}
+
+	size_t EventBus::GetHandlerCount( const unsigned int p_Type ) const
+	{
+		if( p_Type >= m_Handlers.size( ) )
+		{
+			return 0;
+		}
+
+		size_t Count = 0;
+		for( size_t i = 0; i < m_Handlers[ p_Type ].size( ); i++ )
+		{
+			if( m_Handlers[ p_Type ][ i ] != LUA_NOREF )
+			{
+				Count++;
+			}
+		}
+		return Count;
+	}
+
+	// Private functions
+	void EventBus::PushArgument( const Argument & p_Argument )
+	{
+		// Arguments without an event are ignored.
+		if( m_Queue.Events.empty( ) )
+		{
+			return;
+		}
+
+		m_Queue.Arguments.push_back( p_Argument );
+		m_Queue.Events.back( ).ArgumentCount++;
+	}
+
+	void EventBus::PushArgument( lua_State * p_pState, const Argument & p_Argument, const std::string & p_Strings ) const
+	{
+		switch( p_Argument.Type )
+		{
+			case ARGUMENT_BOOLEAN:
+			{
+				lua_pushboolean( p_pState, p_Argument.Boolean ? 1 : 0 );
+			}
+			break;
+			case ARGUMENT_INTEGER:
+			{
+				lua_pushinteger( p_pState, static_cast<lua_Integer>( p_Argument.Integer ) );
+			}
+			break;
+			case ARGUMENT_NUMBER:
+			{
+				lua_pushnumber( p_pState, p_Argument.Number );
+			}
+			break;
+			default:
+			{
+				lua_pushlstring( p_pState, p_Strings.data( ) + p_Argument.Offset, p_Argument.Length );
+			}
+			break;
+		}
+	}
+
+	int EventBus::LuaOn( lua_State * p_pState )
+	{
+		EventBus * pBus = static_cast<EventBus *>( lua_touserdata( p_pState, lua_upvalueindex( 1 ) ) );
+		const char * pName = luaL_checkstring( p_pState, 1 );
+		luaL_checktype( p_pState, 2, LUA_TFUNCTION );
+
+		unsigned int Type = pBus->GetEventType( pName );
+		lua_pushvalue( p_pState, 2 );
+		pBus->m_Handlers[ Type ].push_back( luaL_ref( p_pState, LUA_REGISTRYINDEX ) );
+
+		lua_pushvalue( p_pState, 2 );
+		return 1;
+	}
+
+	int EventBus::LuaOff( lua_State * p_pState )
+	{
+		EventBus * pBus = static_cast<EventBus *>( lua_touserdata( p_pState, lua_upvalueindex( 1 ) ) );
+		const char * pName = luaL_checkstring( p_pState, 1 );
+		luaL_checktype( p_pState, 2, LUA_TFUNCTION );
+
+		std::unordered_map<std::string, unsigned int>::iterator it = pBus->m_Types.find( pName );
+		if( it == pBus->m_Types.end( ) )
+		{
+			lua_pushboolean( p_pState, 0 );
+			return 1;
+		}
+
+		std::vector<int> & Handlers = pBus->m_Handlers[ it->second ];
+		for( size_t i = 0; i < Handlers.size( ); i++ )
+		{
+			if( Handlers[ i ] == LUA_NOREF )
+			{
+				continue;
+			}
+
+			lua_rawgeti( p_pState, LUA_REGISTRYINDEX, Handlers[ i ] );
+			bool Equal = lua_rawequal( p_pState, -1, 2 ) != 0;
+			lua_pop( p_pState, 1 );
+			if( Equal == false )
+			{
+				continue;
+			}
+
+			// The array is compacted after the dispatch, the indices of the running dispatch stay valid.
+			luaL_unref( p_pState, LUA_REGISTRYINDEX, Handlers[ i ] );
+			if( pBus->m_Dispatching )
+			{
+				Handlers[ i ] = LUA_NOREF;
+				pBus->m_Removed = true;
+			}
+			else
+			{
+				Handlers.erase( Handlers.begin( ) + i );
+			}
+
+			lua_pushboolean( p_pState, 1 );
+			return 1;
+		}
+
+		lua_pushboolean( p_pState, 0 );
+		return 1;
+	}
+
+}
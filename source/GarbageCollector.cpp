@@ -0,0 +1,258 @@
+// ///////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2013 Jimmie Bergmann - jimmiebergmann@gmail.com
+//
+// This software is provided 'as-is', without any express or
+// implied warranty. In no event will the authors be held
+// liable for any damages arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute
+// it freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented;
+//    you must not claim that you wrote the original software.
+//    If you use this software in a product, an acknowledgment
+//    in the product documentation would be appreciated but
+//    is not required.
+//
+// 2. Altered source versions must be plainly marked as such,
+//    and must not be misrepresented as being the original software.
+//
+// 3. This notice may not be removed or altered from any
+//    source distribution.
+// ///////////////////////////////////////////////////////////////////////////
+
+#include <LuaW/GarbageCollector.hpp>
+#include "HookContext.hpp"
+
+namespace LuaW
+{
+
+	// Name of the sentinel meta table in the registry
+	static const char * g_pSentinelTable = "LuaW_GcSentinel";
+
+	// Longest time between two frees of the same burst, nanoseconds. The sweep frees back to back,
+	// a longer gap means that the mutator ran in between.
+	static const long long g_BurstGap = 5000;
+
+	// Single writer increments, no need for read-modify-write instructions.
+	template<typename T>
+	static void AddRelaxed( std::atomic<T> & p_Atomic, const T p_Value )
+	{
+		p_Atomic.store( p_Atomic.load( std::memory_order_relaxed ) + p_Value, std::memory_order_relaxed );
+	}
+
+
+	// Constructor/destructor
+	GarbageCollectorTelemetry::GarbageCollectorTelemetry( lua_State * p_pState ) :
+		m_pState( p_pState ),
+		m_Allocator( NULL ),
+		m_pAllocatorData( NULL ),
+		m_ppSentinel( NULL ),
+		m_Callback( NULL ),
+		m_pCallbackData( NULL ),
+		m_HeapBytes( 0 ),
+		m_PeakHeapBytes( 0 ),
+		m_Cycles( 0 ),
+		m_BytesFreedLastCycle( 0 ),
+		m_TotalBytesFreed( 0 ),
+		m_LastCyclePause( 0 ),
+		m_MaxPause( 0 ),
+		m_TotalPause( 0 ),
+		m_CycleFreedStart( 0 ),
+		m_CyclePause( 0 ),
+		m_InBurst( false ),
+		m_BurstStart( 0 ),
+		m_BurstEnd( 0 ),
+		m_History( HistorySize ),
+		m_HistoryCount( 0 )
+	{
+		// Start counting from the current heap size
+		size_t HeapBytes = static_cast<size_t>( lua_gc( m_pState, LUA_GCCOUNT, 0 ) ) * 1024 +
+			static_cast<size_t>( lua_gc( m_pState, LUA_GCCOUNTB, 0 ) );
+		m_HeapBytes = HeapBytes;
+		m_PeakHeapBytes = HeapBytes;
+
+		// Wrap the allocator
+		m_Allocator = lua_getallocf( m_pState, &m_pAllocatorData );
+		lua_setallocf( m_pState, Allocate, this );
+
+		// Create the sentinel meta table
+		luaL_newmetatable( m_pState, g_pSentinelTable );
+		lua_pushcfunction( m_pState, SentinelFinalizer );
+		lua_setfield( m_pState, -2, "__gc" );
+		lua_pop( m_pState, 1 );
+
+		CreateSentinel( m_pState );
+	}
+
+	GarbageCollectorTelemetry::~GarbageCollectorTelemetry( )
+	{
+		// The pending sentinel must not call us anymore.
+		if( m_ppSentinel )
+		{
+			*m_ppSentinel = NULL;
+		}
+
+		lua_setallocf( m_pState, m_Allocator, m_pAllocatorData );
+	}
+
+	// Public functions
+	void GarbageCollectorTelemetry::SetCallback( GarbageCollectorCallback p_Callback, void * p_pUserData )
+	{
+		m_Callback = p_Callback;
+		m_pCallbackData = p_pUserData;
+	}
+
+	GarbageCollectorStats GarbageCollectorTelemetry::GetStats( ) const
+	{
+		GarbageCollectorStats Stats;
+		Stats.HeapBytes = m_HeapBytes.load( std::memory_order_relaxed );
+		Stats.PeakHeapBytes = m_PeakHeapBytes.load( std::memory_order_relaxed );
+		Stats.Cycles = m_Cycles.load( std::memory_order_relaxed );
+		Stats.BytesFreedLastCycle = m_BytesFreedLastCycle.load( std::memory_order_relaxed );
+		Stats.TotalBytesFreed = m_TotalBytesFreed.load( std::memory_order_relaxed );
+		Stats.LastCyclePause = m_LastCyclePause.load( std::memory_order_relaxed );
+		Stats.MaxPause = m_MaxPause.load( std::memory_order_relaxed );
+		Stats.TotalPause = m_TotalPause.load( std::memory_order_relaxed );
+		return Stats;
+	}
+
+	void GarbageCollectorTelemetry::GetHistory( std::vector<GarbageCollectorSample> & p_Samples ) const
+	{
+		std::lock_guard<std::mutex> Lock( m_HistoryMutex );
+
+		p_Samples.clear( );
+		size_t First = m_HistoryCount > HistorySize ? m_HistoryCount - HistorySize : 0;
+		for( size_t i = First; i < m_HistoryCount; i++ )
+		{
+			p_Samples.push_back( m_History[ i % HistorySize ] );
+		}
+	}
+
+	// Private functions
+	void GarbageCollectorTelemetry::CreateSentinel( lua_State * p_pState )
+	{
+		// The sentinel is never referenced, it is finalized by the next cycle.
+		m_ppSentinel = static_cast<GarbageCollectorTelemetry **>(
+			lua_newuserdata( p_pState, sizeof( GarbageCollectorTelemetry * ) ) );
+		*m_ppSentinel = this;
+		luaL_setmetatable( p_pState, g_pSentinelTable );
+		lua_pop( p_pState, 1 );
+	}
+
+	void GarbageCollectorTelemetry::EndBurst( )
+	{
+		m_InBurst = false;
+
+		unsigned long long Pause = static_cast<unsigned long long>( m_BurstEnd - m_BurstStart );
+		AddRelaxed( m_TotalPause, Pause );
+		if( Pause > m_CyclePause )
+		{
+			m_CyclePause = Pause;
+		}
+		if( Pause > m_MaxPause.load( std::memory_order_relaxed ) )
+		{
+			m_MaxPause.store( Pause, std::memory_order_relaxed );
+		}
+	}
+
+	void GarbageCollectorTelemetry::EndCycle( lua_State * p_pState )
+	{
+		if( m_InBurst )
+		{
+			EndBurst( );
+		}
+
+		unsigned long long Freed = m_TotalBytesFreed.load( std::memory_order_relaxed );
+		m_BytesFreedLastCycle.store( Freed - m_CycleFreedStart, std::memory_order_relaxed );
+		m_CycleFreedStart = Freed;
+		m_LastCyclePause.store( m_CyclePause, std::memory_order_relaxed );
+		m_CyclePause = 0;
+		AddRelaxed( m_Cycles, 1ULL );
+
+		// Record the heap size
+		{
+			std::lock_guard<std::mutex> Lock( m_HistoryMutex );
+			GarbageCollectorSample & Sample = m_History[ m_HistoryCount % HistorySize ];
+			Sample.Time = GetTimeNanoseconds( );
+			Sample.HeapBytes = m_HeapBytes.load( std::memory_order_relaxed );
+			m_HistoryCount++;
+		}
+
+		if( m_Callback )
+		{
+			m_Callback( GetStats( ), m_pCallbackData );
+		}
+
+		// The finalizer may run on any thread of the state, use the current one.
+		CreateSentinel( p_pState );
+	}
+
+	void * GarbageCollectorTelemetry::Allocate( void * p_pUserData, void * p_pPointer, size_t p_OldSize, size_t p_NewSize )
+	{
+		GarbageCollectorTelemetry * pTelemetry = static_cast<GarbageCollectorTelemetry *>( p_pUserData );
+
+		// The old size is the type of the object if there is no block.
+		size_t OldSize = p_pPointer ? p_OldSize : 0;
+
+		// Most frees are made by the sweep, a burst of frees close in time is a sweep step.
+		// The mutator frees as well, resizes and stack shrinks, but not back to back.
+		if( p_NewSize == 0 )
+		{
+			if( p_pPointer )
+			{
+				long long Time = GetTimeNanoseconds( );
+				if( pTelemetry->m_InBurst && Time - pTelemetry->m_BurstEnd > g_BurstGap )
+				{
+					pTelemetry->EndBurst( );
+				}
+				if( pTelemetry->m_InBurst == false )
+				{
+					pTelemetry->m_InBurst = true;
+					pTelemetry->m_BurstStart = Time;
+				}
+				pTelemetry->m_BurstEnd = Time;
+
+				AddRelaxed( pTelemetry->m_TotalBytesFreed, static_cast<unsigned long long>( OldSize ) );
+				pTelemetry->m_HeapBytes.store( pTelemetry->m_HeapBytes.load( std::memory_order_relaxed ) - OldSize,
+					std::memory_order_relaxed );
+			}
+
+			return pTelemetry->m_Allocator( pTelemetry->m_pAllocatorData, p_pPointer, p_OldSize, p_NewSize );
+		}
+
+		// Any allocation ends the burst.
+		if( pTelemetry->m_InBurst )
+		{
+			pTelemetry->EndBurst( );
+		}
+
+		void * pBlock = pTelemetry->m_Allocator( pTelemetry->m_pAllocatorData, p_pPointer, p_OldSize, p_NewSize );
+		if( pBlock )
+		{
+			size_t HeapBytes = pTelemetry->m_HeapBytes.load( std::memory_order_relaxed ) - OldSize + p_NewSize;
+			pTelemetry->m_HeapBytes.store( HeapBytes, std::memory_order_relaxed );
+			if( HeapBytes > pTelemetry->m_PeakHeapBytes.load( std::memory_order_relaxed ) )
+			{
+				pTelemetry->m_PeakHeapBytes.store( HeapBytes, std::memory_order_relaxed );
+			}
+		}
+
+		return pBlock;
+	}
+
+	int GarbageCollectorTelemetry::SentinelFinalizer( lua_State * p_pState )
+	{
+		GarbageCollectorTelemetry ** ppTelemetry =
+			static_cast<GarbageCollectorTelemetry **>( lua_touserdata( p_pState, 1 ) );
+
+		if( ppTelemetry && *ppTelemetry )
+		{
+			( *ppTelemetry )->EndCycle( p_pState );
+		}
+
+		return 0;
+	}
+
+}
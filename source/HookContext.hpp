@@ -0,0 +1,88 @@
+// ///////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2013 Jimmie Bergmann - jimmiebergmann@gmail.com
+//
+// This software is provided 'as-is', without any express or
+// implied warranty. In no event will the authors be held
+// liable for any damages arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute
+// it freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented;
+//    you must not claim that you wrote the original software.
+//    If you use this software in a product, an acknowledgment
+//    in the product documentation would be appreciated but
+//    is not required.
+//
+// 2. Altered source versions must be plainly marked as such,
+//    and must not be misrepresented as being the original software.
+//
+// 3. This notice may not be removed or altered from any
+//    source distribution.
+// ///////////////////////////////////////////////////////////////////////////
+
+// Internal hook context, shared by the execution limits, the scheduler and the profiler.
+
+#ifndef LUA_W_HOOK_CONTEXT_HPP
+#define LUA_W_HOOK_CONTEXT_HPP
+
+#include <LuaW.hpp>
+#include <atomic>
+#include <chrono>
+
+namespace LuaW
+{
+
+	// Number of instructions executed between each hook check.
+	static const unsigned int g_HookInterval = 1000;
+
+	inline long long GetTimeNanoseconds( )
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now( ).time_since_epoch( ) ).count( );
+	}
+
+	// Hook context, shared by every thread of the state.
+	// The deadline and the interrupt flag may be written by a watchdog thread.
+	struct Script::HookContext
+	{
+		HookContext( ) :
+			Interrupted( false ),
+			Deadline( 0 ),
+			InstructionLimit( 0 ),
+			TimeLimit( 0 ),
+			Instructions( 0 ),
+			Depth( 0 ),
+			Expired( ERROR_NONE ),
+			pRunningTask( NULL ),
+			SliceEnd( 0 ),
+			pProfiler( NULL ),
+			Sampling( 0 )
+		{
+			YieldableFunctions[ 0 ] = NULL;
+			YieldableFunctions[ 1 ] = NULL;
+		}
+
+		// Execution limits
+		std::atomic<bool> Interrupted;
+		std::atomic<long long> Deadline; // Nanoseconds, 0 = no deadline
+		unsigned int InstructionLimit;
+		unsigned int TimeLimit; // Microseconds
+		unsigned int Instructions; // Executed by the running call
+		int Depth; // Nested calls of the owning script
+		eError Expired;
+
+		// Preemption
+		lua_State * pRunningTask; // Yields at the end of its time slice
+		long long SliceEnd; // Nanoseconds
+		lua_CFunction YieldableFunctions[ 2 ]; // C functions we may yield across (pcall, xpcall)
+
+		// Profiling, may be toggled by any thread.
+		std::atomic<Profiler *> pProfiler;
+		std::atomic<unsigned int> Sampling; // Hooks using the profiler, Profiler::Stop waits for them.
+	};
+
+}
+
+#endif
@@ -0,0 +1,272 @@
+// ///////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2013 Jimmie Bergmann - jimmiebergmann@gmail.com
+//
+// This software is provided 'as-is', without any express or
+// implied warranty. In no event will the authors be held
+// liable for any damages arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute
+// it freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented;
+//    you must not claim that you wrote the original software.
+//    If you use this software in a product, an acknowledgment
+//    in the product documentation would be appreciated but
+//    is not required.
+//
+// 2. Altered source versions must be plainly marked as such,
+//    and must not be misrepresented as being the original software.
+//
+// 3. This notice may not be removed or altered from any
+//    source distribution.
+// ///////////////////////////////////////////////////////////////////////////
+
+#include <LuaW/Instrumentation.hpp>
+#include "HookContext.hpp"
+#include <sstream>
+
+namespace LuaW
+{
+
+	// Call targets with statistics of their own
+	static const size_t g_MaximumCallTargets = 1024;
+
+	// Histogram
+	Histogram::Histogram( ) :
+		m_Count( 0 ),
+		m_Max( 0 )
+	{
+		for( unsigned int i = 0; i < BucketCount; i++ )
+		{
+			m_Buckets[ i ] = 0;
+		}
+	}
+
+	void Histogram::Record( const unsigned long long p_Value )
+	{
+		// There is only one writer, no need for read-modify-write instructions.
+		std::atomic<unsigned long long> & Bucket = m_Buckets[ GetBucketIndex( p_Value ) ];
+		Bucket.store( Bucket.load( std::memory_order_relaxed ) + 1, std::memory_order_relaxed );
+		m_Count.store( m_Count.load( std::memory_order_relaxed ) + 1, std::memory_order_relaxed );
+
+		if( p_Value > m_Max.load( std::memory_order_relaxed ) )
+		{
+			m_Max.store( p_Value, std::memory_order_relaxed );
+		}
+	}
+
+	void Histogram::Merge( const Histogram & p_Histogram )
+	{
+		for( unsigned int i = 0; i < BucketCount; i++ )
+		{
+			m_Buckets[ i ].store( m_Buckets[ i ].load( std::memory_order_relaxed ) +
+				p_Histogram.m_Buckets[ i ].load( std::memory_order_relaxed ), std::memory_order_relaxed );
+		}
+
+		m_Count.store( m_Count.load( std::memory_order_relaxed ) + p_Histogram.GetCount( ), std::memory_order_relaxed );
+		if( p_Histogram.GetMax( ) > m_Max.load( std::memory_order_relaxed ) )
+		{
+			m_Max.store( p_Histogram.GetMax( ), std::memory_order_relaxed );
+		}
+	}
+
+	void Histogram::Reset( )
+	{
+		for( unsigned int i = 0; i < BucketCount; i++ )
+		{
+			m_Buckets[ i ] = 0;
+		}
+		m_Count = 0;
+		m_Max = 0;
+	}
+
+	unsigned long long Histogram::GetCount( ) const
+	{
+		return m_Count.load( std::memory_order_relaxed );
+	}
+
+	unsigned long long Histogram::GetMax( ) const
+	{
+		return m_Max.load( std::memory_order_relaxed );
+	}
+
+	unsigned long long Histogram::GetPercentile( const double p_Percentile ) const
+	{
+		unsigned long long Count = GetCount( );
+		if( Count == 0 )
+		{
+			return 0;
+		}
+
+		// Find the bucket holding the requested rank.
+		unsigned long long Rank = static_cast<unsigned long long>( p_Percentile / 100.0 * static_cast<double>( Count ) + 0.5 );
+		if( Rank == 0 )
+		{
+			Rank = 1;
+		}
+
+		unsigned long long Seen = 0;
+		for( unsigned int i = 0; i < BucketCount; i++ )
+		{
+			Seen += m_Buckets[ i ].load( std::memory_order_relaxed );
+			if( Seen >= Rank )
+			{
+				unsigned long long Value = GetBucketValue( i );
+				unsigned long long Max = GetMax( );
+				return Value < Max ? Value : Max;
+			}
+		}
+
+		return GetMax( );
+	}
+
+	unsigned int Histogram::GetBucketIndex( const unsigned long long p_Value )
+	{
+		// Values below 8 get a bucket each.
+		if( p_Value < 8 )
+		{
+			return static_cast<unsigned int>( p_Value );
+		}
+
+		// Find the highest set bit
+		unsigned int Magnitude = 0;
+		unsigned long long Value = p_Value;
+		for( unsigned int Shift = 32; Shift; Shift >>= 1 )
+		{
+			if( Value >> Shift )
+			{
+				Value >>= Shift;
+				Magnitude += Shift;
+			}
+		}
+
+		// The three bits below the highest one select the sub bucket.
+		unsigned int SubBucket = static_cast<unsigned int>( p_Value >> ( Magnitude - 3 ) ) & 7;
+		return ( Magnitude - 2 ) * 8 + SubBucket;
+	}
+
+	unsigned long long Histogram::GetBucketValue( const unsigned int p_Index )
+	{
+		if( p_Index < 8 )
+		{
+			return p_Index;
+		}
+
+		unsigned int Shift = p_Index / 8 - 1;
+		unsigned long long SubBucket = p_Index % 8;
+		return ( ( ( 8 + SubBucket ) << Shift ) + ( 1ULL << Shift ) ) - 1;
+	}
+
+
+	// Instrumentation
+	Instrumentation::Instrumentation( ) :
+		m_Enabled( false ),
+		m_pOtherCallTargets( NULL )
+	{
+	}
+
+	Instrumentation::~Instrumentation( )
+	{
+		for( size_t i = 0; i < m_Bindings.size( ); i++ )
+		{
+			delete m_Bindings[ i ];
+		}
+	}
+
+	void Instrumentation::SetEnabled( const bool p_Enabled )
+	{
+		m_Enabled = p_Enabled;
+	}
+
+	bool Instrumentation::IsEnabled( ) const
+	{
+		return m_Enabled;
+	}
+
+	void Instrumentation::GetBindings( std::vector<const BindingStats *> & p_Bindings ) const
+	{
+		std::lock_guard<std::mutex> Lock( m_Mutex );
+		p_Bindings.assign( m_Bindings.begin( ), m_Bindings.end( ) );
+	}
+
+	void Instrumentation::PushFunction( lua_State * p_pState, const char * p_pName, lua_CFunction p_Function )
+	{
+		lua_pushlightuserdata( p_pState, AddBinding( p_pName ) );
+		lua_pushcfunction( p_pState, p_Function );
+		lua_pushcclosure( p_pState, InstrumentedFunction, 2 );
+	}
+
+	BindingStats * Instrumentation::GetCallTarget( lua_State * p_pState, const int p_Index )
+	{
+		lua_Debug Debug;
+		lua_pushvalue( p_pState, p_Index );
+		lua_getinfo( p_pState, ">S", &Debug );
+
+		// C functions are keyed by their address, Lua functions by where they are defined.
+		// Closures are created and collected all the time, their addresses are not used. The short
+		// source bounds the cost of the key, targets it can not tell apart get the same name anyway.
+		CallTargetKey & Key = m_CallTargetKey;
+		Key.second.second = Debug.linedefined;
+		if( Debug.what[ 0 ] == 'C' )
+		{
+			Key.first.clear( );
+			Key.second.first = reinterpret_cast<const void *>( lua_tocfunction( p_pState, p_Index ) );
+		}
+		else
+		{
+			Key.first.assign( Debug.short_src );
+			Key.second.first = NULL;
+		}
+
+		std::map<CallTargetKey, BindingStats *>::iterator it = m_CallTargets.find( Key );
+		if( it != m_CallTargets.end( ) )
+		{
+			return it->second;
+		}
+
+		// Keep the memory bounded, scripts may load new chunks forever.
+		if( m_CallTargets.size( ) >= g_MaximumCallTargets )
+		{
+			if( m_pOtherCallTargets == NULL )
+			{
+				m_pOtherCallTargets = AddBinding( "(other)" );
+			}
+			return m_pOtherCallTargets;
+		}
+
+		// First call of this function, name it by where it is defined.
+		std::stringstream Name;
+		Name << Debug.short_src << ':' << Debug.linedefined;
+
+		BindingStats * pStats = AddBinding( Name.str( ) );
+		m_CallTargets[ Key ] = pStats;
+		return pStats;
+	}
+
+	// Private functions
+	BindingStats * Instrumentation::AddBinding( const std::string & p_Name )
+	{
+		BindingStats * pStats = new BindingStats( p_Name );
+
+		std::lock_guard<std::mutex> Lock( m_Mutex );
+		m_Bindings.push_back( pStats );
+		return pStats;
+	}
+
+	int Instrumentation::InstrumentedFunction( lua_State * p_pState )
+	{
+		BindingStats * pStats = static_cast<BindingStats *>( lua_touserdata( p_pState, lua_upvalueindex( 1 ) ) );
+		lua_CFunction Function = lua_tocfunction( p_pState, lua_upvalueindex( 2 ) );
+
+		pStats->Calls.store( pStats->Calls.load( std::memory_order_relaxed ) + 1, std::memory_order_relaxed );
+
+		// Errors never return here, they are the calls missing in the histogram.
+		long long Start = GetTimeNanoseconds( );
+		int Results = Function( p_pState );
+		pStats->Latency.Record( static_cast<unsigned long long>( GetTimeNanoseconds( ) - Start ) );
+
+		return Results;
+	}
+
+}
@@ -0,0 +1,358 @@
+// ///////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2013 Jimmie Bergmann - jimmiebergmann@gmail.com
+//
+// This software is provided 'as-is', without any express or
+// implied warranty. In no event will the authors be held
+// liable for any damages arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute
+// it freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented;
+//    you must not claim that you wrote the original software.
+//    If you use this software in a product, an acknowledgment
+//    in the product documentation would be appreciated but
+//    is not required.
+//
+// 2. Altered source versions must be plainly marked as such,
+//    and must not be misrepresented as being the original software.
+//
+// 3. This notice may not be removed or altered from any
+//    source distribution.
+// ///////////////////////////////////////////////////////////////////////////
+
+#include <LuaW/Layout.hpp>
+#include <string>
+
+namespace LuaW
+{
+
+	// Array proxy data
+	struct ArrayProxy
+	{
+		char * pData;
+		size_t Count;
+	};
+
+	// Constructor
+	Layout::Layout( const char * p_pName, const size_t p_Size, const FieldDescriptor * p_pFields, const unsigned int p_FieldCount ) :
+		m_pName( p_pName ),
+		m_Size( p_Size ),
+		m_pFields( p_pFields ),
+		m_FieldCount( p_FieldCount ),
+		m_ArrayKey( 0 )
+	{
+	}
+
+	// Public functions
+	void Layout::Push( lua_State * p_pState, void * p_pObject ) const
+	{
+		void ** ppObject = static_cast<void **>( lua_newuserdata( p_pState, sizeof( void * ) ) );
+		*ppObject = p_pObject;
+
+		PushMetatable( p_pState );
+		lua_setmetatable( p_pState, -2 );
+	}
+
+	void Layout::PushArray( lua_State * p_pState, void * p_pObjects, const size_t p_Count ) const
+	{
+		ArrayProxy * pArray = static_cast<ArrayProxy *>( lua_newuserdata( p_pState, sizeof( ArrayProxy ) ) );
+		pArray->pData = static_cast<char *>( p_pObjects );
+		pArray->Count = p_Count;
+
+		PushArrayMetatable( p_pState );
+		lua_setmetatable( p_pState, -2 );
+	}
+
+	void * Layout::ToObject( lua_State * p_pState, const int p_Index ) const
+	{
+		void ** ppObject = static_cast<void **>( lua_touserdata( p_pState, p_Index ) );
+		if( ppObject == NULL || lua_getmetatable( p_pState, p_Index ) == 0 )
+		{
+			return NULL;
+		}
+
+		lua_rawgetp( p_pState, LUA_REGISTRYINDEX, this );
+		bool Equal = lua_rawequal( p_pState, -1, -2 ) != 0;
+		lua_pop( p_pState, 2 );
+
+		return Equal ? *ppObject : NULL;
+	}
+
+	// General get functions
+	const char * Layout::GetName( ) const
+	{
+		return m_pName;
+	}
+
+	size_t Layout::GetSize( ) const
+	{
+		return m_Size;
+	}
+
+	const FieldDescriptor * Layout::GetFields( ) const
+	{
+		return m_pFields;
+	}
+
+	unsigned int Layout::GetFieldCount( ) const
+	{
+		return m_FieldCount;
+	}
+
+	// Private functions
+	void Layout::PushMetatable( lua_State * p_pState ) const
+	{
+		// The metatable is created once per state, the registry key is the layout.
+		lua_rawgetp( p_pState, LUA_REGISTRYINDEX, this );
+		if( lua_istable( p_pState, -1 ) )
+		{
+			return;
+		}
+		lua_pop( p_pState, 1 );
+
+		lua_createtable( p_pState, 0, 4 );
+
+		// Map of the field names to the field numbers, shared by __index and __newindex.
+		lua_createtable( p_pState, 0, static_cast<int>( m_FieldCount ) );
+		for( unsigned int i = 0; i < m_FieldCount; i++ )
+		{
+			lua_pushinteger( p_pState, static_cast<lua_Integer>( i + 1 ) );
+			lua_setfield( p_pState, -2, m_pFields[ i ].pName );
+		}
+
+		lua_pushlightuserdata( p_pState, const_cast<Layout *>( this ) );
+		lua_pushvalue( p_pState, -2 );
+		lua_pushcclosure( p_pState, Index, 2 );
+		lua_setfield( p_pState, -3, "__index" );
+
+		lua_pushlightuserdata( p_pState, const_cast<Layout *>( this ) );
+		lua_insert( p_pState, -2 );
+		lua_pushcclosure( p_pState, NewIndex, 2 );
+		lua_setfield( p_pState, -2, "__newindex" );
+
+		lua_pushstring( p_pState, m_pName );
+		lua_setfield( p_pState, -2, "__name" );
+
+		// Hide the metatable, the metamethods must not be called with other userdata.
+		lua_pushboolean( p_pState, 0 );
+		lua_setfield( p_pState, -2, "__metatable" );
+
+		lua_pushvalue( p_pState, -1 );
+		lua_rawsetp( p_pState, LUA_REGISTRYINDEX, this );
+	}
+
+	void Layout::PushArrayMetatable( lua_State * p_pState ) const
+	{
+		lua_rawgetp( p_pState, LUA_REGISTRYINDEX, &m_ArrayKey );
+		if( lua_istable( p_pState, -1 ) )
+		{
+			return;
+		}
+		lua_pop( p_pState, 1 );
+
+		lua_createtable( p_pState, 0, 3 );
+
+		lua_pushlightuserdata( p_pState, const_cast<Layout *>( this ) );
+		lua_pushcclosure( p_pState, ArrayIndex, 1 );
+		lua_setfield( p_pState, -2, "__index" );
+
+		lua_pushlightuserdata( p_pState, const_cast<Layout *>( this ) );
+		lua_pushcclosure( p_pState, ArrayLength, 1 );
+		lua_setfield( p_pState, -2, "__len" );
+
+		lua_pushboolean( p_pState, 0 );
+		lua_setfield( p_pState, -2, "__metatable" );
+
+		lua_pushvalue( p_pState, -1 );
+		lua_rawsetp( p_pState, LUA_REGISTRYINDEX, &m_ArrayKey );
+	}
+
+	int Layout::Index( lua_State * p_pState )
+	{
+		const Layout * pLayout = static_cast<const Layout *>( lua_touserdata( p_pState, lua_upvalueindex( 1 ) ) );
+		void ** ppObject = static_cast<void **>( CheckProxy( p_pState, pLayout, pLayout->m_pName ) );
+
+		// Find the field number
+		lua_pushvalue( p_pState, 2 );
+		lua_rawget( p_pState, lua_upvalueindex( 2 ) );
+		lua_Integer Number = lua_tointeger( p_pState, -1 );
+		lua_pop( p_pState, 1 );
+
+		if( Number == 0 )
+		{
+			lua_pushnil( p_pState );
+			return 1;
+		}
+
+		const FieldDescriptor & Field = pLayout->m_pFields[ Number - 1 ];
+		char * pField = static_cast<char *>( *ppObject ) + Field.Offset;
+
+		switch( Field.Type )
+		{
+			case FIELD_BOOLEAN:
+			{
+				lua_pushboolean( p_pState, *reinterpret_cast<bool *>( pField ) ? 1 : 0 );
+			}
+			break;
+			case FIELD_INT:
+			{
+				lua_pushinteger( p_pState, static_cast<lua_Integer>( *reinterpret_cast<int *>( pField ) ) );
+			}
+			break;
+			case FIELD_UNSIGNED_INT:
+			{
+				lua_pushinteger( p_pState, static_cast<lua_Integer>( *reinterpret_cast<unsigned int *>( pField ) ) );
+			}
+			break;
+			case FIELD_LONG_LONG:
+			{
+				lua_pushinteger( p_pState, static_cast<lua_Integer>( *reinterpret_cast<long long *>( pField ) ) );
+			}
+			break;
+			case FIELD_FLOAT:
+			{
+				lua_pushnumber( p_pState, static_cast<lua_Number>( *reinterpret_cast<float *>( pField ) ) );
+			}
+			break;
+			case FIELD_DOUBLE:
+			{
+				lua_pushnumber( p_pState, static_cast<lua_Number>( *reinterpret_cast<double *>( pField ) ) );
+			}
+			break;
+			case FIELD_STRING:
+			{
+				const std::string & String = *reinterpret_cast<std::string *>( pField );
+				lua_pushlstring( p_pState, String.data( ), String.size( ) );
+			}
+			break;
+			case FIELD_STRUCT:
+			{
+				Field.pLayout->Push( p_pState, pField );
+			}
+			break;
+			default:
+			{
+				lua_pushnil( p_pState );
+			}
+			break;
+		}
+
+		return 1;
+	}
+
+	int Layout::NewIndex( lua_State * p_pState )
+	{
+		const Layout * pLayout = static_cast<const Layout *>( lua_touserdata( p_pState, lua_upvalueindex( 1 ) ) );
+		void ** ppObject = static_cast<void **>( CheckProxy( p_pState, pLayout, pLayout->m_pName ) );
+
+		lua_pushvalue( p_pState, 2 );
+		lua_rawget( p_pState, lua_upvalueindex( 2 ) );
+		lua_Integer Number = lua_tointeger( p_pState, -1 );
+		lua_pop( p_pState, 1 );
+
+		if( Number == 0 )
+		{
+			const char * pName = lua_type( p_pState, 2 ) == LUA_TSTRING ? lua_tostring( p_pState, 2 ) : "?";
+			return luaL_error( p_pState, "%s has no field '%s'", pLayout->m_pName, pName );
+		}
+
+		const FieldDescriptor & Field = pLayout->m_pFields[ Number - 1 ];
+		if( Field.ReadOnly )
+		{
+			return luaL_error( p_pState, "field '%s' of %s is read only", Field.pName, pLayout->m_pName );
+		}
+
+		char * pField = static_cast<char *>( *ppObject ) + Field.Offset;
+
+		switch( Field.Type )
+		{
+			case FIELD_BOOLEAN:
+			{
+				*reinterpret_cast<bool *>( pField ) = lua_toboolean( p_pState, 3 ) != 0;
+			}
+			break;
+			case FIELD_INT:
+			{
+				*reinterpret_cast<int *>( pField ) = static_cast<int>( luaL_checkinteger( p_pState, 3 ) );
+			}
+			break;
+			case FIELD_UNSIGNED_INT:
+			{
+				*reinterpret_cast<unsigned int *>( pField ) = static_cast<unsigned int>( luaL_checkinteger( p_pState, 3 ) );
+			}
+			break;
+			case FIELD_LONG_LONG:
+			{
+				*reinterpret_cast<long long *>( pField ) = static_cast<long long>( luaL_checkinteger( p_pState, 3 ) );
+			}
+			break;
+			case FIELD_FLOAT:
+			{
+				*reinterpret_cast<float *>( pField ) = static_cast<float>( luaL_checknumber( p_pState, 3 ) );
+			}
+			break;
+			case FIELD_DOUBLE:
+			{
+				*reinterpret_cast<double *>( pField ) = static_cast<double>( luaL_checknumber( p_pState, 3 ) );
+			}
+			break;
+			case FIELD_STRING:
+			{
+				size_t Length = 0;
+				const char * pString = luaL_checklstring( p_pState, 3, &Length );
+				reinterpret_cast<std::string *>( pField )->assign( pString, Length );
+			}
+			break;
+			default:
+			break;
+		}
+
+		return 0;
+	}
+
+	int Layout::ArrayIndex( lua_State * p_pState )
+	{
+		const Layout * pLayout = static_cast<const Layout *>( lua_touserdata( p_pState, lua_upvalueindex( 1 ) ) );
+		ArrayProxy * pArray = static_cast<ArrayProxy *>( CheckProxy( p_pState, &pLayout->m_ArrayKey, pLayout->m_pName ) );
+		lua_Integer Index = lua_tointeger( p_pState, 2 );
+
+		if( Index < 1 || static_cast<size_t>( Index ) > pArray->Count )
+		{
+			lua_pushnil( p_pState );
+			return 1;
+		}
+
+		pLayout->Push( p_pState, pArray->pData + static_cast<size_t>( Index - 1 ) * pLayout->m_Size );
+		return 1;
+	}
+
+	int Layout::ArrayLength( lua_State * p_pState )
+	{
+		const Layout * pLayout = static_cast<const Layout *>( lua_touserdata( p_pState, lua_upvalueindex( 1 ) ) );
+		ArrayProxy * pArray = static_cast<ArrayProxy *>( CheckProxy( p_pState, &pLayout->m_ArrayKey, pLayout->m_pName ) );
+		lua_pushinteger( p_pState, static_cast<lua_Integer>( pArray->Count ) );
+		return 1;
+	}
+
+	void * Layout::CheckProxy( lua_State * p_pState, const void * p_pKey, const char * p_pName )
+	{
+		// The metatable must be the one stored under the key, any other userdata has a different memory layout.
+		void * pProxy = lua_touserdata( p_pState, 1 );
+		if( pProxy != NULL && lua_getmetatable( p_pState, 1 ) )
+		{
+			lua_rawgetp( p_pState, LUA_REGISTRYINDEX, p_pKey );
+			bool Equal = lua_rawequal( p_pState, -1, -2 ) != 0;
+			lua_pop( p_pState, 2 );
+			if( Equal )
+			{
+				return pProxy;
+			}
+		}
+
+		luaL_error( p_pState, "%s proxy expected", p_pName );
+		return NULL;
+	}
+
+}
@@ -23,40 +23,252 @@
 // ///////////////////////////////////////////////////////////////////////////
 
 #include <LuaW.hpp>
+#include <LuaW/Embedded.hpp>
+#include <LuaW/GarbageCollector.hpp>
+#include <LuaW/Instrumentation.hpp>
+#include <LuaW/Profiler.hpp>
+#include <LuaW/Trace.hpp>
+#include "HookContext.hpp"
+#include <cstdio>
+#include <cstring>
 #include <iostream>
+#include <thread>
+#include <utility>
 
 namespace LuaW
 {
 
+	// Registry key of the hook context, the address of the variable is the key.
+	static const char g_HookContextKey = 0;
+
+#if !defined( LUAW_BACKEND_LUA54 )
+	// Pushes the table emulating the user values of a userdata, false if there is none and it should not be created.
+	static bool PushUserValueTable( lua_State * p_pState, const int p_Index, const bool p_Create )
+	{
+#if defined( LUAW_BACKEND_LUAJIT )
+		// The environment of new userdata is the global table.
+		lua_getfenv( p_pState, p_Index );
+		if( lua_istable( p_pState, -1 ) && lua_rawequal( p_pState, -1, LUA_GLOBALSINDEX ) == 0 )
+		{
+			return true;
+		}
+#else
+		lua_getuservalue( p_pState, p_Index );
+		if( lua_istable( p_pState, -1 ) )
+		{
+			return true;
+		}
+#endif
+		lua_pop( p_pState, 1 );
+
+		if( p_Create == false )
+		{
+			return false;
+		}
+
+		lua_newtable( p_pState );
+		lua_pushvalue( p_pState, -1 );
+#if defined( LUAW_BACKEND_LUAJIT )
+		lua_setfenv( p_pState, p_Index );
+#else
+		lua_setuservalue( p_pState, p_Index );
+#endif
+		return true;
+	}
+#endif
+
+	// Registry key of the message handler closure.
+	static const char g_MessageHandlerKey = 0;
+
+	// Registry key of the trace recorder, global sets through any view of the state are recorded.
+	static const char g_TraceRecorderKey = 0;
+
+	// Trace recorder of the state, NULL if the script never recorded.
+	static TraceRecorder * GetTraceRecorder( lua_State * p_pState )
+	{
+		lua_rawgetp( p_pState, LUA_REGISTRYINDEX, &g_TraceRecorderKey );
+		TraceRecorder * pRecorder = static_cast<TraceRecorder *>( lua_touserdata( p_pState, -1 ) );
+		lua_pop( p_pState, 1 );
+		return pRecorder;
+	}
+
+	// Records the global set of the value on top of the stack.
+	static void RecordSetGlobal( lua_State * p_pState, const char * p_pName )
+	{
+		TraceRecorder * pRecorder = GetTraceRecorder( p_pState );
+		if( pRecorder == NULL )
+		{
+			return;
+		}
+
+		if( pRecorder->Begin( TRACE_SET_GLOBAL ) )
+		{
+			pRecorder->WriteString( p_pName );
+			pRecorder->WriteValue( p_pState, -1 );
+		}
+		pRecorder->End( );
+	}
+
+	// Raw call stack of the last error, filled by the message handler without any allocations.
+	struct Script::ErrorTrace
+	{
+		static const unsigned int MaxFrames = 32;
+
+		struct Frame
+		{
+			char Source[ LUA_IDSIZE ];
+			int Line;
+			int LineDefined;
+			char What; // 'L'ua, 'C', 'm'ain
+			lua_CFunction pFunction; // C functions only
+		};
+
+		ErrorTrace( ) :
+			Count( 0 ),
+			Truncated( false ),
+			Pending( false )
+		{
+		}
+
+		Frame Frames[ MaxFrames ];
+		unsigned int Count;
+		bool Truncated;
+		bool Pending; // Captured, but not formatted yet.
+	};
+
+	// Checks if there are any C functions on the call stack that we are not allowed to yield across.
+	static bool IsYieldable( lua_State * p_pState, const lua_CFunction * p_pYieldableFunctions )
+	{
+		lua_Debug Debug;
+		for( int Level = 0; lua_getstack( p_pState, Level, &Debug ); Level++ )
+		{
+			// Get the info and push the function
+			lua_getinfo( p_pState, "Sf", &Debug );
+			lua_CFunction Function = lua_tocfunction( p_pState, -1 );
+			lua_pop( p_pState, 1 );
+
+			if( Debug.what[ 0 ] == 'C' &&
+				Function != p_pYieldableFunctions[ 0 ] &&
+				Function != p_pYieldableFunctions[ 1 ] )
+			{
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	// Constructor
+	StateView::StateView( lua_State * p_pState ) :
+		m_pState( p_pState )
+	{
+	}
+
+
 	// Constructor/destructor
 	Script::Script( ) :
-		m_pState( NULL ),
-		m_ErrorMessage( "" )
+		StateView( NULL ),
+		m_ErrorMessage( "" ),
+		m_pErrorTrace( NULL ),
+		m_pHookContext( NULL ),
+		m_pWatchedContext( NULL ),
+		m_WatchdogCalls( 0 ),
+		m_pInstrumentation( NULL ),
+		m_pGarbageCollectorTelemetry( NULL ),
+		m_pTraceRecorder( NULL )
 	{
 		// Create a new Lua state
 		m_pState = luaL_newstate( );
 
 		// Open the Lua libraries
 		luaL_openlibs( m_pState );
+
+		// Create the hook context right away, watchdog threads may arm the timer at any time.
+		GetHookContext( );
 	}
 
 	Script::Script( lua_State * p_pState ) :
-		m_pState( NULL ),
-		m_ErrorMessage( "" )
+		StateView( p_pState ),
+		m_ErrorMessage( "" ),
+		m_pErrorTrace( NULL ),
+		m_pHookContext( NULL ),
+		m_pWatchedContext( NULL ),
+		m_WatchdogCalls( 0 ),
+		m_pInstrumentation( NULL ),
+		m_pGarbageCollectorTelemetry( NULL ),
+		m_pTraceRecorder( NULL )
 	{
-		if( p_pState )
-		{
-			m_pState = p_pState;
-		}
+		GetHookContext( );
+	}
+
+	Script::Script( Script && p_Script ) :
+		StateView( p_Script.m_pState ),
+		m_ErrorMessage( std::move( p_Script.m_ErrorMessage ) ),
+		m_pErrorTrace( p_Script.m_pErrorTrace ),
+		m_pHookContext( p_Script.m_pHookContext ),
+		m_pWatchedContext( p_Script.m_pHookContext ),
+		m_WatchdogCalls( 0 ),
+		m_pInstrumentation( p_Script.m_pInstrumentation ),
+		m_pGarbageCollectorTelemetry( p_Script.m_pGarbageCollectorTelemetry ),
+		m_pTraceRecorder( p_Script.m_pTraceRecorder )
+	{
+		// Everything is allocated on the heap, the pointers stay valid after the move.
+		p_Script.m_pState = NULL;
+		p_Script.m_pErrorTrace = NULL;
+		p_Script.m_pHookContext = NULL;
+		p_Script.m_pWatchedContext = NULL;
+		p_Script.m_pInstrumentation = NULL;
+		p_Script.m_pGarbageCollectorTelemetry = NULL;
+		p_Script.m_pTraceRecorder = NULL;
 	}
 
 	Script::~Script( )
 	{
+		Unload( );
+		delete m_pInstrumentation;
+		delete m_pTraceRecorder;
+		delete m_pErrorTrace;
+	}
+
+	// Move operator
+	Script & Script::operator = ( Script && p_Script )
+	{
+		if( this == &p_Script )
+		{
+			return *this;
+		}
+
+		// Close our own state first
+		Unload( );
+		delete m_pInstrumentation;
+		delete m_pTraceRecorder;
+		delete m_pErrorTrace;
+
+		m_pState = p_Script.m_pState;
+		m_ErrorMessage = std::move( p_Script.m_ErrorMessage );
+		m_pErrorTrace = p_Script.m_pErrorTrace;
+		m_pHookContext = p_Script.m_pHookContext;
+		m_pWatchedContext = p_Script.m_pHookContext;
+		m_pInstrumentation = p_Script.m_pInstrumentation;
+		m_pGarbageCollectorTelemetry = p_Script.m_pGarbageCollectorTelemetry;
+		m_pTraceRecorder = p_Script.m_pTraceRecorder;
+
+		p_Script.m_pState = NULL;
+		p_Script.m_pErrorTrace = NULL;
+		p_Script.m_pHookContext = NULL;
+		p_Script.m_pWatchedContext = NULL;
+		p_Script.m_pInstrumentation = NULL;
+		p_Script.m_pGarbageCollectorTelemetry = NULL;
+		p_Script.m_pTraceRecorder = NULL;
+
+		return *this;
 	}
 
 	// Public functions
 	eError Script::Call( int p_Arguments, int p_ReturnValues )
 	{
+		DiscardErrorTrace( );
+
 		// Make sure the stack size is ok
 		int StackSize = lua_gettop( m_pState );
 
@@ -65,9 +277,44 @@ namespace LuaW
 			return ERROR_STACK;
 		}
 
+		// Find the statistics of the function
+		BindingStats * pStats = NULL;
+		long long Start = 0;
+		if( m_pInstrumentation && m_pInstrumentation->IsEnabled( ) )
+		{
+			pStats = m_pInstrumentation->GetCallTarget( m_pState, -( p_Arguments + 1 ) );
+			pStats->Calls.store( pStats->Calls.load( std::memory_order_relaxed ) + 1, std::memory_order_relaxed );
+			Start = GetTimeNanoseconds( );
+		}
+
+		// Record the call, calls made from within a recorded call are not recorded.
+		TraceRecorder * pRecorder = m_pTraceRecorder;
+		if( pRecorder && pRecorder->Begin( TRACE_CALL ) )
+		{
+			pRecorder->WriteFunction( m_pState, -( p_Arguments + 1 ) );
+			pRecorder->WriteInteger( static_cast<unsigned long long>( p_Arguments ) );
+			for( int i = StackSize - p_Arguments + 1; i <= StackSize; i++ )
+			{
+				pRecorder->WriteValue( m_pState, i );
+			}
+		}
+
 		// Call the function at the stack.
-		int Error = LUA_OK;
-		if( ( Error = lua_pcall( m_pState, p_Arguments, LUA_MULTRET, 0 ) ) != LUA_OK )
+		BeginExecution( );
+		int Error = ProtectedCall( p_Arguments, p_ReturnValues );
+		eError Expired = EndExecution( );
+
+		if( pRecorder )
+		{
+			pRecorder->End( );
+		}
+
+		if( pStats && Error == LUA_OK )
+		{
+			pStats->Latency.Record( static_cast<unsigned long long>( GetTimeNanoseconds( ) - Start ) );
+		}
+
+		if( Error != LUA_OK )
 		{
 			// Something went wrong
 			// Get the stack size again.
@@ -83,7 +330,11 @@ namespace LuaW
 				lua_pop( m_pState, 1 );
 			}
 
-			// Return the error code
+			// Return the error code, an expired limit is reported over the runtime error.
+			if( Expired != ERROR_NONE )
+			{
+				return Expired;
+			}
 			return ConvertErrorCode( Error );
 		}
 
@@ -93,60 +344,90 @@ namespace LuaW
 
 	void Script::RegisterFunction( const char * p_pName, lua_CFunction p_Function )
 	{
+		if( m_pInstrumentation && m_pInstrumentation->IsEnabled( ) )
+		{
+			m_pInstrumentation->PushFunction( m_pState, p_pName, p_Function );
+			lua_setglobal( m_pState, p_pName );
+			return;
+		}
+
 		lua_register( m_pState, p_pName, p_Function );
 	}
 
 	eError Script::RunFile( const char * p_pFilePath )
 	{
+		DiscardErrorTrace( );
+
 		// Load and run the file for a first time
-		if( luaL_dofile( m_pState, p_pFilePath ) != false )
+		TraceRecorder * pRecorder = m_pTraceRecorder;
+		if( pRecorder && pRecorder->Begin( TRACE_RUN_FILE ) )
 		{
-			// Something messed up
-			// Get the stack size again.
-			int StackSize = lua_gettop( m_pState );
-
-			// Is there any error message on the stack?
-			if( StackSize )
-			{
-				// Get the error message, put it into a std::string
-				m_ErrorMessage = lua_tostring( m_pState, -1 );
-
-				// Pop the error message from the stack.
-				lua_pop( m_pState, 1 );
-			}
-
-			return ERROR_RUNTIME;
+			pRecorder->WriteString( p_pFilePath );
 		}
-		return ERROR_NONE;
+
+		BeginExecution( );
+		return RunChunk( luaL_loadfile( m_pState, p_pFilePath ), pRecorder );
 	}
 
 	eError Script::RunString( const char * p_pString )
 	{
+		DiscardErrorTrace( );
+
 		// Load and run the string for a first time
-		int Error = LUA_OK;
-		if( ( Error = luaL_dostring( m_pState, p_pString ) ) != LUA_OK )
+		TraceRecorder * pRecorder = m_pTraceRecorder;
+		if( pRecorder && pRecorder->Begin( TRACE_RUN_STRING ) )
 		{
-			// Something messed up
-			// Get the stack size again.
-			int StackSize = lua_gettop( m_pState );
+			pRecorder->WriteString( p_pString );
+		}
 
-			// Is there any error message on the stack?
-			if( StackSize )
-			{
-				// Get the error message, put it into a std::string
-				m_ErrorMessage = lua_tostring( m_pState, -1 );
+		BeginExecution( );
+		return RunChunk( luaL_loadstring( m_pState, p_pString ), pRecorder );
+	}
 
-				// Pop the error message from the stack.
-				lua_pop( m_pState, 1 );
-			}
+	eError Script::RunEmbedded( const char * p_pName )
+	{
+		DiscardErrorTrace( );
 
+		const EmbeddedScript * pScript = EmbeddedScripts::Find( p_pName );
+		if( pScript == NULL )
+		{
+			m_ErrorMessage = std::string( "Embedded script not found: " ) + p_pName;
 			return ERROR_RUNTIME;
 		}
-		return ERROR_NONE;
+
+		TraceRecorder * pRecorder = m_pTraceRecorder;
+		if( pRecorder && pRecorder->Begin( TRACE_RUN_EMBEDDED ) )
+		{
+			pRecorder->WriteString( p_pName );
+		}
+
+		// The chunk is loaded in place, without parsing if it is bytecode.
+		std::string ChunkName = std::string( "@" ) + p_pName;
+		BeginExecution( );
+		return RunChunk( luaL_loadbuffer( m_pState, reinterpret_cast<const char *>( pScript->pChunk ), pScript->Size, ChunkName.c_str( ) ), pRecorder );
+	}
+
+	eError Script::RunBuffer( const char * p_pData, const size_t p_Size, const char * p_pChunkName )
+	{
+		DiscardErrorTrace( );
+
+		// Chunks of files are traced as the file, the replay reads it from disk.
+		TraceRecorder * pRecorder = p_pChunkName && p_pChunkName[ 0 ] == '@' ? m_pTraceRecorder : NULL;
+		if( pRecorder && pRecorder->Begin( TRACE_RUN_FILE ) )
+		{
+			pRecorder->WriteString( p_pChunkName + 1 );
+		}
+
+		BeginExecution( );
+		return RunChunk( luaL_loadbuffer( m_pState, p_pData, p_Size, p_pChunkName ), pRecorder );
 	}
 
 	void Script::Unload( )
 	{
+		EnableGarbageCollectorTelemetry( false );
+		ReleaseHookContext( );
+		StopRecording( );
+
 		if( m_pState )
 		{
 			lua_close( m_pState );
@@ -154,6 +435,254 @@ namespace LuaW
 		}
 	}
 
+	// Execution limit functions
+	void Script::SetInstructionLimit( const unsigned int p_Instructions )
+	{
+		HookContext * pContext = GetHookContext( );
+		if( pContext )
+		{
+			pContext->InstructionLimit = p_Instructions;
+		}
+	}
+
+	void Script::SetTimeLimit( const unsigned int p_Microseconds )
+	{
+		HookContext * pContext = GetHookContext( );
+		if( pContext )
+		{
+			pContext->TimeLimit = p_Microseconds;
+		}
+	}
+
+	void Script::ArmTimer( const unsigned int p_Microseconds )
+	{
+		// Never create the context here, we might not be on the thread owning the state.
+		// Unload waits for the calls in progress before it deletes the context.
+		m_WatchdogCalls++;
+		HookContext * pContext = m_pWatchedContext.load( );
+		if( pContext )
+		{
+			// The running call is always hooked, the hook of every thread checks the deadline.
+			pContext->Deadline = GetTimeNanoseconds( ) + static_cast<long long>( p_Microseconds ) * 1000;
+		}
+		m_WatchdogCalls--;
+	}
+
+	void Script::Interrupt( )
+	{
+		m_WatchdogCalls++;
+		HookContext * pContext = m_pWatchedContext.load( );
+		if( pContext )
+		{
+			pContext->Interrupted = true;
+		}
+		m_WatchdogCalls--;
+	}
+
+	// Instrumentation functions
+	void Script::EnableInstrumentation( const bool p_Enabled )
+	{
+		if( m_pInstrumentation == NULL )
+		{
+			if( p_Enabled == false )
+			{
+				return;
+			}
+
+			m_pInstrumentation = new Instrumentation;
+		}
+
+		m_pInstrumentation->SetEnabled( p_Enabled );
+	}
+
+	Instrumentation * Script::GetInstrumentation( ) const
+	{
+		return m_pInstrumentation;
+	}
+
+	// Garbage collector functions
+	void Script::SetGarbageCollectorMode( const eGarbageCollectorMode p_Mode )
+	{
+#if defined( LUAW_BACKEND_LUA54 )
+		// Zero keeps the current parameters of the mode.
+		if( p_Mode == GC_GENERATIONAL )
+		{
+			lua_gc( m_pState, LUA_GCGEN, 0, 0 );
+		}
+		else
+		{
+			lua_gc( m_pState, LUA_GCINC, 0, 0, 0 );
+		}
+#elif defined( LUA_GCGEN )
+		lua_gc( m_pState, p_Mode == GC_GENERATIONAL ? LUA_GCGEN : LUA_GCINC, 0 );
+#else
+		// The backend only has the incremental collector.
+		(void)p_Mode;
+#endif
+	}
+
+	int Script::SetGarbageCollectorPause( const int p_Percent )
+	{
+		return lua_gc( m_pState, LUA_GCSETPAUSE, p_Percent );
+	}
+
+	int Script::SetGarbageCollectorStepMultiplier( const int p_Percent )
+	{
+		return lua_gc( m_pState, LUA_GCSETSTEPMUL, p_Percent );
+	}
+
+	void Script::StopGarbageCollector( )
+	{
+		lua_gc( m_pState, LUA_GCSTOP, 0 );
+	}
+
+	void Script::RestartGarbageCollector( )
+	{
+		lua_gc( m_pState, LUA_GCRESTART, 0 );
+	}
+
+	bool Script::IsGarbageCollectorRunning( )
+	{
+#if defined( LUA_GCISRUNNING )
+		return lua_gc( m_pState, LUA_GCISRUNNING, 0 ) != 0;
+#else
+		return true;
+#endif
+	}
+
+	void Script::CollectGarbage( )
+	{
+		lua_gc( m_pState, LUA_GCCOLLECT, 0 );
+	}
+
+	bool Script::StepGarbageCollector( const unsigned int p_Microseconds )
+	{
+		// Run the smallest steps possible until the budget is used,
+		// stepping works even if the collector is stopped.
+		long long Deadline = GetTimeNanoseconds( ) + static_cast<long long>( p_Microseconds ) * 1000;
+		do
+		{
+			if( lua_gc( m_pState, LUA_GCSTEP, 0 ) )
+			{
+				return true;
+			}
+		}
+		while( GetTimeNanoseconds( ) < Deadline );
+
+		return false;
+	}
+
+	size_t Script::GetMemoryUsage( )
+	{
+		return static_cast<size_t>( lua_gc( m_pState, LUA_GCCOUNT, 0 ) ) * 1024 +
+			static_cast<size_t>( lua_gc( m_pState, LUA_GCCOUNTB, 0 ) );
+	}
+
+	void Script::EnableGarbageCollectorTelemetry( const bool p_Enabled )
+	{
+		if( p_Enabled && m_pGarbageCollectorTelemetry == NULL && m_pState )
+		{
+			m_pGarbageCollectorTelemetry = new GarbageCollectorTelemetry( m_pState );
+		}
+		else if( p_Enabled == false && m_pGarbageCollectorTelemetry )
+		{
+			delete m_pGarbageCollectorTelemetry;
+			m_pGarbageCollectorTelemetry = NULL;
+		}
+	}
+
+	GarbageCollectorTelemetry * Script::GetGarbageCollectorTelemetry( ) const
+	{
+		return m_pGarbageCollectorTelemetry;
+	}
+
+	// JIT functions
+	bool Script::SetJitEnabled( const bool p_Enabled )
+	{
+#if defined( LUAW_BACKEND_LUAJIT )
+		return luaJIT_setmode( m_pState, 0, LUAJIT_MODE_ENGINE | ( p_Enabled ? LUAJIT_MODE_ON : LUAJIT_MODE_OFF ) ) != 0;
+#else
+		( void )p_Enabled;
+		return false;
+#endif
+	}
+
+	bool Script::FlushJit( )
+	{
+#if defined( LUAW_BACKEND_LUAJIT )
+		return luaJIT_setmode( m_pState, 0, LUAJIT_MODE_ENGINE | LUAJIT_MODE_FLUSH ) != 0;
+#else
+		return false;
+#endif
+	}
+
+	bool Script::EnableFfi( )
+	{
+#if defined( LUAW_BACKEND_LUAJIT )
+		// The FFI module is preloaded, but not loaded by luaL_openlibs.
+		lua_getglobal( m_pState, "require" );
+		lua_pushstring( m_pState, "ffi" );
+		if( lua_pcall( m_pState, 1, 1, 0 ) != LUA_OK )
+		{
+			DiscardErrorTrace( );
+			m_ErrorMessage = lua_tostring( m_pState, -1 );
+			lua_pop( m_pState, 1 );
+			return false;
+		}
+
+		lua_setglobal( m_pState, "ffi" );
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	// Error functions
+	void Script::EnableTraceback( const bool p_Enabled )
+	{
+		if( p_Enabled && m_pErrorTrace == NULL )
+		{
+			m_pErrorTrace = new ErrorTrace;
+
+			// Create the handler once, every protected call pushes it from the registry.
+			lua_pushlightuserdata( m_pState, m_pErrorTrace );
+			lua_pushcclosure( m_pState, MessageHandler, 1 );
+			lua_rawsetp( m_pState, LUA_REGISTRYINDEX, &g_MessageHandlerKey );
+		}
+		else if( p_Enabled == false && m_pErrorTrace )
+		{
+			lua_pushnil( m_pState );
+			lua_rawsetp( m_pState, LUA_REGISTRYINDEX, &g_MessageHandlerKey );
+
+			delete m_pErrorTrace;
+			m_pErrorTrace = NULL;
+		}
+	}
+
+	// Trace functions
+	bool Script::StartRecording( const char * p_pFilePath )
+	{
+		// The recorder is kept until the script is destroyed, calls in progress may still use it.
+		if( m_pTraceRecorder == NULL )
+		{
+			m_pTraceRecorder = new TraceRecorder;
+
+			// Registered in the state, views of it record as well.
+			lua_pushlightuserdata( m_pState, m_pTraceRecorder );
+			lua_rawsetp( m_pState, LUA_REGISTRYINDEX, &g_TraceRecorderKey );
+		}
+
+		return m_pTraceRecorder->Open( p_pFilePath );
+	}
+
+	void Script::StopRecording( )
+	{
+		if( m_pTraceRecorder )
+		{
+			m_pTraceRecorder->Close( );
+		}
+	}
+
 	// Foo Test
 	class Foo
 	{
@@ -181,7 +710,7 @@ namespace LuaW
 		//std::cout << "[FooNewConstructor]" << std::endl;
 
 
-		LuaW::Script Lua( p_pState );
+		LuaW::StateView Lua( p_pState );
 		int Parameter = Lua.GetInteger( -1 );
 
 		Foo ** ppData = (Foo**)lua_newuserdata( p_pState, sizeof(Foo * ));
@@ -197,7 +726,7 @@ namespace LuaW
 	int FooGetData( lua_State * p_pState )
 	{
 		//std::cout << "[FooGetData]" << std::endl;
-		LuaW::Script Lua( p_pState );
+		LuaW::StateView Lua( p_pState );
 
 		Foo * pFoo = *(Foo**)luaL_checkudata( p_pState, 1, "Foo_Table" );
 	
@@ -241,7 +770,7 @@ namespace LuaW
 
 
 	// Get globals functions
-	bool Script::GetGlobalBoolean( const char * p_pName )
+	bool StateView::GetGlobalBoolean( const char * p_pName )
 	{
 		// Push the value by the variable name
 		lua_getglobal( m_pState, p_pName );
@@ -252,7 +781,7 @@ namespace LuaW
 		return Ret;
 	}
 
-	lua_Integer Script::GetGlobalInteger( const char * p_pName )
+	lua_Integer StateView::GetGlobalInteger( const char * p_pName )
 	{
 		// Push the value by the variable name
 		lua_getglobal( m_pState, p_pName );
@@ -263,7 +792,7 @@ namespace LuaW
 		return Ret;
 	}
 
-	lua_Number Script::GetGlobalNumber( const char * p_pName )
+	lua_Number StateView::GetGlobalNumber( const char * p_pName )
 	{
 		// Push the value by the variable name
 		lua_getglobal( m_pState, p_pName );
@@ -274,7 +803,7 @@ namespace LuaW
 		return Ret;
 	}
 
-	std::string Script::GetGlobalString( const char * p_pName )
+	std::string StateView::GetGlobalString( const char * p_pName )
 	{
 		// Push the value by the variable name
 		lua_getglobal( m_pState, p_pName );
@@ -286,33 +815,37 @@ namespace LuaW
 	}
 
 	// Set globals functions
-	void Script::SetGlobalBoolean( const char * p_pName, const bool p_Boolean )
+	void StateView::SetGlobalBoolean( const char * p_pName, const bool p_Boolean )
 	{
 		lua_pushboolean( m_pState, static_cast<int>( p_Boolean ) );
+		RecordSetGlobal( m_pState, p_pName );
 		lua_setglobal( m_pState, p_pName );
 	}
 
-	void Script::SetGlobalInteger( const char * p_pName, const lua_Integer p_Integer )
+	void StateView::SetGlobalInteger( const char * p_pName, const lua_Integer p_Integer )
 	{
 		lua_pushinteger( m_pState, p_Integer );
+		RecordSetGlobal( m_pState, p_pName );
 		lua_setglobal( m_pState, p_pName );
 	}
 
-	void Script::SetGlobalNumber( const char * p_pName, const lua_Number p_Number )
+	void StateView::SetGlobalNumber( const char * p_pName, const lua_Number p_Number )
 	{
 		lua_pushnumber( m_pState, p_Number );
+		RecordSetGlobal( m_pState, p_pName );
 		lua_setglobal( m_pState, p_pName );
 	}
 
-	void Script::SetGlobalString( const char * p_pName, const std::string & p_String )
+	void StateView::SetGlobalString( const char * p_pName, const std::string & p_String )
 	{
 		lua_pushstring( m_pState, p_String.c_str( ) );
+		RecordSetGlobal( m_pState, p_pName );
 		lua_setglobal( m_pState, p_pName );
 	}
 
 
 	// Stack functions
-	void Script::ClearStack( )
+	void StateView::ClearStack( )
 	{
 		int StackSize = lua_gettop( m_pState );
 
@@ -322,12 +855,12 @@ namespace LuaW
 		}
 	}
 
-	int Script::GetStackSize( ) const
+	int StateView::GetStackSize( ) const
 	{
 		return lua_gettop( m_pState );
 	}
 
-	void Script::DumpStack( )
+	void StateView::DumpStack( )
 	{
 		int StackSize = lua_gettop( m_pState );
 
@@ -384,53 +917,116 @@ namespace LuaW
 
 
 	// Stack push functions
-	void Script::Push( )
+	void StateView::Push( )
 	{
 		lua_pushnil( m_pState );
 	}
 
-	void Script::PushBoolean( const bool p_Boolean )
+	void StateView::PushBoolean( const bool p_Boolean )
 	{
 		lua_pushboolean( m_pState, static_cast<int>( p_Boolean ) );
 	}
 
-	void Script::PushGlobal( const char * p_pName )
+	void StateView::PushGlobal( const char * p_pName )
 	{
 		lua_getglobal( m_pState, p_pName );
+
+		TraceRecorder * pRecorder = GetTraceRecorder( m_pState );
+		if( pRecorder )
+		{
+			pRecorder->SetGlobalHint( m_pState, p_pName );
+		}
 	}
 
-	void Script::PushInteger( const lua_Number p_Integer )
+	void StateView::PushInteger( const lua_Integer p_Integer )
 	{
 		lua_pushinteger( m_pState, p_Integer );
 	}
 
-	void Script::PushNumber( const lua_Number p_Number )
+	void StateView::PushNumber( const lua_Number p_Number )
 	{
 		lua_pushnumber( m_pState, p_Number );
 	}
 
-	void Script::PushString( const std::string & p_String )
+	void StateView::PushString( const std::string & p_String )
 	{
 		lua_pushstring( m_pState, p_String.c_str( ) );
 	}
 
-	void Script::PushValue( const int p_Index )
+	void StateView::PushValue( const int p_Index )
 	{
 		lua_pushvalue( m_pState, p_Index );
 	}
 
+	// Userdata functions
+	void * StateView::NewUserdata( const size_t p_Size, const int p_UserValues )
+	{
+#if defined( LUAW_BACKEND_LUA54 )
+		return lua_newuserdatauv( m_pState, p_Size, p_UserValues );
+#else
+		// The user value table is created by the first SetUserValue.
+		(void)p_UserValues;
+		return lua_newuserdata( m_pState, p_Size );
+#endif
+	}
+
+	bool StateView::SetUserValue( const int p_Index, const int p_Slot )
+	{
+#if defined( LUAW_BACKEND_LUA54 )
+		return lua_setiuservalue( m_pState, p_Index, p_Slot ) != 0;
+#else
+		int Index = lua_absindex( m_pState, p_Index );
+		if( p_Slot < 1 || lua_type( m_pState, Index ) != LUA_TUSERDATA )
+		{
+			lua_pop( m_pState, 1 );
+			return false;
+		}
+
+		PushUserValueTable( m_pState, Index, true );
+		lua_insert( m_pState, -2 );
+		lua_rawseti( m_pState, -2, p_Slot );
+		lua_pop( m_pState, 1 );
+		return true;
+#endif
+	}
+
+	bool StateView::PushUserValue( const int p_Index, const int p_Slot )
+	{
+#if defined( LUAW_BACKEND_LUA54 )
+		return lua_getiuservalue( m_pState, p_Index, p_Slot ) != LUA_TNONE;
+#else
+		int Index = lua_absindex( m_pState, p_Index );
+		if( p_Slot < 1 || lua_type( m_pState, Index ) != LUA_TUSERDATA )
+		{
+			lua_pushnil( m_pState );
+			return false;
+		}
+
+		if( PushUserValueTable( m_pState, Index, false ) )
+		{
+			lua_rawgeti( m_pState, -1, p_Slot );
+			lua_remove( m_pState, -2 );
+		}
+		else
+		{
+			lua_pushnil( m_pState );
+		}
+		return true;
+#endif
+	}
+
 	// Stack pop functions
-	void Script::Pop( )
+	void StateView::Pop( )
 	{
 		lua_pop( m_pState, 1 );
 	}
 
-	void Script::Pop( const int p_ElementCount )
+	void StateView::Pop( const int p_ElementCount )
 	{
 		lua_pop( m_pState, p_ElementCount );
 	}
 
-	bool Script::PopBoolean( )
+	bool StateView::PopBoolean( )
 	{
 		// Get stack size
 		int StackSize = lua_gettop( m_pState );
@@ -447,7 +1043,7 @@ namespace LuaW
 		return false;
 	}
 
-	lua_Integer Script::PopInteger( )
+	lua_Integer StateView::PopInteger( )
 	{
 		// Get stack size
 		int StackSize = lua_gettop( m_pState );
@@ -464,7 +1060,7 @@ namespace LuaW
 		return 0;
 	}
 
-	lua_Number Script::PopNumber( )
+	lua_Number StateView::PopNumber( )
 	{
 		// Get stack size
 		int StackSize = lua_gettop( m_pState );
@@ -481,7 +1077,7 @@ namespace LuaW
 		return 0;
 	}
 
-	std::string Script::PopString( )
+	std::string StateView::PopString( )
 	{
 		// Get stack size
 		int StackSize = lua_gettop( m_pState );
@@ -500,7 +1096,7 @@ namespace LuaW
 
 			
 	// Get stack functions
-	bool Script::GetBoolean( )
+	bool StateView::GetBoolean( )
 	{
 		// Get stack size
 		int StackSize = lua_gettop( m_pState );
@@ -516,13 +1112,13 @@ namespace LuaW
 		return false;
 	}
 
-	bool Script::GetBoolean( const int p_Index )
+	bool StateView::GetBoolean( const int p_Index )
 	{
 		// Get the boolean
 		return static_cast<bool>( lua_toboolean( m_pState, p_Index ) );
 	}
 
-	lua_Integer Script::GetInteger( )
+	lua_Integer StateView::GetInteger( )
 	{
 		// Get stack size
 		int StackSize = lua_gettop( m_pState );
@@ -538,13 +1134,13 @@ namespace LuaW
 		return 0;
 	}
 
-	lua_Integer Script::GetInteger( const int p_Index )
+	lua_Integer StateView::GetInteger( const int p_Index )
 	{
 		// Get the integer
 		return lua_tointeger( m_pState, p_Index );
 	}
 
-	lua_Number Script::GetNumber( )
+	lua_Number StateView::GetNumber( )
 	{
 		// Get stack size
 		int StackSize = lua_gettop( m_pState );
@@ -560,13 +1156,13 @@ namespace LuaW
 		return 0;
 	}
 
-	lua_Number Script::GetNumber( const int p_Index )
+	lua_Number StateView::GetNumber( const int p_Index )
 	{
 		// Get the number
 		return lua_tonumber( m_pState, p_Index );
 	}
 
-	std::string Script::GetString( )
+	std::string StateView::GetString( )
 	{
 		// Get stack size
 		int StackSize = lua_gettop( m_pState );
@@ -582,7 +1178,7 @@ namespace LuaW
 		return "";
 	}
 
-	std::string Script::GetString( const int p_Index )
+	std::string StateView::GetString( const int p_Index )
 	{
 		// Get the number
 		return lua_tostring( m_pState, p_Index );
@@ -590,17 +1186,320 @@ namespace LuaW
 
 
 	// General get functions
-	lua_State * Script::GetState( ) const
+	lua_State * StateView::GetState( ) const
 	{
 		return m_pState;
 	}
 
 	const std::string & Script::GetLastError( ) const
 	{
+		// Format the captured traceback the first time the error is read.
+		if( m_pErrorTrace && m_pErrorTrace->Pending )
+		{
+			m_pErrorTrace->Pending = false;
+			m_ErrorMessage += "\nstack traceback:";
+
+			char Buffer[ LUA_IDSIZE + 64 ];
+			for( unsigned int i = 0; i < m_pErrorTrace->Count; i++ )
+			{
+				const ErrorTrace::Frame & Frame = m_pErrorTrace->Frames[ i ];
+				switch( Frame.What )
+				{
+					case 'C':
+					{
+						std::sprintf( Buffer, "\n\t[C]: in function <%p>", reinterpret_cast<void *>( Frame.pFunction ) );
+					}
+					break;
+					case 'm':
+					{
+						std::sprintf( Buffer, "\n\t%s:%d: in main chunk", Frame.Source, Frame.Line );
+					}
+					break;
+					default:
+					{
+						std::sprintf( Buffer, "\n\t%s:%d: in function <%s:%d>",
+							Frame.Source, Frame.Line, Frame.Source, Frame.LineDefined );
+					}
+					break;
+				}
+				m_ErrorMessage += Buffer;
+			}
+
+			if( m_pErrorTrace->Truncated )
+			{
+				m_ErrorMessage += "\n\t...";
+			}
+		}
+
 		return m_ErrorMessage;
 	}
 
 	// Private functions
+	Script::HookContext * Script::GetHookContext( )
+	{
+		if( m_pHookContext == NULL && m_pState )
+		{
+			m_pHookContext = new HookContext;
+			m_pWatchedContext = m_pHookContext;
+
+			// Store the context in the registry, the hook only knows about the lua_State.
+			lua_pushlightuserdata( m_pState, m_pHookContext );
+			lua_rawsetp( m_pState, LUA_REGISTRYINDEX, &g_HookContextKey );
+		}
+
+		return m_pHookContext;
+	}
+
+	void Script::ReleaseHookContext( )
+	{
+		if( m_pHookContext == NULL )
+		{
+			return;
+		}
+
+		if( m_pState )
+		{
+			lua_sethook( m_pState, NULL, 0, 0 );
+			lua_pushnil( m_pState );
+			lua_rawsetp( m_pState, LUA_REGISTRYINDEX, &g_HookContextKey );
+		}
+
+		// Hide the context from the watchdog threads and wait for those already using it.
+		m_pWatchedContext = NULL;
+		while( m_WatchdogCalls.load( ) )
+		{
+			std::this_thread::yield( );
+		}
+
+		delete m_pHookContext;
+		m_pHookContext = NULL;
+	}
+
+	void Script::BeginExecution( )
+	{
+		// Only the outermost call is limited.
+		if( m_pHookContext == NULL || m_pHookContext->Depth++ > 0 )
+		{
+			return;
+		}
+
+		m_pHookContext->Instructions = 0;
+		m_pHookContext->Expired = ERROR_NONE;
+
+		// An interrupt only aborts the call it was made during.
+		m_pHookContext->Interrupted = false;
+
+		if( m_pHookContext->TimeLimit )
+		{
+			m_pHookContext->Deadline = GetTimeNanoseconds( ) +
+				static_cast<long long>( m_pHookContext->TimeLimit ) * 1000;
+		}
+
+		// Always install the count hook, a watchdog thread may arm the timer at any time.
+		// Coroutines created by the call inherit the hook, so the limits reach them as well.
+		unsigned int Count = g_HookInterval;
+		if( m_pHookContext->InstructionLimit && m_pHookContext->InstructionLimit < Count )
+		{
+			Count = m_pHookContext->InstructionLimit;
+		}
+
+		lua_sethook( m_pState, HookCallback, LUA_MASKCOUNT, static_cast<int>( Count ) );
+	}
+
+	eError Script::EndExecution( )
+	{
+		if( m_pHookContext == NULL || --m_pHookContext->Depth > 0 )
+		{
+			return ERROR_NONE;
+		}
+
+		eError Expired = m_pHookContext->Expired;
+
+		// Disarm everything, the limits are per call. Keep the hook for the profiler.
+		if( m_pHookContext->pProfiler.load( ) )
+		{
+			lua_sethook( m_pState, HookCallback, LUA_MASKCOUNT, g_HookInterval );
+		}
+		else
+		{
+			lua_sethook( m_pState, NULL, 0, 0 );
+		}
+		m_pHookContext->Expired = ERROR_NONE;
+		m_pHookContext->Interrupted = false;
+		m_pHookContext->Deadline = 0;
+
+		return Expired;
+	}
+
+	void Script::HookCallback( lua_State * p_pState, lua_Debug * p_pDebug )
+	{
+		( void )p_pDebug;
+
+		// Find the hook context of the state
+		lua_rawgetp( p_pState, LUA_REGISTRYINDEX, &g_HookContextKey );
+		HookContext * pContext = static_cast<HookContext *>( lua_touserdata( p_pState, -1 ) );
+		lua_pop( p_pState, 1 );
+
+		if( pContext == NULL )
+		{
+			return;
+		}
+
+		// Only calls made by the owning script are limited.
+		if( pContext->Depth > 0 && pContext->Expired == ERROR_NONE )
+		{
+			pContext->Instructions += static_cast<unsigned int>( lua_gethookcount( p_pState ) );
+
+			if( pContext->Interrupted.load( ) )
+			{
+				pContext->Expired = ERROR_TIMEOUT;
+			}
+			else if( pContext->InstructionLimit && pContext->Instructions >= pContext->InstructionLimit )
+			{
+				pContext->Expired = ERROR_INSTRUCTION_LIMIT;
+			}
+			else
+			{
+				long long Deadline = pContext->Deadline.load( );
+				if( Deadline && GetTimeNanoseconds( ) >= Deadline )
+				{
+					pContext->Expired = ERROR_TIMEOUT;
+				}
+			}
+
+			if( pContext->Expired != ERROR_NONE )
+			{
+				// Raise the error at every instruction from now on,
+				// the script must not be able to swallow it with pcall.
+				lua_sethook( p_pState, HookCallback, LUA_MASKCOUNT, 1 );
+			}
+			else if( pContext->InstructionLimit )
+			{
+				// Hit the instruction limit exactly.
+				unsigned int Remaining = pContext->InstructionLimit - pContext->Instructions;
+				if( Remaining < g_HookInterval )
+				{
+					lua_sethook( p_pState, HookCallback, LUA_MASKCOUNT, static_cast<int>( Remaining ) );
+				}
+			}
+		}
+
+		if( pContext->Depth > 0 && pContext->Expired != ERROR_NONE )
+		{
+			luaL_error( p_pState, pContext->Expired == ERROR_TIMEOUT ?
+				"time limit exceeded" : "instruction limit exceeded" );
+		}
+
+		// Sample the call stack, announce the use first so that a stopping profiler waits for it.
+		if( pContext->pProfiler.load( ) )
+		{
+			pContext->Sampling++;
+			Profiler * pProfiler = pContext->pProfiler.load( );
+			if( pProfiler )
+			{
+				pProfiler->TakeSample( p_pState );
+			}
+			pContext->Sampling--;
+		}
+
+		// Preempt the running task of the scheduler at the end of its time slice.
+		if( pContext->pRunningTask == p_pState &&
+			GetTimeNanoseconds( ) >= pContext->SliceEnd &&
+			IsYieldable( p_pState, pContext->YieldableFunctions ) )
+		{
+			lua_yield( p_pState, 0 );
+		}
+	}
+
+	int Script::MessageHandler( lua_State * p_pState )
+	{
+		// Copy the raw frames only, the error message is returned untouched.
+		ErrorTrace * pTrace = static_cast<ErrorTrace *>( lua_touserdata( p_pState, lua_upvalueindex( 1 ) ) );
+		pTrace->Count = 0;
+		pTrace->Truncated = false;
+		pTrace->Pending = true;
+
+		lua_Debug Debug;
+		for( int Level = 1; lua_getstack( p_pState, Level, &Debug ); Level++ )
+		{
+			if( pTrace->Count == ErrorTrace::MaxFrames )
+			{
+				pTrace->Truncated = true;
+				break;
+			}
+
+			lua_getinfo( p_pState, "Slf", &Debug );
+			ErrorTrace::Frame & Frame = pTrace->Frames[ pTrace->Count++ ];
+			std::memcpy( Frame.Source, Debug.short_src, sizeof( Frame.Source ) );
+			Frame.Line = Debug.currentline;
+			Frame.LineDefined = Debug.linedefined;
+			Frame.What = Debug.what[ 0 ] == 'C' ? 'C' : ( Debug.what[ 0 ] == 'm' ? 'm' : 'L' );
+			Frame.pFunction = lua_tocfunction( p_pState, -1 );
+			lua_pop( p_pState, 1 );
+		}
+
+		return 1;
+	}
+
+	int Script::ProtectedCall( const int p_Arguments, const int p_ReturnValues )
+	{
+		if( m_pErrorTrace == NULL )
+		{
+			return lua_pcall( m_pState, p_Arguments, p_ReturnValues, 0 );
+		}
+
+		// Put the handler below the function and remove it again afterwards.
+		m_pErrorTrace->Pending = false;
+		int Base = lua_gettop( m_pState ) - p_Arguments;
+		lua_rawgetp( m_pState, LUA_REGISTRYINDEX, &g_MessageHandlerKey );
+		lua_insert( m_pState, Base );
+
+		int Error = lua_pcall( m_pState, p_Arguments, p_ReturnValues, Base );
+		lua_remove( m_pState, Base );
+		return Error;
+	}
+
+	eError Script::RunChunk( const int p_LoadError, TraceRecorder * p_pRecorder )
+	{
+		int Error = p_LoadError;
+		if( Error == LUA_OK )
+		{
+			Error = ProtectedCall( 0, LUA_MULTRET );
+		}
+		eError Expired = EndExecution( );
+
+		if( p_pRecorder )
+		{
+			p_pRecorder->End( );
+		}
+
+		if( Error != LUA_OK )
+		{
+			// Is there any error message on the stack?
+			if( lua_gettop( m_pState ) )
+			{
+				const char * pMessage = lua_tostring( m_pState, -1 );
+				m_ErrorMessage = pMessage ? pMessage : "";
+				lua_pop( m_pState, 1 );
+			}
+
+			if( Expired != ERROR_NONE )
+			{
+				return Expired;
+			}
+			return ERROR_RUNTIME;
+		}
+		return ERROR_NONE;
+	}
+
+	void Script::DiscardErrorTrace( )
+	{
+		if( m_pErrorTrace )
+		{
+			m_pErrorTrace->Pending = false;
+		}
+	}
+
 	eError Script::ConvertErrorCode( int p_Code )
 	{
 		switch( p_Code )
@@ -625,11 +1524,13 @@ namespace LuaW
 				return ERROR_MEMORY;
 			}
 			break;
+#if defined( LUA_ERRGCMM )
 			case LUA_ERRGCMM:
 			{
 				return ERROR_GARBAGE_COLLECTOR;
 			}
 			break;
+#endif
 			case LUA_ERRERR:
 			{
 				return ERROR_MESSAGE_HANDLER;
@@ -0,0 +1,147 @@
+// ///////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2013 Jimmie Bergmann - jimmiebergmann@gmail.com
+//
+// This software is provided 'as-is', without any express or
+// implied warranty. In no event will the authors be held
+// liable for any damages arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute
+// it freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented;
+//    you must not claim that you wrote the original software.
+//    If you use this software in a product, an acknowledgment
+//    in the product documentation would be appreciated but
+//    is not required.
+//
+// 2. Altered source versions must be plainly marked as such,
+//    and must not be misrepresented as being the original software.
+//
+// 3. This notice may not be removed or altered from any
+//    source distribution.
+// ///////////////////////////////////////////////////////////////////////////
+
+#include "MappedFile.hpp"
+
+#if defined( _WIN32 )
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace LuaW
+{
+
+	// Constructor/destructor
+	MappedFile::MappedFile( ) :
+		m_pData( NULL ),
+		m_Size( 0 )
+	{
+	}
+
+	MappedFile::~MappedFile( )
+	{
+		Close( );
+	}
+
+	// Public functions
+	bool MappedFile::Open( const std::string & p_FileName )
+	{
+		Close( );
+
+#if defined( _WIN32 )
+		HANDLE File = CreateFileA( p_FileName.c_str( ), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL );
+		if( File == INVALID_HANDLE_VALUE )
+		{
+			return false;
+		}
+
+		LARGE_INTEGER FileSize;
+		if( GetFileSizeEx( File, &FileSize ) == 0 || FileSize.QuadPart == 0 )
+		{
+			CloseHandle( File );
+			return false;
+		}
+
+		// The view keeps the file open, the handles are not needed once it is mapped.
+		const char * pData = NULL;
+		HANDLE Mapping = CreateFileMappingA( File, NULL, PAGE_READONLY, 0, 0, NULL );
+		if( Mapping )
+		{
+			pData = static_cast<const char *>( MapViewOfFile( Mapping, FILE_MAP_READ, 0, 0, 0 ) );
+			CloseHandle( Mapping );
+		}
+		CloseHandle( File );
+
+		if( pData == NULL )
+		{
+			return false;
+		}
+
+		m_pData = pData;
+		m_Size = static_cast<size_t>( FileSize.QuadPart );
+#else
+		int File = open( p_FileName.c_str( ), O_RDONLY );
+		if( File < 0 )
+		{
+			return false;
+		}
+
+		struct stat Status;
+		if( fstat( File, &Status ) != 0 || Status.st_size == 0 )
+		{
+			close( File );
+			return false;
+		}
+
+		// The mapping keeps the file open, the descriptor is not needed once it is mapped.
+		size_t Size = static_cast<size_t>( Status.st_size );
+		void * pMapping = mmap( NULL, Size, PROT_READ, MAP_SHARED, File, 0 );
+		close( File );
+
+		if( pMapping == MAP_FAILED )
+		{
+			return false;
+		}
+
+		m_pData = static_cast<const char *>( pMapping );
+		m_Size = Size;
+#endif
+
+		return true;
+	}
+
+	void MappedFile::Close( )
+	{
+		if( m_pData == NULL )
+		{
+			return;
+		}
+
+#if defined( _WIN32 )
+		UnmapViewOfFile( m_pData );
+#else
+		munmap( const_cast<char *>( m_pData ), m_Size );
+#endif
+
+		m_pData = NULL;
+		m_Size = 0;
+	}
+
+	// General get functions
+	const char * MappedFile::GetData( ) const
+	{
+		return m_pData;
+	}
+
+	size_t MappedFile::GetSize( ) const
+	{
+		return m_Size;
+	}
+
+}
@@ -0,0 +1,80 @@
+// ///////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2013 Jimmie Bergmann - jimmiebergmann@gmail.com
+//
+// This software is provided 'as-is', without any express or
+// implied warranty. In no event will the authors be held
+// liable for any damages arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute
+// it freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented;
+//    you must not claim that you wrote the original software.
+//    If you use this software in a product, an acknowledgment
+//    in the product documentation would be appreciated but
+//    is not required.
+//
+// 2. Altered source versions must be plainly marked as such,
+//    and must not be misrepresented as being the original software.
+//
+// 3. This notice may not be removed or altered from any
+//    source distribution.
+// ///////////////////////////////////////////////////////////////////////////
+
+// Internal read-only file mapping, shared by the datasets and the bundles.
+
+#ifndef LUA_W_MAPPED_FILE_HPP
+#define LUA_W_MAPPED_FILE_HPP
+
+#include <cstddef>
+#include <string>
+
+namespace LuaW
+{
+
+	// FNV-1a, the hash of the indexes in mapped blocks. Changing it breaks existing files.
+	inline unsigned int HashString( const char * p_pString, const size_t p_Length )
+	{
+		unsigned int Hash = 2166136261U;
+		for( size_t i = 0; i < p_Length; i++ )
+		{
+			Hash ^= static_cast<unsigned char>( p_pString[ i ] );
+			Hash *= 16777619U;
+		}
+		return Hash;
+	}
+
+	// Maps a whole file read-only, the pages are shared with every process mapping the same file.
+	class MappedFile
+	{
+
+	public:
+
+		// Constructor/destructor
+		MappedFile( );
+		~MappedFile( );
+
+		// Public functions
+		bool Open( const std::string & p_FileName ); // Fails for empty files
+		void Close( );
+
+		// General get functions
+		const char * GetData( ) const;
+		size_t GetSize( ) const;
+
+	private:
+
+		// Copy is not allowed
+		MappedFile( const MappedFile & p_File );
+		MappedFile & operator = ( const MappedFile & p_File );
+
+		// Private variables
+		const char * m_pData;
+		size_t m_Size;
+
+	};
+
+}
+
+#endif
@@ -0,0 +1,252 @@
+// ///////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2013 Jimmie Bergmann - jimmiebergmann@gmail.com
+//
+// This software is provided 'as-is', without any express or
+// implied warranty. In no event will the authors be held
+// liable for any damages arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute
+// it freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented;
+//    you must not claim that you wrote the original software.
+//    If you use this software in a product, an acknowledgment
+//    in the product documentation would be appreciated but
+//    is not required.
+//
+// 2. Altered source versions must be plainly marked as such,
+//    and must not be misrepresented as being the original software.
+//
+// 3. This notice may not be removed or altered from any
+//    source distribution.
+// ///////////////////////////////////////////////////////////////////////////
+
+#include <LuaW/ParallelLoader.hpp>
+#include "ChunkWriter.hpp"
+#include <cstdio>
+#include <thread>
+
+namespace LuaW
+{
+
+	// Sort states of the files
+	enum eSortState
+	{
+		SORT_NONE = 0,
+		SORT_VISITING = 1,
+		SORT_DONE = 2
+	};
+
+	// Constructor
+	ParallelLoader::ParallelLoader( const unsigned int p_Threads ) :
+		m_Threads( p_Threads ),
+		m_NextFile( 0 ),
+		m_Compiled( false )
+	{
+		if( m_Threads == 0 )
+		{
+			m_Threads = std::thread::hardware_concurrency( );
+		}
+		if( m_Threads == 0 )
+		{
+			m_Threads = 1;
+		}
+	}
+
+	// Public functions
+	size_t ParallelLoader::AddFile( const std::string & p_FileName )
+	{
+		File NewFile;
+		NewFile.FileName = p_FileName;
+		m_Files.push_back( NewFile );
+		m_Compiled = false;
+		return m_Files.size( ) - 1;
+	}
+
+	bool ParallelLoader::AddDependency( const size_t p_File, const size_t p_Dependency )
+	{
+		if( p_File >= m_Files.size( ) || p_Dependency >= m_Files.size( ) )
+		{
+			m_LastError = "Unknown file number of the dependency.";
+			return false;
+		}
+
+		m_Files[ p_File ].Dependencies.push_back( p_Dependency );
+		return true;
+	}
+
+	bool ParallelLoader::Compile( )
+	{
+		m_LastError.clear( );
+		for( size_t i = 0; i < m_Files.size( ); i++ )
+		{
+			m_Files[ i ].Chunk.clear( );
+			m_Files[ i ].Error.clear( );
+		}
+
+		// The calling thread is one of the workers.
+		size_t Threads = m_Threads < m_Files.size( ) ? m_Threads : m_Files.size( );
+		m_NextFile = 0;
+
+		std::vector<std::thread> Workers;
+		for( size_t i = 1; i < Threads; i++ )
+		{
+			Workers.push_back( std::thread( &ParallelLoader::CompileFiles, this ) );
+		}
+		CompileFiles( );
+		for( size_t i = 0; i < Workers.size( ); i++ )
+		{
+			Workers[ i ].join( );
+		}
+
+		for( size_t i = 0; i < m_Files.size( ); i++ )
+		{
+			if( m_Files[ i ].Error.size( ) )
+			{
+				m_LastError += m_Files[ i ].Error + "\n";
+			}
+		}
+
+		m_Compiled = m_LastError.empty( );
+		return m_Compiled;
+	}
+
+	eError ParallelLoader::Run( Script & p_Script )
+	{
+		if( m_Compiled == false )
+		{
+			m_LastError = "The files are not compiled.";
+			return ERROR_RUNTIME;
+		}
+
+		// Dependencies first, else in the order the files were added.
+		std::vector<unsigned char> States( m_Files.size( ), SORT_NONE );
+		std::vector<size_t> Order;
+		Order.reserve( m_Files.size( ) );
+		for( size_t i = 0; i < m_Files.size( ); i++ )
+		{
+			if( SortFile( i, States, Order ) == false )
+			{
+				return ERROR_RUNTIME;
+			}
+		}
+
+		for( size_t i = 0; i < Order.size( ); i++ )
+		{
+			const File & Current = m_Files[ Order[ i ] ];
+			std::string ChunkName = "@" + Current.FileName;
+
+			eError Error = p_Script.RunBuffer( Current.Chunk.data( ), Current.Chunk.size( ), ChunkName.c_str( ) );
+			if( Error != ERROR_NONE )
+			{
+				return Error;
+			}
+		}
+
+		return ERROR_NONE;
+	}
+
+	void ParallelLoader::Clear( )
+	{
+		m_Files.clear( );
+		m_Compiled = false;
+		m_LastError.clear( );
+	}
+
+	// General get functions
+	const std::string & ParallelLoader::GetLastError( ) const
+	{
+		return m_LastError;
+	}
+
+	size_t ParallelLoader::GetFileCount( ) const
+	{
+		return m_Files.size( );
+	}
+
+	// Private functions
+	void ParallelLoader::CompileFiles( )
+	{
+		// The scratch state only parses, no libraries are needed.
+		lua_State * pState = luaL_newstate( );
+		std::string Source;
+		char Buffer[ 4096 ];
+
+		for( size_t Number = m_NextFile++; Number < m_Files.size( ); Number = m_NextFile++ )
+		{
+			File & Current = m_Files[ Number ];
+			if( pState == NULL )
+			{
+				Current.Error = Current.FileName + ": cannot create a Lua state";
+				continue;
+			}
+
+			FILE * pFile = fopen( Current.FileName.c_str( ), "rb" );
+			if( pFile == NULL )
+			{
+				Current.Error = "cannot open " + Current.FileName;
+				continue;
+			}
+
+			Source.clear( );
+			size_t Read = 0;
+			while( ( Read = fread( Buffer, 1, sizeof( Buffer ), pFile ) ) > 0 )
+			{
+				Source.append( Buffer, Read );
+			}
+			fclose( pFile );
+
+			// Skip a UTF-8 byte order mark and comment out a first line starting with '#', as luaL_loadfile does.
+			size_t Start = Source.compare( 0, 3, "\xEF\xBB\xBF" ) == 0 ? 3 : 0;
+			if( Source.size( ) > Start && Source[ Start ] == '#' )
+			{
+				Source.replace( Start, 1, "--" );
+			}
+
+			std::string ChunkName = "@" + Current.FileName;
+			if( luaL_loadbuffer( pState, Source.data( ) + Start, Source.size( ) - Start, ChunkName.c_str( ) ) != LUA_OK )
+			{
+				Current.Error = lua_tostring( pState, -1 );
+			}
+			else
+			{
+				lua_dump( pState, WriteChunk, &Current.Chunk );
+			}
+			lua_settop( pState, 0 );
+		}
+
+		if( pState )
+		{
+			lua_close( pState );
+		}
+	}
+
+	bool ParallelLoader::SortFile( const size_t p_File, std::vector<unsigned char> & p_States, std::vector<size_t> & p_Order )
+	{
+		if( p_States[ p_File ] == SORT_DONE )
+		{
+			return true;
+		}
+		if( p_States[ p_File ] == SORT_VISITING )
+		{
+			m_LastError = "Circular dependency of " + m_Files[ p_File ].FileName;
+			return false;
+		}
+
+		p_States[ p_File ] = SORT_VISITING;
+		const std::vector<size_t> & Dependencies = m_Files[ p_File ].Dependencies;
+		for( size_t i = 0; i < Dependencies.size( ); i++ )
+		{
+			if( SortFile( Dependencies[ i ], p_States, p_Order ) == false )
+			{
+				return false;
+			}
+		}
+
+		p_States[ p_File ] = SORT_DONE;
+		p_Order.push_back( p_File );
+		return true;
+	}
+
+}
@@ -0,0 +1,260 @@
+// ///////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2013 Jimmie Bergmann - jimmiebergmann@gmail.com
+//
+// This software is provided 'as-is', without any express or
+// implied warranty. In no event will the authors be held
+// liable for any damages arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute
+// it freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented;
+//    you must not claim that you wrote the original software.
+//    If you use this software in a product, an acknowledgment
+//    in the product documentation would be appreciated but
+//    is not required.
+//
+// 2. Altered source versions must be plainly marked as such,
+//    and must not be misrepresented as being the original software.
+//
+// 3. This notice may not be removed or altered from any
+//    source distribution.
+// ///////////////////////////////////////////////////////////////////////////
+
+#include <LuaW/Profiler.hpp>
+#include "HookContext.hpp"
+#include <algorithm>
+#include <sstream>
+#include <thread>
+
+namespace LuaW
+{
+
+	// Constructor/destructor
+	Profiler::Profiler( Script & p_Script ) :
+		m_Script( p_Script ),
+		m_Period( 0 ),
+		m_NextSample( 0 ),
+		m_Buffer( BufferSize ),
+		m_Head( 0 ),
+		m_Tail( 0 ),
+		m_Dropped( 0 )
+	{
+	}
+
+	Profiler::~Profiler( )
+	{
+		Stop( );
+	}
+
+	// Public functions
+	bool Profiler::Start( const unsigned int p_Microseconds )
+	{
+		// Never create the context here, we might not be on the thread owning the state.
+		// The calls are always hooked, the hook picks the profiler up.
+		m_Script.m_WatchdogCalls++;
+		Script::HookContext * pContext = m_Script.m_pWatchedContext.load( );
+		if( pContext )
+		{
+			m_Period = static_cast<long long>( p_Microseconds ) * 1000;
+			pContext->pProfiler = this;
+		}
+		m_Script.m_WatchdogCalls--;
+		return pContext != NULL;
+	}
+
+	void Profiler::Stop( )
+	{
+		m_Script.m_WatchdogCalls++;
+		Script::HookContext * pContext = m_Script.m_pWatchedContext.load( );
+		if( pContext )
+		{
+			// Wait for a hook that picked us up before we were removed.
+			Profiler * pThis = this;
+			if( pContext->pProfiler.compare_exchange_strong( pThis, NULL ) )
+			{
+				while( pContext->Sampling.load( ) )
+				{
+					std::this_thread::yield( );
+				}
+			}
+		}
+		m_Script.m_WatchdogCalls--;
+	}
+
+	void Profiler::Reset( )
+	{
+		Drain( );
+
+		std::lock_guard<std::mutex> Lock( m_StackMutex );
+		m_Stacks.clear( );
+		m_Dropped = 0;
+	}
+
+	void Profiler::WriteFolded( std::ostream & p_Stream )
+	{
+		Drain( );
+
+		std::lock_guard<std::mutex> StackLock( m_StackMutex );
+		std::lock_guard<std::mutex> FrameLock( m_FrameMutex );
+
+		for( std::map<std::vector<unsigned int>, unsigned int>::const_iterator it = m_Stacks.begin( );
+			it != m_Stacks.end( ); it++ )
+		{
+			const std::vector<unsigned int> & Frames = it->first;
+			for( size_t i = 0; i < Frames.size( ); i++ )
+			{
+				if( i )
+				{
+					p_Stream << ';';
+				}
+				p_Stream << m_FrameNames[ Frames[ i ] ];
+			}
+
+			p_Stream << ' ' << it->second << '\n';
+		}
+	}
+
+	// General get functions
+	bool Profiler::IsRunning( ) const
+	{
+		m_Script.m_WatchdogCalls++;
+		Script::HookContext * pContext = m_Script.m_pWatchedContext.load( );
+		bool Running = pContext && pContext->pProfiler.load( ) == this;
+		m_Script.m_WatchdogCalls--;
+		return Running;
+	}
+
+	unsigned int Profiler::GetSampleCount( )
+	{
+		Drain( );
+
+		std::lock_guard<std::mutex> Lock( m_StackMutex );
+		unsigned int Count = 0;
+		for( std::map<std::vector<unsigned int>, unsigned int>::const_iterator it = m_Stacks.begin( );
+			it != m_Stacks.end( ); it++ )
+		{
+			Count += it->second;
+		}
+		return Count;
+	}
+
+	unsigned int Profiler::GetDroppedSampleCount( ) const
+	{
+		return m_Dropped.load( );
+	}
+
+	// Private functions
+	void Profiler::TakeSample( lua_State * p_pState )
+	{
+		long long Time = GetTimeNanoseconds( );
+		if( Time < m_NextSample )
+		{
+			return;
+		}
+		m_NextSample = Time + m_Period.load( );
+
+		// Is there any room left in the buffer?
+		unsigned int Head = m_Head.load( std::memory_order_relaxed );
+		if( Head - m_Tail.load( std::memory_order_acquire ) >= BufferSize )
+		{
+			m_Dropped++;
+			return;
+		}
+
+		// Walk the call stack
+		StackSample & Sample = m_Buffer[ Head % BufferSize ];
+		lua_Debug Debug;
+		Sample.Depth = 0;
+		while( Sample.Depth < MaxDepth && lua_getstack( p_pState, Sample.Depth, &Debug ) )
+		{
+			Sample.Frames[ Sample.Depth ] = GetFrameId( p_pState, Debug );
+			Sample.Depth++;
+		}
+
+		m_Head.store( Head + 1, std::memory_order_release );
+	}
+
+	unsigned int Profiler::GetFrameId( lua_State * p_pState, lua_Debug & p_Debug )
+	{
+		lua_getinfo( p_pState, "S", &p_Debug );
+
+		// Lua functions are identified by their chunk name and line, C functions by their address.
+		// Frames with the same short source and line get the same name anyway.
+		FrameKey & Key = m_FrameKey;
+		Key.second.second = p_Debug.linedefined;
+		if( p_Debug.what[ 0 ] == 'C' )
+		{
+			lua_getinfo( p_pState, "f", &p_Debug );
+			Key.first.clear( );
+			Key.second.first = reinterpret_cast<const void *>( lua_tocfunction( p_pState, -1 ) );
+			lua_pop( p_pState, 1 );
+		}
+		else
+		{
+			Key.first.assign( p_Debug.short_src );
+			Key.second.first = NULL;
+		}
+
+		std::map<FrameKey, unsigned int>::iterator it = m_FrameIds.find( Key );
+		if( it != m_FrameIds.end( ) )
+		{
+			return it->second;
+		}
+
+		// First time we see this frame, build the name.
+		lua_getinfo( p_pState, "n", &p_Debug );
+
+		std::stringstream Name;
+		if( p_Debug.what[ 0 ] == 'C' )
+		{
+			Name << ( p_Debug.name ? p_Debug.name : "?" ) << " [C]";
+		}
+		else if( p_Debug.what[ 0 ] == 'm' )
+		{
+			Name << "main " << p_Debug.short_src;
+		}
+		else
+		{
+			Name << ( p_Debug.name ? p_Debug.name : "?" ) << ' ' << p_Debug.short_src << ':' << p_Debug.linedefined;
+		}
+
+		// Semicolons separate the frames in the folded format.
+		std::string FrameName = Name.str( );
+		for( size_t i = 0; i < FrameName.size( ); i++ )
+		{
+			if( FrameName[ i ] == ';' )
+			{
+				FrameName[ i ] = ':';
+			}
+		}
+
+		std::lock_guard<std::mutex> Lock( m_FrameMutex );
+		unsigned int Id = static_cast<unsigned int>( m_FrameNames.size( ) );
+		m_FrameNames.push_back( FrameName );
+		m_FrameIds[ Key ] = Id;
+		return Id;
+	}
+
+	void Profiler::Drain( )
+	{
+		std::lock_guard<std::mutex> Lock( m_StackMutex );
+
+		unsigned int Tail = m_Tail.load( std::memory_order_relaxed );
+		unsigned int Head = m_Head.load( std::memory_order_acquire );
+
+		std::vector<unsigned int> Frames;
+		for( ; Tail != Head; Tail++ )
+		{
+			// Reverse the stack, the root frame goes first.
+			const StackSample & Sample = m_Buffer[ Tail % BufferSize ];
+			Frames.assign( Sample.Frames, Sample.Frames + Sample.Depth );
+			std::reverse( Frames.begin( ), Frames.end( ) );
+			m_Stacks[ Frames ]++;
+		}
+
+		m_Tail.store( Tail, std::memory_order_release );
+	}
+
+}
@@ -0,0 +1,306 @@
+// ///////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2013 Jimmie Bergmann - jimmiebergmann@gmail.com
+//
+// This software is provided 'as-is', without any express or
+// implied warranty. In no event will the authors be held
+// liable for any damages arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute
+// it freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented;
+//    you must not claim that you wrote the original software.
+//    If you use this software in a product, an acknowledgment
+//    in the product documentation would be appreciated but
+//    is not required.
+//
+// 2. Altered source versions must be plainly marked as such,
+//    and must not be misrepresented as being the original software.
+//
+// 3. This notice may not be removed or altered from any
+//    source distribution.
+// ///////////////////////////////////////////////////////////////////////////
+
+#include <LuaW/Scheduler.hpp>
+#include "HookContext.hpp"
+#include <chrono>
+#include <thread>
+
+namespace LuaW
+{
+
+	// The address is the key yielded by waiting tasks.
+	static const char g_WaitKey = 0;
+
+	// Registry key of the set of task threads, keyed by the thread as light userdata.
+	static const char g_TaskKey = 0;
+
+	// Longest sleep of Run while every task is waiting, microseconds
+	static const unsigned int g_MaximumBackoff = 1000;
+
+	// Constructor/destructor
+	Scheduler::Scheduler( Script & p_Script ) :
+		m_Script( p_Script ),
+		m_TimeSlice( 0 ),
+		m_Waiting( false ),
+		m_IdleCallback( NULL ),
+		m_pIdleData( NULL ),
+		m_ErrorMessage( "" )
+	{
+		Script::HookContext * pContext = m_Script.GetHookContext( );
+		lua_State * pState = m_Script.GetState( );
+
+		// The base library functions using continuations, the hook may yield across them.
+		if( pContext && pState )
+		{
+			lua_getglobal( pState, "pcall" );
+			pContext->YieldableFunctions[ 0 ] = lua_tocfunction( pState, -1 );
+			lua_getglobal( pState, "xpcall" );
+			pContext->YieldableFunctions[ 1 ] = lua_tocfunction( pState, -1 );
+			lua_pop( pState, 2 );
+		}
+	}
+
+	Scheduler::~Scheduler( )
+	{
+		while( m_Tasks.size( ) )
+		{
+			ReleaseTask( m_Tasks.front( ) );
+			m_Tasks.pop_front( );
+		}
+	}
+
+	// Public functions
+	void Scheduler::SetTimeSlice( const unsigned int p_Microseconds )
+	{
+		m_TimeSlice = p_Microseconds;
+	}
+
+	void Scheduler::SetIdleCallback( SchedulerIdleCallback p_Callback, void * p_pUserData )
+	{
+		m_IdleCallback = p_Callback;
+		m_pIdleData = p_pUserData;
+	}
+
+	eError Scheduler::Spawn( const int p_Arguments, const unsigned int p_Weight )
+	{
+		lua_State * pState = m_Script.GetState( );
+
+		// Make sure the stack size is ok
+		if( pState == NULL || lua_gettop( pState ) < p_Arguments + 1 ) // Num arguments + function
+		{
+			return ERROR_STACK;
+		}
+
+		// Create the thread and keep it alive in the registry
+		Task NewTask;
+		NewTask.pThread = lua_newthread( pState );
+		NewTask.Reference = luaL_ref( pState, LUA_REGISTRYINDEX );
+
+		// Add it to the task set, only tasks may yield the wait key.
+		lua_rawgetp( pState, LUA_REGISTRYINDEX, &g_TaskKey );
+		if( lua_istable( pState, -1 ) == 0 )
+		{
+			lua_pop( pState, 1 );
+			lua_newtable( pState );
+			lua_pushvalue( pState, -1 );
+			lua_rawsetp( pState, LUA_REGISTRYINDEX, &g_TaskKey );
+		}
+		lua_pushboolean( pState, 1 );
+		lua_rawsetp( pState, -2, NewTask.pThread );
+		lua_pop( pState, 1 );
+		NewTask.Arguments = p_Arguments;
+		NewTask.YieldedValues = 0;
+		NewTask.Weight = p_Weight ? p_Weight : 1;
+		NewTask.pWaitable = NULL;
+
+		// Move the function and the arguments to the thread
+		lua_xmove( pState, NewTask.pThread, p_Arguments + 1 );
+
+		m_Tasks.push_back( NewTask );
+		return ERROR_NONE;
+	}
+
+	eError Scheduler::Step( )
+	{
+		if( m_Tasks.size( ) == 0 )
+		{
+			m_Waiting = false;
+			return ERROR_NONE;
+		}
+
+		// Move the waiting tasks to the back of the queue.
+		size_t Waiting = 0;
+		while( Waiting < m_Tasks.size( ) && m_Tasks.front( ).pWaitable && m_Tasks.front( ).pWaitable->IsReady( ) == false )
+		{
+			m_Tasks.push_back( m_Tasks.front( ) );
+			m_Tasks.pop_front( );
+			Waiting++;
+		}
+
+		m_Waiting = Waiting == m_Tasks.size( );
+		if( m_Waiting )
+		{
+			return ERROR_YEILD;
+		}
+
+		Task Current = m_Tasks.front( );
+		m_Tasks.pop_front( );
+		Current.pWaitable = NULL;
+
+		lua_State * pState = m_Script.GetState( );
+		Script::HookContext * pContext = m_Script.GetHookContext( );
+
+		// Arm the time slice, the count hook yields the task when it is used.
+		if( m_TimeSlice && pContext )
+		{
+			pContext->pRunningTask = Current.pThread;
+			pContext->SliceEnd = GetTimeNanoseconds( ) +
+				static_cast<long long>( m_TimeSlice ) * Current.Weight * 1000;
+		}
+
+		if( pContext && ( m_TimeSlice || pContext->pProfiler.load( ) ) )
+		{
+			lua_sethook( Current.pThread, Script::HookCallback, LUA_MASKCOUNT, g_HookInterval );
+		}
+		else
+		{
+			lua_sethook( Current.pThread, NULL, 0, 0 );
+		}
+
+		// Resume the task, values yielded by the last resume are discarded.
+		// The stack of a preempted task is never touched, on Lua 5.4 it holds the interrupted frame.
+		int Arguments = Current.Arguments;
+		if( Current.YieldedValues > 0 )
+		{
+			lua_pop( Current.pThread, Current.YieldedValues );
+		}
+		Current.Arguments = 0;
+
+		int Error = lua_resume( Current.pThread, pState, Arguments, &Current.YieldedValues );
+
+		if( pContext )
+		{
+			pContext->pRunningTask = NULL;
+		}
+
+		// Still alive, put it at the back of the queue.
+		if( Error == LUA_YIELD )
+		{
+			if( Current.YieldedValues == 2 && lua_touserdata( Current.pThread, -2 ) == &g_WaitKey )
+			{
+				Current.pWaitable = static_cast<const Waitable *>( lua_touserdata( Current.pThread, -1 ) );
+			}
+
+			m_Tasks.push_back( Current );
+			return ERROR_YEILD;
+		}
+
+		// Finished or failed
+		if( Error != LUA_OK )
+		{
+			const char * pMessage = lua_tostring( Current.pThread, -1 );
+			m_ErrorMessage = pMessage ? pMessage : "";
+		}
+
+		ReleaseTask( Current );
+		return m_Script.ConvertErrorCode( Error );
+	}
+
+	eError Scheduler::Run( )
+	{
+		unsigned int Backoff = 0;
+		while( m_Tasks.size( ) )
+		{
+			eError Error = Step( );
+			if( Error != ERROR_NONE && Error != ERROR_YEILD )
+			{
+				return Error;
+			}
+
+			if( m_Waiting == false )
+			{
+				Backoff = 0;
+				continue;
+			}
+
+			// Let the threads we are waiting for run, idle longer the longer nothing is ready.
+			if( m_IdleCallback )
+			{
+				m_IdleCallback( Backoff, m_pIdleData );
+			}
+			else if( Backoff == 0 )
+			{
+				std::this_thread::yield( );
+			}
+			else
+			{
+				std::this_thread::sleep_for( std::chrono::microseconds( Backoff ) );
+			}
+			Backoff = Backoff == 0 ? 1 : ( Backoff * 2 < g_MaximumBackoff ? Backoff * 2 : g_MaximumBackoff );
+		}
+
+		return ERROR_NONE;
+	}
+
+	// General get functions
+	unsigned int Scheduler::GetTaskCount( ) const
+	{
+		return static_cast<unsigned int>( m_Tasks.size( ) );
+	}
+
+	unsigned int Scheduler::GetTimeSlice( ) const
+	{
+		return m_TimeSlice;
+	}
+
+	bool Scheduler::IsWaiting( ) const
+	{
+		return m_Waiting;
+	}
+
+	const std::string & Scheduler::GetLastError( ) const
+	{
+		return m_ErrorMessage;
+	}
+
+	const void * Scheduler::GetWaitKey( )
+	{
+		return &g_WaitKey;
+	}
+
+	bool Scheduler::IsTask( lua_State * p_pState )
+	{
+		lua_rawgetp( p_pState, LUA_REGISTRYINDEX, &g_TaskKey );
+		if( lua_istable( p_pState, -1 ) == 0 )
+		{
+			lua_pop( p_pState, 1 );
+			return false;
+		}
+
+		lua_rawgetp( p_pState, -1, p_pState );
+		bool Task = lua_toboolean( p_pState, -1 ) != 0;
+		lua_pop( p_pState, 2 );
+		return Task;
+	}
+
+	// Private functions
+	void Scheduler::ReleaseTask( const Task & p_Task )
+	{
+		lua_State * pState = m_Script.GetState( );
+		if( pState )
+		{
+			lua_rawgetp( pState, LUA_REGISTRYINDEX, &g_TaskKey );
+			if( lua_istable( pState, -1 ) )
+			{
+				lua_pushnil( pState );
+				lua_rawsetp( pState, -2, p_Task.pThread );
+			}
+			lua_pop( pState, 1 );
+
+			luaL_unref( pState, LUA_REGISTRYINDEX, p_Task.Reference );
+		}
+	}
+
+}
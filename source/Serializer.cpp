@@ -0,0 +1,741 @@
+// ///////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2013 Jimmie Bergmann - jimmiebergmann@gmail.com
+//
+// This software is provided 'as-is', without any express or
+// implied warranty. In no event will the authors be held
+// liable for any damages arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute
+// it freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented;
+//    you must not claim that you wrote the original software.
+//    If you use this software in a product, an acknowledgment
+//    in the product documentation would be appreciated but
+//    is not required.
+//
+// 2. Altered source versions must be plainly marked as such,
+//    and must not be misrepresented as being the original software.
+//
+// 3. This notice may not be removed or altered from any
+//    source distribution.
+// ///////////////////////////////////////////////////////////////////////////
+
+#include <LuaW/Serializer.hpp>
+#include <cmath>
+#include <cstring>
+#include <new>
+
+namespace LuaW
+{
+
+	// Registry key of the shared serializer of a state
+	static const char g_SerializerKey = 0;
+
+	// Format version, the first byte of every value.
+	static const unsigned char g_FormatVersion = 1;
+
+	// Strings shorter than this are never interned.
+	static const size_t g_MinInternLength = 3;
+
+	// Maximum nesting of tables
+	static const int g_MaxDepth = 100;
+
+	// Flags of the second byte, the decoder only keeps references if needed.
+	enum eSerializerFlag
+	{
+		FLAG_TABLE_REFERENCES = 1,
+		FLAG_STRING_REFERENCES = 2
+	};
+
+	// Value tags
+	enum eSerializerTag
+	{
+		TAG_NIL = 0,
+		TAG_FALSE = 1,
+		TAG_TRUE = 2,
+		TAG_INTEGER = 3, // Zigzag varint
+		TAG_NUMBER = 4, // Double, host byte order
+		TAG_STRING = 5, // Varint length and the bytes
+		TAG_STRING_REFERENCE = 6, // Varint string number
+		TAG_TABLE = 7, // Varint array size, 32 bit hash size, the array values and the hash pairs.
+		TAG_TABLE_REFERENCE = 8 // Varint table number
+	};
+
+	// Pointer map
+	Serializer::PointerMap::PointerMap( ) :
+		m_Size( 0 ),
+		m_Generation( 1 )
+	{
+	}
+
+	void Serializer::PointerMap::Clear( )
+	{
+		m_Size = 0;
+
+		// Bumping the generation empties every entry, the memory is only touched when it wraps.
+		if( ++m_Generation == 0 )
+		{
+			for( size_t i = 0; i < m_Entries.size( ); i++ )
+			{
+				m_Entries[ i ].Generation = 0;
+			}
+			m_Generation = 1;
+		}
+	}
+
+	unsigned int Serializer::PointerMap::Find( const void * p_pKey ) const
+	{
+		if( m_Size == 0 )
+		{
+			return 0;
+		}
+
+		size_t Mask = m_Entries.size( ) - 1;
+		for( size_t Slot = GetSlot( p_pKey ); ; Slot = ( Slot + 1 ) & Mask )
+		{
+			const Entry & Current = m_Entries[ Slot ];
+			if( Current.Generation != m_Generation )
+			{
+				return 0;
+			}
+			if( Current.pKey == p_pKey )
+			{
+				return Current.Value;
+			}
+		}
+	}
+
+	void Serializer::PointerMap::Insert( const void * p_pKey, const unsigned int p_Value )
+	{
+		// Keep the load below one half.
+		if( ( m_Size + 1 ) * 2 > m_Entries.size( ) )
+		{
+			Grow( );
+		}
+
+		size_t Mask = m_Entries.size( ) - 1;
+		size_t Slot = GetSlot( p_pKey );
+		while( m_Entries[ Slot ].Generation == m_Generation )
+		{
+			Slot = ( Slot + 1 ) & Mask;
+		}
+
+		m_Entries[ Slot ].pKey = p_pKey;
+		m_Entries[ Slot ].Value = p_Value;
+		m_Entries[ Slot ].Generation = m_Generation;
+		m_Size++;
+	}
+
+	unsigned int Serializer::PointerMap::GetSize( ) const
+	{
+		return m_Size;
+	}
+
+	size_t Serializer::PointerMap::GetSlot( const void * p_pKey ) const
+	{
+		// Objects are aligned, mix the upper bits into the low ones.
+		unsigned long long Hash = static_cast<unsigned long long>( reinterpret_cast<size_t>( p_pKey ) ) * 0x9E3779B97F4A7C15ULL;
+		return static_cast<size_t>( Hash >> 32 ) & ( m_Entries.size( ) - 1 );
+	}
+
+	void Serializer::PointerMap::Grow( )
+	{
+		std::vector<Entry> Old;
+		Old.swap( m_Entries );
+
+		Entry Empty = { NULL, 0, 0 };
+		m_Entries.resize( Old.size( ) ? Old.size( ) * 2 : 64, Empty );
+
+		unsigned int Generation = m_Generation;
+		m_Size = 0;
+		for( size_t i = 0; i < Old.size( ); i++ )
+		{
+			if( Old[ i ].Generation == Generation )
+			{
+				Insert( Old[ i ].pKey, Old[ i ].Value );
+			}
+		}
+	}
+
+	// Constructor
+	Serializer::Serializer( ) :
+		m_pString( NULL ),
+		m_pBuffer( NULL ),
+		m_Size( 0 ),
+		m_Capacity( 0 ),
+		m_Flags( 0 ),
+		m_pData( NULL ),
+		m_pEnd( NULL ),
+		m_References( 0 ),
+		m_TableCount( 0 ),
+		m_StringCount( 0 ),
+		m_pError( "" )
+	{
+	}
+
+	// Public functions
+	bool Serializer::Encode( lua_State * p_pState, const int p_Index, std::string & p_Buffer )
+	{
+		p_Buffer.clear( );
+		m_pString = &p_Buffer;
+		m_pBuffer = NULL;
+		m_Capacity = 0;
+
+		bool Result = Encode( p_pState, p_Index );
+		m_pString = NULL;
+		return Result;
+	}
+
+	size_t Serializer::Encode( lua_State * p_pState, const int p_Index, char * p_pBuffer, const size_t p_Capacity )
+	{
+		m_pString = NULL;
+		m_pBuffer = p_pBuffer;
+		m_Capacity = p_Capacity;
+
+		bool Result = Encode( p_pState, p_Index );
+		m_pBuffer = NULL;
+
+		if( Result && m_Size > p_Capacity )
+		{
+			m_pError = "buffer too small";
+			return 0;
+		}
+		return Result ? m_Size : 0;
+	}
+
+	bool Serializer::Decode( lua_State * p_pState, const char * p_pData, const size_t p_Size )
+	{
+		int Top = lua_gettop( p_pState );
+		m_pError = "";
+
+		if( p_Size < 2 || static_cast<unsigned char>( p_pData[ 0 ] ) != g_FormatVersion )
+		{
+			m_pError = "unknown format";
+			return false;
+		}
+
+		unsigned char Flags = static_cast<unsigned char>( p_pData[ 1 ] );
+		m_pData = p_pData + 2;
+		m_pEnd = p_pData + p_Size;
+		m_References = 0;
+		m_TableCount = 0;
+		m_StringCount = 0;
+
+		// Keep the tables and strings in a table if they are referenced.
+		if( Flags & ( FLAG_TABLE_REFERENCES | FLAG_STRING_REFERENCES ) )
+		{
+			lua_newtable( p_pState );
+			m_References = lua_gettop( p_pState );
+		}
+
+		bool Result = DecodeValue( p_pState, 0 );
+		if( Result && m_pData != m_pEnd )
+		{
+			m_pError = "trailing data";
+			Result = false;
+		}
+
+		if( Result == false )
+		{
+			lua_settop( p_pState, Top );
+			return false;
+		}
+
+		if( m_References )
+		{
+			lua_remove( p_pState, m_References );
+		}
+		return true;
+	}
+
+	bool Serializer::Decode( lua_State * p_pState, const std::string & p_Buffer )
+	{
+		return Decode( p_pState, p_Buffer.data( ), p_Buffer.size( ) );
+	}
+
+	// General get functions
+	const char * Serializer::GetLastError( ) const
+	{
+		return m_pError;
+	}
+
+	size_t Serializer::GetRequiredSize( ) const
+	{
+		return m_Size;
+	}
+
+	std::string & Serializer::GetScratchBuffer( )
+	{
+		return m_Scratch;
+	}
+
+	// Static functions
+	Serializer & Serializer::Get( lua_State * p_pState )
+	{
+		lua_rawgetp( p_pState, LUA_REGISTRYINDEX, &g_SerializerKey );
+		Serializer * pSerializer = static_cast<Serializer *>( lua_touserdata( p_pState, -1 ) );
+		lua_pop( p_pState, 1 );
+
+		if( pSerializer )
+		{
+			return *pSerializer;
+		}
+
+		// Create it as userdata, it is destroyed with the state.
+		pSerializer = new( lua_newuserdata( p_pState, sizeof( Serializer ) ) ) Serializer;
+		lua_createtable( p_pState, 0, 1 );
+		lua_pushcfunction( p_pState, LuaCollect );
+		lua_setfield( p_pState, -2, "__gc" );
+		lua_setmetatable( p_pState, -2 );
+		lua_rawsetp( p_pState, LUA_REGISTRYINDEX, &g_SerializerKey );
+
+		return *pSerializer;
+	}
+
+	void Serializer::OpenLibrary( lua_State * p_pState )
+	{
+		lua_createtable( p_pState, 0, 2 );
+		lua_pushcfunction( p_pState, LuaEncode );
+		lua_setfield( p_pState, -2, "encode" );
+		lua_pushcfunction( p_pState, LuaDecode );
+		lua_setfield( p_pState, -2, "decode" );
+		lua_setglobal( p_pState, "serializer" );
+	}
+
+	// Private functions
+	bool Serializer::Encode( lua_State * p_pState, const int p_Index )
+	{
+		m_Tables.Clear( );
+		m_Strings.Clear( );
+		m_Size = 0;
+		m_Flags = 0;
+		m_pError = "";
+
+		WriteByte( g_FormatVersion );
+		WriteByte( 0 );
+
+		if( EncodeValue( p_pState, lua_absindex( p_pState, p_Index ), 0 ) == false )
+		{
+			return false;
+		}
+
+		Patch( 1, &m_Flags, 1 );
+		return true;
+	}
+
+	bool Serializer::EncodeValue( lua_State * p_pState, const int p_Index, const int p_Depth )
+	{
+		switch( lua_type( p_pState, p_Index ) )
+		{
+			case LUA_TNIL:
+			{
+				WriteByte( TAG_NIL );
+			}
+			break;
+			case LUA_TBOOLEAN:
+			{
+				WriteByte( lua_toboolean( p_pState, p_Index ) ? TAG_TRUE : TAG_FALSE );
+			}
+			break;
+			case LUA_TNUMBER:
+			{
+				long long Integer = 0;
+#if LUA_VERSION_NUM >= 503
+				bool IsInteger = lua_isinteger( p_pState, p_Index ) != 0;
+				if( IsInteger )
+				{
+					Integer = static_cast<long long>( lua_tointeger( p_pState, p_Index ) );
+				}
+#else
+				// Integral numbers are stored as integers, they are usually much smaller.
+				lua_Number Number = lua_tonumber( p_pState, p_Index );
+				bool IsInteger = std::floor( Number ) == Number && std::fabs( Number ) < 9007199254740992.0 &&
+					( Number != 0 || std::signbit( Number ) == false );
+				if( IsInteger )
+				{
+					Integer = static_cast<long long>( Number );
+				}
+#endif
+				if( IsInteger )
+				{
+					WriteByte( TAG_INTEGER );
+					WriteInteger( ( static_cast<unsigned long long>( Integer ) << 1 ) ^ static_cast<unsigned long long>( Integer >> 63 ) );
+				}
+				else
+				{
+					lua_Number Value = lua_tonumber( p_pState, p_Index );
+					WriteByte( TAG_NUMBER );
+					Write( &Value, sizeof( Value ) );
+				}
+			}
+			break;
+			case LUA_TSTRING:
+			{
+				size_t Length = 0;
+				const char * pString = lua_tolstring( p_pState, p_Index, &Length );
+
+				// Short strings are interned by Lua, equal strings share the address.
+				if( Length >= g_MinInternLength )
+				{
+					unsigned int Reference = m_Strings.Find( pString );
+					if( Reference != 0 )
+					{
+						m_Flags |= FLAG_STRING_REFERENCES;
+						WriteByte( TAG_STRING_REFERENCE );
+						WriteInteger( Reference );
+						break;
+					}
+
+					m_Strings.Insert( pString, m_Strings.GetSize( ) + 1 );
+				}
+
+				WriteByte( TAG_STRING );
+				WriteInteger( Length );
+				Write( pString, Length );
+			}
+			break;
+			case LUA_TTABLE:
+			{
+				const void * pTable = lua_topointer( p_pState, p_Index );
+				unsigned int Reference = m_Tables.Find( pTable );
+				if( Reference != 0 )
+				{
+					m_Flags |= FLAG_TABLE_REFERENCES;
+					WriteByte( TAG_TABLE_REFERENCE );
+					WriteInteger( Reference );
+					break;
+				}
+
+				if( p_Depth >= g_MaxDepth || lua_checkstack( p_pState, 3 ) == 0 )
+				{
+					m_pError = "tables nested too deep";
+					return false;
+				}
+
+				m_Tables.Insert( pTable, m_Tables.GetSize( ) + 1 );
+
+				// Array part
+				size_t ArraySize = lua_rawlen( p_pState, p_Index );
+				WriteByte( TAG_TABLE );
+				WriteInteger( ArraySize );
+
+				// The hash size is patched when known
+				size_t HashPosition = m_Size;
+				unsigned int HashSize = 0;
+				Write( &HashSize, sizeof( HashSize ) );
+
+				for( size_t i = 1; i <= ArraySize; i++ )
+				{
+					lua_rawgeti( p_pState, p_Index, static_cast<int>( i ) );
+					if( EncodeValue( p_pState, lua_gettop( p_pState ), p_Depth + 1 ) == false )
+					{
+						lua_pop( p_pState, 1 );
+						return false;
+					}
+					lua_pop( p_pState, 1 );
+				}
+
+				// Hash part, the keys of the array part are skipped.
+				lua_pushnil( p_pState );
+				while( lua_next( p_pState, p_Index ) )
+				{
+					int Top = lua_gettop( p_pState );
+					if( lua_type( p_pState, Top - 1 ) == LUA_TNUMBER && ArraySize )
+					{
+						lua_Number Key = lua_tonumber( p_pState, Top - 1 );
+						if( Key >= 1 && Key <= static_cast<lua_Number>( ArraySize ) && std::floor( Key ) == Key )
+						{
+							lua_pop( p_pState, 1 );
+							continue;
+						}
+					}
+
+					if( EncodeValue( p_pState, Top - 1, p_Depth + 1 ) == false ||
+						EncodeValue( p_pState, Top, p_Depth + 1 ) == false )
+					{
+						lua_pop( p_pState, 2 );
+						return false;
+					}
+					lua_pop( p_pState, 1 );
+					HashSize++;
+				}
+
+				Patch( HashPosition, &HashSize, sizeof( HashSize ) );
+			}
+			break;
+			default:
+			{
+				m_pError = "value type cannot be serialized";
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	bool Serializer::DecodeValue( lua_State * p_pState, const int p_Depth )
+	{
+		if( m_pData >= m_pEnd )
+		{
+			m_pError = "unexpected end of data";
+			return false;
+		}
+		if( p_Depth >= g_MaxDepth || lua_checkstack( p_pState, 4 ) == 0 )
+		{
+			m_pError = "tables nested too deep";
+			return false;
+		}
+
+		unsigned long long Integer = 0;
+		switch( static_cast<unsigned char>( *m_pData++ ) )
+		{
+			case TAG_NIL:
+			{
+				lua_pushnil( p_pState );
+			}
+			break;
+			case TAG_FALSE:
+			{
+				lua_pushboolean( p_pState, 0 );
+			}
+			break;
+			case TAG_TRUE:
+			{
+				lua_pushboolean( p_pState, 1 );
+			}
+			break;
+			case TAG_INTEGER:
+			{
+				if( ReadInteger( Integer ) == false )
+				{
+					return false;
+				}
+
+				long long Value = static_cast<long long>( Integer >> 1 ) ^ -static_cast<long long>( Integer & 1 );
+#if LUA_VERSION_NUM >= 503
+				lua_pushinteger( p_pState, static_cast<lua_Integer>( Value ) );
+#else
+				lua_pushnumber( p_pState, static_cast<lua_Number>( Value ) );
+#endif
+			}
+			break;
+			case TAG_NUMBER:
+			{
+				lua_Number Number = 0;
+				if( static_cast<size_t>( m_pEnd - m_pData ) < sizeof( Number ) )
+				{
+					m_pError = "unexpected end of data";
+					return false;
+				}
+				std::memcpy( &Number, m_pData, sizeof( Number ) );
+				m_pData += sizeof( Number );
+				lua_pushnumber( p_pState, Number );
+			}
+			break;
+			case TAG_STRING:
+			{
+				if( ReadInteger( Integer ) == false || static_cast<unsigned long long>( m_pEnd - m_pData ) < Integer )
+				{
+					m_pError = "unexpected end of data";
+					return false;
+				}
+
+				size_t Length = static_cast<size_t>( Integer );
+				lua_pushlstring( p_pState, m_pData, Length );
+				m_pData += Length;
+
+				// Number the strings the same way as the encoder.
+				if( Length >= g_MinInternLength )
+				{
+					m_StringCount++;
+					if( m_References )
+					{
+						lua_pushvalue( p_pState, -1 );
+						lua_rawseti( p_pState, m_References, -static_cast<int>( m_StringCount ) );
+					}
+				}
+			}
+			break;
+			case TAG_STRING_REFERENCE:
+			{
+				if( ReadInteger( Integer ) == false || m_References == 0 || Integer == 0 || Integer > m_StringCount )
+				{
+					m_pError = "invalid string reference";
+					return false;
+				}
+				lua_rawgeti( p_pState, m_References, -static_cast<int>( Integer ) );
+			}
+			break;
+			case TAG_TABLE:
+			{
+				unsigned long long ArraySize = 0;
+				unsigned int HashSize = 0;
+				if( ReadInteger( ArraySize ) == false || static_cast<size_t>( m_pEnd - m_pData ) < sizeof( HashSize ) )
+				{
+					m_pError = "unexpected end of data";
+					return false;
+				}
+				std::memcpy( &HashSize, m_pData, sizeof( HashSize ) );
+				m_pData += sizeof( HashSize );
+
+				// Every value takes at least a byte, never presize more than the data can hold.
+				unsigned long long Remaining = static_cast<unsigned long long>( m_pEnd - m_pData );
+				if( ArraySize > Remaining || HashSize > Remaining )
+				{
+					m_pError = "invalid table size";
+					return false;
+				}
+
+				lua_createtable( p_pState, static_cast<int>( ArraySize ), static_cast<int>( HashSize ) );
+				m_TableCount++;
+				if( m_References )
+				{
+					lua_pushvalue( p_pState, -1 );
+					lua_rawseti( p_pState, m_References, static_cast<int>( m_TableCount ) );
+				}
+
+				for( unsigned long long i = 1; i <= ArraySize; i++ )
+				{
+					if( DecodeValue( p_pState, p_Depth + 1 ) == false )
+					{
+						return false;
+					}
+					lua_rawseti( p_pState, -2, static_cast<int>( i ) );
+				}
+
+				for( unsigned int i = 0; i < HashSize; i++ )
+				{
+					if( DecodeValue( p_pState, p_Depth + 1 ) == false )
+					{
+						return false;
+					}
+					if( lua_isnil( p_pState, -1 ) ||
+						( lua_type( p_pState, -1 ) == LUA_TNUMBER && lua_tonumber( p_pState, -1 ) != lua_tonumber( p_pState, -1 ) ) )
+					{
+						m_pError = "invalid table key";
+						return false;
+					}
+					if( DecodeValue( p_pState, p_Depth + 1 ) == false )
+					{
+						return false;
+					}
+					lua_rawset( p_pState, -3 );
+				}
+			}
+			break;
+			case TAG_TABLE_REFERENCE:
+			{
+				if( ReadInteger( Integer ) == false || m_References == 0 || Integer == 0 || Integer > m_TableCount )
+				{
+					m_pError = "invalid table reference";
+					return false;
+				}
+				lua_rawgeti( p_pState, m_References, static_cast<int>( Integer ) );
+			}
+			break;
+			default:
+			{
+				m_pError = "unknown value tag";
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	void Serializer::Write( const void * p_pData, const size_t p_Size )
+	{
+		if( m_pString )
+		{
+			m_pString->append( static_cast<const char *>( p_pData ), p_Size );
+		}
+		else if( m_Size + p_Size <= m_Capacity )
+		{
+			std::memcpy( m_pBuffer + m_Size, p_pData, p_Size );
+		}
+
+		// The size keeps growing if the buffer is too small, it is the required size.
+		m_Size += p_Size;
+	}
+
+	void Serializer::WriteByte( const unsigned char p_Byte )
+	{
+		Write( &p_Byte, 1 );
+	}
+
+	void Serializer::WriteInteger( unsigned long long p_Integer )
+	{
+		unsigned char Bytes[ 10 ];
+		size_t Size = 0;
+		while( p_Integer >= 0x80 )
+		{
+			Bytes[ Size++ ] = static_cast<unsigned char>( ( p_Integer & 0x7F ) | 0x80 );
+			p_Integer >>= 7;
+		}
+		Bytes[ Size++ ] = static_cast<unsigned char>( p_Integer );
+		Write( Bytes, Size );
+	}
+
+	void Serializer::Patch( const size_t p_Position, const void * p_pData, const size_t p_Size )
+	{
+		if( m_pString )
+		{
+			std::memcpy( &( *m_pString )[ p_Position ], p_pData, p_Size );
+		}
+		else if( p_Position + p_Size <= m_Capacity )
+		{
+			std::memcpy( m_pBuffer + p_Position, p_pData, p_Size );
+		}
+	}
+
+	bool Serializer::ReadInteger( unsigned long long & p_Integer )
+	{
+		p_Integer = 0;
+		for( unsigned int Shift = 0; Shift < 64 && m_pData < m_pEnd; Shift += 7 )
+		{
+			unsigned char Byte = static_cast<unsigned char>( *m_pData++ );
+			p_Integer |= static_cast<unsigned long long>( Byte & 0x7F ) << Shift;
+			if( ( Byte & 0x80 ) == 0 )
+			{
+				return true;
+			}
+		}
+
+		m_pError = "invalid integer";
+		return false;
+	}
+
+	int Serializer::LuaEncode( lua_State * p_pState )
+	{
+		luaL_checkany( p_pState, 1 );
+		Serializer & Current = Get( p_pState );
+		if( Current.Encode( p_pState, 1, Current.m_Scratch ) == false )
+		{
+			return luaL_error( p_pState, "serializer.encode: %s", Current.m_pError );
+		}
+
+		lua_pushlstring( p_pState, Current.m_Scratch.data( ), Current.m_Scratch.size( ) );
+		return 1;
+	}
+
+	int Serializer::LuaDecode( lua_State * p_pState )
+	{
+		size_t Size = 0;
+		const char * pData = luaL_checklstring( p_pState, 1, &Size );
+		Serializer & Current = Get( p_pState );
+		if( Current.Decode( p_pState, pData, Size ) == false )
+		{
+			return luaL_error( p_pState, "serializer.decode: %s", Current.m_pError );
+		}
+		return 1;
+	}
+
+	int Serializer::LuaCollect( lua_State * p_pState )
+	{
+		static_cast<Serializer *>( lua_touserdata( p_pState, 1 ) )->~Serializer( );
+		return 0;
+	}
+
+}
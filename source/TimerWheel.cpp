@@ -0,0 +1,430 @@
+// ///////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2013 Jimmie Bergmann - jimmiebergmann@gmail.com
+//
+// This software is provided 'as-is', without any express or
+// implied warranty. In no event will the authors be held
+// liable for any damages arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute
+// it freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented;
+//    you must not claim that you wrote the original software.
+//    If you use this software in a product, an acknowledgment
+//    in the product documentation would be appreciated but
+//    is not required.
+//
+// 2. Altered source versions must be plainly marked as such,
+//    and must not be misrepresented as being the original software.
+//
+// 3. This notice may not be removed or altered from any
+//    source distribution.
+// ///////////////////////////////////////////////////////////////////////////
+
+#include <LuaW/TimerWheel.hpp>
+
+namespace LuaW
+{
+
+	// End of a list
+	static const unsigned int g_NoTimer = 0xFFFFFFFF;
+
+	// Longest delay a timer is placed by, later timers are placed again when this is reached.
+	static const unsigned long long g_MaxDelta = 0xFFFFFFFFULL;
+
+	// Constructor/destructor
+	TimerWheel::TimerWheel( Script & p_Script ) :
+		m_Script( p_Script ),
+		m_FreeTimer( g_NoTimer ),
+		m_Count( 0 ),
+		m_FirstLevelCount( 0 ),
+		m_Base( 1 ),
+		m_Start( 0 ),
+		m_Started( false ),
+		m_Ticking( false )
+	{
+		for( unsigned int i = 0; i < LIST_COUNT; i++ )
+		{
+			m_Lists[ i ] = g_NoTimer;
+		}
+
+		lua_State * pState = m_Script.GetState( );
+		lua_createtable( pState, 0, 4 );
+		lua_pushlightuserdata( pState, this );
+		lua_pushcclosure( pState, LuaAfter, 1 );
+		lua_setfield( pState, -2, "after" );
+		lua_pushlightuserdata( pState, this );
+		lua_pushcclosure( pState, LuaEvery, 1 );
+		lua_setfield( pState, -2, "every" );
+		lua_pushlightuserdata( pState, this );
+		lua_pushcclosure( pState, LuaCancel, 1 );
+		lua_setfield( pState, -2, "cancel" );
+		lua_pushlightuserdata( pState, this );
+		lua_pushcclosure( pState, LuaNow, 1 );
+		lua_setfield( pState, -2, "now" );
+		lua_setglobal( pState, "timer" );
+	}
+
+	TimerWheel::~TimerWheel( )
+	{
+		lua_State * pState = m_Script.GetState( );
+		if( pState == NULL )
+		{
+			return;
+		}
+
+		for( size_t i = 0; i < m_Timers.size( ); i++ )
+		{
+			luaL_unref( pState, LUA_REGISTRYINDEX, m_Timers[ i ].Reference );
+		}
+
+		// The functions of the timer table refer to the wheel.
+		lua_pushnil( pState );
+		lua_setglobal( pState, "timer" );
+	}
+
+	// Public functions
+	eError TimerWheel::Tick( const unsigned long long p_Now )
+	{
+		// Callbacks may not tick the wheel they are called by.
+		if( m_Ticking )
+		{
+			return ERROR_NONE;
+		}
+
+		if( m_Started == false )
+		{
+			m_Start = p_Now;
+			m_Started = true;
+		}
+		if( p_Now < m_Start )
+		{
+			return ERROR_NONE;
+		}
+
+		unsigned long long Target = p_Now - m_Start;
+		lua_State * pState = m_Script.GetState( );
+		if( lua_checkstack( pState, 2 ) == 0 )
+		{
+			return ERROR_STACK;
+		}
+
+		// Each callback starts from the same top, whatever a callback leaves is dropped.
+		int Top = lua_gettop( pState );
+		eError Result = ERROR_NONE;
+		m_Ticking = true;
+
+		while( m_Base <= Target )
+		{
+			// Nothing to fire, jump to the target.
+			if( m_Count == 0 )
+			{
+				m_Base = Target + 1;
+				break;
+			}
+
+			// The upper levels only hold later timers, skip to the next cascade if the first level is empty.
+			if( m_FirstLevelCount == 0 && ( m_Base & 255 ) != 0 )
+			{
+				unsigned long long Next = ( m_Base | 255 ) + 1;
+				m_Base = Next <= Target ? Next : Target + 1;
+				continue;
+			}
+
+			// Cascade the next slot of the upper levels at each wrap of the level below.
+			unsigned int Slot = static_cast<unsigned int>( m_Base & 255 );
+			if( Slot == 0 )
+			{
+				for( unsigned int Level = 0; Level < 4; Level++ )
+				{
+					unsigned int Index = static_cast<unsigned int>( ( m_Base >> ( 8 + Level * 6 ) ) & 63 );
+					Move( 256 + Level * 64 + Index, true );
+					if( Index != 0 )
+					{
+						break;
+					}
+				}
+			}
+
+			// Timers added by the callbacks of this tick go to the next tick.
+			Move( Slot, false );
+			m_Base++;
+
+			while( m_Lists[ LIST_DUE ] != g_NoTimer )
+			{
+				unsigned int Number = m_Lists[ LIST_DUE ];
+				Unlink( Number );
+
+				// Timers beyond the longest delay come back early, place them again.
+				Timer & Current = m_Timers[ Number ];
+				if( Current.Expires >= m_Base )
+				{
+					Insert( Number );
+					continue;
+				}
+
+				lua_rawgeti( pState, LUA_REGISTRYINDEX, Current.Reference );
+				lua_pushnumber( pState, static_cast<lua_Number>( GetHandle( Number ) ) );
+
+				if( Current.Interval )
+				{
+					Current.Expires += Current.Interval;
+					Insert( Number );
+				}
+				else
+				{
+					Release( Number );
+				}
+
+				eError Error = m_Script.Call( 1, 0 );
+				lua_settop( pState, Top );
+				if( Error != ERROR_NONE && Result == ERROR_NONE )
+				{
+					Result = Error;
+				}
+			}
+		}
+
+		m_Ticking = false;
+		return Result;
+	}
+
+	bool TimerWheel::Cancel( const unsigned long long p_Handle )
+	{
+		unsigned int Number = Find( p_Handle );
+		if( Number == g_NoTimer )
+		{
+			return false;
+		}
+
+		Unlink( Number );
+		Release( Number );
+		return true;
+	}
+
+	// General get functions
+	size_t TimerWheel::GetTimerCount( ) const
+	{
+		return m_Count;
+	}
+
+	unsigned long long TimerWheel::GetTime( ) const
+	{
+		return m_Base - 1;
+	}
+
+	// Private functions
+	unsigned long long TimerWheel::Add( const unsigned long long p_Delay, const unsigned long long p_Interval, const int p_Reference )
+	{
+		unsigned int Number = m_FreeTimer;
+		if( Number == g_NoTimer )
+		{
+			Timer NewTimer;
+			NewTimer.Generation = 0;
+			m_Timers.push_back( NewTimer );
+			Number = static_cast<unsigned int>( m_Timers.size( ) - 1 );
+		}
+		else
+		{
+			m_FreeTimer = m_Timers[ Number ].Next;
+		}
+
+		Timer & Current = m_Timers[ Number ];
+		Current.Expires = GetTime( ) + p_Delay;
+		Current.Interval = p_Interval;
+		Current.Reference = p_Reference;
+		Insert( Number );
+		m_Count++;
+
+		return GetHandle( Number );
+	}
+
+	unsigned int TimerWheel::Find( const unsigned long long p_Handle ) const
+	{
+		unsigned long long Number = p_Handle & 0xFFFFFFFF;
+		if( Number >= m_Timers.size( ) )
+		{
+			return g_NoTimer;
+		}
+
+		const Timer & Current = m_Timers[ static_cast<size_t>( Number ) ];
+		if( Current.Reference == LUA_NOREF || Current.Generation != ( p_Handle >> 32 ) )
+		{
+			return g_NoTimer;
+		}
+		return static_cast<unsigned int>( Number );
+	}
+
+	unsigned long long TimerWheel::GetHandle( const unsigned int p_Timer ) const
+	{
+		// The generation is limited to 21 bits, the handles are exact as Lua numbers.
+		return ( static_cast<unsigned long long>( m_Timers[ p_Timer ].Generation ) << 32 ) | p_Timer;
+	}
+
+	void TimerWheel::Insert( const unsigned int p_Timer )
+	{
+		// Due timers fire at the next tick.
+		unsigned long long Expires = m_Timers[ p_Timer ].Expires;
+		if( Expires < m_Base )
+		{
+			Expires = m_Base;
+		}
+
+		unsigned long long Delta = Expires - m_Base;
+		if( Delta > g_MaxDelta )
+		{
+			Delta = g_MaxDelta;
+			Expires = m_Base + Delta;
+		}
+
+		unsigned int List = 0;
+		if( Delta < 256 )
+		{
+			List = static_cast<unsigned int>( Expires & 255 );
+		}
+		else if( Delta < ( 1ULL << 14 ) )
+		{
+			List = 256 + static_cast<unsigned int>( ( Expires >> 8 ) & 63 );
+		}
+		else if( Delta < ( 1ULL << 20 ) )
+		{
+			List = 256 + 64 + static_cast<unsigned int>( ( Expires >> 14 ) & 63 );
+		}
+		else if( Delta < ( 1ULL << 26 ) )
+		{
+			List = 256 + 128 + static_cast<unsigned int>( ( Expires >> 20 ) & 63 );
+		}
+		else
+		{
+			List = 256 + 192 + static_cast<unsigned int>( ( Expires >> 26 ) & 63 );
+		}
+
+		Link( List, p_Timer );
+	}
+
+	void TimerWheel::Link( const unsigned int p_List, const unsigned int p_Timer )
+	{
+		Timer & Current = m_Timers[ p_Timer ];
+		Current.List = p_List;
+		Current.Previous = g_NoTimer;
+		if( p_List < 256 )
+		{
+			m_FirstLevelCount++;
+		}
+		Current.Next = m_Lists[ p_List ];
+
+		if( Current.Next != g_NoTimer )
+		{
+			m_Timers[ Current.Next ].Previous = p_Timer;
+		}
+		m_Lists[ p_List ] = p_Timer;
+	}
+
+	void TimerWheel::Unlink( const unsigned int p_Timer )
+	{
+		Timer & Current = m_Timers[ p_Timer ];
+		if( Current.List < 256 )
+		{
+			m_FirstLevelCount--;
+		}
+
+		if( Current.Previous != g_NoTimer )
+		{
+			m_Timers[ Current.Previous ].Next = Current.Next;
+		}
+		else
+		{
+			m_Lists[ Current.List ] = Current.Next;
+		}
+
+		if( Current.Next != g_NoTimer )
+		{
+			m_Timers[ Current.Next ].Previous = Current.Previous;
+		}
+	}
+
+	void TimerWheel::Release( const unsigned int p_Timer )
+	{
+		Timer & Current = m_Timers[ p_Timer ];
+		luaL_unref( m_Script.GetState( ), LUA_REGISTRYINDEX, Current.Reference );
+
+		Current.Reference = LUA_NOREF;
+		Current.Generation = ( Current.Generation + 1 ) & 0x1FFFFF;
+		Current.Next = m_FreeTimer;
+		m_FreeTimer = p_Timer;
+		m_Count--;
+	}
+
+	void TimerWheel::Move( const unsigned int p_List, const bool p_Insert )
+	{
+		unsigned int Number = m_Lists[ p_List ];
+		m_Lists[ p_List ] = g_NoTimer;
+
+		while( Number != g_NoTimer )
+		{
+			unsigned int Next = m_Timers[ Number ].Next;
+			if( p_List < 256 )
+			{
+				m_FirstLevelCount--;
+			}
+			if( p_Insert )
+			{
+				Insert( Number );
+			}
+			else
+			{
+				Link( LIST_DUE, Number );
+			}
+			Number = Next;
+		}
+	}
+
+	int TimerWheel::LuaAfter( lua_State * p_pState )
+	{
+		TimerWheel * pWheel = static_cast<TimerWheel *>( lua_touserdata( p_pState, lua_upvalueindex( 1 ) ) );
+		lua_Number Delay = luaL_checknumber( p_pState, 1 );
+		luaL_checktype( p_pState, 2, LUA_TFUNCTION );
+		luaL_argcheck( p_pState, Delay < 4.0e18, 1, "delay too long" );
+
+		lua_pushvalue( p_pState, 2 );
+		int Reference = luaL_ref( p_pState, LUA_REGISTRYINDEX );
+		unsigned long long Ticks = Delay > 0 ? static_cast<unsigned long long>( Delay ) : 0;
+
+		lua_pushnumber( p_pState, static_cast<lua_Number>( pWheel->Add( Ticks, 0, Reference ) ) );
+		return 1;
+	}
+
+	int TimerWheel::LuaEvery( lua_State * p_pState )
+	{
+		TimerWheel * pWheel = static_cast<TimerWheel *>( lua_touserdata( p_pState, lua_upvalueindex( 1 ) ) );
+		lua_Number Interval = luaL_checknumber( p_pState, 1 );
+		luaL_checktype( p_pState, 2, LUA_TFUNCTION );
+		luaL_argcheck( p_pState, Interval >= 1 && Interval < 4.0e18, 1, "interval must be at least 1 ms" );
+
+		lua_pushvalue( p_pState, 2 );
+		int Reference = luaL_ref( p_pState, LUA_REGISTRYINDEX );
+		unsigned long long Ticks = static_cast<unsigned long long>( Interval );
+
+		lua_pushnumber( p_pState, static_cast<lua_Number>( pWheel->Add( Ticks, Ticks, Reference ) ) );
+		return 1;
+	}
+
+	int TimerWheel::LuaCancel( lua_State * p_pState )
+	{
+		TimerWheel * pWheel = static_cast<TimerWheel *>( lua_touserdata( p_pState, lua_upvalueindex( 1 ) ) );
+		lua_Number Handle = luaL_checknumber( p_pState, 1 );
+
+		bool Cancelled = Handle >= 0 && pWheel->Cancel( static_cast<unsigned long long>( Handle ) );
+		lua_pushboolean( p_pState, Cancelled ? 1 : 0 );
+		return 1;
+	}
+
+	int TimerWheel::LuaNow( lua_State * p_pState )
+	{
+		TimerWheel * pWheel = static_cast<TimerWheel *>( lua_touserdata( p_pState, lua_upvalueindex( 1 ) ) );
+		lua_pushnumber( p_pState, static_cast<lua_Number>( pWheel->GetTime( ) ) );
+		return 1;
+	}
+
+}
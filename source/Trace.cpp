@@ -0,0 +1,554 @@
+// ///////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2013 Jimmie Bergmann - jimmiebergmann@gmail.com
+//
+// This software is provided 'as-is', without any express or
+// implied warranty. In no event will the authors be held
+// liable for any damages arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute
+// it freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented;
+//    you must not claim that you wrote the original software.
+//    If you use this software in a product, an acknowledgment
+//    in the product documentation would be appreciated but
+//    is not required.
+//
+// 2. Altered source versions must be plainly marked as such,
+//    and must not be misrepresented as being the original software.
+//
+// 3. This notice may not be removed or altered from any
+//    source distribution.
+// ///////////////////////////////////////////////////////////////////////////
+
+#include <LuaW/Trace.hpp>
+#include "HookContext.hpp"
+#include <climits>
+#include <cstring>
+#include <thread>
+
+namespace LuaW
+{
+
+	// File header of the traces
+	static const char g_TraceHeader[ 8 ] = { 'L', 'U', 'A', 'W', 'T', 'R', 'C', '1' };
+
+	// Value tags
+	enum eTraceValue
+	{
+		TRACE_NIL = 0,
+		TRACE_FALSE = 1,
+		TRACE_TRUE = 2,
+		TRACE_NUMBER = 3,
+		TRACE_STRING = 4,
+		TRACE_INTEGER = 5 // Zigzag varint, integer subtype of Lua 5.3+
+	};
+
+
+	// Trace recorder
+	TraceRecorder::TraceRecorder( ) :
+		m_Type( TRACE_CALL ),
+		m_Depth( 0 ),
+		m_Start( 0 ),
+		m_LastStart( 0 ),
+		m_pHintFunction( NULL )
+	{
+	}
+
+	TraceRecorder::~TraceRecorder( )
+	{
+		Close( );
+	}
+
+	bool TraceRecorder::Open( const char * p_pFilePath )
+	{
+		Close( );
+
+		m_File.open( p_pFilePath, std::ios::out | std::ios::binary | std::ios::trunc );
+		if( m_File.is_open( ) == false )
+		{
+			return false;
+		}
+
+		m_File.write( g_TraceHeader, sizeof( g_TraceHeader ) );
+		m_LastStart = GetTimeNanoseconds( );
+		m_FunctionNames.clear( );
+		return true;
+	}
+
+	void TraceRecorder::Close( )
+	{
+		if( m_File.is_open( ) )
+		{
+			m_File.close( );
+		}
+	}
+
+	bool TraceRecorder::Begin( const eTraceRecord p_Type )
+	{
+		if( m_Depth++ > 0 || m_File.is_open( ) == false )
+		{
+			return false;
+		}
+
+		m_Type = p_Type;
+		m_Record.clear( );
+		m_Start = GetTimeNanoseconds( );
+		return true;
+	}
+
+	void TraceRecorder::WriteString( const char * p_pString )
+	{
+		size_t Length = std::strlen( p_pString );
+		AppendInteger( m_Record, Length );
+		m_Record.append( p_pString, Length );
+	}
+
+	void TraceRecorder::WriteInteger( const unsigned long long p_Integer )
+	{
+		AppendInteger( m_Record, p_Integer );
+	}
+
+	void TraceRecorder::WriteValue( lua_State * p_pState, const int p_Index )
+	{
+		switch( lua_type( p_pState, p_Index ) )
+		{
+			case LUA_TBOOLEAN:
+			{
+				m_Record.push_back( static_cast<char>( lua_toboolean( p_pState, p_Index ) ? TRACE_TRUE : TRACE_FALSE ) );
+			}
+			break;
+			case LUA_TNUMBER:
+			{
+#if LUA_VERSION_NUM >= 503
+				if( lua_isinteger( p_pState, p_Index ) )
+				{
+					long long Integer = static_cast<long long>( lua_tointeger( p_pState, p_Index ) );
+					m_Record.push_back( static_cast<char>( TRACE_INTEGER ) );
+					AppendInteger( m_Record, ( static_cast<unsigned long long>( Integer ) << 1 ) ^ static_cast<unsigned long long>( Integer >> 63 ) );
+					break;
+				}
+#endif
+				lua_Number Number = lua_tonumber( p_pState, p_Index );
+				m_Record.push_back( static_cast<char>( TRACE_NUMBER ) );
+				m_Record.append( reinterpret_cast<const char *>( &Number ), sizeof( Number ) );
+			}
+			break;
+			case LUA_TSTRING:
+			{
+				size_t Length = 0;
+				const char * pString = lua_tolstring( p_pState, p_Index, &Length );
+				m_Record.push_back( static_cast<char>( TRACE_STRING ) );
+				AppendInteger( m_Record, Length );
+				m_Record.append( pString, Length );
+			}
+			break;
+			default:
+			{
+				m_Record.push_back( static_cast<char>( TRACE_NIL ) );
+			}
+			break;
+		}
+	}
+
+	void TraceRecorder::WriteFunction( lua_State * p_pState, const int p_Index )
+	{
+		int Index = lua_absindex( p_pState, p_Index );
+		const void * pFunction = lua_topointer( p_pState, Index );
+
+		// Most calls are made right after pushing the global. The cached names are checked against
+		// the globals, they may have been reassigned or the address reused by another function.
+		if( pFunction == m_pHintFunction && IsGlobal( p_pState, Index, m_HintName ) )
+		{
+			WriteString( m_HintName.c_str( ) );
+			return;
+		}
+
+		std::map<const void *, std::string>::iterator it = m_FunctionNames.find( pFunction );
+		if( it != m_FunctionNames.end( ) )
+		{
+			if( IsGlobal( p_pState, Index, it->second ) )
+			{
+				WriteString( it->second.c_str( ) );
+				return;
+			}
+			m_FunctionNames.erase( it );
+		}
+
+		// Search the globals for the function, an empty name is written if not found.
+		std::string Name;
+		lua_pushglobaltable( p_pState );
+		lua_pushnil( p_pState );
+		while( lua_next( p_pState, -2 ) )
+		{
+			if( lua_type( p_pState, -2 ) == LUA_TSTRING && lua_rawequal( p_pState, -1, Index ) )
+			{
+				Name = lua_tostring( p_pState, -2 );
+				lua_pop( p_pState, 2 );
+				break;
+			}
+			lua_pop( p_pState, 1 );
+		}
+		lua_pop( p_pState, 1 );
+
+		// Functions without a global name are searched again, a miss can not be checked.
+		if( Name.size( ) )
+		{
+			m_FunctionNames[ pFunction ] = Name;
+		}
+		WriteString( Name.c_str( ) );
+	}
+
+	void TraceRecorder::End( )
+	{
+		if( --m_Depth > 0 || m_File.is_open( ) == false )
+		{
+			return;
+		}
+
+		long long Time = GetTimeNanoseconds( );
+
+		std::string Header;
+		Header.push_back( static_cast<char>( m_Type ) );
+		AppendInteger( Header, static_cast<unsigned long long>( m_Start - m_LastStart ) );
+		AppendInteger( Header, static_cast<unsigned long long>( Time - m_Start ) );
+		m_LastStart = m_Start;
+
+		m_File.write( Header.data( ), Header.size( ) );
+		m_File.write( m_Record.data( ), m_Record.size( ) );
+	}
+
+	void TraceRecorder::SetGlobalHint( lua_State * p_pState, const char * p_pName )
+	{
+		if( lua_type( p_pState, -1 ) == LUA_TFUNCTION )
+		{
+			m_pHintFunction = lua_topointer( p_pState, -1 );
+			m_HintName = p_pName;
+		}
+	}
+
+	bool TraceRecorder::IsGlobal( lua_State * p_pState, const int p_Index, const std::string & p_Name )
+	{
+		// Raw access, the check must not run metamethods of the globals.
+		lua_pushglobaltable( p_pState );
+		lua_pushlstring( p_pState, p_Name.data( ), p_Name.size( ) );
+		lua_rawget( p_pState, -2 );
+		bool Equal = lua_rawequal( p_pState, -1, p_Index ) != 0;
+		lua_pop( p_pState, 2 );
+		return Equal;
+	}
+
+	void TraceRecorder::AppendInteger( std::string & p_Buffer, unsigned long long p_Integer )
+	{
+		// Variable length, 7 bits per byte, the high bit is set if more bytes follow.
+		while( p_Integer >= 0x80 )
+		{
+			p_Buffer.push_back( static_cast<char>( ( p_Integer & 0x7F ) | 0x80 ) );
+			p_Integer >>= 7;
+		}
+		p_Buffer.push_back( static_cast<char>( p_Integer ) );
+	}
+
+
+	// Trace replayer
+	TraceReplayer::TraceReplayer( Script & p_Script ) :
+		m_Script( p_Script ),
+		m_FileSize( 0 ),
+		m_ErrorMessage( "" )
+	{
+		std::memset( &m_Stats, 0, sizeof( m_Stats ) );
+	}
+
+	eError TraceReplayer::Replay( const char * p_pFilePath, const bool p_Paced )
+	{
+		std::memset( &m_Stats, 0, sizeof( m_Stats ) );
+		lua_State * pState = m_Script.GetState( );
+
+		// Open the file and check the header
+		m_File.close( );
+		m_File.clear( );
+		m_File.open( p_pFilePath, std::ios::in | std::ios::binary );
+
+		// The size bounds the string lengths read from the file.
+		m_File.seekg( 0, std::ios::end );
+		std::streamoff Size = m_File.tellg( );
+		m_FileSize = Size > 0 ? static_cast<unsigned long long>( Size ) : 0;
+		m_File.seekg( 0, std::ios::beg );
+
+		char Header[ sizeof( g_TraceHeader ) ];
+		if( m_File.read( Header, sizeof( Header ) ).gcount( ) != sizeof( Header ) ||
+			std::memcmp( Header, g_TraceHeader, sizeof( Header ) ) != 0 )
+		{
+			m_ErrorMessage = "Not a trace file: " + std::string( p_pFilePath );
+			return ERROR_RUNTIME;
+		}
+
+		long long WallStart = GetTimeNanoseconds( );
+		long long RecordedStart = 0;
+
+		int Type = 0;
+		while( ( Type = m_File.get( ) ) != std::char_traits<char>::eof( ) )
+		{
+			unsigned long long Delta = 0;
+			unsigned long long Duration = 0;
+			std::string String;
+
+			if( ReadInteger( Delta ) == false || ReadInteger( Duration ) == false )
+			{
+				break;
+			}
+
+			// Keep the recorded start times
+			RecordedStart += static_cast<long long>( Delta );
+			if( p_Paced )
+			{
+				long long Wait = WallStart + RecordedStart - GetTimeNanoseconds( );
+				if( Wait > 0 )
+				{
+					std::this_thread::sleep_for( std::chrono::nanoseconds( Wait ) );
+				}
+			}
+
+			int StackSize = lua_gettop( pState );
+			eError Error = ERROR_NONE;
+			long long Start = 0;
+
+			switch( Type )
+			{
+				case TRACE_CALL:
+				{
+					unsigned long long Arguments = 0;
+					if( ReadString( String ) == false || ReadInteger( Arguments ) == false )
+					{
+						Type = -1;
+						break;
+					}
+
+					// A count the stack can not hold is a corrupt trace.
+					if( Arguments > static_cast<unsigned long long>( INT_MAX - 1 ) ||
+						lua_checkstack( pState, static_cast<int>( Arguments ) + 1 ) == 0 )
+					{
+						Type = -1;
+						break;
+					}
+
+					if( String.size( ) == 0 )
+					{
+						m_Stats.UnresolvedCalls++;
+					}
+					lua_getglobal( pState, String.c_str( ) );
+
+					for( unsigned long long i = 0; i < Arguments && Type != -1; i++ )
+					{
+						if( PushValue( ) == false )
+						{
+							Type = -1;
+						}
+					}
+					if( Type == -1 )
+					{
+						break;
+					}
+
+					Start = GetTimeNanoseconds( );
+					Error = m_Script.Call( static_cast<int>( Arguments ), 0 );
+				}
+				break;
+				case TRACE_RUN_STRING:
+				{
+					if( ReadString( String ) == false )
+					{
+						Type = -1;
+						break;
+					}
+
+					Start = GetTimeNanoseconds( );
+					Error = m_Script.RunString( String.c_str( ) );
+				}
+				break;
+				case TRACE_RUN_FILE:
+				{
+					if( ReadString( String ) == false )
+					{
+						Type = -1;
+						break;
+					}
+
+					Start = GetTimeNanoseconds( );
+					Error = m_Script.RunFile( String.c_str( ) );
+				}
+				break;
+				case TRACE_RUN_EMBEDDED:
+				{
+					if( ReadString( String ) == false )
+					{
+						Type = -1;
+						break;
+					}
+
+					Start = GetTimeNanoseconds( );
+					Error = m_Script.RunEmbedded( String.c_str( ) );
+				}
+				break;
+				case TRACE_SET_GLOBAL:
+				{
+					if( ReadString( String ) == false || PushValue( ) == false )
+					{
+						Type = -1;
+						break;
+					}
+
+					Start = GetTimeNanoseconds( );
+					lua_setglobal( pState, String.c_str( ) );
+				}
+				break;
+				default:
+				{
+					Type = -1;
+				}
+				break;
+			}
+
+			if( Type == -1 )
+			{
+				lua_settop( pState, StackSize );
+				m_ErrorMessage = "Corrupt trace file: " + std::string( p_pFilePath );
+				return ERROR_RUNTIME;
+			}
+
+			m_Stats.ReplayedTime += static_cast<unsigned long long>( GetTimeNanoseconds( ) - Start );
+			m_Stats.RecordedTime += Duration;
+			m_Stats.Records++;
+
+			if( Error != ERROR_NONE )
+			{
+				m_Stats.Errors++;
+				m_ErrorMessage = m_Script.GetLastError( );
+			}
+
+			// Drop the return values
+			lua_settop( pState, StackSize );
+		}
+
+		m_Stats.WallTime = static_cast<unsigned long long>( GetTimeNanoseconds( ) - WallStart );
+		return ERROR_NONE;
+	}
+
+	const TraceStats & TraceReplayer::GetStats( ) const
+	{
+		return m_Stats;
+	}
+
+	const std::string & TraceReplayer::GetLastError( ) const
+	{
+		return m_ErrorMessage;
+	}
+
+	bool TraceReplayer::ReadInteger( unsigned long long & p_Integer )
+	{
+		p_Integer = 0;
+		for( unsigned int Shift = 0; Shift < 64; Shift += 7 )
+		{
+			int Byte = m_File.get( );
+			if( Byte == std::char_traits<char>::eof( ) )
+			{
+				return false;
+			}
+
+			p_Integer |= static_cast<unsigned long long>( Byte & 0x7F ) << Shift;
+			if( ( Byte & 0x80 ) == 0 )
+			{
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	bool TraceReplayer::ReadString( std::string & p_String )
+	{
+		unsigned long long Length = 0;
+		if( ReadInteger( Length ) == false )
+		{
+			return false;
+		}
+
+		// A corrupt length must not allocate more than the rest of the file.
+		std::streamoff Position = m_File.tellg( );
+		if( Position < 0 || Length > m_FileSize - static_cast<unsigned long long>( Position ) )
+		{
+			return false;
+		}
+
+		p_String.resize( static_cast<size_t>( Length ) );
+		if( Length == 0 )
+		{
+			return true;
+		}
+
+		return m_File.read( &p_String[ 0 ], static_cast<std::streamsize>( Length ) ).gcount( ) ==
+			static_cast<std::streamsize>( Length );
+	}
+
+	bool TraceReplayer::PushValue( )
+	{
+		lua_State * pState = m_Script.GetState( );
+
+		switch( m_File.get( ) )
+		{
+			case TRACE_NIL:
+			{
+				lua_pushnil( pState );
+			}
+			break;
+			case TRACE_FALSE:
+			{
+				lua_pushboolean( pState, 0 );
+			}
+			break;
+			case TRACE_TRUE:
+			{
+				lua_pushboolean( pState, 1 );
+			}
+			break;
+			case TRACE_NUMBER:
+			{
+				lua_Number Number = 0;
+				if( m_File.read( reinterpret_cast<char *>( &Number ), sizeof( Number ) ).gcount( ) != sizeof( Number ) )
+				{
+					return false;
+				}
+				lua_pushnumber( pState, Number );
+			}
+			break;
+			case TRACE_INTEGER:
+			{
+				unsigned long long Integer = 0;
+				if( ReadInteger( Integer ) == false )
+				{
+					return false;
+				}
+				lua_pushinteger( pState, static_cast<lua_Integer>( static_cast<long long>( Integer >> 1 ) ^ -static_cast<long long>( Integer & 1 ) ) );
+			}
+			break;
+			case TRACE_STRING:
+			{
+				std::string String;
+				if( ReadString( String ) == false )
+				{
+					return false;
+				}
+				lua_pushlstring( pState, String.data( ), String.size( ) );
+			}
+			break;
+			default:
+			{
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+}
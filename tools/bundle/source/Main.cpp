@@ -0,0 +1,128 @@
+// ///////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2013 Jimmie Bergmann - jimmiebergmann@gmail.com
+//
+// This software is provided 'as-is', without any express or
+// implied warranty. In no event will the authors be held
+// liable for any damages arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute
+// it freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented;
+//    you must not claim that you wrote the original software.
+//    If you use this software in a product, an acknowledgment
+//    in the product documentation would be appreciated but
+//    is not required.
+//
+// 2. Altered source versions must be plainly marked as such,
+//    and must not be misrepresented as being the original software.
+//
+// 3. This notice may not be removed or altered from any
+//    source distribution.
+// ///////////////////////////////////////////////////////////////////////////
+
+// Packs Lua modules into a bundle.
+// Usage: luaw-bundle [--source] [--root directory] output.bundle file.lua ...
+// The module names are the file paths relative to the root, "a/b.lua" and "a/b/init.lua" become "a.b".
+// The modules are precompiled unless --source is given, precompiled bundles only load with the same backend.
+
+#include <LuaW/Bundle.hpp>
+#include <iostream>
+#include <string>
+
+static std::string GetModuleName( const std::string & p_Root, const std::string & p_FileName )
+{
+	std::string Name = p_FileName;
+	for( size_t i = 0; i < Name.size( ); i++ )
+	{
+		if( Name[ i ] == '\\' )
+		{
+			Name[ i ] = '/';
+		}
+	}
+
+	// Strip the root, the extension and init modules
+	if( p_Root.size( ) && Name.compare( 0, p_Root.size( ), p_Root ) == 0 )
+	{
+		Name.erase( 0, p_Root.size( ) );
+	}
+	while( Name.size( ) && Name[ 0 ] == '/' )
+	{
+		Name.erase( 0, 1 );
+	}
+	if( Name.size( ) > 4 && Name.compare( Name.size( ) - 4, 4, ".lua" ) == 0 )
+	{
+		Name.erase( Name.size( ) - 4 );
+	}
+	if( Name.size( ) > 5 && Name.compare( Name.size( ) - 5, 5, "/init" ) == 0 )
+	{
+		Name.erase( Name.size( ) - 5 );
+	}
+
+	for( size_t i = 0; i < Name.size( ); i++ )
+	{
+		if( Name[ i ] == '/' )
+		{
+			Name[ i ] = '.';
+		}
+	}
+	return Name;
+}
+
+int main( int p_ArgumentCount, char ** p_ppArguments )
+{
+	bool Precompile = true;
+	std::string Root;
+	std::string Output;
+	LuaW::BundleBuilder Builder;
+
+	for( int i = 1; i < p_ArgumentCount; i++ )
+	{
+		std::string Argument = p_ppArguments[ i ];
+
+		if( Argument == "--source" )
+		{
+			Precompile = false;
+		}
+		else if( Argument == "--root" && i + 1 < p_ArgumentCount )
+		{
+			Root = p_ppArguments[ ++i ];
+			for( size_t j = 0; j < Root.size( ); j++ )
+			{
+				if( Root[ j ] == '\\' )
+				{
+					Root[ j ] = '/';
+				}
+			}
+		}
+		else if( Output.empty( ) )
+		{
+			Output = Argument;
+		}
+		else
+		{
+			std::string Name = GetModuleName( Root, Argument );
+			if( Builder.AddFile( Name, Argument, Precompile ) == false )
+			{
+				std::cerr << "[Error]: " << Builder.GetLastError( ) << std::endl;
+				return 1;
+			}
+		}
+	}
+
+	if( Output.empty( ) || Builder.GetModuleCount( ) == 0 )
+	{
+		std::cerr << "Usage: luaw-bundle [--source] [--root directory] output.bundle file.lua ..." << std::endl;
+		return 1;
+	}
+
+	if( Builder.Save( Output ) == false )
+	{
+		std::cerr << "[Error]: Cannot write " << Output << std::endl;
+		return 1;
+	}
+
+	std::cout << Builder.GetModuleCount( ) << " modules written to " << Output << std::endl;
+	return 0;
+}
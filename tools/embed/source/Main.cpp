@@ -0,0 +1,216 @@
+// ///////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2013 Jimmie Bergmann - jimmiebergmann@gmail.com
+//
+// This software is provided 'as-is', without any express or
+// implied warranty. In no event will the authors be held
+// liable for any damages arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute
+// it freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented;
+//    you must not claim that you wrote the original software.
+//    If you use this software in a product, an acknowledgment
+//    in the product documentation would be appreciated but
+//    is not required.
+//
+// 2. Altered source versions must be plainly marked as such,
+//    and must not be misrepresented as being the original software.
+//
+// 3. This notice may not be removed or altered from any
+//    source distribution.
+// ///////////////////////////////////////////////////////////////////////////
+
+// Compiles Lua scripts and writes them as a C++ source file for Script::RunEmbedded.
+// Usage: luaw-embed [--debug] [--root directory] output.cpp file.lua ...
+// The script names are the file paths relative to the root, with forward slashes.
+// The bytecode is stripped unless --debug is given, Lua 5.2 always keeps the debug information.
+// The bytecode only loads with the backend the tool was built with.
+
+#include <LuaW.hpp>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+
+static std::string GetScriptName( const std::string & p_Root, const std::string & p_FileName )
+{
+	std::string Name = p_FileName;
+	for( size_t i = 0; i < Name.size( ); i++ )
+	{
+		if( Name[ i ] == '\\' )
+		{
+			Name[ i ] = '/';
+		}
+	}
+
+	if( p_Root.size( ) && Name.compare( 0, p_Root.size( ), p_Root ) == 0 )
+	{
+		Name.erase( 0, p_Root.size( ) );
+	}
+	while( Name.size( ) && Name[ 0 ] == '/' )
+	{
+		Name.erase( 0, 1 );
+	}
+	return Name;
+}
+
+static bool Compile( lua_State * p_pState, const std::string & p_Name, const std::string & p_FileName,
+	const bool p_Debug, std::string & p_Chunk )
+{
+	std::string Source;
+	FILE * pFile = fopen( p_FileName.c_str( ), "rb" );
+	if( pFile == NULL )
+	{
+		std::cerr << "[Error]: Cannot open " << p_FileName << std::endl;
+		return false;
+	}
+
+	char Buffer[ 4096 ];
+	size_t Read = 0;
+	while( ( Read = fread( Buffer, 1, sizeof( Buffer ), pFile ) ) > 0 )
+	{
+		Source.append( Buffer, Read );
+	}
+	fclose( pFile );
+
+	// The chunk name matches the one given by RunEmbedded.
+	std::string ChunkName = "@" + p_Name;
+	lua_getglobal( p_pState, "string" );
+	lua_getfield( p_pState, -1, "dump" );
+	if( luaL_loadbuffer( p_pState, Source.data( ), Source.size( ), ChunkName.c_str( ) ) != LUA_OK )
+	{
+		std::cerr << "[Error]: " << lua_tostring( p_pState, -1 ) << std::endl;
+		lua_settop( p_pState, 0 );
+		return false;
+	}
+
+	// string.dump strips the debug information on every backend but Lua 5.2.
+	lua_pushboolean( p_pState, p_Debug ? 0 : 1 );
+	if( lua_pcall( p_pState, 2, 1, 0 ) != LUA_OK )
+	{
+		std::cerr << "[Error]: " << lua_tostring( p_pState, -1 ) << std::endl;
+		lua_settop( p_pState, 0 );
+		return false;
+	}
+
+	size_t Size = 0;
+	const char * pChunk = lua_tolstring( p_pState, -1, &Size );
+	p_Chunk.assign( pChunk, Size );
+	lua_settop( p_pState, 0 );
+	return true;
+}
+
+static bool WriteSource( const std::string & p_FileName, const std::vector<std::string> & p_Names,
+	const std::vector<std::string> & p_Chunks )
+{
+	FILE * pFile = fopen( p_FileName.c_str( ), "w" );
+	if( pFile == NULL )
+	{
+		return false;
+	}
+
+	fprintf( pFile, "// Generated by luaw-embed, do not edit.\n\n#include <LuaW/Embedded.hpp>\n\nnamespace\n{\n\n" );
+
+	for( size_t i = 0; i < p_Chunks.size( ); i++ )
+	{
+		const std::string & Chunk = p_Chunks[ i ];
+		fprintf( pFile, "\tconst unsigned char g_Chunk%u[ %u ] =\n\t{", static_cast<unsigned int>( i ), static_cast<unsigned int>( Chunk.size( ) ) );
+		for( size_t j = 0; j < Chunk.size( ); j++ )
+		{
+			fprintf( pFile, "%s0x%02X%s", j % 16 ? " " : "\n\t\t", static_cast<unsigned char>( Chunk[ j ] ), j + 1 < Chunk.size( ) ? "," : "" );
+		}
+		fprintf( pFile, "\n\t};\n\n" );
+	}
+
+	fprintf( pFile, "\tconst LuaW::EmbeddedScript g_Scripts[ %u ] =\n\t{\n", static_cast<unsigned int>( p_Names.size( ) ) );
+	for( size_t i = 0; i < p_Names.size( ); i++ )
+	{
+		// The names are file paths, only quotes and backslashes need escaping.
+		std::string Name;
+		for( size_t j = 0; j < p_Names[ i ].size( ); j++ )
+		{
+			char Character = p_Names[ i ][ j ];
+			if( Character == '"' || Character == '\\' )
+			{
+				Name += '\\';
+			}
+			Name += Character;
+		}
+
+		fprintf( pFile, "\t\t{ \"%s\", g_Chunk%u, sizeof( g_Chunk%u ) }%s\n", Name.c_str( ),
+			static_cast<unsigned int>( i ), static_cast<unsigned int>( i ), i + 1 < p_Names.size( ) ? "," : "" );
+	}
+	fprintf( pFile, "\t};\n\n" );
+	fprintf( pFile, "\tLuaW::EmbeddedScripts g_Registration( g_Scripts, %u );\n\n}\n", static_cast<unsigned int>( p_Names.size( ) ) );
+
+	return fclose( pFile ) == 0;
+}
+
+int main( int p_ArgumentCount, char ** p_ppArguments )
+{
+	bool Debug = false;
+	std::string Root;
+	std::string Output;
+	std::vector<std::string> Files;
+
+	for( int i = 1; i < p_ArgumentCount; i++ )
+	{
+		std::string Argument = p_ppArguments[ i ];
+
+		if( Argument == "--debug" )
+		{
+			Debug = true;
+		}
+		else if( Argument == "--root" && i + 1 < p_ArgumentCount )
+		{
+			Root = p_ppArguments[ ++i ];
+			for( size_t j = 0; j < Root.size( ); j++ )
+			{
+				if( Root[ j ] == '\\' )
+				{
+					Root[ j ] = '/';
+				}
+			}
+		}
+		else if( Output.empty( ) )
+		{
+			Output = Argument;
+		}
+		else
+		{
+			Files.push_back( Argument );
+		}
+	}
+
+	if( Output.empty( ) || Files.empty( ) )
+	{
+		std::cerr << "Usage: luaw-embed [--debug] [--root directory] output.cpp file.lua ..." << std::endl;
+		return 1;
+	}
+
+	lua_State * pState = luaL_newstate( );
+	luaL_openlibs( pState );
+
+	std::vector<std::string> Names;
+	std::vector<std::string> Chunks;
+	for( size_t i = 0; i < Files.size( ); i++ )
+	{
+		Names.push_back( GetScriptName( Root, Files[ i ] ) );
+		Chunks.push_back( std::string( ) );
+		if( Compile( pState, Names.back( ), Files[ i ], Debug, Chunks.back( ) ) == false )
+		{
+			lua_close( pState );
+			return 1;
+		}
+	}
+	lua_close( pState );
+
+	if( WriteSource( Output, Names, Chunks ) == false )
+	{
+		std::cerr << "[Error]: Cannot write " << Output << std::endl;
+		return 1;
+	}
+	return 0;
+}